@@ -0,0 +1,34 @@
+//
+//  AtomicMutex.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 20.01.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include "AtomicMutex.hpp"
+
+// All stats objects are static and register themselves during static init,
+// thus this doesn't need a lock. It's zero-initialized before any constructor runs.
+static AtomicMutexStats* statsList;
+
+AtomicMutexStats::AtomicMutexStats(const char* _name)
+: name(_name), next(NULL), enabled(false), acquisitions(0), contended(0), waitNs(0) {
+	next = statsList;
+	statsList = this;
+}
+
+void AtomicMutexStats::reset() {
+	acquisitions = 0;
+	contended = 0;
+	waitNs = 0;
+}
+
+AtomicMutexStats* AtomicMutexStats::first() {
+	return statsList;
+}
+
+void AtomicMutexStats::setAllEnabled(bool enabled) {
+	for(AtomicMutexStats* s = statsList; s; s = s->next)
+		s->enabled = enabled;
+}
@@ -10,28 +10,140 @@
 #define MusicPlayer_AtomicMutex_hpp
 
 #include <assert.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+#include <chrono>
 #include <boost/atomic.hpp>
 #include <boost/noncopyable.hpp>
 
-class AtomicMutex {
-	boost::atomic<bool> lock;
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
-public:
-	AtomicMutex() : lock(false) {}
-	
-	struct Scope : boost::noncopyable {
-		AtomicMutex& m;
-		Scope(AtomicMutex& _m) : m(_m) {
-			while(true) {
-				bool expected = false;
-				if(m.lock.compare_exchange_weak(expected, true))
-					break;
+// Optional counters for an AtomicMutex, or for a group of them (e.g. all GuiObject.nativeGuiObject locks).
+// Instances are registered globally in their constructor and are expected to be static.
+// See AtomicMutex.cpp. They can be read from Python via _gui.lockStats().
+// Counting is off by default, so that an unused stats object doesn't cost us a shared cache line write
+// on every lock.
+struct AtomicMutexStats : boost::noncopyable {
+	const char* name;
+	AtomicMutexStats* next;
+	boost::atomic<bool> enabled;
+	boost::atomic<uint64_t> acquisitions;
+	boost::atomic<uint64_t> contended; // did not get the lock on the first try
+	boost::atomic<uint64_t> waitNs; // total time spent in the contended path
+
+	AtomicMutexStats(const char* _name);
+	void reset();
+
+	// Iterate over all registered stats.
+	static AtomicMutexStats* first();
+	static void setAllEnabled(bool enabled);
+};
+
+// Spins a bit and then blocks. On Linux, we block in a futex. Elsewhere, we fall back to yielding.
+// The state is the classic futex mutex: 0 - unlocked, 1 - locked, 2 - locked and maybe waiters.
+class AtomicMutex : boost::noncopyable {
+	boost::atomic<int> state;
+	AtomicMutexStats* stats;
+
+	enum { SpinCount = 100 };
+
+#ifdef __linux__
+	int* futexAddr() {
+		static_assert(sizeof(boost::atomic<int>) == sizeof(int), "futex needs a plain int");
+		return reinterpret_cast<int*>(&state);
+	}
+	void wait(int& round) {
+		(void) round;
+		syscall(SYS_futex, futexAddr(), FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+	}
+	void wake() {
+		syscall(SYS_futex, futexAddr(), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+#else
+	void wait(int& round) {
+		if(round < 100) { ++round; sched_yield(); return; }
+		// The holder is probably not running. Don't keep the core busy.
+		struct timespec t = {0, 50 * 1000};
+		nanosleep(&t, NULL);
+	}
+	void wake() {}
+#endif
+
+	void lockSlow() {
+		bool count = stats && stats->enabled.load(boost::memory_order_relaxed);
+		std::chrono::steady_clock::time_point start;
+		if(count) start = std::chrono::steady_clock::now();
+
+		int c = 0;
+		bool locked = false;
+		for(int i = 0; i < SpinCount; ++i) {
+			cpuRelax();
+			c = state.load(boost::memory_order_relaxed);
+			if(c == 0 && state.compare_exchange_weak(c, 1, boost::memory_order_acquire)) {
+				locked = true;
+				break;
 			}
 		}
-		~Scope() {
-			bool oldLock = m.lock.exchange(false);
-			assert(oldLock);
+		if(!locked) {
+			// From here on, we might sleep, so mark the lock as having waiters.
+			c = state.exchange(2, boost::memory_order_acquire);
+			int round = 0;
+			while(c != 0) {
+				wait(round);
+				c = state.exchange(2, boost::memory_order_acquire);
+			}
 		}
+
+		if(count) {
+			uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			stats->acquisitions.fetch_add(1, boost::memory_order_relaxed);
+			stats->contended.fetch_add(1, boost::memory_order_relaxed);
+			stats->waitNs.fetch_add(ns, boost::memory_order_relaxed);
+		}
+	}
+
+public:
+	// Hint for the CPU that we are in a spin-wait loop.
+	static void cpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+		__asm__ __volatile__("yield");
+#endif
+	}
+
+	AtomicMutex(AtomicMutexStats* _stats = NULL) : state(0), stats(_stats) {}
+
+	bool tryLock() {
+		int c = 0;
+		return state.compare_exchange_strong(c, 1, boost::memory_order_acquire);
+	}
+
+	void lock() {
+		if(tryLock()) {
+			if(stats && stats->enabled.load(boost::memory_order_relaxed))
+				stats->acquisitions.fetch_add(1, boost::memory_order_relaxed);
+			return;
+		}
+		lockSlow();
+	}
+
+	void unlock() {
+		int old = state.exchange(0, boost::memory_order_release);
+		assert(old != 0);
+		if(old == 2)
+			wake();
+	}
+
+	struct Scope : boost::noncopyable {
+		AtomicMutex& m;
+		Scope(AtomicMutex& _m) : m(_m) { m.lock(); }
+		~Scope() { m.unlock(); }
 	};
 };
 
@@ -8,6 +8,8 @@
 
 #include "FunctionWrapper.hpp"
 
+// See FunctionWrapper::storage.
+static_assert(std::alignment_of<FunctionWrapper>::value <= alignof(void*), "FunctionWrapper must not be over-aligned");
 
 static PyObject* FunctionWrapper_alloc(PyTypeObject *type, Py_ssize_t nitems) {
     PyObject *obj;
@@ -43,18 +45,61 @@ static void FunctionWrapper_dealloc(PyObject* obj) {
 	FunctionWrapper* wrapper = (FunctionWrapper*) obj;
 	if(wrapper->weakrefs)
 		PyObject_ClearWeakRefs(obj);
+	if(wrapper->func) {
+		wrapper->destroy(wrapper->func, wrapper->funcInPlace());
+		wrapper->func = NULL;
+	}
 	wrapper->~FunctionWrapper();
 	Py_TYPE(obj)->tp_free(obj);
 }
 
 
+// Slow path for the positional kind: maps keyword args onto the positions.
+static PyObject* FunctionWrapper_callPositionalKw(FunctionWrapper* wrapper, PyObject* args, PyObject* kw) {
+	PyObject* argv[FunctionWrapper::MaxPositionalArgs];
+	Py_ssize_t nargs = PyTuple_GET_SIZE(args);
+	if(nargs > wrapper->numArgs) {
+		PyErr_Format(PyExc_TypeError, "%s() takes at most %zd arguments (%zd given)", wrapper->name, wrapper->numArgs, nargs);
+		return NULL;
+	}
+	Py_ssize_t numKw = 0;
+	for(Py_ssize_t i = 0; i < wrapper->numArgs; ++i) {
+		if(i < nargs) {
+			argv[i] = PyTuple_GET_ITEM(args, i);
+			if(kw && PyDict_GetItemString(kw, wrapper->kwlist[i])) {
+				PyErr_Format(PyExc_TypeError, "%s() got multiple values for argument '%s'", wrapper->name, wrapper->kwlist[i]);
+				return NULL;
+			}
+			continue;
+		}
+		argv[i] = kw ? PyDict_GetItemString(kw, wrapper->kwlist[i]) : NULL;
+		if(!argv[i]) {
+			PyErr_Format(PyExc_TypeError, "%s() is missing argument '%s'", wrapper->name, wrapper->kwlist[i]);
+			return NULL;
+		}
+		++numKw;
+	}
+	if(kw && PyDict_Size(kw) != numKw) {
+		PyErr_Format(PyExc_TypeError, "%s() got an unexpected keyword argument", wrapper->name);
+		return NULL;
+	}
+	return wrapper->invokePositional(wrapper->func, argv);
+}
+
 static PyObject* FunctionWrapper_call(PyObject* obj, PyObject* args, PyObject* kw) {
-	PyCallback func = ((FunctionWrapper*)obj)->func;
-	if(!func) {
+	FunctionWrapper* wrapper = (FunctionWrapper*) obj;
+	if(!wrapper->func) {
 		PyErr_Format(PyExc_ValueError, "FunctionWrapper: function is not set");
 		return NULL;
 	}
-	return func(args, kw);
+	// Note that we call the function in place. The caller holds a reference to us,
+	// thus we stay alive during the call.
+	if(wrapper->invokePositional) {
+		if((!kw || PyDict_Size(kw) == 0) && PyTuple_GET_SIZE(args) == wrapper->numArgs)
+			return wrapper->invokePositional(wrapper->func, &PyTuple_GET_ITEM(args, 0));
+		return FunctionWrapper_callPositionalKw(wrapper, args, kw);
+	}
+	return wrapper->invoke(wrapper->func, args, kw);
 }
 
 PyTypeObject FunctionWrapper_Type = {
@@ -98,11 +143,7 @@ PyTypeObject FunctionWrapper_Type = {
 	PyType_GenericNew,				/* tp_new */
 };
 
-FunctionWrapper* newFunctionWrapper(PyCallback func) {
-	if(!func) {
-		PyErr_Format(PyExc_ValueError, "newFunctionWrapper: func must not be NULL");
-		return NULL;
-	}
+FunctionWrapper* allocFunctionWrapper() {
 	if(PyType_Ready(&FunctionWrapper_Type) < 0) {
 		PyErr_Format(PyExc_SystemError, "failed to init FunctionWrapper_Type");
 		return NULL;
@@ -114,7 +155,13 @@ FunctionWrapper* newFunctionWrapper(PyCallback func) {
 		Py_DECREF(res);
 		return NULL;
 	}
-	FunctionWrapper* wrapper = (FunctionWrapper*) res;
-	wrapper->func = func;
-	return wrapper;
+	return (FunctionWrapper*) res;
+}
+
+FunctionWrapper* newFunctionWrapper(PyCallback func) {
+	if(!func) {
+		PyErr_Format(PyExc_ValueError, "newFunctionWrapper: func must not be NULL");
+		return NULL;
+	}
+	return newFunctionWrapper<PyCallback>(func);
 }
@@ -10,18 +10,106 @@
 #define __MusicPlayer__FunctionWrapper__
 
 #include <Python.h>
+#include <new>
+#include <type_traits>
 #include <boost/function.hpp>
 
 typedef boost::function<PyObject*(PyObject* args, PyObject* kw)> PyCallback;
 
+// A Python callable which calls a C++ functor.
+// The functor is stored in place if it fits into `storage`, otherwise on the heap.
+// It is called in place, i.e. a call does not copy it and does not allocate.
+//
+// There are two kinds:
+//  - newFunctionWrapper(f): f(PyObject* args, PyObject* kw), like a tp_call.
+//  - newPositionalFunctionWrapper(name, kwlist, f): f(PyObject* const* args),
+//    gets exactly one borrowed object per kwlist entry. A positional call (the common case,
+//    e.g. from utils.Event) directly passes the tuple items without any kwargs parsing.
+//    Keyword args are mapped onto the positions in a slower path.
 struct FunctionWrapper {
-    PyObject_HEAD
-	PyCallback func;
+	enum { StorageSize = 64, MaxPositionalArgs = 8 };
+
+	PyObject_HEAD
+	PyObject* (*invoke)(void* func, PyObject* args, PyObject* kw);
+	PyObject* (*invokePositional)(void* func, PyObject* const* args);
+	void (*destroy)(void* func, bool inPlace);
+	void* func; // points to storage or to the heap. NULL if not set
+	const char* name; // positional: for error messages
+	const char* const* kwlist; // positional: names of the args, NULL terminated
+	Py_ssize_t numArgs; // positional: length of kwlist
 	PyObject* weakrefs;
+	// The object comes from the Python allocator, which only guarantees pointer alignment
+	// (pymalloc: 8 bytes). Thus we cannot have more here, see FitsInPlace.
+	std::aligned_storage<StorageSize, alignof(void*)>::type storage;
+
+	template<typename F>
+	static PyObject* invokeFunc(void* func, PyObject* args, PyObject* kw) {
+		return (*(F*) func)(args, kw);
+	}
+
+	template<typename F>
+	static PyObject* invokePositionalFunc(void* func, PyObject* const* args) {
+		return (*(F*) func)(args);
+	}
+
+	template<typename F>
+	static void destroyFunc(void* func, bool inPlace) {
+		if(inPlace) ((F*) func)->~F();
+		else delete (F*) func;
+	}
+
+	template<typename F>
+	struct FitsInPlace : std::integral_constant<bool,
+		sizeof(F) <= StorageSize &&
+		std::alignment_of<F>::value <= alignof(void*)> {};
+
+	template<typename F>
+	void setFunc(const F& f, std::true_type /* in place */) { func = new (&storage) F(f); }
+	template<typename F>
+	void setFunc(const F& f, std::false_type /* in place */) { func = new F(f); }
+
+	template<typename F>
+	void setFunc(const F& f) {
+		setFunc(f, FitsInPlace<F>());
+		destroy = &destroyFunc<F>;
+	}
+
+	bool funcInPlace() const { return func == (void*) &storage; }
 };
 
 extern PyTypeObject FunctionWrapper_Type;
 
+// Returns a new FunctionWrapper with no function set, or NULL with a Python exception.
+FunctionWrapper* allocFunctionWrapper();
+
+template<typename F>
+FunctionWrapper* newFunctionWrapper(const F& func) {
+	FunctionWrapper* wrapper = allocFunctionWrapper();
+	if(!wrapper) return NULL;
+	wrapper->setFunc(func);
+	wrapper->invoke = &FunctionWrapper::invokeFunc<F>;
+	return wrapper;
+}
+
 FunctionWrapper* newFunctionWrapper(PyCallback func);
 
+// kwlist must stay valid as long as the wrapper, e.g. be static.
+template<typename F>
+FunctionWrapper* newPositionalFunctionWrapper(const char* name, const char* const* kwlist, const F& func) {
+	Py_ssize_t numArgs = 0;
+	while(kwlist[numArgs]) ++numArgs;
+	if(numArgs > FunctionWrapper::MaxPositionalArgs) {
+		PyErr_Format(PyExc_ValueError, "newPositionalFunctionWrapper: %s has too many args", name);
+		return NULL;
+	}
+	FunctionWrapper* wrapper = allocFunctionWrapper();
+	if(!wrapper) return NULL;
+	wrapper->setFunc(func);
+	wrapper->invokePositional = &FunctionWrapper::invokePositionalFunc<F>;
+	wrapper->name = name;
+	wrapper->kwlist = kwlist;
+	wrapper->numArgs = numArgs;
+	return wrapper;
+}
+
 #endif /* defined(__MusicPlayer__FunctionWrapper__) */
@@ -0,0 +1,139 @@
+//
+//  GILInstrument.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 25.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer__GILInstrument__
+#define __MusicPlayer__GILInstrument__
+
+#include <Python.h>
+#include <dlfcn.h>
+#include <chrono>
+#include <boost/noncopyable.hpp>
+
+// Reports the GIL acquires/releases of the GUI modules to GILStats (app/GILStats.hpp)
+// and to EventTrace (app/EventTrace.hpp).
+// Those live in the main binary, thus we look them up via dlsym.
+// If they are not there (e.g. in the Python interpreter) or if both are disabled,
+// this is only two extra calls per acquire.
+//
+// Use these instead of PyScopedGIL, PyGILState_Ensure and Py_BEGIN_ALLOW_THREADS.
+// GIL_SITE identifies the call site in the stats.
+
+#define _GIL_SITE_STR2(x) #x
+#define _GIL_SITE_STR(x) _GIL_SITE_STR2(x)
+#define GIL_SITE (__FILE__ ":" _GIL_SITE_STR(__LINE__))
+
+struct GILInstrument_Funcs {
+	int (*isEnabled)();
+	void (*onAcquire)(const char* site, unsigned long long waitNs);
+	void (*onRelease)();
+	void (*onSave)();
+	void (*onRestore)(const char* site, unsigned long long waitNs);
+	int (*traceIsActive)();
+	void (*traceOnAcquired)(const char* site, unsigned long long waitNs);
+	void (*traceOnReleased)();
+	void (*traceOnSave)();
+	void (*traceOnRestore)(const char* site, unsigned long long waitNs);
+
+	GILInstrument_Funcs() {
+		isEnabled = (int(*)()) dlsym(RTLD_DEFAULT, "GILStats_isEnabled");
+		onAcquire = (void(*)(const char*, unsigned long long)) dlsym(RTLD_DEFAULT, "GILStats_onAcquire");
+		onRelease = (void(*)()) dlsym(RTLD_DEFAULT, "GILStats_onRelease");
+		onSave = (void(*)()) dlsym(RTLD_DEFAULT, "GILStats_onSave");
+		onRestore = (void(*)(const char*, unsigned long long)) dlsym(RTLD_DEFAULT, "GILStats_onRestore");
+		if(!onAcquire || !onRelease || !onSave || !onRestore)
+			isEnabled = NULL;
+		traceIsActive = (int(*)()) dlsym(RTLD_DEFAULT, "EventTrace_isActive");
+		traceOnAcquired = (void(*)(const char*, unsigned long long)) dlsym(RTLD_DEFAULT, "EventTrace_onGILAcquired");
+		traceOnReleased = (void(*)()) dlsym(RTLD_DEFAULT, "EventTrace_onGILReleased");
+		traceOnSave = (void(*)()) dlsym(RTLD_DEFAULT, "EventTrace_onGILSave");
+		traceOnRestore = (void(*)(const char*, unsigned long long)) dlsym(RTLD_DEFAULT, "EventTrace_onGILRestore");
+		if(!traceOnAcquired || !traceOnReleased || !traceOnSave || !traceOnRestore)
+			traceIsActive = NULL;
+	}
+	bool enabled() const { return isEnabled && isEnabled(); }
+	bool traceActive() const { return traceIsActive && traceIsActive(); }
+};
+
+static inline const GILInstrument_Funcs& GILInstrument_funcs() {
+	static const GILInstrument_Funcs funcs;
+	return funcs;
+}
+
+static inline unsigned long long GILInstrument_nsSince(std::chrono::steady_clock::time_point start) {
+	return (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static inline PyGILState_STATE GILInstrument_ensure(const char* site) {
+	const GILInstrument_Funcs& funcs = GILInstrument_funcs();
+	bool stats = funcs.enabled(), trace = funcs.traceActive();
+	if(!stats && !trace) return PyGILState_Ensure();
+	auto start = std::chrono::steady_clock::now();
+	PyGILState_STATE gstate = PyGILState_Ensure();
+	// Nested ensures are no real acquisition.
+	if(gstate == PyGILState_UNLOCKED) {
+		unsigned long long waitNs = GILInstrument_nsSince(start);
+		if(stats) funcs.onAcquire(site, waitNs);
+		if(trace) funcs.traceOnAcquired(site, waitNs);
+	}
+	return gstate;
+}
+
+static inline void GILInstrument_release(PyGILState_STATE gstate) {
+	if(gstate == PyGILState_UNLOCKED) {
+		const GILInstrument_Funcs& funcs = GILInstrument_funcs();
+		// These do nothing if the acquire was not recorded.
+		if(funcs.isEnabled) funcs.onRelease();
+		if(funcs.traceIsActive) funcs.traceOnReleased();
+	}
+	PyGILState_Release(gstate);
+}
+
+static inline PyThreadState* GILInstrument_save() {
+	const GILInstrument_Funcs& funcs = GILInstrument_funcs();
+	if(funcs.isEnabled) funcs.onSave();
+	if(funcs.traceIsActive) funcs.traceOnSave();
+	return PyEval_SaveThread();
+}
+
+static inline void GILInstrument_restore(PyThreadState* tstate, const char* site) {
+	const GILInstrument_Funcs& funcs = GILInstrument_funcs();
+	bool stats = funcs.enabled(), trace = funcs.traceActive();
+	if(!stats && !trace) {
+		PyEval_RestoreThread(tstate);
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	PyEval_RestoreThread(tstate);
+	unsigned long long waitNs = GILInstrument_nsSince(start);
+	if(stats) funcs.onRestore(site, waitNs);
+	if(trace) funcs.traceOnRestore(site, waitNs);
+}
+
+// Like PyScopedGIL.
+struct PyScopedGILInstr : boost::noncopyable {
+	PyGILState_STATE gstate;
+	PyScopedGILInstr(const char* site) { gstate = GILInstrument_ensure(site); }
+	~PyScopedGILInstr() { GILInstrument_release(gstate); }
+};
+
+// Like PyScopedGIUnlock.
+struct PyScopedGIUnlockInstr : boost::noncopyable {
+	PyScopedGILInstr gil;
+	const char* site;
+	PyThreadState* _save;
+	PyScopedGIUnlockInstr(const char* _site) : gil(_site), site(_site) { _save = GILInstrument_save(); }
+	~PyScopedGIUnlockInstr() { GILInstrument_restore(_save, site); }
+};
+
+// Like Py_BEGIN_ALLOW_THREADS / Py_END_ALLOW_THREADS.
+#define GIL_BEGIN_ALLOW_THREADS { \
+	PyThreadState *_save = GILInstrument_save();
+#define GIL_END_ALLOW_THREADS \
+	GILInstrument_restore(_save, GIL_SITE); }
+
+#endif /* defined(__MusicPlayer__GILInstrument__) */
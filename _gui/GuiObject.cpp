@@ -1,6 +1,8 @@
 
 #include "GuiObject.hpp"
+#include "Layout.hpp"
 #include "PythonHelpers.h"
+#include "GILInstrument.hpp"
 
 
 int GuiObject::init(PyObject* args, PyObject* kwds) {
@@ -102,9 +104,9 @@ PyObject* guiObject_method_addChild(PyObject* _self, PyObject* _arg) {
 		PyErr_Format(PyExc_AttributeError, "GuiObject.addChild: must be specified in subclass");
 		return NULL;
 	}
-	Py_BEGIN_ALLOW_THREADS
+	GIL_BEGIN_ALLOW_THREADS
 	func(self, arg);
-	Py_END_ALLOW_THREADS
+	GIL_END_ALLOW_THREADS
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -126,9 +128,12 @@ PyObject* guiObject_method_updateContent(PyObject* _self, PyObject* _unused_arg)
 		PyErr_Format(PyExc_AttributeError, "GuiObject.updateContent: must be specified in subclass");
 		return NULL;
 	}
-	Py_BEGIN_ALLOW_THREADS
+	// This might change the geometry on the native side.
+	int transaction = self->suspendGeometryTransaction();
+	GIL_BEGIN_ALLOW_THREADS
 	func(self);
-	Py_END_ALLOW_THREADS
+	GIL_END_ALLOW_THREADS
+	self->resumeGeometryTransaction(transaction);
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -140,6 +145,65 @@ static PyMethodDef md_updateContent = {
 	NULL
 };
 
+static
+PyObject* guiObject_method_beginGeometryTransaction(PyObject* _self, PyObject* _unused_arg) {
+	(void)_unused_arg; // unused
+	((GuiObject*) _self)->beginGeometryTransaction();
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyMethodDef md_beginGeometryTransaction = {
+	"beginGeometryTransaction",
+	guiObject_method_beginGeometryTransaction,
+	METH_NOARGS,
+	NULL
+};
+
+static
+PyObject* guiObject_method_commitGeometryTransaction(PyObject* _self, PyObject* _unused_arg) {
+	(void)_unused_arg; // unused
+	GuiObject* self = (GuiObject*) _self;
+	if(self->geometryRoot()->geometryTransactionDepth <= 0) {
+		PyErr_Format(PyExc_RuntimeError, "GuiObject.commitGeometryTransaction: no open transaction");
+		return NULL;
+	}
+	self->commitGeometryTransaction();
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyMethodDef md_commitGeometryTransaction = {
+	"commitGeometryTransaction",
+	guiObject_method_commitGeometryTransaction,
+	METH_NOARGS,
+	NULL
+};
+
+static
+PyObject* guiObject_method_layout(PyObject* _self, PyObject* _unused_arg) {
+	(void)_unused_arg; // unused
+	GuiObject* self = (GuiObject*) _self;
+	if(!guiObject_nativeLayout(self)) {
+		// Fallback to the Python implementation (gui._GuiObject.layout).
+		PyObject* func = PyObject_GenericGetAttr(_self, GuiObject_AttribKeys[GuiObjectAttrib_layout]);
+		PyObject* res = func ? PyObject_CallFunction(func, NULL) : NULL;
+		Py_XDECREF(func);
+		return res;
+	}
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyMethodDef md_layout = {
+	"layout",
+	guiObject_method_layout,
+	METH_NOARGS,
+	NULL
+};
+
+
+AtomicMutexStats GuiObject_nativeGuiObjectLockStats("GuiObject.nativeGuiObject");
 
 static PyObject* returnObj(PyObject* obj) {
 	if(!obj) obj = Py_None;
@@ -147,23 +211,98 @@ static PyObject* returnObj(PyObject* obj) {
 	return obj;
 }
 
-#define _ReturnAttr(attr) { if(strcmp(key, #attr) == 0) return returnObj((PyObject*) attr); }
 
-#define _ReturnAttrVec(attr) { if(strcmp(key, #attr) == 0) return attr.asPyObject(); }
+// The attribute lookup is hit very often by the layouting code.
+// Thus we don't compare strings but dispatch on the interned key objects.
+
+PyObject* GuiObject_AttribKeys[GuiObjectAttrib_Count];
+
+static const char* const attribNames[GuiObjectAttrib_Count] = {
+#define _AttribName(name) #name,
+	GuiObject_AttribList(_AttribName)
+#undef _AttribName
+};
+
+// Open addressing hash table, interned key pointer -> GuiObjectAttrib.
+static const size_t AttribTableSize = 128; // power of two, much bigger than GuiObjectAttrib_Count
+static PyObject* attribTableKeys[AttribTableSize];
+static unsigned char attribTableIds[AttribTableSize];
+
+static inline size_t attribTableSlot(PyObject* key) {
+	return ((size_t) key >> 4) & (AttribTableSize - 1);
+}
+
+bool guiObject_initAttribKeys() {
+	for(int i = 0; i < GuiObjectAttrib_Count; ++i) {
+		if(GuiObject_AttribKeys[i]) continue;
+		PyObject* key = PyString_InternFromString(attribNames[i]);
+		if(!key) return false;
+		GuiObject_AttribKeys[i] = key; // keep ref forever
+		size_t slot = attribTableSlot(key);
+		while(attribTableKeys[slot])
+			slot = (slot + 1) & (AttribTableSize - 1);
+		attribTableKeys[slot] = key;
+		attribTableIds[slot] = (unsigned char) i;
+	}
+	return true;
+}
+
+GuiObjectAttrib guiObject_lookupAttrib(PyObject* key) {
+	if(!PyString_CheckExact(key))
+		return GuiObjectAttrib_Unknown;
+	if(PyString_CHECK_INTERNED(key)) {
+		// All our keys are interned, so any other interned string is not one of ours.
+		for(size_t slot = attribTableSlot(key); attribTableKeys[slot]; slot = (slot + 1) & (AttribTableSize - 1)) {
+			if(attribTableKeys[slot] == key)
+				return (GuiObjectAttrib) attribTableIds[slot];
+		}
+		return GuiObjectAttrib_Unknown;
+	}
+	// Rare: Attribute names are usually interned by the compiler.
+	const char* s = PyString_AS_STRING(key);
+	for(int i = 0; i < GuiObjectAttrib_Count; ++i) {
+		if(strcmp(s, attribNames[i]) == 0)
+			return (GuiObjectAttrib) i;
+	}
+	return GuiObjectAttrib_Unknown;
+}
+
+
+#define _ReturnAttr(attr) case GuiObjectAttrib_ ## attr: return returnObj((PyObject*) attr);
+
+#define _ReturnAttrVec(attr) case GuiObjectAttrib_ ## attr: return attr.asPyObject();
+
+#define _ReturnCustomAttr(attr) \
+	case GuiObjectAttrib_ ## attr: { \
+		if(get_ ## attr == 0) { \
+			PyErr_Format(PyExc_AttributeError, "GuiObject attribute '%.400s' must be specified in subclass", #attr); \
+			return NULL; \
+		} \
+		PyThreadState *_save = GILInstrument_save(); \
+		auto res = (* get_ ## attr)(this); \
+		GILInstrument_restore(_save, GIL_SITE); \
+		return res.asPyObject(); \
+	}
 
-#define _ReturnCustomAttr(attr) { \
-	if(strcmp(key, #attr) == 0) { \
+// Same as _ReturnCustomAttr but we use the shadow geometry if we are in a geometry transaction.
+#define _ReturnGeometryAttr(attr) \
+	case GuiObjectAttrib_ ## attr: { \
+		const GuiGeometry* geom = shadowGeometry(); \
+		if(geom) return geom->attr.asPyObject(); \
 		if(get_ ## attr == 0) { \
-			PyErr_Format(PyExc_AttributeError, "GuiObject attribute '%.400s' must be specified in subclass", key); \
+			PyErr_Format(PyExc_AttributeError, "GuiObject attribute '%.400s' must be specified in subclass", #attr); \
 			return NULL; \
 		} \
-		PyThreadState *_save = PyEval_SaveThread(); \
+		PyThreadState *_save = GILInstrument_save(); \
 		auto res = (* get_ ## attr)(this); \
-		PyEval_RestoreThread(_save); \
+		GILInstrument_restore(_save, GIL_SITE); \
 		return res.asPyObject(); \
-	} }
+	}
 
-PyObject* GuiObject::getattr(const char* key) {
+#define _ReturnMethod(attr) case GuiObjectAttrib_ ## attr: return PyCFunction_New(&md_ ## attr, (PyObject*) this);
+
+PyObject* GuiObject::getattro(PyObject* key) {
+	switch(guiObject_lookupAttrib(key)) {
 	_ReturnAttr(root);
 	_ReturnAttr(parent);
 	_ReturnAttr(attr);
@@ -172,109 +311,181 @@ PyObject* GuiObject::getattr(const char* key) {
 	_ReturnAttrVec(DefaultSpace);
 	_ReturnAttrVec(OuterSpace);
 	_ReturnAttrVec(PresetSize);
-	
-	_ReturnCustomAttr(pos);
-	_ReturnCustomAttr(size);
-	_ReturnCustomAttr(innerSize);
+
+	_ReturnGeometryAttr(pos);
+	_ReturnGeometryAttr(size);
+	_ReturnGeometryAttr(innerSize);
 	_ReturnCustomAttr(autoresize);
-	
-	if(strcmp(key, "addChild") == 0) {
-		return PyCFunction_New(&md_addChild, (PyObject*) this);
-	}
 
-	if(strcmp(key, "updateContent") == 0 && meth_updateContent) {
-		return PyCFunction_New(&md_updateContent, (PyObject*) this);
-	}
+	_ReturnMethod(addChild);
+	_ReturnMethod(beginGeometryTransaction);
+	_ReturnMethod(commitGeometryTransaction);
 
-	if(strcmp(key, "__dict__") == 0) {
+	case GuiObjectAttrib_updateContent:
+		if(meth_updateContent)
+			return PyCFunction_New(&md_updateContent, (PyObject*) this);
+		break;
+
+	case GuiObjectAttrib_layout:
+		// The native layout needs the geometry batch functions.
+		if(get_geometryBatch && set_geometryBatch)
+			return PyCFunction_New(&md_layout, (PyObject*) this);
+		break;
+
+	case GuiObjectAttrib___dict__:
 		if(!__dict__)
 			__dict__ = PyDict_New();
 		if(!__dict__)
 			return NULL;
 		return returnObj(__dict__);
+
+	default:
+		break;
 	}
-	
+
 	// Fallthrough to generic getattr. In case we got another base type, this might work.
-	PyObject* s = PyString_FromString(key);
+	return PyObject_GenericGetAttr((PyObject*) this, key);
+}
+
+PyObject* GuiObject::getattr(const char* key) {
+	PyObject* s = PyString_InternFromString(key);
 	if(!s) return NULL;
-	PyObject* ret = PyObject_GenericGetAttr((PyObject*) this, s);
+	PyObject* ret = getattro(s);
 	Py_DECREF(s);
 	return ret;
 }
 
 
 
-#define _SetAttr(attr) { \
-	if(strcmp(key, #attr) == 0) { \
+#define _SetAttr(attr) \
+	case GuiObjectAttrib_ ## attr: { \
+		PyObject* old = attr; \
 		attr = value; \
 		Py_INCREF(value); \
+		Py_XDECREF(old); \
 		return 0; \
-	} }
+	}
 
-#define _SetAttrType(attr, ValueType) { \
-	if(strcmp(key, #attr) == 0) { \
+#define _SetAttrSafe(attr) \
+	case GuiObjectAttrib_ ## attr: { \
+		Py_INCREF(value); \
+		Py_DecRef(attr.exchange(value)); \
+		return 0; \
+	}
+
+#define _SetAttrType(attr, ValueType) \
+	case GuiObjectAttrib_ ## attr: { \
 		if(!PyType_IsSubtype(Py_TYPE(value), & ValueType ## _Type)) { \
-			PyErr_Format(PyExc_ValueError, "GuiObject attribute '%.400s' must be of type " #ValueType, key); \
+			PyErr_Format(PyExc_ValueError, "GuiObject attribute '%.400s' must be of type " #ValueType, #attr); \
 			return -1; \
 		} \
+		ValueType* old = attr; \
 		attr = (ValueType*) value; \
 		Py_INCREF(value); \
+		Py_XDECREF(old); \
 		return 0; \
-	} }
+	}
 
-#define _SetAttrVec(attr) { \
-	if(strcmp(key, #attr) == 0) { \
+#define _SetAttrVec(attr) \
+	case GuiObjectAttrib_ ## attr: { \
 		Vec v; \
 		if(!v.initFromPyObject(value)) \
 			return -1; \
 		attr = v; \
 		return 0; \
-	} }
+	}
 
-#define _SetCustomAttr(attr, ValueType) { \
-	if(strcmp(key, #attr) == 0) { \
+#define _SetCustomAttr(attr, ValueType) \
+	case GuiObjectAttrib_ ## attr: { \
 		if(set_ ## attr == 0) { \
-			PyErr_Format(PyExc_AttributeError, "GuiObject attribute '%.400s' must be specified in subclass", key); \
+			PyErr_Format(PyExc_AttributeError, "GuiObject attribute '%.400s' must be specified in subclass", #attr); \
 			return -1; \
 		} \
 		ValueType v; \
 		if(!v.initFromPyObject(value)) \
 			return -1; \
-		Py_BEGIN_ALLOW_THREADS \
+		GIL_BEGIN_ALLOW_THREADS \
+		(* set_ ## attr)(this, v); \
+		GIL_END_ALLOW_THREADS \
+		return 0; \
+	}
+
+// Same as _SetCustomAttr but we use the shadow geometry if we are in a geometry transaction.
+#define _SetGeometryAttr(attr, setShadowFunc) \
+	case GuiObjectAttrib_ ## attr: { \
+		if(set_ ## attr == 0) { \
+			PyErr_Format(PyExc_AttributeError, "GuiObject attribute '%.400s' must be specified in subclass", #attr); \
+			return -1; \
+		} \
+		Vec v; \
+		if(!v.initFromPyObject(value)) \
+			return -1; \
+		if(setShadowFunc(v)) \
+			return 0; \
+		GIL_BEGIN_ALLOW_THREADS \
 		(* set_ ## attr)(this, v); \
-		Py_END_ALLOW_THREADS \
+		GIL_END_ALLOW_THREADS \
 		return 0; \
-	} }
+	}
 
-#define _SetAttr_ErrReadOnly(attr) { \
-	if(strcmp(key, #attr) == 0) { \
-		PyErr_Format(PyExc_AttributeError, "GuiObject attribute '%.400s' is readonly", key); \
+#define _SetAttr_ErrReadOnly(attr) \
+	case GuiObjectAttrib_ ## attr: { \
+		PyErr_Format(PyExc_AttributeError, "GuiObject attribute '%.400s' is readonly", #attr); \
 		return -1; \
-	} }
+	}
 
-int GuiObject::setattr(const char* key, PyObject* value) {
+int GuiObject::setattro(PyObject* key, PyObject* value) {
+	GuiObjectAttrib a = guiObject_lookupAttrib(key);
+
+	if(!value) {
+		// delattr
+		if(a < GuiObjectAttrib_FirstNonNative) {
+			PyErr_Format(PyExc_AttributeError, "GuiObject attribute '%.400s' cannot be deleted", attribNames[a]);
+			return -1;
+		}
+		return PyObject_GenericSetAttr((PyObject*) this, key, value);
+	}
+
+	switch(a) {
 	_SetAttrType(root, GuiObject);
 	_SetAttrType(parent, GuiObject);
 	_SetAttr(attr);
 	_SetAttr(subjectObject);
-	_SetAttr(nativeGuiObject);
+	_SetAttrSafe(nativeGuiObject);
 	_SetAttrVec(DefaultSpace);
 	_SetAttrVec(OuterSpace);
 	_SetAttrVec(PresetSize);
-	
-	_SetCustomAttr(pos, Vec);
-	_SetCustomAttr(size, Vec);
+
+	_SetGeometryAttr(pos, setShadowPos);
+	_SetGeometryAttr(size, setShadowSize);
 	_SetCustomAttr(autoresize, Autoresize);
 
 	_SetAttr_ErrReadOnly(innerSize);
 	_SetAttr_ErrReadOnly(addChild);
 	//_SetAttr_ErrReadOnly(updateContent); // as long as we have Python code overwriting this
 	_SetAttr_ErrReadOnly(__dict__);
-	
+
+	// These define the structure for the layouting. See gui.py.
+	case GuiObjectAttrib_firstChildGuiObject:
+		guiObject_invalidateNativeLayout(this);
+		break;
+	case GuiObjectAttrib_rightGuiObject:
+	case GuiObjectAttrib_bottomGuiObject:
+		guiObject_invalidateNativeLayout(parent);
+		break;
+
+	default:
+		break;
+	}
+
 	// Fallthrough to generic setattr. In case we got another base type, this might work.
-	PyObject* s = PyString_FromString(key);
+	return PyObject_GenericSetAttr((PyObject*) this, key, value);
+}
+
+int GuiObject::setattr(const char* key, PyObject* value) {
+	PyObject* s = PyString_InternFromString(key);
 	if(!s) return -1;
-	int ret = PyObject_GenericSetAttr((PyObject*) this, s, value);
+	int ret = setattro(s, value);
 	Py_DECREF(s);
 	return ret;
 }
@@ -289,6 +500,7 @@ void GuiObject::layout() {
 }
 
 Vec GuiObject::setupChilds() {
+	guiObject_invalidateNativeLayout(this);
 	Vec sizeVec;
 	PyObject* size = PyObject_CallMethod((PyObject*) this, (char*)"setupChilds", NULL);
 	if(!size) {
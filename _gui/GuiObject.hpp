@@ -11,10 +11,15 @@
 
 #include <Python.h>
 #include <boost/function.hpp>
+#include <vector>
 #include "SafeValue.hpp"
+#include "ReadMostlyValue.hpp"
 
 extern PyTypeObject GuiObject_Type;
 
+// Shared by the nativeGuiObject write lock of all GuiObjects.
+extern AtomicMutexStats GuiObject_nativeGuiObjectLockStats;
+
 struct Vec {
 	int x, y;
 	Vec(int _x = 0, int _y = 0) : x(_x), y(_y) {}
@@ -30,11 +35,63 @@ struct Autoresize {
 	PyObject* asPyObject() const;
 };
 
+struct GuiObject;
+struct GuiLayoutTree;
+
+// The attributes which GuiObject::getattro/setattro handle natively,
+// followed by some other keys which we want to have cached.
+#define GuiObject_AttribList(_) \
+	_(root) _(parent) _(attr) _(nativeGuiObject) _(subjectObject) \
+	_(DefaultSpace) _(OuterSpace) _(PresetSize) \
+	_(pos) _(size) _(innerSize) _(autoresize) \
+	_(addChild) _(updateContent) _(layout) \
+	_(beginGeometryTransaction) _(commitGeometryTransaction) \
+	_(__dict__) \
+	/* not native: */ \
+	_(firstChildGuiObject) _(rightGuiObject) _(bottomGuiObject) _(childs)
+
+enum GuiObjectAttrib {
+#define _GuiObject_AttribEnum(name) GuiObjectAttrib_ ## name,
+	GuiObject_AttribList(_GuiObject_AttribEnum)
+#undef _GuiObject_AttribEnum
+	GuiObjectAttrib_Count,
+	GuiObjectAttrib_Unknown = GuiObjectAttrib_Count,
+	GuiObjectAttrib_FirstNonNative = GuiObjectAttrib_firstChildGuiObject
+};
+
+// Interned key strings. Initialized in the _gui module init.
+extern PyObject* GuiObject_AttribKeys[GuiObjectAttrib_Count];
+bool guiObject_initAttribKeys();
+GuiObjectAttrib guiObject_lookupAttrib(PyObject* key);
+
+struct GuiGeometry {
+	Vec pos, size, innerSize;
+};
+
+struct GuiGeometryUpdate {
+	GuiObject* obj;
+	Vec pos, size;
+	bool setPos, setSize;
+};
+
+// Shadow geometry, used while a geometry transaction is open.
+// See GuiObject::beginGeometryTransaction().
+struct GuiGeometryShadow {
+	GuiGeometry geom;
+	bool valid;
+	bool tracked; // in root->geometryTransactionObjs
+	bool posDirty, sizeDirty;
+	GuiGeometryShadow() : valid(false), tracked(false), posDirty(false), sizeDirty(false) {}
+};
+
 
 struct GuiObject {
 	PyObject_HEAD
 
 	int init(PyObject* args, PyObject* kwds);
+	PyObject* getattro(PyObject* key);
+	int setattro(PyObject* key, PyObject* value);
+	// Slower. Used by subclasses which still forward via tp_getattr/tp_setattr.
 	PyObject* getattr(const char* key);
 	int setattr(const char* key, PyObject* value);
 
@@ -45,6 +102,10 @@ struct GuiObject {
 		Py_VISIT(attr);
 		Py_VISIT(subjectObject);
 		{ PyObject* o = nativeGuiObject; Py_VISIT(o); }
+		for(GuiObject* obj : geometryTransactionObjs)
+			Py_VISIT((PyObject*) obj);
+		for(GuiObject* obj : nativeLayoutRequests)
+			Py_VISIT((PyObject*) obj);
 		if(meth_childIter) {
 			int ret = 0;
 			(*meth_childIter)(this, [=,&ret](GuiObject* child, bool& stop){
@@ -56,16 +117,35 @@ struct GuiObject {
 		return 0;
 	}
 	int clear() {
+		// The native layout trees of the parents might reference our childs.
+		for(GuiObject* p = this; p; p = p->parent) {
+			p->nativeLayout.reset();
+			p->nativeLayoutFailed = false;
+		}
 		Py_CLEAR(__dict__);
 		Py_CLEAR(root);
 		Py_CLEAR(parent);
 		Py_CLEAR(attr);
 		Py_CLEAR(subjectObject);
 		Py_DecRef(nativeGuiObject.exchange(NULL));
+		{
+			std::vector<GuiObject*> objs;
+			objs.swap(geometryTransactionObjs);
+			for(GuiObject* obj : objs) {
+				obj->geometryShadow.tracked = false;
+				Py_DECREF(obj);
+			}
+		}
+		{
+			std::vector<GuiObject*> objs;
+			objs.swap(nativeLayoutRequests);
+			for(GuiObject* obj : objs)
+				Py_DECREF(obj);
+		}
 		return 0;
 	}
 	
-	GuiObject() {}
+	GuiObject() : nativeGuiObject(&GuiObject_nativeGuiObjectLockStats) {}
 	~GuiObject() {
 		if(weakreflist)
 			PyObject_ClearWeakRefs((PyObject*) this);
@@ -79,7 +159,7 @@ struct GuiObject {
 	GuiObject* parent;
 	PyObject* attr; // if this is a child of something, this is the access attrib of the parent.subjectObject
 	PyObject* subjectObject;
-	SafeValue<PyObject*> nativeGuiObject; // safe so that we can access without the GIL
+	ReadMostlyValue<PyObject*> nativeGuiObject; // safe so that we can access without the GIL. set rarely, read very often
 
 	Vec DefaultSpace;
 	Vec OuterSpace;
@@ -99,6 +179,37 @@ struct GuiObject {
 	// Custom. not exposed to Python right now but might later. Optional.
 	// This is called *with* the Python GIL.
 	void (*meth_childIter)(GuiObject*, boost::function<void(GuiObject* child, bool& stop)>); // used by tp_traverse if set
+
+	// Custom. Optional. Called without the GIL.
+	// Gets/sets the geometry of all the given objects at once, e.g. in a single main thread dispatch.
+	// All the given objects have the same implementation. Used by geometry transactions.
+	void (*get_geometryBatch)(GuiObject* const* objs, GuiGeometry* out, size_t n);
+	void (*set_geometryBatch)(const GuiGeometryUpdate* updates, size_t n);
+
+	// Geometry transactions. See GuiObjectGeometry.cpp.
+	// While a transaction is open on the root, the pos/size/innerSize attribute
+	// accesses from Python go against a cached shadow geometry and all the writes
+	// are applied at once when the outermost transaction gets committed.
+	// These are all called with the GIL.
+	GuiGeometryShadow geometryShadow;
+	int geometryTransactionDepth; // on the root
+	std::vector<GuiObject*> geometryTransactionObjs; // on the root. strong refs
+	GuiObject* geometryRoot() { return root ? root : this; }
+	bool inGeometryTransaction();
+	void beginGeometryTransaction();
+	void commitGeometryTransaction();
+	int suspendGeometryTransaction(); // applies all pending writes. returns the old depth
+	void resumeGeometryTransaction(int depth);
+	const GuiGeometry* shadowGeometry(); // NULL if not in a transaction
+	bool setShadowPos(const Vec& v); // false if not in a transaction
+	bool setShadowSize(const Vec& v);
+
+	// Native layouting. See Layout.cpp.
+	boost::shared_ptr<GuiLayoutTree> nativeLayout; // cached structure of the childs
+	bool nativeLayoutFailed; // we could not build the tree. until the childs change, use the Python layout
+	int nativeLayoutApplying; // on the root. nesting depth in nativeLayoutThread
+	long nativeLayoutThread; // on the root. the thread which applies
+	std::vector<GuiObject*> nativeLayoutRequests; // on the root. from other threads while applying. strong refs
 	
 	// other helpers
 	void layout();
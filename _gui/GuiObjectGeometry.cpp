@@ -0,0 +1,201 @@
+//
+//  GuiObjectGeometry.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 18.01.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+// Geometry transactions.
+// The layouting code in gui.py reads and writes pos/size/innerSize of many
+// controls. Every single one of these accesses is a main thread dispatch
+// in the native implementation (e.g. guiQt). Within a transaction, we read
+// the geometry once (for a whole group of controls, via get_geometryBatch)
+// into the shadow geometry, work on that and apply all the changes at once
+// (via set_geometryBatch) when the outermost transaction gets committed.
+// Transactions are per root object (i.e. per window). Only objects which
+// provide get_geometryBatch and set_geometryBatch take part in transactions.
+
+#include "GuiObject.hpp"
+#include "PythonHelpers.h"
+#include "GILInstrument.hpp"
+#include <algorithm>
+#include <assert.h>
+
+
+bool GuiObject::inGeometryTransaction() {
+	return geometryRoot()->geometryTransactionDepth > 0;
+}
+
+void GuiObject::beginGeometryTransaction() {
+	geometryRoot()->geometryTransactionDepth++;
+}
+
+// Applies the dirty shadow geometries. Expects the GIL and releases it meanwhile.
+static void flushGeometry(const std::vector<GuiObject*>& objs) {
+	std::vector<GuiGeometryUpdate> updates;
+	for(GuiObject* obj : objs) {
+		GuiGeometryShadow& shadow = obj->geometryShadow;
+		if(!shadow.posDirty && !shadow.sizeDirty) continue;
+		GuiGeometryUpdate u;
+		u.obj = obj;
+		u.pos = shadow.geom.pos;
+		u.size = shadow.geom.size;
+		u.setPos = shadow.posDirty;
+		u.setSize = shadow.sizeDirty;
+		updates.push_back(u);
+		shadow.posDirty = shadow.sizeDirty = false;
+	}
+	if(updates.empty()) return;
+
+	GIL_BEGIN_ALLOW_THREADS
+	size_t i = 0;
+	while(i < updates.size()) {
+		GuiObject* obj = updates[i].obj;
+		size_t n = 1;
+		while(i + n < updates.size() && updates[i + n].obj->set_geometryBatch == obj->set_geometryBatch)
+			++n;
+		obj->set_geometryBatch(&updates[i], n);
+		i += n;
+	}
+	GIL_END_ALLOW_THREADS
+}
+
+// Applies all pending writes and drops all the shadow geometries.
+// Expects the GIL and releases it meanwhile.
+static void flushAndReleaseGeometry(GuiObject* root) {
+	std::vector<GuiObject*> objs;
+	objs.swap(root->geometryTransactionObjs);
+	flushGeometry(objs);
+	for(GuiObject* obj : objs) {
+		obj->geometryShadow.valid = false;
+		obj->geometryShadow.tracked = false;
+		Py_DECREF(obj);
+	}
+}
+
+void GuiObject::commitGeometryTransaction() {
+	GuiObject* r = geometryRoot();
+	Py_INCREF(r);
+	assert(r->geometryTransactionDepth > 0);
+	if(r->geometryTransactionDepth > 0) r->geometryTransactionDepth--;
+	// Note that we reset the depth before the flush. Applying the geometry might trigger
+	// other layouting (e.g. via resize events), which will be outside of this transaction.
+	if(r->geometryTransactionDepth == 0)
+		flushAndReleaseGeometry(r);
+	Py_DECREF(r);
+}
+
+// Native code might change the geometry on its own, e.g. updateContent()
+// might resize a control depending on its content, or a builder sets up the
+// childs and resizes the new widget. Before we call such code, we apply all
+// pending writes and leave the transaction. Any layouting code in there
+// runs in its own transactions. Afterwards, we refetch the geometry.
+int GuiObject::suspendGeometryTransaction() {
+	GuiObject* r = geometryRoot();
+	int depth = r->geometryTransactionDepth;
+	if(depth == 0) return 0;
+	Py_INCREF(r);
+	r->geometryTransactionDepth = 0;
+	flushAndReleaseGeometry(r);
+	Py_DECREF(r);
+	return depth;
+}
+
+void GuiObject::resumeGeometryTransaction(int depth) {
+	geometryRoot()->geometryTransactionDepth += depth;
+}
+
+// Adds the GuiObject childs (via the `childs` dict, see gui.py) of obj.
+static void collectChilds(GuiObject* obj, std::vector<GuiObject*>& out) {
+	PyObject* childs = PyObject_GetAttr((PyObject*) obj, GuiObject_AttribKeys[GuiObjectAttrib_childs]);
+	if(!childs) {
+		PyErr_Clear();
+		return;
+	}
+	if(PyDict_Check(childs)) {
+		Py_ssize_t i = 0;
+		PyObject *key, *value;
+		while(PyDict_Next(childs, &i, &key, &value)) {
+			if(PyType_IsSubtype(Py_TYPE(value), &GuiObject_Type))
+				out.push_back((GuiObject*) value);
+		}
+	}
+	Py_DECREF(childs);
+}
+
+// Fetches the geometry of obj. We also prefetch its siblings and its childs
+// because the layouting code will very likely ask for them next.
+static void fetchGeometry(GuiObject* obj) {
+	GuiObject* r = obj->geometryRoot();
+
+	std::vector<GuiObject*> candidates;
+	candidates.push_back(obj);
+	if(obj->parent) collectChilds(obj->parent, candidates);
+	collectChilds(obj, candidates);
+
+	std::vector<GuiObject*> objs;
+	for(GuiObject* c : candidates) {
+		if(c->geometryShadow.valid) continue;
+		if(c->geometryRoot() != r) continue;
+		if(c->get_geometryBatch != obj->get_geometryBatch) continue;
+		if(std::find(objs.begin(), objs.end(), c) != objs.end()) continue;
+		Py_INCREF(c);
+		objs.push_back(c);
+	}
+	std::vector<GuiGeometry> geoms(objs.size());
+
+	GIL_BEGIN_ALLOW_THREADS
+	obj->get_geometryBatch(&objs[0], &geoms[0], objs.size());
+	GIL_END_ALLOW_THREADS
+
+	for(size_t i = 0; i < objs.size(); ++i) {
+		GuiObject* c = objs[i];
+		// Someone else might have been faster while we released the GIL.
+		// Or the transaction might be over already.
+		if(c->geometryShadow.valid || !c->inGeometryTransaction()) {
+			Py_DECREF(c);
+			continue;
+		}
+		c->geometryShadow.geom = geoms[i];
+		c->geometryShadow.valid = true;
+		if(c->geometryShadow.tracked)
+			Py_DECREF(c);
+		else {
+			// overtake the ref
+			c->geometryShadow.tracked = true;
+			r->geometryTransactionObjs.push_back(c);
+		}
+	}
+}
+
+// Returns NULL if we are not in a transaction (anymore).
+// The caller should fall back to the direct access then.
+const GuiGeometry* GuiObject::shadowGeometry() {
+	if(!get_geometryBatch || !set_geometryBatch) return NULL;
+	if(!inGeometryTransaction()) return NULL;
+	if(!geometryShadow.valid)
+		fetchGeometry(this);
+	if(!geometryShadow.valid) return NULL;
+	return &geometryShadow.geom;
+}
+
+bool GuiObject::setShadowPos(const Vec& v) {
+	if(!shadowGeometry()) return false;
+	geometryShadow.geom.pos = v;
+	geometryShadow.posDirty = true;
+	return true;
+}
+
+bool GuiObject::setShadowSize(const Vec& v) {
+	const GuiGeometry* geom = shadowGeometry();
+	if(!geom) return false;
+	// We expect that the inner size changes the same way.
+	Vec innerSize(
+		geom->innerSize.x + v.x - geom->size.x,
+		geom->innerSize.y + v.y - geom->size.y);
+	geometryShadow.geom.size = v;
+	geometryShadow.geom.innerSize = innerSize;
+	geometryShadow.sizeDirty = true;
+	return true;
+}
@@ -0,0 +1,454 @@
+//
+//  Layout.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 18.01.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include "Layout.hpp"
+#include "PythonHelpers.h"
+#include "GILInstrument.hpp"
+#include <pythread.h>
+#include <set>
+#include <algorithm>
+#include <assert.h>
+
+
+// Sanity limit, also against cyclic structures.
+static const size_t MaxLayoutNodes = 10000;
+
+// Returns a borrowed ref or NULL. The attribute is kept alive by obj.
+static GuiObject* getGuiObjectAttr(GuiObject* obj, GuiObjectAttrib key) {
+	PyObject* value = PyObject_GetAttr((PyObject*) obj, GuiObject_AttribKeys[key]);
+	if(!value) {
+		if(PyErr_ExceptionMatches(PyExc_AttributeError))
+			PyErr_Clear();
+		return NULL;
+	}
+	GuiObject* ret = NULL;
+	if(PyType_IsSubtype(Py_TYPE(value), &GuiObject_Type))
+		ret = (GuiObject*) value;
+	Py_DECREF(value);
+	return ret;
+}
+
+// -1 for None, otherwise the truth value.
+static signed char getTriStateAttr(PyObject* attr, const char* name) {
+	if(!attr) return -1;
+	PyObject* value = PyObject_GetAttrString(attr, name);
+	if(!value) {
+		if(PyErr_ExceptionMatches(PyExc_AttributeError))
+			PyErr_Clear();
+		return -1;
+	}
+	signed char ret = -1;
+	if(value != Py_None) {
+		int r = PyObject_IsTrue(value);
+		if(r < 0) PyErr_Clear();
+		else ret = (signed char) r;
+	}
+	Py_DECREF(value);
+	return ret;
+}
+
+static bool getOptIntAttr(PyObject* attr, const char* name, int& out) {
+	if(!attr) return false;
+	PyObject* value = PyObject_GetAttrString(attr, name);
+	if(!value) {
+		if(PyErr_ExceptionMatches(PyExc_AttributeError))
+			PyErr_Clear();
+		return false;
+	}
+	bool ret = false;
+	if(value != Py_None) {
+		long v = PyInt_AsLong(value);
+		if(v == -1 && PyErr_Occurred()) PyErr_Clear();
+		else { out = (int) v; ret = true; }
+	}
+	Py_DECREF(value);
+	return ret;
+}
+
+// Collects the structure like _GuiObject.childGuiObjectsInColumn and guiObjectsInLine.
+class LayoutTreeBuilder {
+	GuiLayoutTree& tree;
+	std::set<GuiObject*> visited;
+	// We can only handle a single backend.
+	void (*get_geometryBatch)(GuiObject* const* objs, GuiGeometry* out, size_t n);
+	void (*set_geometryBatch)(const GuiGeometryUpdate* updates, size_t n);
+
+public:
+	bool ok;
+	LayoutTreeBuilder(GuiLayoutTree& t, GuiObject* container)
+		: tree(t),
+		  get_geometryBatch(container->get_geometryBatch),
+		  set_geometryBatch(container->set_geometryBatch),
+		  ok(true)
+	{}
+
+	int addNode(GuiObject* obj, int parent) {
+		if(!ok) return -1;
+		if(!visited.insert(obj).second || tree.nodes.size() >= MaxLayoutNodes) {
+			ok = false;
+			return -1;
+		}
+		if(obj->get_geometryBatch != get_geometryBatch || obj->set_geometryBatch != set_geometryBatch) {
+			ok = false;
+			return -1;
+		}
+
+		int idx = (int) tree.nodes.size();
+		{
+			GuiLayoutNode node;
+			node.obj = obj;
+			node.parent = parent;
+			node.firstLine = 0;
+			node.numLines = 0;
+			node.spaceX = 0;
+			node.hasSpaceX = getOptIntAttr(obj->attr, "spaceX", node.spaceX);
+			node.variableWidth = getTriStateAttr(obj->attr, "variableWidth");
+			node.variableHeight = getTriStateAttr(obj->attr, "variableHeight");
+			node.OuterSpace = obj->OuterSpace;
+			node.DefaultSpace = obj->DefaultSpace;
+			tree.nodes.push_back(node);
+		}
+
+		std::vector< std::vector<GuiObject*> > column;
+		GuiObject* child = getGuiObjectAttr(obj, GuiObjectAttrib_firstChildGuiObject);
+		while(child) {
+			if(column.size() >= MaxLayoutNodes) { ok = false; return -1; }
+			std::vector<GuiObject*> line;
+			line.push_back(child);
+			while(GuiObject* right = getGuiObjectAttr(child, GuiObjectAttrib_rightGuiObject)) {
+				if(line.size() >= MaxLayoutNodes) { ok = false; return -1; }
+				child = right;
+				line.push_back(child);
+			}
+			column.push_back(line);
+			child = getGuiObjectAttr(child, GuiObjectAttrib_bottomGuiObject);
+		}
+		if(PyErr_Occurred()) { ok = false; return -1; }
+
+		// Reserve our lines first so that they are contiguous.
+		int firstLine = (int) tree.lines.size();
+		for(const std::vector<GuiObject*>& line : column) {
+			GuiLayoutLine l;
+			l.first = (int) tree.lineItems.size();
+			l.count = (int) line.size();
+			tree.lines.push_back(l);
+			tree.lineItems.resize(tree.lineItems.size() + line.size(), -1);
+		}
+		tree.nodes[idx].firstLine = firstLine;
+		tree.nodes[idx].numLines = (int) column.size();
+
+		for(size_t i = 0; i < column.size(); ++i) {
+			for(size_t j = 0; j < column[i].size(); ++j) {
+				int childIdx = addNode(column[i][j], idx);
+				if(childIdx < 0) return -1;
+				tree.lineItems[tree.lines[firstLine + i].first + j] = childIdx;
+			}
+		}
+		return idx;
+	}
+};
+
+static boost::shared_ptr<GuiLayoutTree> buildLayoutTree(GuiObject* obj) {
+	boost::shared_ptr<GuiLayoutTree> tree(new GuiLayoutTree());
+	LayoutTreeBuilder builder(*tree, obj);
+	builder.addNode(obj, -1);
+	if(!builder.ok) {
+		if(PyErr_Occurred()) PyErr_Print();
+		return boost::shared_ptr<GuiLayoutTree>();
+	}
+	return tree;
+}
+
+
+// The geometry of a node while we solve.
+struct GuiLayoutState {
+	Vec pos, size, innerSize;
+	Autoresize autoresize;
+	bool posChanged, sizeChanged, autoresizeChanged;
+	GuiLayoutState() : posChanged(false), sizeChanged(false), autoresizeChanged(false) {}
+};
+
+// This is exactly the algorithm of _GuiObject.layout and layoutLine in gui.py.
+// Does not need the GIL.
+class LayoutSolver {
+	const GuiLayoutTree& tree;
+	std::vector<GuiLayoutState>& state;
+
+	int lineItem(const GuiLayoutLine& line, int i) const { return tree.lineItems[line.first + i]; }
+
+	void setPos(int i, const Vec& v) {
+		if(state[i].pos.x == v.x && state[i].pos.y == v.y) return;
+		state[i].pos = v;
+		state[i].posChanged = true;
+	}
+
+	void setSize(int i, const Vec& v) {
+		GuiLayoutState& s = state[i];
+		if(s.size.x == v.x && s.size.y == v.y) return;
+		// We expect that the inner size changes the same way.
+		s.innerSize.x += v.x - s.size.x;
+		s.innerSize.y += v.y - s.size.y;
+		s.size = v;
+		s.sizeChanged = true;
+	}
+
+	void setAutoresize(int i, bool Autoresize::*flag) {
+		if(state[i].autoresize.*flag) return;
+		state[i].autoresize.*flag = true;
+		state[i].autoresizeChanged = true;
+	}
+
+	int spaceX(int i, const GuiLayoutNode& container) const {
+		if(tree.nodes[i].hasSpaceX) return tree.nodes[i].spaceX;
+		return container.DefaultSpace.x;
+	}
+
+	void layoutLine(int c, const GuiLayoutLine& line) {
+		const GuiLayoutNode& container = tree.nodes[c];
+		if(line.count == 0) return;
+
+		int minY = state[lineItem(line, 0)].pos.y;
+		int maxH = state[lineItem(line, 0)].size.y;
+		for(int k = 1; k < line.count; ++k) {
+			minY = std::min(minY, state[lineItem(line, k)].pos.y);
+			maxH = std::max(maxH, state[lineItem(line, k)].size.y);
+		}
+
+		// Set x-pos from left to right.
+		int x = container.OuterSpace.x;
+		for(int k = 0; k < line.count; ++k) {
+			int i = lineItem(line, k);
+			int h = state[i].size.y;
+			setPos(i, Vec(x, minY + (maxH - h) / 2));
+			x += state[i].size.x + spaceX(i, container);
+		}
+
+		// Search the variable-width-control.
+		int varWidth = -1;
+		for(int k = 0; k < line.count; ++k) {
+			if(tree.nodes[lineItem(line, k)].variableWidth > 0) {
+				varWidth = lineItem(line, k);
+				break;
+			}
+		}
+		if(varWidth < 0) {
+			varWidth = lineItem(line, line.count - 1);
+			if(tree.nodes[varWidth].variableWidth == 0)
+				// It explicitly doesn't want to be of variable size.
+				return;
+		}
+
+		x = state[c].innerSize.x - container.OuterSpace.x;
+		for(int k = line.count - 1; k >= 0; --k) {
+			int i = lineItem(line, k);
+			int w = state[i].size.x, h = state[i].size.y;
+			int y = state[i].pos.y;
+
+			if(i == varWidth) {
+				w = x - state[i].pos.x;
+				x = state[i].pos.x;
+				setPos(i, Vec(x, y));
+				setSize(i, Vec(w, h));
+				setAutoresize(i, &Autoresize::w);
+				layout(i);
+				break;
+			}
+			else {
+				x -= w;
+				setPos(i, Vec(x, y));
+				setAutoresize(i, &Autoresize::x);
+				x -= spaceX(i, container);
+			}
+		}
+	}
+
+public:
+	LayoutSolver(const GuiLayoutTree& t, std::vector<GuiLayoutState>& s) : tree(t), state(s) {}
+
+	void layout(int c) {
+		const GuiLayoutNode& container = tree.nodes[c];
+		if(container.numLines == 0) return;
+		const GuiLayoutLine* lines = &tree.lines[container.firstLine];
+		const int numLines = container.numLines;
+
+		// Search variable-height-control.
+		int varHeightLine = -1;
+		for(int l = 0; l < numLines; ++l) {
+			if(tree.nodes[lineItem(lines[l], 0)].variableHeight > 0) {
+				varHeightLine = l;
+				break;
+			}
+		}
+		if(varHeightLine < 0) {
+			varHeightLine = numLines - 1;
+			if(tree.nodes[lineItem(lines[varHeightLine], 0)].variableHeight == 0)
+				// It explicitly doesn't want to be of variable size.
+				varHeightLine = -1;
+		}
+
+		if(varHeightLine >= 0) {
+			// Set y-pos from bottom to top, until we get to the varHeightControl.
+			int y = state[c].innerSize.y - container.OuterSpace.y;
+			for(int l = numLines - 1; l >= 0; --l) {
+				int i = lineItem(lines[l], 0);
+				int w = state[i].size.x, h = state[i].size.y;
+				int x = state[i].pos.x;
+
+				if(l == varHeightLine) {
+					h = y - state[i].pos.y;
+					y = state[i].pos.y;
+					setPos(i, Vec(x, y));
+					setSize(i, Vec(w, h));
+					setAutoresize(i, &Autoresize::h);
+					// The size has changed, thus update its layout.
+					layout(i);
+					break;
+				}
+				else {
+					y -= h;
+					for(int k = 0; k < lines[l].count; ++k) {
+						int j = lineItem(lines[l], k);
+						setPos(j, Vec(state[j].pos.x, y));
+						setAutoresize(j, &Autoresize::y);
+					}
+					y -= container.DefaultSpace.y;
+				}
+			}
+		}
+
+		for(int l = 0; l < numLines; ++l)
+			layoutLine(c, lines[l]);
+
+		// If we are not auto-resizable in height,
+		// set our own height according to the last control.
+		if(!state[c].autoresize.h) {
+			int last = lineItem(lines[numLines - 1], 0);
+			setSize(c, Vec(state[c].size.x, state[last].pos.y + state[last].size.y));
+		}
+	}
+};
+
+
+// While we apply a layout, the backend might call layout() again for the resized
+// controls (e.g. guiQt does that in QtBaseWidget::resizeEvent). We already did that.
+// The GIL is released while we apply, thus other threads can also call layout()
+// in that time. Those are real requests, we queue them and run them after the apply.
+// All of the state is on the root and protected by the GIL.
+static bool deferLayout(GuiObject* obj) {
+	GuiObject* root = obj->geometryRoot();
+	if(root->nativeLayoutApplying == 0) return false;
+	if(root->nativeLayoutThread == PyThread_get_thread_ident()) return true;
+	for(GuiObject* o : root->nativeLayoutRequests)
+		if(o == obj) return true;
+	Py_INCREF(obj);
+	root->nativeLayoutRequests.push_back(obj);
+	return true;
+}
+
+static void runDeferredLayouts(GuiObject* root) {
+	std::vector<GuiObject*> objs;
+	objs.swap(root->nativeLayoutRequests);
+	for(GuiObject* o : objs) {
+		// This also does the Python fallback, if needed.
+		PyObject* res = PyObject_CallMethod((PyObject*) o, (char*)"layout", NULL);
+		if(!res) {
+			printf("GuiObject: deferred layout failed\n");
+			if(PyErr_Occurred()) PyErr_Print();
+		}
+		Py_XDECREF(res);
+		Py_DECREF(o);
+	}
+}
+
+bool guiObject_nativeLayout(GuiObject* obj) {
+	if(!obj->get_geometryBatch || !obj->set_geometryBatch) return false;
+	if(obj->nativeLayoutFailed) return false;
+	if(deferLayout(obj)) return true;
+
+	boost::shared_ptr<GuiLayoutTree> tree = obj->nativeLayout;
+	if(!tree) {
+		tree = buildLayoutTree(obj);
+		if(!tree) {
+			// Don't retry (and print the error again) for every layout().
+			obj->nativeLayoutFailed = true;
+			return false;
+		}
+		obj->nativeLayout = tree;
+	}
+
+	// We need the real geometry. Any pending writes must be applied first.
+	int transaction = obj->suspendGeometryTransaction();
+
+	const size_t n = tree->nodes.size();
+	std::vector<GuiObject*> objs(n);
+	for(size_t i = 0; i < n; ++i) {
+		objs[i] = tree->nodes[i].obj;
+		Py_INCREF(objs[i]);
+	}
+	GuiObject* root = obj->geometryRoot();
+	Py_INCREF(root);
+	if(root->nativeLayoutApplying++ == 0)
+		root->nativeLayoutThread = PyThread_get_thread_ident();
+
+	GIL_BEGIN_ALLOW_THREADS
+	{
+		std::vector<GuiGeometry> geoms(n);
+		obj->get_geometryBatch(&objs[0], &geoms[0], n);
+
+		std::vector<GuiLayoutState> state(n);
+		for(size_t i = 0; i < n; ++i) {
+			state[i].pos = geoms[i].pos;
+			state[i].size = geoms[i].size;
+			state[i].innerSize = geoms[i].innerSize;
+			if(objs[i]->get_autoresize)
+				state[i].autoresize = objs[i]->get_autoresize(objs[i]);
+		}
+
+		LayoutSolver(*tree, state).layout(0);
+
+		std::vector<GuiGeometryUpdate> updates;
+		for(size_t i = 0; i < n; ++i) {
+			if(!state[i].posChanged && !state[i].sizeChanged) continue;
+			GuiGeometryUpdate u;
+			u.obj = objs[i];
+			u.pos = state[i].pos;
+			u.size = state[i].size;
+			u.setPos = state[i].posChanged;
+			u.setSize = state[i].sizeChanged;
+			updates.push_back(u);
+		}
+		if(!updates.empty())
+			obj->set_geometryBatch(&updates[0], updates.size());
+
+		for(size_t i = 0; i < n; ++i) {
+			if(state[i].autoresizeChanged && objs[i]->set_autoresize)
+				objs[i]->set_autoresize(objs[i], state[i].autoresize);
+		}
+	}
+	GIL_END_ALLOW_THREADS
+
+	bool outermost = --root->nativeLayoutApplying == 0;
+	if(outermost) root->nativeLayoutThread = 0;
+	for(GuiObject* o : objs)
+		Py_DECREF(o);
+
+	obj->resumeGeometryTransaction(transaction);
+
+	if(outermost) runDeferredLayouts(root);
+	Py_DECREF(root);
+	return true;
+}
+
+void guiObject_invalidateNativeLayout(GuiObject* obj) {
+	// The trees of all parents include this object.
+	while(obj) {
+		obj->nativeLayout.reset();
+		obj->nativeLayoutFailed = false;
+		obj = obj->parent;
+	}
+}
@@ -0,0 +1,52 @@
+//
+//  Layout.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 18.01.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef MusicPlayer_Layout_hpp
+#define MusicPlayer_Layout_hpp
+
+#include <Python.h>
+#include <vector>
+#include "GuiObject.hpp"
+
+// Native implementation of the layouting in gui.py (_GuiObject.layout, layoutLine).
+// The structure of a container (which is setup in _GuiObject.setupChilds)
+// is collected once into a compact array of node descriptors.
+// For a layout, we fetch the geometry of all nodes at once, solve it
+// without the GIL and apply all changes at once.
+
+// A horizontal line of controls. Range in GuiLayoutTree::lineItems.
+struct GuiLayoutLine {
+	int first;
+	int count;
+};
+
+struct GuiLayoutNode {
+	GuiObject* obj; // borrowed. GuiObject::setupChilds() invalidates the tree
+	int parent; // -1 for the container we have the tree for
+	int firstLine, numLines; // range in GuiLayoutTree::lines. the childs in the column
+	bool hasSpaceX;
+	int spaceX; // attr.spaceX
+	signed char variableWidth, variableHeight; // attr.variableWidth/Height. -1 for None
+	Vec OuterSpace, DefaultSpace;
+};
+
+struct GuiLayoutTree {
+	std::vector<GuiLayoutNode> nodes; // nodes[0] is the container
+	std::vector<GuiLayoutLine> lines;
+	std::vector<int> lineItems; // node indices
+};
+
+// Expects the GIL. Returns false if the native layout is not possible for this object,
+// e.g. because the backend does not provide the geometry batch functions.
+// The caller should fall back to the Python implementation then.
+bool guiObject_nativeLayout(GuiObject* obj);
+
+// Expects the GIL. Must be called when the childs of obj change.
+void guiObject_invalidateNativeLayout(GuiObject* obj);
+
+#endif
@@ -56,6 +56,14 @@ static int guiobject_setattr(PyObject* self, char* key, PyObject* value) {
 	return ((GuiObject*) self)->setattr(key, value);
 }
 
+static PyObject* guiobject_getattro(PyObject* self, PyObject* key) {
+	return ((GuiObject*) self)->getattro(key);
+}
+
+static int guiobject_setattro(PyObject* self, PyObject* key, PyObject* value) {
+	return ((GuiObject*) self)->setattro(key, value);
+}
+
 static int guiobject_traverse(PyObject* self, visitproc visit, void *arg) {
 	return ((GuiObject*) self)->traverse(visit, arg);
 }
@@ -83,8 +91,8 @@ PyTypeObject GuiObject_Type = {
 	0,					/*tp_hash */
 	0, // tp_call
 	0, // tp_str
-	0, // tp_getattro
-	0, // tp_setattro
+	guiobject_getattro, // tp_getattro
+	guiobject_setattro, // tp_setattro
 	0, // tp_as_buffer
 	Py_TPFLAGS_HAVE_CLASS|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_WEAKREFS|Py_TPFLAGS_HAVE_GC, // flags
 	"GuiObject type", // doc
@@ -108,7 +116,59 @@ PyTypeObject GuiObject_Type = {
 };
 
 
+static PyObject* lockStatsDict(AtomicMutexStats* s) {
+	return Py_BuildValue("{s:K,s:K,s:K,s:O}",
+		"acquisitions", (unsigned long long) s->acquisitions.load(),
+		"contended", (unsigned long long) s->contended.load(),
+		"waitNs", (unsigned long long) s->waitNs.load(),
+		"enabled", s->enabled.load() ? Py_True : Py_False);
+}
+
+static PyObject* module_lockStats(PyObject* self) {
+	PyObject* res = PyDict_New();
+	if(!res) return NULL;
+	for(AtomicMutexStats* s = AtomicMutexStats::first(); s; s = s->next) {
+		PyObject* d = lockStatsDict(s);
+		if(!d || PyDict_SetItemString(res, s->name, d) != 0) {
+			Py_XDECREF(d);
+			Py_DECREF(res);
+			return NULL;
+		}
+		Py_DECREF(d);
+	}
+	return res;
+}
+
+static PyObject* module_setLockStatsEnabled(PyObject* self, PyObject* args) {
+	PyObject* flag = NULL;
+	if(!PyArg_ParseTuple(args, "O:setLockStatsEnabled", &flag))
+		return NULL;
+	int enabled = PyObject_IsTrue(flag);
+	if(enabled < 0) return NULL;
+	AtomicMutexStats::setAllEnabled(enabled);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* module_resetLockStats(PyObject* self) {
+	for(AtomicMutexStats* s = AtomicMutexStats::first(); s; s = s->next)
+		s->reset();
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+#ifdef MUSICPLAYER_BENCHMARKS
+// SafeValueBenchmark.cpp
+PyObject* guiModule_benchmarkSafeValues(PyObject* self, PyObject* args, PyObject* kws);
+#endif
+
 static PyMethodDef module_methods[] = {
+	{"lockStats",	(PyCFunction)module_lockStats,	METH_NOARGS,	"lockStats() -> dict name -> {acquisitions, contended, waitNs, enabled}"},
+	{"setLockStatsEnabled",	(PyCFunction)module_setLockStatsEnabled,	METH_VARARGS,	"setLockStatsEnabled(flag). Lock counting is off by default."},
+	{"resetLockStats",	(PyCFunction)module_resetLockStats,	METH_NOARGS,	"resetLockStats()"},
+#ifdef MUSICPLAYER_BENCHMARKS
+	{"benchmarkSafeValues",	(PyCFunction)guiModule_benchmarkSafeValues,	METH_VARARGS|METH_KEYWORDS,	"benchmarkSafeValues(numThreads=1, iterations=1000000, writeIntervalUs=0) -> dict variant -> reads/sec"},
+#endif
 	{NULL,				NULL}	/* sentinel */
 };
 
@@ -119,6 +179,11 @@ PyMODINIT_FUNC
 init_gui(void) {
 	PyEval_InitThreads(); /* Start the interpreter's thread-awareness */
 
+	if(!guiObject_initAttribKeys()) {
+		Py_FatalError("Can't initialize GuiObject attribute keys");
+		return;
+	}
+
 	if(PyType_Ready(&GuiObject_Type) < 0) {
 		Py_FatalError("Can't initialize GuiObject type");
 		return;
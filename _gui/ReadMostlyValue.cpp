@@ -0,0 +1,99 @@
+//
+//  ReadMostlyValue.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 20.01.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include "ReadMostlyValue.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <assert.h>
+
+// One per thread which ever entered a read section.
+// Records are never freed. When a thread exits, its record is put back for reuse.
+// The padding keeps the record of one thread off the cache lines of the others.
+struct EpochThreadRecord {
+	char pad0[64];
+	boost::atomic<uint64_t> active; // 0 if outside of a read section, otherwise the entered epoch
+	int depth; // only accessed by the owning thread
+	boost::atomic<bool> inUse;
+	EpochThreadRecord* next;
+	char pad1[64];
+
+	EpochThreadRecord() : active(0), depth(0), inUse(true), next(NULL) {}
+};
+
+static boost::atomic<uint64_t> globalEpoch(1);
+static boost::atomic<EpochThreadRecord*> records(NULL);
+static __thread EpochThreadRecord* threadRecord;
+static pthread_key_t threadRecordKey;
+static pthread_once_t threadRecordKeyOnce = PTHREAD_ONCE_INIT;
+
+static void threadRecordRelease(void* p) {
+	EpochThreadRecord* rec = (EpochThreadRecord*) p;
+	assert(rec->depth == 0);
+	rec->active = 0;
+	rec->inUse = false;
+}
+
+static void threadRecordKeyInit() {
+	pthread_key_create(&threadRecordKey, threadRecordRelease);
+}
+
+static EpochThreadRecord* acquireThreadRecord() {
+	pthread_once(&threadRecordKeyOnce, threadRecordKeyInit);
+
+	EpochThreadRecord* rec = NULL;
+	for(EpochThreadRecord* r = records.load(); r; r = r->next) {
+		bool expected = false;
+		if(r->inUse.compare_exchange_strong(expected, true)) {
+			rec = r;
+			break;
+		}
+	}
+	if(!rec) {
+		rec = new EpochThreadRecord();
+		EpochThreadRecord* head = records.load();
+		do {
+			rec->next = head;
+		} while(!records.compare_exchange_weak(head, rec));
+	}
+
+	pthread_setspecific(threadRecordKey, rec);
+	threadRecord = rec;
+	return rec;
+}
+
+EpochThreadRecord* epoch_enter() {
+	EpochThreadRecord* rec = threadRecord;
+	if(!rec) rec = acquireThreadRecord();
+	if(rec->depth++ == 0) {
+		// seq_cst, so that the following pointer load is ordered after this store.
+		rec->active.store(globalEpoch.load());
+	}
+	return rec;
+}
+
+void epoch_leave(EpochThreadRecord* rec) {
+	assert(rec->depth > 0);
+	if(--rec->depth == 0)
+		rec->active.store(0, boost::memory_order_release);
+}
+
+void epoch_synchronize() {
+	assert(!threadRecord || threadRecord->depth == 0);
+	// Everyone who enters after this has the new epoch and will see the already unpublished pointer.
+	uint64_t epoch = globalEpoch.fetch_add(1);
+	for(EpochThreadRecord* r = records.load(); r; r = r->next) {
+		int round = 0;
+		while(true) {
+			uint64_t a = r->active.load();
+			if(a == 0 || a > epoch) break;
+			if(round < 100) { ++round; AtomicMutex::cpuRelax(); }
+			else sched_yield();
+		}
+	}
+}
@@ -0,0 +1,143 @@
+//
+//  ReadMostlyValue.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 20.01.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef MusicPlayer_ReadMostlyValue_hpp
+#define MusicPlayer_ReadMostlyValue_hpp
+
+#include "AtomicMutex.hpp"
+#include <string.h>
+#include <type_traits>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+// Like SafeValue, but for values which are written rarely and read very often,
+// e.g. the native widget pointer. Readers never write to a shared cache line.
+// Writers are serialized via an AtomicMutex and are more expensive than with SafeValue.
+//
+// For trivially copyable T, this is a seqlock: the reader retries when a writer was active.
+// For pointers T*, this uses epoch-based reclamation: see ReadMostlyValue<T*> below.
+
+
+// Epochs. Each thread which reads has its own record, which is only written by itself.
+// A reader marks itself active with the global epoch it entered with.
+// A writer, after it has unpublished a pointer, advances the global epoch and waits until
+// no reader is still active in an older epoch (epoch_synchronize).
+// After that, nobody can still see the old pointer and it can be freed.
+// Implemented in ReadMostlyValue.cpp.
+
+struct EpochThreadRecord;
+
+EpochThreadRecord* epoch_enter();
+void epoch_leave(EpochThreadRecord* rec);
+// Must not be called inside a read section of the same thread.
+void epoch_synchronize();
+
+struct EpochReadScope : boost::noncopyable {
+	EpochThreadRecord* rec;
+	EpochReadScope() : rec(epoch_enter()) {}
+	~EpochReadScope() { epoch_leave(rec); }
+};
+
+
+template<typename T>
+class ReadMostlyValue : boost::noncopyable {
+	static_assert(std::is_trivially_copyable<T>::value, "ReadMostlyValue<T> needs a trivially copyable T");
+
+	boost::atomic<unsigned int> seq; // odd while a writer is active
+	AtomicMutex writeMutex;
+	T value;
+
+public:
+	ReadMostlyValue(AtomicMutexStats* stats = NULL) : seq(0), writeMutex(stats), value() {}
+
+	void set(const T& _v) {
+		AtomicMutex::Scope lock(writeMutex);
+		unsigned int s = seq.load(boost::memory_order_relaxed);
+		seq.store(s + 1, boost::memory_order_relaxed);
+		boost::atomic_thread_fence(boost::memory_order_release);
+		memcpy((void*) &value, &_v, sizeof(T));
+		seq.store(s + 2, boost::memory_order_release);
+	}
+
+	T exchange(const T& _v) {
+		AtomicMutex::Scope lock(writeMutex);
+		// We hold the write lock, thus the value is stable.
+		T old;
+		memcpy(&old, (const void*) &value, sizeof(T));
+		unsigned int s = seq.load(boost::memory_order_relaxed);
+		seq.store(s + 1, boost::memory_order_relaxed);
+		boost::atomic_thread_fence(boost::memory_order_release);
+		memcpy((void*) &value, &_v, sizeof(T));
+		seq.store(s + 2, boost::memory_order_release);
+		return old;
+	}
+
+	T get() const {
+		T res;
+		while(true) {
+			unsigned int s1 = seq.load(boost::memory_order_acquire);
+			if(s1 & 1) {
+				AtomicMutex::cpuRelax();
+				continue;
+			}
+			memcpy(&res, (const void*) &value, sizeof(T));
+			boost::atomic_thread_fence(boost::memory_order_acquire);
+			unsigned int s2 = seq.load(boost::memory_order_relaxed);
+			if(s1 == s2) return res;
+		}
+	}
+
+	ReadMostlyValue& operator=(const T& _v) { set(_v); return *this; }
+	operator T() const { return get(); }
+};
+
+
+// Pointers. The pointer itself is just an atomic.
+// read() gives the pointer to a callback inside an epoch read section.
+// exchange() returns the old pointer only after all readers which could have seen it are done,
+// thus the caller can free it right away.
+// The callback in read() must be short and must not block on anything
+// which a writer might hold (e.g. the Python GIL).
+template<typename T>
+class ReadMostlyValue<T*> : boost::noncopyable {
+	boost::atomic<T*> ptr;
+	AtomicMutex writeMutex;
+
+public:
+	ReadMostlyValue(AtomicMutexStats* stats = NULL) : ptr(NULL), writeMutex(stats) {}
+
+	// Only publishes. The old value is not returned, thus there is nothing to wait for.
+	void set(T* _v) {
+		AtomicMutex::Scope lock(writeMutex);
+		ptr.store(_v);
+	}
+
+	T* exchange(T* _v) {
+		AtomicMutex::Scope lock(writeMutex);
+		T* old = ptr.exchange(_v);
+		if(old) epoch_synchronize();
+		return old;
+	}
+
+	// The pointer is only safe to use if the caller otherwise ensures that it is not freed,
+	// e.g. when it holds the Python GIL and all writers also do.
+	T* get() const {
+		return ptr.load(boost::memory_order_acquire);
+	}
+
+	template<typename ResType, typename Fn>
+	ResType read(Fn op) const {
+		EpochReadScope scope;
+		return op(ptr.load());
+	}
+
+	ReadMostlyValue& operator=(T* _v) { set(_v); return *this; }
+	operator T*() const { return get(); }
+};
+
+#endif
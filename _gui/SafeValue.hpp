@@ -21,6 +21,8 @@ class SafeValue {
 	T value;
 
 public:
+	SafeValue(AtomicMutexStats* stats = NULL) : mutex(stats), value() {}
+
 	void set(const T& _v) {
 		AtomicMutex::Scope lock(mutex);
 		value = _v;
@@ -0,0 +1,216 @@
+//
+//  SafeValueBenchmark.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 20.01.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+// Import Python first, see PythonInterface.cpp.
+#include <Python.h>
+#include <pthread.h>
+#include <chrono>
+#include <vector>
+#include "GuiObject.hpp"
+#include "SafeValue.hpp"
+#include "ReadMostlyValue.hpp"
+
+// Compares the reader scaling of SafeValue and ReadMostlyValue.
+// Exposed as _gui.benchmarkSafeValues(), see tools/benchmark-safevalue.py.
+// Only in builds with benchmarks, see _gui.pro.
+
+#ifdef MUSICPLAYER_BENCHMARKS
+
+namespace {
+
+struct Dummy { int x; };
+static Dummy dummies[2];
+
+struct Values {
+	SafeValue<Dummy*> safePtr;
+	ReadMostlyValue<Dummy*> readMostlyPtr;
+	SafeValue<Vec> safeVec;
+	ReadMostlyValue<Vec> readMostlyVec;
+};
+
+enum Variant {
+	Variant_SafePtr,
+	Variant_ReadMostlyPtr,
+	Variant_SafeVec,
+	Variant_ReadMostlyVec,
+	Variant_Count
+};
+
+static const char* const variantNames[Variant_Count] = {
+	"SafeValue<T*>",
+	"ReadMostlyValue<T*>",
+	"SafeValue<Vec>",
+	"ReadMostlyValue<Vec>",
+};
+
+struct BenchState {
+	Values* values;
+	Variant variant;
+	long iterations;
+	int numThreads;
+	int writeIntervalUs; // 0 means no writer
+	boost::atomic<int> started;
+	boost::atomic<bool> stop;
+};
+
+struct ReaderArg {
+	BenchState* state;
+	long sink;
+};
+
+static void* readerProc(void* p) {
+	ReaderArg* arg = (ReaderArg*) p;
+	BenchState* state = arg->state;
+	Values* values = state->values;
+	long sink = 0;
+
+	state->started.fetch_add(1);
+	while(state->started.load() < state->numThreads)
+		AtomicMutex::cpuRelax();
+
+	switch(state->variant) {
+		case Variant_SafePtr:
+			for(long i = 0; i < state->iterations; ++i)
+				sink += values->safePtr.get()->x;
+			break;
+		case Variant_ReadMostlyPtr:
+			for(long i = 0; i < state->iterations; ++i)
+				sink += values->readMostlyPtr.read<int>([](Dummy* d) { return d->x; });
+			break;
+		case Variant_SafeVec:
+			for(long i = 0; i < state->iterations; ++i)
+				sink += values->safeVec.get().x;
+			break;
+		case Variant_ReadMostlyVec:
+			for(long i = 0; i < state->iterations; ++i)
+				sink += values->readMostlyVec.get().x;
+			break;
+		default: break;
+	}
+
+	arg->sink = sink;
+	return NULL;
+}
+
+static void* writerProc(void* p) {
+	BenchState* state = (BenchState*) p;
+	Values* values = state->values;
+	int i = 0;
+	while(!state->stop.load()) {
+		++i;
+		switch(state->variant) {
+			case Variant_SafePtr: values->safePtr.exchange(&dummies[i % 2]); break;
+			case Variant_ReadMostlyPtr: values->readMostlyPtr.exchange(&dummies[i % 2]); break;
+			case Variant_SafeVec: values->safeVec.set(Vec(i, i)); break;
+			case Variant_ReadMostlyVec: values->readMostlyVec.set(Vec(i, i)); break;
+			default: break;
+		}
+		struct timespec t = {0, state->writeIntervalUs * 1000L};
+		nanosleep(&t, NULL);
+	}
+	return NULL;
+}
+
+// Returns the total reads per second, or a negative number on error.
+static double runVariant(Variant variant, int numThreads, long iterations, int writeIntervalUs) {
+	Values values;
+	values.safePtr = &dummies[0];
+	values.readMostlyPtr = &dummies[0];
+	values.safeVec = Vec(1, 1);
+	values.readMostlyVec = Vec(1, 1);
+
+	BenchState state;
+	state.values = &values;
+	state.variant = variant;
+	state.iterations = iterations;
+	state.numThreads = numThreads;
+	state.writeIntervalUs = writeIntervalUs;
+	state.started = 0;
+	state.stop = false;
+
+	std::vector<ReaderArg> args(numThreads);
+	std::vector<pthread_t> threads(numThreads);
+	pthread_t writer = 0;
+	bool haveWriter = false;
+	int numStarted = 0;
+	double res = -1;
+
+	if(writeIntervalUs > 0) {
+		if(pthread_create(&writer, NULL, &writerProc, &state) != 0) {
+			printf("benchmarkSafeValues: failed to create writer thread\n");
+			goto final;
+		}
+		haveWriter = true;
+	}
+
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(; numStarted < numThreads; ++numStarted) {
+			args[numStarted].state = &state;
+			args[numStarted].sink = 0;
+			if(pthread_create(&threads[numStarted], NULL, &readerProc, &args[numStarted]) != 0) {
+				printf("benchmarkSafeValues: failed to create reader thread\n");
+				// Let the others run, otherwise they wait forever.
+				state.numThreads = numStarted;
+				break;
+			}
+		}
+		for(int i = 0; i < numStarted; ++i)
+			pthread_join(threads[i], NULL);
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if(numStarted == numThreads && secs > 0)
+			res = double(iterations) * numThreads / secs;
+	}
+
+final:
+	state.stop = true;
+	if(haveWriter)
+		pthread_join(writer, NULL);
+	return res;
+}
+
+}
+
+PyObject* guiModule_benchmarkSafeValues(PyObject* self, PyObject* args, PyObject* kws) {
+	int numThreads = 1;
+	long iterations = 1000000;
+	int writeIntervalUs = 0;
+	static const char* kwlist[] = {"numThreads", "iterations", "writeIntervalUs", NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kws, "|ili:benchmarkSafeValues", (char**) kwlist, &numThreads, &iterations, &writeIntervalUs))
+		return NULL;
+	if(numThreads <= 0 || iterations <= 0 || writeIntervalUs < 0) {
+		PyErr_SetString(PyExc_ValueError, "benchmarkSafeValues: invalid arguments");
+		return NULL;
+	}
+
+	double results[Variant_Count];
+	Py_BEGIN_ALLOW_THREADS
+	for(int v = 0; v < Variant_Count; ++v)
+		results[v] = runVariant((Variant) v, numThreads, iterations, writeIntervalUs);
+	Py_END_ALLOW_THREADS
+
+	PyObject* res = PyDict_New();
+	if(!res) return NULL;
+	for(int v = 0; v < Variant_Count; ++v) {
+		if(results[v] < 0) {
+			Py_DECREF(res);
+			PyErr_SetString(PyExc_RuntimeError, "benchmarkSafeValues: failed to run");
+			return NULL;
+		}
+		PyObject* f = PyFloat_FromDouble(results[v]);
+		if(!f || PyDict_SetItemString(res, variantNames[v], f) != 0) {
+			Py_XDECREF(f);
+			Py_DECREF(res);
+			return NULL;
+		}
+		Py_DECREF(f);
+	}
+	return res;
+}
+
+#endif // MUSICPLAYER_BENCHMARKS
@@ -18,6 +18,10 @@ QMAKE_CXXFLAGS += -std=c++11
 
 INCLUDEPATH += $$top_srcdir/core
 
+# The benchmark entry points (e.g. _gui.benchmarkSafeValues) are only
+# in builds configured with: qmake CONFIG+=benchmarks
+CONFIG(benchmarks): DEFINES += MUSICPLAYER_BENCHMARKS
+
 mac {
         QMAKE_LFLAGS += -undefined dynamic_lookup
 }
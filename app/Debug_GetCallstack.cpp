@@ -52,6 +52,7 @@
 #include <stdlib.h>
 #include "sysutils.hpp"
 #include "pthread_mutex.hpp"
+#include <boost/ref.hpp>
 
 #ifndef HAVE_EXECINFO
 #	if defined(__linux__)
@@ -73,47 +74,58 @@ static volatile bool callFinishedSignal = false;
 static boost::function<void(int signum, void* siginfo, void* sigsecret)> threadCallback;
 
 
-struct GetCallstackFunctor {
-	void** threadCallstackBuffer;
-	int threadCallstackBufferSize;
-	int threadCallstackCount;
-	
-	GetCallstackFunctor() : threadCallstackBuffer(NULL), threadCallstackBufferSize(0), threadCallstackCount(0) {}
+void GetCallstackFunctor::operator()(int signr, void *info, void *secret) {
+#if HAVE_EXECINFO
+	threadCallstackCount = backtrace(threadCallstackBuffer, threadCallstackBufferSize);
 	
-	void operator()(int signr, void *info, void *secret) {
-#if HAVE_EXECINFO		
-		threadCallstackCount = backtrace(threadCallstackBuffer, threadCallstackBufferSize);
-		
-		// Search for the frame origin.
-		if(secret) {
-			for(int i = 1; i < threadCallstackCount; ++i) {
-				if(threadCallstackBuffer[i] != NULL) continue;
-				
-				// Found it at stack[i]. Thus remove the first i.
-				const int IgnoreTopFramesNum = i;
-				threadCallstackCount -= IgnoreTopFramesNum;
-				memmove(threadCallstackBuffer, threadCallstackBuffer + IgnoreTopFramesNum, threadCallstackCount * sizeof(void*));
-				threadCallstackBuffer[0] = GetPCFromUContext(secret); // replace by real PC ptr
-				break;
-			}
-		}
-		else {
-			// remove top frame
-			const int IgnoreTopFramesNum = 1;
+	// Search for the frame origin.
+	if(secret) {
+		void* pc = GetPCFromUContext(secret);
+		int origin = -1;
+		// On Mac, the signal frame has a NULL return address.
+		for(int i = 1; i < threadCallstackCount; ++i)
+			if(threadCallstackBuffer[i] == NULL) { origin = i; break; }
+		// On Linux, the unwinder steps through the signal frame and we get the interrupted PC itself.
+		if(origin < 0)
+			for(int i = 1; i < threadCallstackCount; ++i)
+				if(threadCallstackBuffer[i] == pc) { origin = i; break; }
+		if(origin > 0) {
+			// Found it at stack[origin]. Thus remove the first origin.
+			const int IgnoreTopFramesNum = origin;
 			threadCallstackCount -= IgnoreTopFramesNum;
-			memmove(threadCallstackBuffer, threadCallstackBuffer + IgnoreTopFramesNum, threadCallstackCount * sizeof(void*));		
-		}		
+			memmove(threadCallstackBuffer, threadCallstackBuffer + IgnoreTopFramesNum, threadCallstackCount * sizeof(void*));
+			threadCallstackBuffer[0] = pc; // replace by real PC ptr
+		}
+	}
+	else {
+		// remove top frame
+		const int IgnoreTopFramesNum = 1;
+		threadCallstackCount -= IgnoreTopFramesNum;
+		memmove(threadCallstackBuffer, threadCallstackBuffer + IgnoreTopFramesNum, threadCallstackCount * sizeof(void*));		
+	}		
 #else // !HAVE_EXECINFO
 #warning No fillCallstackBuffer without <execinfo.h>
 #endif
-	}
-};
+}
 
 
 #ifndef WIN32
 
 #include <signal.h>
 #include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <boost/atomic.hpp>
+#if defined(__linux__)
+#include <dirent.h>
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
 
 
 #define CALLSTACK_SIG SIGUSR2
@@ -165,6 +177,222 @@ void ExecInThread(ThreadId threadId, boost::function<void(int,void*,void*)> func
 	threadCallback = NULL;
 }
 
+
+// GetAllCallstacks() uses its own signal and handler. The handler stays installed
+// because a thread which did not respond in time gets the signal later.
+// SA_RESTART restarts most blocking syscalls after the handler, but not
+// nanosleep, select, poll and some others. Those return early with EINTR.
+// In Python 2, time.sleep() then just returns early, but e.g. select.select()
+// raises select.error(EINTR). This is why the snapshot is only taken rarely,
+// e.g. for a detected hang.
+// On Linux, we take a realtime signal which nothing else uses. Elsewhere there are
+// none, thus we take SIGUSR1 and pass the signals which are not ours to the
+// handler which was installed before, e.g. by Python signal.signal or faulthandler.
+#if defined(__linux__)
+#define SNAPSHOT_SIG (SIGRTMIN + 2)
+#else
+#define SNAPSHOT_SIG SIGUSR1
+#endif
+
+static ThreadCallstackSlot* snapshotSlots = NULL;
+static int snapshotNumSlots = 0;
+static boost::atomic<bool> snapshotAccepting(false); // also releases the waiting handlers
+static boost::atomic<int> snapshotInHandler(0);
+static boost::atomic<int> snapshotResponded(0);
+// Sent by us, not yet handled. If a thread exits before it gets its signal,
+// it stays counted, and we treat one foreign signal as ours later. That is rare.
+static boost::atomic<int> snapshotPendingSignals(0);
+static struct sigaction snapshotOldAction;
+
+static void _snapshotSleep() {
+	struct timespec t = {0, 50 * 1000};
+	nanosleep(&t, NULL);
+}
+
+// Returns true if the signal was sent by _signalThread.
+static bool _snapshotTakePendingSignal() {
+	int pending = snapshotPendingSignals;
+	while(pending > 0) {
+		if(snapshotPendingSignals.compare_exchange_weak(pending, pending - 1))
+			return true;
+	}
+	return false;
+}
+
+static void _snapshotChainOldHandler(int signr, siginfo_t *info, void *secret) {
+	if(snapshotOldAction.sa_flags & SA_SIGINFO) {
+		if(snapshotOldAction.sa_sigaction)
+			snapshotOldAction.sa_sigaction(signr, info, secret);
+	}
+	// SIG_DFL would terminate the process (SIGUSR1). We ignore it, like before.
+	else if(snapshotOldAction.sa_handler != SIG_DFL && snapshotOldAction.sa_handler != SIG_IGN)
+		snapshotOldAction.sa_handler(signr);
+}
+
+static void _snapshot_signal_handler(int signr, siginfo_t *info, void *secret) {
+	int oldErrno = errno;
+	if(!_snapshotTakePendingSignal()) {
+		_snapshotChainOldHandler(signr, info, secret);
+		errno = oldErrno;
+		return;
+	}
+	snapshotInHandler.fetch_add(1);
+	if(snapshotAccepting) {
+		long osThreadId = currentOsThreadId();
+		for(int i = 0; i < snapshotNumSlots; ++i) {
+			ThreadCallstackSlot& slot = snapshotSlots[i];
+			if(slot.osThreadId != osThreadId) continue;
+			// A late signal from an earlier snapshot might have filled it already.
+			if(slot.threadId) break;
+			GetCallstackFunctor func;
+			func.threadCallstackBuffer = slot.callstack;
+			func.threadCallstackBufferSize = ThreadCallstackSlot::MaxDepth;
+			func(signr, info, secret);
+			slot.callstackCount = func.threadCallstackCount;
+			slot.threadId = (ThreadId) pthread_self();
+			snapshotResponded.fetch_add(1);
+			// Wait here until all threads are captured, so that the snapshot is consistent.
+			while(snapshotAccepting)
+				_snapshotSleep();
+			break;
+		}
+	}
+	snapshotInHandler.fetch_sub(1);
+	errno = oldErrno;
+}
+
+// Fills osThreadId and name. Returns the number of slots.
+static int _listThreads(ThreadCallstackSlot* slots, int maxSlots) {
+	int n = 0;
+#if defined(__linux__)
+	DIR* dir = opendir("/proc/self/task");
+	if(!dir) {
+		printf("GetAllCallstacks: cannot open /proc/self/task\n");
+		return 0;
+	}
+	while(struct dirent* entry = readdir(dir)) {
+		if(entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+		if(n >= maxSlots) {
+			printf("GetAllCallstacks: more than %i threads, ignoring the rest\n", maxSlots);
+			break;
+		}
+		ThreadCallstackSlot& slot = slots[n++];
+		memset(&slot, 0, offsetof(ThreadCallstackSlot, callstack));
+		slot.osThreadId = atol(entry->d_name);
+		char path[PATH_MAX];
+		int pathLen = snprintf(path, sizeof(path), "/proc/self/task/%s/comm", entry->d_name);
+		if(pathLen < 0 || pathLen >= (int) sizeof(path)) continue;
+		if(FILE* f = fopen(path, "r")) {
+			if(fgets(slot.name, sizeof(slot.name), f)) {
+				char* nl = strchr(slot.name, '\n');
+				if(nl) *nl = 0;
+			}
+			fclose(f);
+		}
+	}
+	closedir(dir);
+#elif defined(__APPLE__)
+	thread_act_array_t threads = NULL;
+	mach_msg_type_number_t count = 0;
+	if(task_threads(mach_task_self(), &threads, &count) != KERN_SUCCESS) {
+		printf("GetAllCallstacks: task_threads failed\n");
+		return 0;
+	}
+	for(mach_msg_type_number_t i = 0; i < count; ++i) {
+		pthread_t t = pthread_from_mach_thread_np(threads[i]);
+		if(t && n < maxSlots) {
+			ThreadCallstackSlot& slot = slots[n++];
+			memset(&slot, 0, offsetof(ThreadCallstackSlot, callstack));
+			slot.osThreadId = (long) threads[i];
+			pthread_getname_np(t, slot.name, sizeof(slot.name));
+		}
+		mach_port_deallocate(mach_task_self(), threads[i]);
+	}
+	vm_deallocate(mach_task_self(), (vm_address_t) threads, count * sizeof(thread_act_t));
+	if(n >= maxSlots)
+		printf("GetAllCallstacks: more than %i threads, ignoring the rest\n", maxSlots);
+#else
+#warning No thread listing for GetAllCallstacks.
+#endif
+	return n;
+}
+
+static bool _signalThread(const ThreadCallstackSlot& slot) {
+	// Before we send it, because the handler might run right away.
+	snapshotPendingSignals.fetch_add(1);
+	bool ok = false;
+#if defined(__linux__)
+	ok = syscall(SYS_tgkill, getpid(), (pid_t) slot.osThreadId, SNAPSHOT_SIG) == 0;
+#elif defined(__APPLE__)
+	pthread_t t = pthread_from_mach_thread_np((mach_port_t) slot.osThreadId);
+	ok = t && pthread_kill(t, SNAPSHOT_SIG) == 0;
+#endif
+	if(!ok) snapshotPendingSignals.fetch_sub(1);
+	return ok;
+}
+
+__attribute__((noinline))
+int GetAllCallstacks(ThreadCallstackSlot* slots, int maxSlots, int timeoutMs) {
+	static Mutex snapshotMutex;
+	Mutex::ScopedLock lock(snapshotMutex);
+	
+	static bool installedHandler = false;
+	if(!installedHandler) {
+		struct sigaction sa;
+		sigfillset(&sa.sa_mask);
+		sa.sa_flags = SA_SIGINFO | SA_RESTART;
+		sa.sa_sigaction = _snapshot_signal_handler;
+		sigaction(SNAPSHOT_SIG, &sa, &snapshotOldAction);
+		installedHandler = true;
+	}
+
+	int n = _listThreads(slots, maxSlots);
+	long myOsThreadId = currentOsThreadId();
+	
+	// Our own stack. This must be done before we signal the others:
+	// backtrace() takes the unwinder and loader locks, and another thread
+	// might wait in its handler while it holds one of them.
+	for(int i = 0; i < n; ++i) {
+		if(slots[i].osThreadId != myOsThreadId) continue;
+		slots[i].callstackCount = GetCallstack(0, slots[i].callstack, ThreadCallstackSlot::MaxDepth);
+		slots[i].threadId = (ThreadId) pthread_self();
+	}
+	
+	// Wait for late handlers from an earlier snapshot before we touch the globals.
+	while(snapshotInHandler > 0)
+		_snapshotSleep();
+	snapshotSlots = slots;
+	snapshotNumSlots = n;
+	snapshotResponded = 0;
+	snapshotAccepting = true;
+	
+	int numSignaled = 0;
+	for(int i = 0; i < n; ++i) {
+		if(slots[i].osThreadId == myOsThreadId) continue;
+		// The thread might have exited meanwhile.
+		if(_signalThread(slots[i])) numSignaled++;
+	}
+	
+	AbsUsTime startTime = current_abs_time_us();
+	while(snapshotResponded < numSignaled) {
+		if(current_abs_time_us() - startTime >= AbsUsTime(timeoutMs) * 1000)
+			break;
+		_snapshotSleep();
+	}
+	
+	// Release the waiting handlers. After that, no handler writes into the slots anymore.
+	snapshotAccepting = false;
+	while(snapshotInHandler > 0)
+		_snapshotSleep();
+	snapshotSlots = NULL;
+	snapshotNumSlots = 0;
+	
+	if(snapshotResponded < numSignaled)
+		printf("GetAllCallstacks: %i of %i threads did not respond within %i ms\n",
+			   numSignaled - snapshotResponded, numSignaled, timeoutMs);
+	return n;
+}
+
 #else // win32
 
 // TODO: win32 implementation
@@ -176,6 +404,10 @@ int ExecInThread(ThreadId threadId, boost::function<void(void)> func) {
 	return 0;
 }
 
+int GetAllCallstacks(ThreadCallstackSlot* slots, int maxSlots, int timeoutMs) {
+	return 0;
+}
+
 #endif
 
 __attribute__((noinline))
@@ -187,7 +419,8 @@ int GetCallstack(ThreadId threadId, void **buffer, int size) {
 	if(threadId == 0 || threadId == (ThreadId)pthread_self())
 		func(0, NULL, NULL);
 	else
-		ExecInThread(threadId, func);
+		// By reference, otherwise the boost::function would fill a copy.
+		ExecInThread(threadId, boost::ref(func));
 
 	return func.threadCallstackCount;
 }
@@ -0,0 +1,357 @@
+//
+//  EventTrace.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 26.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <boost/atomic.hpp>
+
+#include "EventTrace.hpp"
+#include "sysutils.hpp"
+#include "pthread_mutex.hpp"
+
+static const int kMaxOpenEvents = 64;
+static const int kRingSize = 16384;
+// Shorter GIL waits and holds are only counted in the event summary, to not flood the ring buffer.
+static const unsigned long long kMinGILSpanUs = 20;
+// Events with tasks which still did not run after this are finished anyway,
+// e.g. when the task was dropped. Otherwise they would block their slot forever.
+static const unsigned long long kOpenEventTimeoutUs = 10 * 1000 * 1000;
+
+struct OpenEvent {
+	boost::atomic<unsigned long> id; // 0 if unused
+	const char* name;
+	AbsUsTime startUs;
+	boost::atomic<bool> inNotify;
+	boost::atomic<unsigned long long> notifyUs, taskUs, pythonUs, gilWaitUs;
+	boost::atomic<int> tasksSpawned, tasksPending;
+};
+
+struct SpanData {
+	unsigned long eventId;
+	const char* cat;
+	const char* name;
+	const char* site; // GIL site or NULL
+	long threadId;
+	char threadName[32];
+	AbsUsTime startUs;
+	unsigned long long durUs;
+	// Only for the "event" summary.
+	unsigned long long qtUs, pythonUs, gilWaitUs;
+	int tasks, tasksUnfinished;
+};
+
+struct Span {
+	boost::atomic<unsigned long> seq; // ring position + 1, 0 while it is written
+	SpanData d;
+};
+
+static boost::atomic<bool> enabled(false);
+static boost::atomic<unsigned long> nextEventId(1);
+static boost::atomic<unsigned long> droppedEvents(0);
+static OpenEvent openEvents[kMaxOpenEvents];
+static Span ring[kRingSize];
+static boost::atomic<unsigned long> ringPos(0);
+static Mutex writeMutex;
+
+// Per thread state.
+static __thread unsigned long curEventId;
+static __thread bool curHaveThreadName;
+static __thread char curThreadName[32];
+static __thread unsigned long curHoldId; // the event of the current GIL hold, or 0
+static __thread AbsUsTime curHoldStartUs;
+static __thread const char* curHoldSite;
+static __thread unsigned long curSavedHoldId; // in EventTrace_onGILSave
+
+
+static OpenEvent* _event(unsigned long id) {
+	if(!id) return NULL;
+	OpenEvent* ev = &openEvents[id % kMaxOpenEvents];
+	if(ev->id.load(boost::memory_order_acquire) != id) return NULL;
+	return ev;
+}
+
+// pos1 is the ring position + 1 which must be passed to _endSpan.
+static Span* _beginSpan(unsigned long eventId, const char* cat, const char* name, AbsUsTime startUs, unsigned long long durUs, unsigned long& pos1) {
+	unsigned long pos = ringPos.fetch_add(1);
+	pos1 = pos + 1;
+	Span* s = &ring[pos % kRingSize];
+	s->seq.store(0, boost::memory_order_relaxed);
+	boost::atomic_thread_fence(boost::memory_order_release);
+	SpanData& d = s->d;
+	d.eventId = eventId;
+	d.cat = cat;
+	d.name = name;
+	d.site = NULL;
+	d.threadId = (long) pthread_self();
+	if(!curHaveThreadName) {
+		curThreadName[0] = 0;
+		pthread_getname_np(pthread_self(), curThreadName, sizeof(curThreadName));
+		curHaveThreadName = true;
+	}
+	memcpy(d.threadName, curThreadName, sizeof(d.threadName));
+	d.startUs = startUs;
+	d.durUs = durUs;
+	d.qtUs = d.pythonUs = d.gilWaitUs = 0;
+	d.tasks = d.tasksUnfinished = 0;
+	return s;
+}
+
+static void _endSpan(Span* s, unsigned long pos1) {
+	s->seq.store(pos1, boost::memory_order_release);
+}
+
+static void _addSpan(unsigned long eventId, const char* cat, const char* name, const char* site, AbsUsTime startUs, unsigned long long durUs) {
+	unsigned long pos1;
+	Span* s = _beginSpan(eventId, cat, name, startUs, durUs, pos1);
+	s->d.site = site;
+	_endSpan(s, pos1);
+}
+
+static inline unsigned long long _usSince(AbsUsTime start, AbsUsTime now) {
+	return (now > start) ? (now - start) : 0;
+}
+
+void EventTrace_setEnabled(int _enabled) {
+	enabled = _enabled != 0;
+}
+
+int EventTrace_isEnabled() {
+	return enabled ? 1 : 0;
+}
+
+unsigned long EventTrace_beginEvent(const char* name) {
+	if(!enabled) return 0;
+	unsigned long id = nextEventId.fetch_add(1);
+	OpenEvent* ev = &openEvents[id % kMaxOpenEvents];
+	if(ev->id.load() != 0) {
+		// The old one is still not finished. Don't trace this one.
+		droppedEvents++;
+		return 0;
+	}
+	ev->name = name;
+	ev->startUs = current_abs_time_us();
+	ev->inNotify = true;
+	ev->notifyUs = 0;
+	ev->taskUs = 0;
+	ev->pythonUs = 0;
+	ev->gilWaitUs = 0;
+	ev->tasksSpawned = 0;
+	ev->tasksPending = 0;
+	ev->id.store(id, boost::memory_order_release);
+	curEventId = id;
+	return id;
+}
+
+void EventTrace_endNotify(unsigned long id) {
+	curEventId = 0;
+	OpenEvent* ev = _event(id);
+	if(!ev) return;
+	AbsUsTime now = current_abs_time_us();
+	ev->notifyUs = _usSince(ev->startUs, now);
+	_addSpan(id, "qt", ev->name, NULL, ev->startUs, ev->notifyUs);
+	ev->inNotify = false;
+}
+
+unsigned long EventTrace_current() {
+	return curEventId;
+}
+
+unsigned long EventTrace_setCurrent(unsigned long id) {
+	unsigned long prev = curEventId;
+	curEventId = id;
+	return prev;
+}
+
+unsigned long EventTrace_spawn() {
+	OpenEvent* ev = _event(curEventId);
+	if(!ev) return 0;
+	ev->tasksSpawned++;
+	ev->tasksPending++;
+	return curEventId;
+}
+
+unsigned long long EventTrace_timeUs() {
+	return current_abs_time_us();
+}
+
+void EventTrace_taskEnd(unsigned long id, const char* name, unsigned long long startUs) {
+	OpenEvent* ev = _event(id);
+	if(!ev) return;
+	unsigned long long us = _usSince(startUs, current_abs_time_us());
+	ev->taskUs += us;
+	_addSpan(id, "task", name, NULL, startUs, us);
+	ev->tasksPending--;
+}
+
+int EventTrace_isActive() {
+	return (curEventId != 0 || curHoldId != 0) ? 1 : 0;
+}
+
+static void _recordGILWait(unsigned long id, const char* site, unsigned long long waitNs) {
+	OpenEvent* ev = _event(id);
+	if(!ev) return;
+	unsigned long long us = waitNs / 1000;
+	ev->gilWaitUs += us;
+	if(us >= kMinGILSpanUs) {
+		AbsUsTime now = current_abs_time_us();
+		_addSpan(id, "gil", "GIL wait", site, now - us, us);
+	}
+}
+
+static void _beginHold(unsigned long id, const char* site) {
+	curHoldId = id;
+	curHoldStartUs = current_abs_time_us();
+	curHoldSite = site;
+}
+
+static void _endHold() {
+	unsigned long id = curHoldId;
+	curHoldId = 0;
+	OpenEvent* ev = _event(id);
+	if(!ev) return;
+	unsigned long long us = _usSince(curHoldStartUs, current_abs_time_us());
+	ev->pythonUs += us;
+	if(us >= kMinGILSpanUs)
+		_addSpan(id, "python", "Python", curHoldSite, curHoldStartUs, us);
+}
+
+void EventTrace_onGILAcquired(const char* site, unsigned long long waitNs) {
+	unsigned long id = curEventId;
+	if(!id) return;
+	_recordGILWait(id, site, waitNs);
+	_beginHold(id, site);
+}
+
+void EventTrace_onGILReleased() {
+	if(curHoldId) _endHold();
+}
+
+void EventTrace_onGILSave() {
+	curSavedHoldId = curHoldId;
+	if(curHoldId) _endHold();
+}
+
+void EventTrace_onGILRestore(const char* site, unsigned long long waitNs) {
+	unsigned long id = curSavedHoldId;
+	curSavedHoldId = 0;
+	if(!id) return;
+	_recordGILWait(id, site, waitNs);
+	_beginHold(id, site);
+}
+
+void EventTrace_onIdle() {
+	AbsUsTime now = 0;
+	for(int i = 0; i < kMaxOpenEvents; ++i) {
+		OpenEvent& ev = openEvents[i];
+		unsigned long id = ev.id.load(boost::memory_order_acquire);
+		if(!id || ev.inNotify) continue;
+		if(!now) now = current_abs_time_us();
+		int tasksPending = ev.tasksPending;
+		if(tasksPending > 0 && _usSince(ev.startUs, now) < kOpenEventTimeoutUs) continue;
+		// Qt is what is left of the main thread time. The Python time and the GIL wait
+		// are only those of the threads which had this event as their current id.
+		long long qtUs = (long long) ev.notifyUs + (long long) ev.taskUs - (long long) ev.pythonUs - (long long) ev.gilWaitUs;
+		unsigned long pos1;
+		Span* s = _beginSpan(id, "event", ev.name, ev.startUs, _usSince(ev.startUs, now), pos1);
+		s->d.qtUs = (qtUs > 0) ? qtUs : 0;
+		s->d.pythonUs = ev.pythonUs;
+		s->d.gilWaitUs = ev.gilWaitUs;
+		s->d.tasks = ev.tasksSpawned;
+		s->d.tasksUnfinished = (tasksPending > 0) ? tasksPending : 0;
+		_endSpan(s, pos1);
+		ev.id.store(0, boost::memory_order_release);
+	}
+}
+
+// Escapes for a JSON string.
+static std::string jsonStr(const char* s) {
+	std::string res = "\"";
+	for(; *s; ++s) {
+		char c = *s;
+		if(c == '"' || c == '\\') { res += '\\'; res += c; }
+		else if((unsigned char) c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", (int) c);
+			res += buf;
+		}
+		else res += c;
+	}
+	return res + "\"";
+}
+
+int EventTrace_writeJson(const char* filename) {
+	Mutex::ScopedLock lock(writeMutex);
+
+	// Copy the consistent spans out first. A writer might overwrite a slot meanwhile,
+	// we notice that via the seq.
+	std::vector<SpanData> spans;
+	spans.reserve(kRingSize);
+	for(int i = 0; i < kRingSize; ++i) {
+		const Span& s = ring[i];
+		unsigned long seq1 = s.seq.load(boost::memory_order_acquire);
+		if(!seq1) continue;
+		spans.push_back(s.d);
+		spans.back().threadName[sizeof(s.d.threadName) - 1] = 0;
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		if(s.seq.load(boost::memory_order_relaxed) != seq1)
+			spans.pop_back();
+	}
+
+	AbsUsTime baseUs = 0;
+	for(const SpanData& s : spans)
+		if(!baseUs || s.startUs < baseUs) baseUs = s.startUs;
+
+	std::string out = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	int pid = (int) getpid();
+	std::set<long> namedThreads;
+	bool first = true;
+	char buf[512];
+	for(const SpanData& s : spans) {
+		if(!first) out += ",\n";
+		first = false;
+		if(s.threadName[0] && namedThreads.insert(s.threadId).second) {
+			snprintf(buf, sizeof(buf),
+					 "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %i, \"tid\": %li, \"args\": {\"name\": ",
+					 pid, s.threadId);
+			out += buf + jsonStr(s.threadName) + "}},\n";
+		}
+		snprintf(buf, sizeof(buf), "{\"ph\": \"X\", \"pid\": %i, \"tid\": %li, \"ts\": %llu, \"dur\": %llu, \"cat\": ",
+				 pid, s.threadId, (unsigned long long) (s.startUs - baseUs), s.durUs);
+		out += buf + jsonStr(s.cat) + ", \"name\": " + jsonStr(s.name ? s.name : "");
+		snprintf(buf, sizeof(buf), ", \"args\": {\"event\": %lu", s.eventId);
+		out += buf;
+		if(s.site)
+			out += ", \"site\": " + jsonStr(s.site);
+		if(strcmp(s.cat, "event") == 0) {
+			snprintf(buf, sizeof(buf), ", \"qtUs\": %llu, \"pythonUs\": %llu, \"gilWaitUs\": %llu, \"tasks\": %i",
+					 s.qtUs, s.pythonUs, s.gilWaitUs, s.tasks);
+			out += buf;
+			if(s.tasksUnfinished) {
+				snprintf(buf, sizeof(buf), ", \"tasksUnfinished\": %i", s.tasksUnfinished);
+				out += buf;
+			}
+		}
+		out += "}}";
+	}
+	out += "\n]}\n";
+
+	FILE* f = fopen(filename, "w");
+	if(!f) {
+		printf("EventTrace: cannot write %s\n", filename);
+		return -1;
+	}
+	fwrite(out.data(), 1, out.size(), f);
+	fclose(f);
+	printf("EventTrace: wrote %i spans to %s (%lu events dropped)\n", (int) spans.size(), filename, droppedEvents.load());
+	return (int) spans.size();
+}
@@ -0,0 +1,93 @@
+//
+//  EventTrace.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 26.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer__EventTrace__
+#define __MusicPlayer__EventTrace__
+
+// Traces the work triggered by a GUI input event (e.g. a click) until the main thread is idle again.
+// See Plans.md, "Trace Python".
+//
+// QtApp::notify() starts an event and makes its id the current one of the main thread.
+// The id is passed along to the main thread tasks which are queued meanwhile
+// (execInMainThread_*, dispatch_async_background_queue), and they get it as their current id.
+// The GIL sections (_gui/GILInstrument.hpp) of a thread with a current id record the GIL wait
+// and the time holding the GIL, i.e. the time in Python.
+// When the main thread is about to block and no task of the event is pending anymore,
+// the event is finished.
+//
+// Everything goes as spans into a ring buffer, which can be dumped in the Chrome trace format
+// (chrome://tracing). Per event, there is a summary span with the time in Qt, in Python,
+// waiting for the GIL and the number of spawned tasks.
+// In Python, see debugger.eventTraceSetEnabled() and debugger.eventTraceDump().
+
+// no C++ mangling for these symbols
+extern "C" {
+	// Off by default.
+	__attribute__((visibility("default")))
+	void EventTrace_setEnabled(int enabled);
+
+	__attribute__((visibility("default")))
+	int EventTrace_isEnabled();
+
+	// Main thread. name must be a static string. Returns 0 if disabled or too many events are open.
+	// Makes it the current id.
+	__attribute__((visibility("default")))
+	unsigned long EventTrace_beginEvent(const char* name);
+
+	// When QApplication::notify() returned. Resets the current id.
+	__attribute__((visibility("default")))
+	void EventTrace_endNotify(unsigned long id);
+
+	// The current id of this thread, or 0.
+	__attribute__((visibility("default")))
+	unsigned long EventTrace_current();
+
+	// Returns the previous one.
+	__attribute__((visibility("default")))
+	unsigned long EventTrace_setCurrent(unsigned long id);
+
+	// A task was queued for the current id. Returns the id for the task, or 0.
+	// Call EventTrace_taskEnd() when the task is done.
+	__attribute__((visibility("default")))
+	unsigned long EventTrace_spawn();
+
+	__attribute__((visibility("default")))
+	unsigned long long EventTrace_timeUs();
+
+	// name must be a static string. startUs from EventTrace_timeUs().
+	__attribute__((visibility("default")))
+	void EventTrace_taskEnd(unsigned long id, const char* name, unsigned long long startUs);
+
+	// Called by the GIL instrumentation, only for real acquisitions. site must be a static string.
+	// Save/restore are for PyEval_SaveThread/PyEval_RestoreThread.
+	// Nonzero if this thread has a current id, i.e. if the calls below would record something.
+	__attribute__((visibility("default")))
+	int EventTrace_isActive();
+
+	__attribute__((visibility("default")))
+	void EventTrace_onGILAcquired(const char* site, unsigned long long waitNs);
+
+	__attribute__((visibility("default")))
+	void EventTrace_onGILReleased();
+
+	__attribute__((visibility("default")))
+	void EventTrace_onGILSave();
+
+	__attribute__((visibility("default")))
+	void EventTrace_onGILRestore(const char* site, unsigned long long waitNs);
+
+	// Main thread, when it is about to block. Finishes the events without pending tasks.
+	__attribute__((visibility("default")))
+	void EventTrace_onIdle();
+
+	// Writes the ring buffer as Chrome trace JSON. Returns the number of spans, or -1 on error.
+	__attribute__((visibility("default")))
+	int EventTrace_writeJson(const char* filename);
+}
+
+#endif /* defined(__MusicPlayer__EventTrace__) */
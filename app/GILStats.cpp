@@ -0,0 +1,317 @@
+//
+//  GILStats.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 25.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <algorithm>
+#include <boost/atomic.hpp>
+
+#include "GILStats.hpp"
+#include "LatencyHistogram.hpp"
+#include "sysutils.hpp"
+
+static const int kMaxThreads = 128;
+static const int kMaxSites = 512; // power of two, it's a hash table
+
+// All writes happen with the GIL held, thus there is only one writer at a time.
+// We use relaxed atomics anyway because GILStats_print() reads without the GIL.
+typedef boost::atomic<uint64_t> Counter;
+
+static inline void counterAdd(Counter& c, uint64_t v) {
+	c.store(c.load(boost::memory_order_relaxed) + v, boost::memory_order_relaxed);
+}
+
+static inline void counterMax(Counter& c, uint64_t v) {
+	if(v > c.load(boost::memory_order_relaxed))
+		c.store(v, boost::memory_order_relaxed);
+}
+
+static inline uint64_t counterGet(const Counter& c) {
+	return c.load(boost::memory_order_relaxed);
+}
+
+struct LatencyCounters {
+	Counter count, totalUs, maxUs;
+	boost::atomic<uint32_t> hist[kHistBuckets];
+
+	void reset() {
+		count = 0; totalUs = 0; maxUs = 0;
+		for(int i = 0; i < kHistBuckets; ++i) hist[i] = 0;
+	}
+	void add(uint64_t us) {
+		counterAdd(count, 1);
+		counterAdd(totalUs, us);
+		counterMax(maxUs, us);
+		boost::atomic<uint32_t>& bucket = hist[histBucket(us)];
+		bucket.store(bucket.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+	}
+	void get(unsigned long long& _count, unsigned long long& _totalUs,
+			 unsigned long long& p50Us, unsigned long long& p99Us, unsigned long long& _maxUs) const {
+		uint32_t counts[kHistBuckets];
+		unsigned long long total = 0;
+		for(int i = 0; i < kHistBuckets; ++i) {
+			counts[i] = hist[i].load(boost::memory_order_relaxed);
+			total += counts[i];
+		}
+		_count = counterGet(count);
+		_totalUs = counterGet(totalUs);
+		_maxUs = counterGet(maxUs);
+		p50Us = p99Us = 0;
+		if(total > 0) {
+			p50Us = histPercentile(counts, total, 0.5, _maxUs);
+			p99Us = histPercentile(counts, total, 0.99, _maxUs);
+		}
+	}
+};
+
+// When a thread exits, its slot is released and can be reused by a new thread.
+struct GILThreadSlot {
+	boost::atomic<bool> inUse;
+	ThreadId threadId;
+	char name[32];
+	LatencyCounters hold, wait;
+};
+
+struct GILSiteSlot {
+	boost::atomic<const char*> site; // NULL if unused
+	Counter holdCount, holdTotalUs, holdMaxUs, waitTotalUs;
+
+	void reset() {
+		holdCount = 0; holdTotalUs = 0; holdMaxUs = 0; waitTotalUs = 0;
+	}
+};
+
+static boost::atomic<bool> enabled(false);
+static GILThreadSlot threadSlots[kMaxThreads];
+static boost::atomic<int> numThreadSlots(0);
+static GILSiteSlot siteSlots[kMaxSites];
+static GILSiteSlot overflowSite; // if the table is full
+
+// The current holder, as far as we know. For the hang report.
+static boost::atomic<ThreadId> holderThreadId(0);
+static boost::atomic<const char*> holderSite(NULL);
+static boost::atomic<AbsUsTime> holderSinceUs(0);
+
+// Per thread state. Only accessed by the thread itself.
+static __thread GILThreadSlot* curThreadSlot;
+static __thread bool curHolding; // we are in a hold which we track
+static __thread bool curWasHolding; // before GILStats_onSave
+static __thread AbsUsTime curHoldStartUs;
+static __thread const char* curHoldSite;
+static pthread_key_t threadSlotKey;
+static pthread_once_t threadSlotKeyOnce = PTHREAD_ONCE_INIT;
+
+
+// Called at thread exit. Without the GIL.
+static void _threadSlotRelease(void* p) {
+	GILThreadSlot* slot = (GILThreadSlot*) p;
+	curThreadSlot = NULL;
+	slot->inUse = false;
+}
+
+static void _threadSlotKeyInit() {
+	pthread_key_create(&threadSlotKey, _threadSlotRelease);
+}
+
+static GILThreadSlot* _threadSlot() {
+	if(curThreadSlot) return curThreadSlot;
+	pthread_once(&threadSlotKeyOnce, _threadSlotKeyInit);
+	// We hold the GIL, thus nobody else allocates a slot right now.
+	// But exiting threads release theirs without the GIL, thus the CAS.
+	GILThreadSlot* slot = NULL;
+	int n = numThreadSlots.load();
+	for(int i = 0; i < n && !slot; ++i) {
+		bool expected = false;
+		if(threadSlots[i].inUse.compare_exchange_strong(expected, true))
+			slot = &threadSlots[i];
+	}
+	if(!slot) {
+		if(n >= kMaxThreads) return NULL;
+		slot = &threadSlots[n];
+		slot->inUse = true;
+		numThreadSlots = n + 1;
+	}
+	slot->threadId = (ThreadId) pthread_self();
+	slot->name[0] = 0;
+	pthread_getname_np(pthread_self(), slot->name, sizeof(slot->name));
+	slot->hold.reset();
+	slot->wait.reset();
+	pthread_setspecific(threadSlotKey, slot);
+	curThreadSlot = slot;
+	return slot;
+}
+
+static GILSiteSlot* _siteSlot(const char* site) {
+	// The site strings are static, thus we can just hash the pointer.
+	size_t h = ((size_t) site >> 3) * 2654435761U;
+	for(int i = 0; i < kMaxSites; ++i) {
+		GILSiteSlot& slot = siteSlots[(h + i) & (kMaxSites - 1)];
+		const char* s = slot.site.load(boost::memory_order_relaxed);
+		if(s == site) return &slot;
+		if(!s) {
+			slot.reset();
+			slot.site.store(site, boost::memory_order_release);
+			return &slot;
+		}
+	}
+	return &overflowSite;
+}
+
+static void _beginHold(const char* site) {
+	curHolding = true;
+	curHoldStartUs = current_abs_time_us();
+	curHoldSite = site;
+	holderSite = site;
+	holderSinceUs = curHoldStartUs;
+	holderThreadId = (ThreadId) pthread_self();
+}
+
+static void _endHold() {
+	curHolding = false;
+	holderThreadId = 0;
+	AbsUsTime now = current_abs_time_us();
+	uint64_t us = (now > curHoldStartUs) ? (now - curHoldStartUs) : 0;
+	GILThreadSlot* slot = _threadSlot();
+	if(slot) slot->hold.add(us);
+	GILSiteSlot* site = _siteSlot(curHoldSite);
+	counterAdd(site->holdCount, 1);
+	counterAdd(site->holdTotalUs, us);
+	counterMax(site->holdMaxUs, us);
+}
+
+static void _recordWait(const char* site, unsigned long long waitNs) {
+	uint64_t us = waitNs / 1000;
+	GILThreadSlot* slot = _threadSlot();
+	if(slot) slot->wait.add(us);
+	counterAdd(_siteSlot(site)->waitTotalUs, us);
+}
+
+void GILStats_setEnabled(int _enabled) {
+	enabled = _enabled != 0;
+}
+
+int GILStats_isEnabled() {
+	return enabled ? 1 : 0;
+}
+
+void GILStats_reset() {
+	int n = numThreadSlots;
+	for(int i = 0; i < n; ++i) {
+		threadSlots[i].hold.reset();
+		threadSlots[i].wait.reset();
+	}
+	for(int i = 0; i < kMaxSites; ++i)
+		siteSlots[i].reset();
+	overflowSite.reset();
+}
+
+void GILStats_onAcquire(const char* site, unsigned long long waitNs) {
+	_recordWait(site, waitNs);
+	_beginHold(site);
+}
+
+void GILStats_onRelease() {
+	if(curHolding) _endHold();
+}
+
+void GILStats_onSave() {
+	curWasHolding = curHolding;
+	if(curHolding) _endHold();
+}
+
+void GILStats_onRestore(const char* site, unsigned long long waitNs) {
+	_recordWait(site, waitNs);
+	// Only if we track the outer hold. Otherwise we would not see its end
+	// (e.g. we were called from Python code).
+	if(curWasHolding) _beginHold(site);
+	curWasHolding = false;
+}
+
+// Only the threads which are still alive.
+int GILStats_getThreads(GILStats_Thread* out, int maxCount) {
+	int numSlots = numThreadSlots.load();
+	int n = 0;
+	for(int i = 0; i < numSlots && n < maxCount; ++i) {
+		const GILThreadSlot& slot = threadSlots[i];
+		if(!slot.inUse) continue;
+		GILStats_Thread& t = out[n++];
+		memset(&t, 0, sizeof(t));
+		strncpy(t.threadName, slot.name, sizeof(t.threadName) - 1);
+		t.threadId = slot.threadId;
+		slot.hold.get(t.holdCount, t.holdTotalUs, t.holdP50Us, t.holdP99Us, t.holdMaxUs);
+		slot.wait.get(t.waitCount, t.waitTotalUs, t.waitP50Us, t.waitP99Us, t.waitMaxUs);
+	}
+	return n;
+}
+
+static bool _siteHoldGreater(const GILSiteSlot* a, const GILSiteSlot* b) {
+	return counterGet(a->holdTotalUs) > counterGet(b->holdTotalUs);
+}
+
+int GILStats_getTopSites(GILStats_Site* out, int maxCount) {
+	const GILSiteSlot* used[kMaxSites + 1];
+	int numUsed = 0;
+	for(int i = 0; i < kMaxSites; ++i)
+		if(siteSlots[i].site.load(boost::memory_order_acquire) && counterGet(siteSlots[i].holdCount) + counterGet(siteSlots[i].waitTotalUs) > 0)
+			used[numUsed++] = &siteSlots[i];
+	if(counterGet(overflowSite.holdCount) > 0)
+		used[numUsed++] = &overflowSite;
+	int n = std::min(numUsed, maxCount);
+	std::partial_sort(used, used + n, used + numUsed, _siteHoldGreater);
+	for(int i = 0; i < n; ++i) {
+		const GILSiteSlot& slot = *used[i];
+		GILStats_Site& s = out[i];
+		memset(&s, 0, sizeof(s));
+		const char* site = (&slot == &overflowSite) ? "(other)" : slot.site.load(boost::memory_order_relaxed);
+		// The file part is the full path from __FILE__. Only keep the basename.
+		const char* base = strrchr(site, '/');
+		strncpy(s.site, base ? (base + 1) : site, sizeof(s.site) - 1);
+		s.holdCount = counterGet(slot.holdCount);
+		s.holdTotalUs = counterGet(slot.holdTotalUs);
+		s.holdMaxUs = counterGet(slot.holdMaxUs);
+		s.waitTotalUs = counterGet(slot.waitTotalUs);
+	}
+	return n;
+}
+
+void GILStats_print(int maxSites) {
+	if(!enabled) return;
+	printf("GIL stats:\n");
+
+	ThreadId holder = holderThreadId;
+	const char* site = holderSite;
+	AbsUsTime since = holderSinceUs;
+	if(holder && site) {
+		AbsUsTime now = current_abs_time_us();
+		printf("  Current holder: thread %li at %s, for %.1f ms\n", (long) holder, site, (now > since) ? (now - since) / 1000.0 : 0.0);
+	}
+	else
+		printf("  No current holder in the instrumented code\n");
+
+	if(maxSites > kMaxSites) maxSites = kMaxSites;
+	GILStats_Site sites[kMaxSites];
+	int n = GILStats_getTopSites(sites, maxSites);
+	printf("  Top sites by hold time:\n");
+	for(int i = 0; i < n; ++i)
+		printf("    %s: %llu holds, total %.1f ms, max %.1f ms, wait total %.1f ms\n",
+			   sites[i].site, sites[i].holdCount, sites[i].holdTotalUs / 1000.0,
+			   sites[i].holdMaxUs / 1000.0, sites[i].waitTotalUs / 1000.0);
+
+	GILStats_Thread threads[kMaxThreads];
+	n = GILStats_getThreads(threads, kMaxThreads);
+	printf("  Threads:\n");
+	for(int i = 0; i < n; ++i) {
+		const GILStats_Thread& t = threads[i];
+		printf("    %s (%li): hold %llu, p50 %llu us, p99 %llu us, max %llu us; wait %llu, p50 %llu us, p99 %llu us, max %llu us\n",
+			   t.threadName, t.threadId,
+			   t.holdCount, t.holdP50Us, t.holdP99Us, t.holdMaxUs,
+			   t.waitCount, t.waitP50Us, t.waitP99Us, t.waitMaxUs);
+	}
+}
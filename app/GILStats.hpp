@@ -0,0 +1,85 @@
+//
+//  GILStats.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 25.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer__GILStats__
+#define __MusicPlayer__GILStats__
+
+// Opt-in statistics about the Python GIL: per thread, how long it holds the GIL and
+// how long it waits for it, and the top holders by call site.
+// The GUI modules report their GIL acquires/releases via _gui/GILInstrument.hpp.
+// Only those are covered, not the Python interpreter itself.
+// All recording is done with the GIL held, thus it needs no locks.
+// In Python, see debugger.gilStats() and co. Also dumped with the hang reports.
+
+// no C++ mangling for these symbols
+extern "C" {
+	struct GILStats_Thread {
+		char threadName[32];
+		long threadId;
+		unsigned long long holdCount;
+		unsigned long long holdTotalUs;
+		unsigned long long holdP50Us; // the percentiles have ~25% error, see LatencyHistogram.hpp
+		unsigned long long holdP99Us;
+		unsigned long long holdMaxUs;
+		unsigned long long waitCount;
+		unsigned long long waitTotalUs;
+		unsigned long long waitP50Us;
+		unsigned long long waitP99Us;
+		unsigned long long waitMaxUs;
+	};
+
+	struct GILStats_Site {
+		char site[128]; // "file:line"
+		unsigned long long holdCount;
+		unsigned long long holdTotalUs;
+		unsigned long long holdMaxUs;
+		unsigned long long waitTotalUs;
+	};
+
+	// Off by default.
+	__attribute__((visibility("default")))
+	void GILStats_setEnabled(int enabled);
+
+	__attribute__((visibility("default")))
+	int GILStats_isEnabled();
+
+	// Call with the GIL held.
+	__attribute__((visibility("default")))
+	void GILStats_reset();
+
+	// Called by the instrumentation, with the GIL held. site must be a static string.
+	// Acquire/release are for real acquisitions, not for nested PyGILState_Ensure calls.
+	// Save/restore are for PyEval_SaveThread/PyEval_RestoreThread.
+	__attribute__((visibility("default")))
+	void GILStats_onAcquire(const char* site, unsigned long long waitNs);
+
+	__attribute__((visibility("default")))
+	void GILStats_onRelease();
+
+	__attribute__((visibility("default")))
+	void GILStats_onSave();
+
+	__attribute__((visibility("default")))
+	void GILStats_onRestore(const char* site, unsigned long long waitNs);
+
+	// Call these with the GIL held. Return the number of entries.
+	// The slot of a thread is released when the thread exits, thus these are only the live threads.
+	__attribute__((visibility("default")))
+	int GILStats_getThreads(struct GILStats_Thread* out, int maxCount);
+
+	// Sorted by holdTotalUs, descending.
+	__attribute__((visibility("default")))
+	int GILStats_getTopSites(struct GILStats_Site* out, int maxCount);
+
+	// Prints the current holder, the top sites and the threads. Works without the GIL,
+	// e.g. from the hang detector, but the numbers might be slightly inconsistent then.
+	__attribute__((visibility("default")))
+	void GILStats_print(int maxSites);
+}
+
+#endif /* defined(__MusicPlayer__GILStats__) */
@@ -0,0 +1,50 @@
+//
+//  LatencyHistogram.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 25.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer__LatencyHistogram__
+#define __MusicPlayer__LatencyHistogram__
+
+#include <stdint.h>
+
+// Log-scaled histogram buckets for latencies, in microsecs.
+// Values 0..3 have their own bucket, above that we have 4 buckets per power of two,
+// i.e. a bucket upper bound has ~25% error.
+// The last bucket is for everything >= ~38 hours.
+static const int kHistBuckets = 148;
+
+static inline int histBucket(unsigned long long v) {
+	if(v < 4) return (int) v;
+	int e = 63 - __builtin_clzll(v); // floor(log2(v)), >= 2
+	int idx = 4 + (e - 2) * 4 + (int) ((v >> (e - 2)) & 3);
+	return (idx < kHistBuckets) ? idx : (kHistBuckets - 1);
+}
+
+// The largest value which falls into the bucket.
+static inline unsigned long long histBucketUpperBound(int idx) {
+	if(idx < 4) return (unsigned long long) idx;
+	int e = (idx - 4) / 4 + 2;
+	int sub = (idx - 4) % 4;
+	return ((unsigned long long) (5 + sub) << (e - 2)) - 1;
+}
+
+// The upper bound of the bucket with the p-th percentile. maxUs is exact, thus we cap at it.
+static inline unsigned long long histPercentile(const uint32_t* counts, unsigned long long total, double p, unsigned long long maxUs) {
+	unsigned long long rank = (unsigned long long) (p * total);
+	if(rank >= total) rank = total - 1;
+	unsigned long long cum = 0;
+	for(int i = 0; i < kHistBuckets; ++i) {
+		cum += counts[i];
+		if(cum > rank) {
+			unsigned long long v = histBucketUpperBound(i);
+			return (maxUs && v > maxUs) ? maxUs : v;
+		}
+	}
+	return maxUs;
+}
+
+#endif /* defined(__MusicPlayer__LatencyHistogram__) */
@@ -0,0 +1,459 @@
+//
+//  LogWriter.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 22.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/atomic.hpp>
+
+#include "LogWriter.hpp"
+#include "sysutils.hpp"
+#include "pthread_mutex.hpp"
+
+
+static const size_t kRingSize = 64 * 1024; // power of two
+static const size_t kMaxRecordLen = kRingSize / 4; // longer writes are split
+static const size_t kStdioBufferSize = 4096;
+static const long long kMaxLogFileSize = 10 * 1024 * 1024;
+static const int kNumRotatedFiles = 3;
+static const AbsUsTime kRepeatWindowUs = 1000 * 1000;
+static const AbsUsTime kFullRingWaitUs = 100 * 1000; // then we drop the message
+static const AbsUsTime kCrashFlushWaitUs = 200 * 1000; // for the flusher thread to finish its write
+static const int kFlushIntervalMs = 100;
+
+struct RecordHeader {
+	uint64_t seq; // global order, the flusher sorts by it
+	uint32_t len;
+};
+
+// One per thread which ever wrote to the log.
+// Rings are never freed. When a thread exits, its ring is put back for reuse.
+// Single producer (the owner thread), single consumer (whoever holds drainLock).
+struct LogRing {
+	boost::atomic<size_t> head; // bytes written. only the owner writes it
+	boost::atomic<size_t> tail; // bytes consumed
+	boost::atomic<bool> inUse;
+	LogRing* next;
+	// For the repeated message rate limit. lastHash is only accessed by the owner thread.
+	// The drainer reports pending suppressed repeats when the owner stays quiet, see takeRepeatNote().
+	uint64_t lastHash;
+	boost::atomic<AbsUsTime> lastEmitTime;
+	boost::atomic<unsigned long> numSuppressed;
+	char data[kRingSize];
+
+	LogRing() : head(0), tail(0), inUse(true), next(NULL), lastHash(0), lastEmitTime(0), numSuppressed(0) {}
+
+	void copyIn(size_t pos, const void* src, size_t len) {
+		size_t offset = pos & (kRingSize - 1);
+		size_t first = std::min(len, kRingSize - offset);
+		memcpy(data + offset, src, first);
+		memcpy(data, (const char*) src + first, len - first);
+	}
+
+	void copyOut(size_t pos, void* dst, size_t len) const {
+		size_t offset = pos & (kRingSize - 1);
+		size_t first = std::min(len, kRingSize - offset);
+		memcpy(dst, data + offset, first);
+		memcpy((char*) dst + first, data, len - first);
+	}
+};
+
+static std::string logPath;
+static boost::atomic<int> logFd(-1);
+static long long logFileSize = 0; // only the flusher thread
+static boost::atomic<bool> asyncMode(false);
+static boost::atomic<LogRing*> rings(NULL);
+static boost::atomic<uint64_t> seqCounter(0);
+static boost::atomic<unsigned long> numDropped(0);
+static boost::atomic<int> drainLock(0);
+static FILE* logFile = NULL;
+
+static Mutex flusherMutex;
+static pthread_cond_t flusherCond = PTHREAD_COND_INITIALIZER;
+static pthread_t flusherThread;
+static bool haveFlusherThread = false;
+static bool flusherStop = false; // protected by flusherMutex
+
+static __thread LogRing* threadRing;
+static pthread_key_t threadRingKey;
+static pthread_once_t threadRingKeyOnce = PTHREAD_ONCE_INIT;
+
+
+static void threadRingRelease(void* p) {
+	LogRing* ring = (LogRing*) p;
+	threadRing = NULL; // if we write again in some later destructor, we get a new one
+	ring->inUse = false;
+}
+
+static void threadRingKeyInit() {
+	pthread_key_create(&threadRingKey, threadRingRelease);
+}
+
+static LogRing* acquireThreadRing() {
+	pthread_once(&threadRingKeyOnce, threadRingKeyInit);
+
+	LogRing* ring = NULL;
+	for(LogRing* r = rings.load(); r; r = r->next) {
+		bool expected = false;
+		if(r->inUse.compare_exchange_strong(expected, true)) {
+			ring = r;
+			break;
+		}
+	}
+	if(!ring) {
+		ring = new LogRing();
+		LogRing* head = rings.load();
+		do {
+			ring->next = head;
+		} while(!rings.compare_exchange_weak(head, ring));
+	}
+	// Keep numSuppressed, it still belongs to the last message in this ring.
+	ring->lastHash = 0;
+
+	pthread_setspecific(threadRingKey, ring);
+	threadRing = ring;
+	return ring;
+}
+
+static void writeAll(int fd, const char* p, size_t len) {
+	while(len > 0) {
+		ssize_t ret = write(fd, p, len);
+		if(ret < 0 && errno == EINTR) continue;
+		if(ret <= 0) return;
+		p += ret;
+		len -= (size_t) ret;
+	}
+}
+
+static void wakeFlusher() {
+	// Without the mutex. We might miss the wakeup but then the flusher wakes up by its timeout.
+	pthread_cond_signal(&flusherCond);
+}
+
+static void ringPush(LogRing* ring, const char* buf, size_t len) {
+	RecordHeader header;
+	header.len = (uint32_t) len;
+	size_t need = sizeof(header) + len;
+	size_t head = ring->head.load(boost::memory_order_relaxed);
+	if(kRingSize - (head - ring->tail.load(boost::memory_order_acquire)) < need) {
+		wakeFlusher();
+		AbsUsTime start = current_abs_time_us();
+		while(kRingSize - (head - ring->tail.load(boost::memory_order_acquire)) < need) {
+			if(!asyncMode || current_abs_time_us() - start > kFullRingWaitUs) {
+				numDropped.fetch_add(1);
+				return;
+			}
+			struct timespec t = {0, 1000 * 1000};
+			nanosleep(&t, NULL);
+		}
+	}
+	header.seq = seqCounter.fetch_add(1, boost::memory_order_relaxed);
+	ring->copyIn(head, &header, sizeof(header));
+	ring->copyIn(head + sizeof(header), buf, len);
+	ring->head.store(head + need, boost::memory_order_release);
+	if(head + need - ring->tail.load(boost::memory_order_relaxed) > kRingSize / 2)
+		wakeFlusher();
+}
+
+static uint64_t hashMessage(const char* buf, size_t len) {
+	uint64_t h = 14695981039346656037ULL; // FNV-1a
+	for(size_t i = 0; i < len; ++i) {
+		h ^= (unsigned char) buf[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// Async-signal-safe. Returns the length.
+static size_t formatRepeatNote(char* buf, size_t size, unsigned long count) {
+	static const char prefix[] = "(last message repeated ";
+	static const char suffix[] = " times)\n";
+	char num[24];
+	int numLen = 0;
+	do { num[numLen++] = (char) ('0' + count % 10); count /= 10; } while(count);
+	size_t n = 0;
+	for(const char* p = prefix; *p && n + 1 < size; ++p) buf[n++] = *p;
+	while(numLen > 0 && n + 1 < size) buf[n++] = num[--numLen];
+	for(const char* p = suffix; *p && n + 1 < size; ++p) buf[n++] = *p;
+	buf[n] = 0;
+	return n;
+}
+
+// The drainer. Holds drainLock.
+// If the owner thread did not log anything else after its suppressed repeats,
+// nobody would ever report them. Thus we do it once the repeat window is over,
+// or always if force (e.g. on crash or shutdown).
+static size_t takeRepeatNote(LogRing* r, char* buf, size_t size, bool force) {
+	if(r->numSuppressed.load(boost::memory_order_relaxed) == 0) return 0;
+	if(!force && current_abs_time_us() - r->lastEmitTime.load(boost::memory_order_relaxed) < kRepeatWindowUs)
+		return 0;
+	unsigned long suppressed = r->numSuppressed.exchange(0);
+	if(suppressed == 0) return 0;
+	return formatRepeatNote(buf, size, suppressed);
+}
+
+static void logWrite(const char* buf, size_t len) {
+	if(len == 0) return;
+	if(!asyncMode) {
+		int fd = logFd;
+		if(fd >= 0) writeAll(fd, buf, len);
+		return;
+	}
+
+	LogRing* ring = threadRing;
+	if(!ring) ring = acquireThreadRing();
+
+	// Rate limit for repeated messages. Only for full lines, e.g. not for a single "\n".
+	if(len > 1 && buf[len - 1] == '\n') {
+		uint64_t h = hashMessage(buf, len);
+		AbsUsTime now = current_abs_time_us();
+		if(h == ring->lastHash && now - ring->lastEmitTime < kRepeatWindowUs) {
+			ring->numSuppressed++;
+			return;
+		}
+		if(unsigned long suppressed = ring->numSuppressed.exchange(0)) {
+			char note[64];
+			size_t n = formatRepeatNote(note, sizeof(note), suppressed);
+			ringPush(ring, note, n);
+		}
+		ring->lastHash = h;
+		ring->lastEmitTime = now;
+	}
+
+	while(len > 0) {
+		size_t n = std::min(len, kMaxRecordLen);
+		ringPush(ring, buf, n);
+		buf += n;
+		len -= n;
+	}
+}
+
+#ifdef __APPLE__
+static int cookieWrite(void* cookie, const char* buf, int size) {
+	if(size > 0) logWrite(buf, (size_t) size);
+	return size;
+}
+#else
+static ssize_t cookieWrite(void* cookie, const char* buf, size_t size) {
+	logWrite(buf, size);
+	return (ssize_t) size;
+}
+#endif
+
+static bool tryLockDrain() {
+	int expected = 0;
+	return drainLock.compare_exchange_strong(expected, 1, boost::memory_order_acquire);
+}
+
+static void unlockDrain() {
+	drainLock.store(0, boost::memory_order_release);
+}
+
+// The flusher. Holds drainLock.
+static void drainInto(std::vector<std::pair<uint64_t, std::string> >& entries) {
+	for(LogRing* r = rings.load(); r; r = r->next) {
+		size_t tail = r->tail.load(boost::memory_order_relaxed);
+		size_t head = r->head.load(boost::memory_order_acquire);
+		bool haveRecords = tail < head;
+		while(tail < head) {
+			RecordHeader header;
+			r->copyOut(tail, &header, sizeof(header));
+			std::string text(header.len, 0);
+			if(header.len) r->copyOut(tail + sizeof(header), &text[0], header.len);
+			entries.push_back(std::make_pair(header.seq, text));
+			tail += sizeof(header) + header.len;
+		}
+		r->tail.store(tail, boost::memory_order_release);
+		char note[64];
+		if(size_t n = takeRepeatNote(r, note, sizeof(note), false)) {
+			// Directly after the last message of this ring. The sort is stable.
+			uint64_t seq = haveRecords ? entries.back().first : seqCounter.fetch_add(1, boost::memory_order_relaxed);
+			entries.push_back(std::make_pair(seq, std::string(note, n)));
+		}
+	}
+}
+
+static bool sortBySeq(const std::pair<uint64_t, std::string>& a, const std::pair<uint64_t, std::string>& b) {
+	return a.first < b.first;
+}
+
+// The flusher. Holds drainLock.
+static void rotateIfNeeded() {
+	if(logFileSize < kMaxLogFileSize) return;
+	for(int i = kNumRotatedFiles; i > 0; --i) {
+		std::string from = (i > 1) ? (logPath + "." + std::to_string(i - 1)) : logPath;
+		std::string to = logPath + "." + std::to_string(i);
+		rename(from.c_str(), to.c_str());
+	}
+	int fd = open(logPath.c_str(), O_WRONLY|O_APPEND|O_CREAT, 0644);
+	if(fd < 0) return; // just continue writing into the old one
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	int oldFd = logFd.exchange(fd);
+	if(oldFd >= 0) close(oldFd);
+	logFileSize = 0;
+}
+
+static void flushAsync() {
+	std::vector<std::pair<uint64_t, std::string> > entries;
+	while(!tryLockDrain()) {
+		struct timespec t = {0, 100 * 1000};
+		nanosleep(&t, NULL);
+	}
+	drainInto(entries);
+	unsigned long dropped = numDropped.exchange(0);
+	std::stable_sort(entries.begin(), entries.end(), sortBySeq);
+	std::string out;
+	for(size_t i = 0; i < entries.size(); ++i)
+		out += entries[i].second;
+	if(dropped)
+		out += "LogWriter: dropped " + std::to_string(dropped) + " messages, the buffer was full\n";
+	if(!out.empty()) {
+		writeAll(logFd, out.data(), out.size());
+		logFileSize += (long long) out.size();
+		rotateIfNeeded();
+	}
+	unlockDrain();
+}
+
+static void* flusherThreadProc(void*) {
+	while(true) {
+		flushAsync();
+		Mutex::ScopedLock lock(flusherMutex);
+		if(flusherStop) break;
+		condWaitRelativeMs(&flusherCond, &flusherMutex.mutex, kFlushIntervalMs);
+	}
+	return NULL;
+}
+
+static void atForkChild() {
+	// No flusher thread in the child. Whatever is buffered belongs to the parent.
+	asyncMode = false;
+	drainLock = 0;
+	haveFlusherThread = false;
+}
+
+bool LogWriter_init(const std::string& filename) {
+	int fd = open(filename.c_str(), O_WRONLY|O_APPEND|O_CREAT, 0644);
+	if(fd < 0) return false;
+
+#ifdef __APPLE__
+	FILE* f = funopen(NULL, NULL, cookieWrite, NULL, NULL);
+#else
+	cookie_io_functions_t funcs;
+	memset(&funcs, 0, sizeof(funcs));
+	funcs.write = cookieWrite;
+	FILE* f = fopencookie(NULL, "w", funcs);
+#endif
+	if(!f) {
+		close(fd);
+		return false;
+	}
+	setvbuf(f, NULL, _IOLBF, kStdioBufferSize);
+
+	struct stat st;
+	logFileSize = (fstat(fd, &st) == 0) ? (long long) st.st_size : 0;
+	logPath = filename;
+	fflush(stdout);
+	fflush(stderr);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	logFd = fd;
+	logFile = f;
+	stdout = f;
+	stderr = f; // I don't like two separate buffers. It just messes up the output.
+
+	pthread_atfork(NULL, NULL, atForkChild);
+	asyncMode = true;
+	if(pthread_create(&flusherThread, NULL, flusherThreadProc, NULL) != 0) {
+		asyncMode = false; // just write directly
+		printf("LogWriter_init: failed to create flusher thread\n");
+	}
+	else
+		haveFlusherThread = true;
+	atexit(LogWriter_shutdown);
+	return true;
+}
+
+// We might be in a signal handler. No malloc, no stdio, no mutex here.
+static void drainSync() {
+	// The flusher thread might be in the middle of a write. Give it a moment.
+	// If we crashed in the flusher thread itself, it cannot continue anymore,
+	// thus we can take over even if it holds the lock.
+	bool haveLock = false;
+	bool isFlusher = haveFlusherThread && pthread_equal(pthread_self(), flusherThread);
+	AbsUsTime start = current_abs_time_us();
+	while(!(haveLock = tryLockDrain()) && !isFlusher) {
+		if(current_abs_time_us() - start > kCrashFlushWaitUs) break;
+		struct timespec t = {0, 100 * 1000};
+		nanosleep(&t, NULL);
+	}
+
+	int fd = logFd;
+	if(!haveLock && !isFlusher) {
+		// Never consume the rings concurrently with the flusher. It will write them later.
+		static const char marker[] = "LogWriter: log tail unavailable, the flusher is busy\n";
+		writeAll(fd, marker, sizeof(marker) - 1);
+		return;
+	}
+
+	// No merging by seq here, just ring by ring.
+	for(LogRing* r = rings.load(); r; r = r->next) {
+		size_t tail = r->tail.load(boost::memory_order_relaxed);
+		size_t head = r->head.load(boost::memory_order_acquire);
+		while(tail < head) {
+			RecordHeader header;
+			r->copyOut(tail, &header, sizeof(header));
+			size_t pos = tail + sizeof(header);
+			size_t offset = pos & (kRingSize - 1);
+			size_t first = std::min((size_t) header.len, kRingSize - offset);
+			writeAll(fd, r->data + offset, first);
+			writeAll(fd, r->data, header.len - first);
+			tail = pos + header.len;
+		}
+		r->tail.store(tail, boost::memory_order_release);
+		char note[64];
+		if(size_t n = takeRepeatNote(r, note, sizeof(note), true))
+			writeAll(fd, note, n);
+	}
+
+	if(haveLock) unlockDrain();
+}
+
+void LogWriter_flushSync(bool fflushStdio) {
+	if(fflushStdio) fflush(stdout);
+	if(asyncMode) drainSync();
+}
+
+void LogWriter_shutdown() {
+	if(!logFile || !asyncMode) return;
+	fflush(stdout);
+	if(haveFlusherThread) {
+		{
+			Mutex::ScopedLock lock(flusherMutex);
+			flusherStop = true;
+			pthread_cond_broadcast(&flusherCond);
+		}
+		pthread_join(flusherThread, NULL);
+		haveFlusherThread = false;
+	}
+	drainSync();
+	// From now on, all writes go directly to the file. Flush what came in meanwhile.
+	asyncMode = false;
+	drainSync();
+}
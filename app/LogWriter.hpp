@@ -0,0 +1,36 @@
+//
+//  LogWriter.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 22.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer__LogWriter__
+#define __MusicPlayer__LogWriter__
+
+#include <string>
+
+// Async log backend for stdout/stderr.
+// stdout and stderr become a FILE whose writes go into a lock-free per-thread ring buffer.
+// A background thread drains the buffers and writes to the log file.
+// Thus a printf does not do a write syscall on the calling thread.
+//
+// - Identical messages which a thread repeats within a second are dropped and counted.
+// - The log file is rotated by size (musicplayer.log -> musicplayer.log.1 -> ...).
+// - fd 1 and 2 also point to the log file, for code which writes there directly
+//   (e.g. backtrace_symbols_fd, the Python faulthandler). Call LogWriter_flushSync()
+//   before such writes to keep the order.
+
+// Opens the log file and redirects stdout/stderr. Returns false on error, nothing is changed then.
+bool LogWriter_init(const std::string& filename);
+
+// Writes all buffered messages to the file, on the calling thread.
+// Can be called from a signal handler, e.g. on crash. Does fflush(stdout) only if fflushStdio.
+void LogWriter_flushSync(bool fflushStdio = false);
+
+// Flushes and stops the background thread. Later writes go directly to the file.
+// Called automatically at exit.
+void LogWriter_shutdown();
+
+#endif /* defined(__MusicPlayer__LogWriter__) */
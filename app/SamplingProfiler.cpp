@@ -0,0 +1,512 @@
+//
+//  SamplingProfiler.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 19.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+// Import Python first, see _gui/PythonInterface.cpp.
+#include <Python.h>
+#include <frameobject.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/atomic.hpp>
+
+#include "SamplingProfiler.hpp"
+#include "sysutils.hpp"
+#include "pthread_mutex.hpp"
+
+
+static const int kMaxThreads = 32;
+static const int kMaxStackDepth = 128;
+static const uint32_t kMaxNodes = 1 << 16;
+static const uint32_t kHashSize = 1 << 17; // power of two
+static const int kDefaultSamplesPerSec = 97; // not a divisor of common timer rates, to avoid lockstep
+
+// Special values for ProfilerNode::line. Native frames have kLineNative.
+static const int32_t kLineNative = -1;
+static const int32_t kLineThreadRoot = -2; // addr is the thread serial
+// Python frames have line >= 0 and addr is the index into pythonFuncNames.
+
+// A node in the call tree. The key is (parent, addr, line).
+struct ProfilerNode {
+	uint32_t parent;
+	uint32_t hashNext; // 0 = end
+	uintptr_t addr;
+	int32_t line;
+	uint32_t selfCount; // samples which ended here
+};
+
+struct ProfiledThread {
+	bool used;
+	ThreadId threadId;
+	uint32_t serial; // index into threadNames
+	PyThreadState* pythonThreadState; // at registration. NULL if the thread had none
+};
+
+// A Python frame as captured in the signal handler.
+// We copy the strings there because the code objects might be gone when we look at it.
+struct PythonFrameSample {
+	char file[96]; // the tail of co_filename if it is too long
+	char func[64];
+	int line;
+};
+
+static void copyPyStringTail(char* dst, size_t dstSize, PyObject* s) {
+	dst[0] = 0;
+	if(!s || !PyString_Check(s)) return;
+	const char* str = PyString_AS_STRING(s);
+	size_t len = (size_t) PyString_GET_SIZE(s);
+	if(len >= dstSize) {
+		str += len - (dstSize - 1);
+		len = dstSize - 1;
+	}
+	memcpy(dst, str, len);
+	dst[len] = 0;
+}
+
+// Only call this in the signal handler of the thread (or in the thread itself).
+// tstate is the one which the thread had at registration. It stays valid until the thread
+// unregisters (see SamplingProfiler_registerCurThread), and the sampler holds the mutex,
+// so that cannot happen meanwhile. We cannot walk the interpreter thread list here because
+// that would need the head lock. The frame chain itself is safe because the thread is
+// stopped and the frames are kept alive by their f_back references.
+static int capturePythonFrames(PyThreadState* tstate, PythonFrameSample* frames, int maxFrames) {
+	if(!tstate) return 0;
+	int n = 0;
+	for(PyFrameObject* f = tstate->frame; f && n < maxFrames; f = f->f_back) {
+		PythonFrameSample& s = frames[n++];
+		copyPyStringTail(s.file, sizeof(s.file), f->f_code ? f->f_code->co_filename : NULL);
+		copyPyStringTail(s.func, sizeof(s.func), f->f_code ? f->f_code->co_name : NULL);
+		s.line = PyFrame_GetLineNumber(f);
+		if(s.line < 0) s.line = 0;
+	}
+	return n;
+}
+
+// Like GetCallstackFunctor but also captures the Python frames in the same snapshot.
+struct MixedCallstackFunctor {
+	GetCallstackFunctor native;
+	PyThreadState* pythonThreadState;
+	PythonFrameSample* pythonFrames;
+	int pythonFramesSize;
+	int pythonFramesCount;
+
+	MixedCallstackFunctor() : pythonThreadState(NULL), pythonFrames(NULL), pythonFramesSize(0), pythonFramesCount(0) {}
+
+	void operator()(int signr, void* info, void* secret) {
+		native(signr, info, secret);
+		pythonFramesCount = capturePythonFrames(pythonThreadState, pythonFrames, pythonFramesSize);
+	}
+};
+
+void* samplerThread_proc(void*);
+
+struct SamplingProfiler {
+	Mutex startStopMutex; // serializes start() and stop()
+	Mutex mutex; // protects everything here, except `running`
+	pthread_cond_t cond;
+	pthread_t samplerThread;
+	bool haveSamplerThread;
+	boost::atomic<bool> running;
+	boost::atomic<bool> pythonStacks;
+	int samplesPerSec;
+
+	ProfiledThread threads[kMaxThreads];
+	// Threads with the same name share the serial, i.e. also the root in the call tree.
+	// Thus threadNames only grows with the number of distinct names, not with the number
+	// of threads which come and go. _reset() drops the names of unregistered threads.
+	std::vector<std::string> threadNames; // by serial. index 0 unused
+	std::map<std::string, uint32_t> threadSerials; // name -> serial
+
+	// The arena. Node 0 is the root.
+	ProfilerNode nodes[kMaxNodes];
+	uint32_t numNodes;
+	uint32_t hashTable[kHashSize]; // 0 = empty
+	unsigned long long numSamples;
+	unsigned long long numDroppedSamples; // because the arena was full
+
+	// For the Python stacks mode.
+	std::map<std::string, uint32_t> pythonFuncIds; // "file:function" -> index into pythonFuncNames
+	std::vector<std::string> pythonFuncNames;
+	std::map<uintptr_t, bool> isEvalFrameCache; // pc -> is in PyEval_EvalFrameEx
+	PythonFrameSample pythonStack[kMaxStackDepth];
+
+	SamplingProfiler() : haveSamplerThread(false), running(false), pythonStacks(false), samplesPerSec(kDefaultSamplesPerSec) {
+		cond = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
+		int ret = pthread_cond_init(&cond, NULL);
+		assert(ret == 0);
+		memset(threads, 0, sizeof(threads));
+		_reset();
+	}
+
+	~SamplingProfiler() {
+		stop();
+		pthread_cond_destroy(&cond);
+	}
+
+	void _reset() {
+		memset(&nodes[0], 0, sizeof(ProfilerNode));
+		numNodes = 1;
+		memset(hashTable, 0, sizeof(hashTable));
+		numSamples = 0;
+		numDroppedSamples = 0;
+		pythonFuncIds.clear();
+		pythonFuncNames.clear();
+
+		// No node refers to a serial anymore, thus we can renumber them.
+		std::vector<std::string> oldNames;
+		oldNames.swap(threadNames);
+		threadSerials.clear();
+		threadNames.push_back("");
+		for(ProfiledThread& t : threads)
+			if(t.used) t.serial = _threadSerial(oldNames[t.serial]);
+	}
+
+	uint32_t _threadSerial(const std::string& threadName) {
+		auto it = threadSerials.find(threadName);
+		if(it != threadSerials.end()) return it->second;
+		uint32_t serial = (uint32_t) threadNames.size();
+		threadNames.push_back(threadName);
+		threadSerials[threadName] = serial;
+		return serial;
+	}
+
+	static uint32_t _hash(uint32_t parent, uintptr_t addr, int32_t line) {
+		uint64_t h = (uint64_t) addr * 0x9E3779B97F4A7C15ULL;
+		h ^= (uint64_t) parent * 0xC2B2AE3D27D4EB4FULL;
+		h ^= (uint64_t) (uint32_t) line * 0x165667B19E3779F9ULL;
+		return (uint32_t) (h >> 32) & (kHashSize - 1);
+	}
+
+	// Returns 0 if the arena is full.
+	uint32_t _child(uint32_t parent, uintptr_t addr, int32_t line) {
+		uint32_t& bucket = hashTable[_hash(parent, addr, line)];
+		for(uint32_t i = bucket; i; i = nodes[i].hashNext) {
+			ProfilerNode& n = nodes[i];
+			if(n.parent == parent && n.addr == addr && n.line == line)
+				return i;
+		}
+		if(numNodes >= kMaxNodes) return 0;
+		uint32_t i = numNodes++;
+		ProfilerNode& n = nodes[i];
+		n.parent = parent;
+		n.addr = addr;
+		n.line = line;
+		n.selfCount = 0;
+		n.hashNext = bucket;
+		bucket = i;
+		return i;
+	}
+
+	// stack is like from backtrace(), i.e. the innermost frame first.
+	void _addStack(uint32_t threadSerial, void** stack, int n) {
+		uint32_t node = _child(0, threadSerial, kLineThreadRoot);
+		for(int i = n - 1; i >= 0 && node; --i)
+			node = _child(node, (uintptr_t) stack[i], kLineNative);
+		if(!node) {
+			numDroppedSamples++;
+			return;
+		}
+		nodes[node].selfCount++;
+		numSamples++;
+	}
+
+	uint32_t _pythonFuncId(const PythonFrameSample& f) {
+		std::string name = std::string(f.file) + ":" + f.func;
+		auto it = pythonFuncIds.find(name);
+		if(it != pythonFuncIds.end()) return it->second;
+		uint32_t id = (uint32_t) pythonFuncNames.size();
+		pythonFuncNames.push_back(name);
+		pythonFuncIds[name] = id;
+		return id;
+	}
+
+	bool _isEvalFrame(uintptr_t pc) {
+		static void* evalFrameFunc = dlsym(RTLD_DEFAULT, "PyEval_EvalFrameEx");
+		if(!evalFrameFunc) return false;
+		auto it = isEvalFrameCache.find(pc);
+		if(it != isEvalFrameCache.end()) return it->second;
+		Dl_info info;
+		memset(&info, 0, sizeof(info));
+		// pc is a return address, thus pc - 1 is inside the calling function.
+		bool res = dladdr((void*) (pc - 1), &info) && info.dli_saddr == evalFrameFunc;
+		isEvalFrameCache[pc] = res;
+		return res;
+	}
+
+	// Like _addStack but replaces each PyEval_EvalFrameEx frame by the Python frame it executes.
+	// Both stacks are innermost first, thus we match them from the innermost frame.
+	// If the native stack was cut off, the outer Python frames which are left over
+	// go directly below the thread root.
+	void _addMixedStack(uint32_t threadSerial, void** stack, int n, PythonFrameSample* pyStack, int pyN) {
+		struct Frame { uintptr_t addr; int32_t line; };
+		Frame merged[kMaxStackDepth * 2];
+		int m = 0, j = 0;
+		for(int i = 0; i < n; ++i) {
+			uintptr_t pc = (uintptr_t) stack[i];
+			if(j < pyN && _isEvalFrame(pc)) {
+				merged[m].addr = _pythonFuncId(pyStack[j]);
+				merged[m].line = pyStack[j].line;
+				++j;
+			}
+			else {
+				merged[m].addr = pc;
+				merged[m].line = kLineNative;
+			}
+			++m;
+		}
+		for(; j < pyN; ++j, ++m) {
+			merged[m].addr = _pythonFuncId(pyStack[j]);
+			merged[m].line = pyStack[j].line;
+		}
+
+		uint32_t node = _child(0, threadSerial, kLineThreadRoot);
+		for(int i = m - 1; i >= 0 && node; --i)
+			node = _child(node, merged[i].addr, merged[i].line);
+		if(!node) {
+			numDroppedSamples++;
+			return;
+		}
+		nodes[node].selfCount++;
+		numSamples++;
+	}
+
+	void _sampleThread(const ProfiledThread& t, void** stack) {
+		if(!pythonStacks) {
+			int n = GetCallstack(t.threadId, stack, kMaxStackDepth);
+			if(n > 0) _addStack(t.serial, stack, n);
+			return;
+		}
+		MixedCallstackFunctor func;
+		func.native.threadCallstackBuffer = stack;
+		func.native.threadCallstackBufferSize = kMaxStackDepth;
+		func.pythonThreadState = t.pythonThreadState;
+		func.pythonFrames = pythonStack;
+		func.pythonFramesSize = kMaxStackDepth;
+		// By reference, otherwise the boost::function would fill a copy.
+		ExecInThread(t.threadId, boost::ref(func));
+		if(func.native.threadCallstackCount > 0 || func.pythonFramesCount > 0)
+			_addMixedStack(t.serial, stack, func.native.threadCallstackCount, pythonStack, func.pythonFramesCount);
+	}
+
+	void registerCurThread(const std::string& threadName) {
+		ThreadId threadId = (ThreadId) pthread_self();
+		// Works without the GIL. NULL if there is no Python thread state for this thread.
+		PyThreadState* tstate = Py_IsInitialized() ? PyGILState_GetThisThreadState() : NULL;
+		Mutex::ScopedLock lock(mutex);
+		ProfiledThread* slot = NULL;
+		for(ProfiledThread& t : threads)
+			if(t.used && t.threadId == threadId) { slot = &t; break; }
+		if(!slot)
+			for(ProfiledThread& t : threads)
+				if(!t.used) { slot = &t; break; }
+		if(!slot) {
+			printf("SamplingProfiler_registerCurThread: too many threads, ignoring %s\n", threadName.c_str());
+			return;
+		}
+		slot->used = true;
+		slot->threadId = threadId;
+		slot->serial = _threadSerial(threadName);
+		slot->pythonThreadState = tstate;
+	}
+
+	// A registered thread must unregister before it exits.
+	void unregisterCurThread() {
+		ThreadId threadId = (ThreadId) pthread_self();
+		// We hold the mutex while sampling, thus the thread is not in use by the sampler after this.
+		Mutex::ScopedLock lock(mutex);
+		for(ProfiledThread& t : threads)
+			if(t.used && t.threadId == threadId) {
+				t.used = false;
+				t.pythonThreadState = NULL;
+			}
+	}
+
+	void start(int _samplesPerSec) {
+		Mutex::ScopedLock startStopLock(startStopMutex);
+		Mutex::ScopedLock lock(mutex);
+		samplesPerSec = (_samplesPerSec > 0) ? _samplesPerSec : kDefaultSamplesPerSec;
+		if(haveSamplerThread) return;
+		running = true;
+		int ret = pthread_create(&samplerThread, NULL, &samplerThread_proc, NULL);
+		if(ret != 0) {
+			printf("SamplingProfiler_start: failed to create thread\n");
+			running = false;
+			return;
+		}
+		haveSamplerThread = true;
+	}
+
+	void stop() {
+		Mutex::ScopedLock startStopLock(startStopMutex);
+		pthread_t t;
+		{
+			Mutex::ScopedLock lock(mutex);
+			if(!haveSamplerThread) return;
+			running = false;
+			pthread_cond_broadcast(&cond);
+			t = samplerThread;
+			haveSamplerThread = false;
+		}
+		pthread_join(t, NULL);
+	}
+
+	void reset() {
+		Mutex::ScopedLock lock(mutex);
+		_reset();
+	}
+
+	void _samplerThread() {
+		// backtrace() might allocate when it is called the first time (it loads libgcc).
+		// Don't let that happen in the signal handler of the sampled thread.
+		{
+			void* dummy[2];
+			backtrace(dummy, 2);
+		}
+
+		void* stack[kMaxStackDepth];
+		Mutex::ScopedLock lock(mutex);
+		while(running) {
+			for(ProfiledThread& t : threads) {
+				if(!t.used) continue;
+				_sampleThread(t, stack);
+			}
+			long periodMs = 1000 / samplesPerSec;
+			if(periodMs < 1) periodMs = 1;
+			condWaitRelativeMs(&cond, &mutex.mutex, periodMs);
+		}
+	}
+
+	static std::string _symbolName(uintptr_t addr) {
+		Dl_info info;
+		memset(&info, 0, sizeof(info));
+		char buf[64];
+		if(dladdr((void*) addr, &info) && info.dli_sname) {
+			int status = -1;
+			char* demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+			std::string res = (status == 0 && demangled) ? demangled : info.dli_sname;
+			free(demangled);
+			return res;
+		}
+		if(info.dli_fname) {
+			const char* base = strrchr(info.dli_fname, '/');
+			base = base ? (base + 1) : info.dli_fname;
+			snprintf(buf, sizeof(buf), "+0x%lx", (unsigned long) (addr - (uintptr_t) info.dli_fbase));
+			return std::string(base) + buf;
+		}
+		snprintf(buf, sizeof(buf), "0x%lx", (unsigned long) addr);
+		return buf;
+	}
+
+	std::string _frameName(const ProfilerNode& n, std::map<uintptr_t, std::string>& symbolCache) {
+		std::string name;
+		if(n.line == kLineThreadRoot)
+			name = (n.addr < threadNames.size()) ? threadNames[n.addr] : "?";
+		else if(n.line >= 0) {
+			name = (n.addr < pythonFuncNames.size()) ? pythonFuncNames[n.addr] : "?";
+			char buf[16];
+			snprintf(buf, sizeof(buf), ":%i", (int) n.line);
+			name += buf;
+		}
+		else {
+			auto it = symbolCache.find(n.addr);
+			if(it == symbolCache.end())
+				it = symbolCache.insert(std::make_pair(n.addr, _symbolName(n.addr))).first;
+			name = it->second;
+		}
+		// ';' is the frame separator and the line ends with " count".
+		for(char& c : name)
+			if(c == ';' || c == '\n') c = '_';
+		return name;
+	}
+
+	std::string dumpFolded() {
+		Mutex::ScopedLock lock(mutex);
+		std::map<uintptr_t, std::string> symbolCache;
+		// Different PCs in the same function give the same line. Merge them.
+		std::map<std::string, unsigned long long> folded;
+		std::vector<uint32_t> path;
+		for(uint32_t i = 1; i < numNodes; ++i) {
+			if(!nodes[i].selfCount) continue;
+			path.clear();
+			for(uint32_t j = i; j; j = nodes[j].parent)
+				path.push_back(j);
+			std::string line;
+			for(size_t k = path.size(); k > 0; --k) {
+				line += _frameName(nodes[path[k - 1]], symbolCache);
+				if(k > 1) line += ";";
+			}
+			folded[line] += nodes[i].selfCount;
+		}
+		if(numDroppedSamples)
+			folded["[dropped, arena full]"] += numDroppedSamples;
+
+		std::string out;
+		for(auto& it : folded) {
+			char buf[32];
+			snprintf(buf, sizeof(buf), " %llu\n", it.second);
+			out += it.first;
+			out += buf;
+		}
+		return out;
+	}
+};
+
+static SamplingProfiler profiler;
+
+
+void* samplerThread_proc(void*) {
+	profiler._samplerThread();
+	return NULL;
+}
+
+
+void SamplingProfiler_registerCurThread(const char* threadName) {
+	profiler.registerCurThread(threadName ? threadName : "");
+}
+
+void SamplingProfiler_unregisterCurThread() {
+	profiler.unregisterCurThread();
+}
+
+void SamplingProfiler_start(int samplesPerSec) {
+	profiler.start(samplesPerSec);
+}
+
+void SamplingProfiler_stop() {
+	profiler.stop();
+}
+
+void SamplingProfiler_setPythonStacks(int enable) {
+	profiler.pythonStacks = enable ? true : false;
+}
+
+int SamplingProfiler_isRunning() {
+	return profiler.running ? 1 : 0;
+}
+
+void SamplingProfiler_reset() {
+	profiler.reset();
+}
+
+size_t SamplingProfiler_dumpFolded(char* buf, size_t bufSize) {
+	std::string s = profiler.dumpFolded();
+	if(buf && bufSize > 0) {
+		size_t n = (s.size() < bufSize - 1) ? s.size() : (bufSize - 1);
+		memcpy(buf, s.data(), n);
+		buf[n] = 0;
+	}
+	return s.size();
+}
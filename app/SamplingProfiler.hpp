@@ -0,0 +1,57 @@
+//
+//  SamplingProfiler.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 19.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer__SamplingProfiler__
+#define __MusicPlayer__SamplingProfiler__
+
+#include <stddef.h>
+
+// A sampling profiler for the registered threads.
+// It runs in its own thread and uses GetCallstack() to get the stack of each registered thread.
+// The stacks are aggregated into a call tree in a preallocated arena, thus the memory is bounded.
+// The output is in the folded stack format ("frame;frame;frame count" per line),
+// as used by flamegraph.pl and others.
+// In the Python stacks mode, each PyEval_EvalFrameEx frame is replaced by the Python frame
+// it executes ("file:function:line"). The Python frames are captured in the same
+// signal handler as the native frames, thus both belong to the same snapshot.
+
+// no C++ mangling for these symbols
+extern "C" {
+	// Also remembers the Python thread state of the thread for the Python stacks mode.
+	// It must stay alive until the thread unregisters.
+	__attribute__((visibility("default")))
+	void SamplingProfiler_registerCurThread(const char* threadName);
+
+	__attribute__((visibility("default")))
+	void SamplingProfiler_unregisterCurThread();
+
+	// Starts the sampler thread. If it is already running, just changes the rate.
+	__attribute__((visibility("default")))
+	void SamplingProfiler_start(int samplesPerSec);
+
+	__attribute__((visibility("default")))
+	void SamplingProfiler_stop();
+
+	// Enables the Python stacks mode. Can be changed while running.
+	__attribute__((visibility("default")))
+	void SamplingProfiler_setPythonStacks(int enable);
+
+	__attribute__((visibility("default")))
+	int SamplingProfiler_isRunning();
+
+	// Clears all collected samples.
+	__attribute__((visibility("default")))
+	void SamplingProfiler_reset();
+
+	// Writes the folded stacks into buf, like snprintf, i.e. the output is always 0-terminated
+	// and the return value is the full length without the terminating 0.
+	__attribute__((visibility("default")))
+	size_t SamplingProfiler_dumpFolded(char* buf, size_t bufSize);
+}
+
+#endif /* defined(__MusicPlayer__SamplingProfiler__) */
@@ -0,0 +1,191 @@
+//
+//  StackRecord.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 21.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <execinfo.h>
+#include <boost/atomic.hpp>
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+#include "StackRecord.hpp"
+
+// Everything below StackRecord_init() must be async-signal-safe.
+// Thus no malloc, no stdio, no locks. Only open/read/write/close and our own formatting.
+
+static char recordDir[400];
+static boost::atomic<unsigned int> recordCounter(0);
+
+void StackRecord_init(const std::string& dir) {
+	std::string path = getTildeExpandedPath(dir);
+	if(path.size() >= sizeof(recordDir)) {
+		printf("StackRecord_init: dir too long: %s\n", path.c_str());
+		return;
+	}
+	mkdir(path.c_str(), 0755); // might exist already
+	strcpy(recordDir, path.c_str());
+
+	// backtrace() might allocate when it is called the first time (it loads libgcc).
+	// Do that now, not in a crash handler.
+	void* dummy[2];
+	backtrace(dummy, 2);
+}
+
+static bool writeAll(int fd, const void* data, size_t len) {
+	const char* p = (const char*) data;
+	while(len > 0) {
+		ssize_t ret = write(fd, p, len);
+		if(ret < 0 && errno == EINTR) continue;
+		if(ret <= 0) return false;
+		p += ret;
+		len -= (size_t) ret;
+	}
+	return true;
+}
+
+static bool writeSectionHeader(int fd, const char tag[4], uint32_t payloadLen) {
+	return writeAll(fd, tag, 4) && writeAll(fd, &payloadLen, sizeof(payloadLen));
+}
+
+// Appends the decimal number to buf at pos. Returns the new pos.
+static size_t appendDec(char* buf, size_t pos, size_t size, unsigned long long x) {
+	char tmp[24];
+	int n = 0;
+	do { tmp[n++] = (char) ('0' + x % 10); x /= 10; } while(x);
+	while(n > 0 && pos + 1 < size) buf[pos++] = tmp[--n];
+	buf[pos] = 0;
+	return pos;
+}
+
+#if defined(__APPLE__)
+static size_t appendHex(char* buf, size_t pos, size_t size, unsigned long long x) {
+	char tmp[24];
+	int n = 0;
+	do { tmp[n++] = "0123456789abcdef"[x % 16]; x /= 16; } while(x);
+	while(n > 0 && pos + 1 < size) buf[pos++] = tmp[--n];
+	buf[pos] = 0;
+	return pos;
+}
+#endif
+
+static size_t appendStr(char* buf, size_t pos, size_t size, const char* s) {
+	while(*s && pos + 1 < size) buf[pos++] = *s++;
+	buf[pos] = 0;
+	return pos;
+}
+
+bool StackRecord::begin(StackRecordKind kind, const char* reason) {
+	end();
+	if(!recordDir[0]) return false;
+
+	// <dir>/stackrecord-<pid>-<counter>.bin
+	size_t pos = 0;
+	pos = appendStr(filename, pos, sizeof(filename), recordDir);
+	pos = appendStr(filename, pos, sizeof(filename), "/stackrecord-");
+	pos = appendDec(filename, pos, sizeof(filename), (unsigned long long) getpid());
+	pos = appendStr(filename, pos, sizeof(filename), "-");
+	pos = appendDec(filename, pos, sizeof(filename), recordCounter.fetch_add(1));
+	pos = appendStr(filename, pos, sizeof(filename), ".bin");
+
+	fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if(fd < 0) return false;
+
+	struct {
+		char magic[8];
+		uint32_t version;
+		uint32_t pointerSize;
+		uint32_t kind;
+		uint32_t pid;
+		uint64_t unixTime;
+	} header;
+	memcpy(header.magic, "MPSTKREC", 8);
+	header.version = 1;
+	header.pointerSize = sizeof(void*);
+	header.kind = kind;
+	header.pid = (uint32_t) getpid();
+	header.unixTime = (uint64_t) time(NULL);
+	bool ok = writeAll(fd, &header, sizeof(header));
+
+	if(ok && reason) {
+		uint32_t len = (uint32_t) strlen(reason);
+		ok = writeSectionHeader(fd, "RSN ", len) && writeAll(fd, reason, len);
+	}
+	if(!ok) {
+		close(fd);
+		fd = -1;
+	}
+	return ok;
+}
+
+void StackRecord::addThread(ThreadId threadId, const char* name, void* const* stack, int numFrames) {
+	if(fd < 0) return;
+	if(numFrames < 0) numFrames = 0;
+	uint64_t id = (uint64_t) threadId;
+	char nameBuf[32];
+	memset(nameBuf, 0, sizeof(nameBuf));
+	if(name) strncpy(nameBuf, name, sizeof(nameBuf) - 1);
+	uint32_t n = (uint32_t) numFrames;
+	uint32_t payloadLen = sizeof(id) + sizeof(nameBuf) + sizeof(n) + n * sizeof(void*);
+	writeSectionHeader(fd, "THRD", payloadLen);
+	writeAll(fd, &id, sizeof(id));
+	writeAll(fd, nameBuf, sizeof(nameBuf));
+	writeAll(fd, &n, sizeof(n));
+	writeAll(fd, stack, n * sizeof(void*));
+}
+
+static void writeMemoryMap(int fd) {
+	char buf[4096];
+#if defined(__APPLE__)
+	uint32_t count = _dyld_image_count();
+	size_t pos = 0;
+	for(uint32_t i = 0; i < count; ++i) {
+		const char* name = _dyld_get_image_name(i);
+		const void* header = _dyld_get_image_header(i);
+		if(!name || !header) continue;
+		if(pos + strlen(name) + 24 >= sizeof(buf)) {
+			writeSectionHeader(fd, "IMGS", (uint32_t) pos);
+			writeAll(fd, buf, pos);
+			pos = 0;
+		}
+		pos = appendHex(buf, pos, sizeof(buf), (unsigned long long) (uintptr_t) header);
+		pos = appendStr(buf, pos, sizeof(buf), " ");
+		pos = appendStr(buf, pos, sizeof(buf), name);
+		pos = appendStr(buf, pos, sizeof(buf), "\n");
+	}
+	if(pos > 0) {
+		writeSectionHeader(fd, "IMGS", (uint32_t) pos);
+		writeAll(fd, buf, pos);
+	}
+#else
+	int mapsFd = open("/proc/self/maps", O_RDONLY);
+	if(mapsFd < 0) return;
+	while(true) {
+		ssize_t n = read(mapsFd, buf, sizeof(buf));
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) break;
+		writeSectionHeader(fd, "MAPS", (uint32_t) n);
+		writeAll(fd, buf, (size_t) n);
+	}
+	close(mapsFd);
+#endif
+}
+
+void StackRecord::end() {
+	if(fd < 0) return;
+	writeMemoryMap(fd);
+	writeSectionHeader(fd, "END ", 0);
+	close(fd);
+	fd = -1;
+}
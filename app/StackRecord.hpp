@@ -0,0 +1,53 @@
+//
+//  StackRecord.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 21.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer__StackRecord__
+#define __MusicPlayer__StackRecord__
+
+#include <string>
+#include "sysutils.hpp"
+
+// Compact binary crash/hang records. They only contain the raw PCs of the threads
+// and the memory map of the process (/proc/self/maps on Linux, the dyld images on Mac).
+// Nothing is symbolized in the process, that is done offline by tools/symbolize.py.
+// Writing a record is async-signal-safe, i.e. it can be used in a crash signal handler.
+//
+// File format, all integers in native byte order:
+//   header: char magic[8] = "MPSTKREC", uint32 version, uint32 pointerSize,
+//           uint32 kind, uint32 pid, uint64 unixTime
+//   then sections: uint32 tag, uint32 payloadLen, payload
+//     'RSN ': the reason as text
+//     'THRD': uint64 threadId, char name[32], uint32 numFrames, numFrames PCs (pointerSize each)
+//     'MAPS': a chunk of /proc/self/maps. The chunks are concatenated.
+//     'IMGS': a chunk of text lines "<hex load addr> <path>" (Mac)
+//     'END ': empty, the last section
+
+enum StackRecordKind {
+	StackRecord_Crash = 1,
+	StackRecord_Hang = 2
+};
+
+// Call this once at startup, before any record is written. Creates the dir if needed.
+void StackRecord_init(const std::string& dir);
+
+struct StackRecord {
+	int fd;
+	char filename[512];
+
+	StackRecord() : fd(-1) { filename[0] = 0; }
+	~StackRecord() { end(); }
+
+	// Creates a new record file in the dir from StackRecord_init().
+	bool begin(StackRecordKind kind, const char* reason);
+	// stack is like from backtrace(), i.e. the innermost frame first.
+	void addThread(ThreadId threadId, const char* name, void* const* stack, int numFrames);
+	// Writes the memory map and closes the file.
+	void end();
+};
+
+#endif /* defined(__MusicPlayer__StackRecord__) */
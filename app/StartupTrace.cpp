@@ -0,0 +1,148 @@
+//
+//  StartupTrace.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 23.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string>
+#include <set>
+#include <boost/atomic.hpp>
+
+#include "StartupTrace.hpp"
+#include "sysutils.hpp"
+#include "pthread_mutex.hpp"
+
+
+static const int kMaxEvents = 4096;
+
+// When all of these are marked, the startup is done and we write the file.
+static const char* const kMilestones[] = {"first window paint", "first sound"};
+static const int kNumMilestones = sizeof(kMilestones) / sizeof(kMilestones[0]);
+
+struct StartupTraceEvent {
+	boost::atomic<bool> ready; // set after all other fields
+	char phase; // 'B', 'E' or 'i', like in the Chrome trace format
+	char name[64];
+	char threadName[32];
+	long threadId;
+	AbsUsTime time;
+};
+
+static boost::atomic<bool> enabled(false);
+static std::string traceFilename;
+static AbsUsTime startTime = 0;
+static StartupTraceEvent events[kMaxEvents];
+static boost::atomic<int> numEvents(0);
+static boost::atomic<int> milestonesSeen(0);
+static Mutex writeMutex;
+
+
+static void addEvent(char phase, const char* name) {
+	if(!enabled.load(boost::memory_order_relaxed)) return;
+	int i = numEvents.fetch_add(1);
+	if(i >= kMaxEvents) return; // full. we only care about the startup anyway
+	StartupTraceEvent& ev = events[i];
+	ev.time = current_abs_time_us();
+	ev.phase = phase;
+	strncpy(ev.name, name ? name : "", sizeof(ev.name) - 1);
+	ev.name[sizeof(ev.name) - 1] = 0;
+	ev.threadId = (long) pthread_self();
+	ev.threadName[0] = 0;
+	pthread_getname_np(pthread_self(), ev.threadName, sizeof(ev.threadName));
+	ev.ready.store(true, boost::memory_order_release);
+}
+
+// Escapes for a JSON string.
+static std::string jsonStr(const char* s) {
+	std::string res = "\"";
+	for(; *s; ++s) {
+		char c = *s;
+		if(c == '"' || c == '\\') { res += '\\'; res += c; }
+		else if((unsigned char) c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", (int) c);
+			res += buf;
+		}
+		else res += c;
+	}
+	return res + "\"";
+}
+
+void StartupTrace_enable(const char* filename) {
+	traceFilename = filename ? filename : "";
+	startTime = current_abs_time_us();
+	enabled = true;
+	atexit(StartupTrace_writeFile);
+	StartupTrace_mark("startup");
+}
+
+int StartupTrace_isEnabled() {
+	return enabled ? 1 : 0;
+}
+
+void StartupTrace_begin(const char* name) {
+	addEvent('B', name);
+}
+
+void StartupTrace_end(const char* name) {
+	addEvent('E', name);
+}
+
+void StartupTrace_mark(const char* name) {
+	if(!enabled) return;
+	addEvent('i', name);
+	for(int i = 0; i < kNumMilestones; ++i)
+		if(name && strcmp(name, kMilestones[i]) == 0) {
+			printf("StartupTrace: %s after %.1f ms\n", name, (current_abs_time_us() - startTime) / 1000.0);
+			if(milestonesSeen.fetch_add(1) + 1 == kNumMilestones)
+				StartupTrace_writeFile();
+			break;
+		}
+}
+
+void StartupTrace_writeFile() {
+	if(!enabled) return;
+	Mutex::ScopedLock lock(writeMutex);
+
+	std::string out = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	int pid = (int) getpid();
+	int n = numEvents.load();
+	if(n > kMaxEvents) n = kMaxEvents;
+	std::set<long> namedThreads;
+	bool first = true;
+	char buf[256];
+	for(int i = 0; i < n; ++i) {
+		const StartupTraceEvent& ev = events[i];
+		if(!ev.ready.load(boost::memory_order_acquire)) continue;
+		if(!first) out += ",\n";
+		first = false;
+		if(ev.threadName[0] && namedThreads.insert(ev.threadId).second) {
+			snprintf(buf, sizeof(buf),
+					 "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %i, \"tid\": %li, \"args\": {\"name\": ",
+					 pid, ev.threadId);
+			out += buf + jsonStr(ev.threadName) + "}},\n";
+		}
+		// The time might be before startTime if someone got it before we were enabled.
+		long long ts = (long long) ev.time - (long long) startTime;
+		snprintf(buf, sizeof(buf), "{\"ph\": \"%c\", \"pid\": %i, \"tid\": %li, \"ts\": %lli, %s\"name\": ",
+				 ev.phase, pid, ev.threadId, ts, (ev.phase == 'i') ? "\"s\": \"g\", " : "");
+		out += buf + jsonStr(ev.name) + "}";
+	}
+	out += "\n]}\n";
+
+	FILE* f = fopen(traceFilename.c_str(), "w");
+	if(!f) {
+		printf("StartupTrace: cannot write %s\n", traceFilename.c_str());
+		return;
+	}
+	fwrite(out.data(), 1, out.size(), f);
+	fclose(f);
+	printf("StartupTrace: wrote %i events to %s\n", n, traceFilename.c_str());
+}
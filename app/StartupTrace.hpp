@@ -0,0 +1,51 @@
+//
+//  StartupTrace.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 23.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer__StartupTrace__
+#define __MusicPlayer__StartupTrace__
+
+// Timeline of the startup phases, enabled with --startup-trace.
+// The events are written as a Chrome trace JSON (chrome://tracing, Perfetto).
+// The file is written when all milestones ("first window paint", "first sound")
+// have been marked, and again at exit.
+// From Python, use the StartupTrace module (src/StartupTrace.py).
+// All functions are cheap no-ops if the trace is not enabled.
+
+// no C++ mangling for these symbols
+extern "C" {
+	// Call this early in main(). The timestamps are relative to this call.
+	__attribute__((visibility("default")))
+	void StartupTrace_enable(const char* filename);
+
+	__attribute__((visibility("default")))
+	int StartupTrace_isEnabled();
+
+	// A phase on the current thread. Phases can be nested.
+	__attribute__((visibility("default")))
+	void StartupTrace_begin(const char* name);
+
+	__attribute__((visibility("default")))
+	void StartupTrace_end(const char* name);
+
+	// A point in time, e.g. "first sound".
+	__attribute__((visibility("default")))
+	void StartupTrace_mark(const char* name);
+
+	__attribute__((visibility("default")))
+	void StartupTrace_writeFile();
+}
+
+#ifdef __cplusplus
+struct StartupTracePhase {
+	const char* name;
+	StartupTracePhase(const char* _name) : name(_name) { StartupTrace_begin(name); }
+	~StartupTracePhase() { StartupTrace_end(name); }
+};
+#endif
+
+#endif /* defined(__MusicPlayer__StartupTrace__) */
@@ -7,29 +7,133 @@
 //
 
 #include <Python.h>
-#include <map>
 #include <string>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <execinfo.h>
+#include <boost/atomic.hpp>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
 
 #include "ThreadHangDetector.hpp"
+#include "LatencyHistogram.hpp"
+#include "GILStats.hpp"
+#include "StackRecord.hpp"
 #include "sysutils.hpp"
 #include "pthread_mutex.hpp"
 
 static ThreadId mainThread = (ThreadId) pthread_self();
 
 
-struct ThreadInfo {
+// Each registered thread owns one slot.
+// The life signal is the hot path (e.g. every GUI event loop iteration),
+// thus it must not take any lock: the thread finds its slot via a thread-local pointer
+// and only does a relaxed store into its own cache line (plus one histogram bucket).
+// Everything else in the slot is only accessed with the detector mutex.
+struct alignas(64) ThreadSlot {
+	// Written only by the owning thread. Read by the watcher thread.
+	boost::atomic<AbsMsTime> lastLifeSignal;
+	boost::atomic<uint32_t> maxIntervalUs; // since the last reset
+	AbsUsTime lastLifeSignalUs; // only accessed by the owning thread
+	uint32_t seenResetGen; // only accessed by the owning thread
+
+	// Interval histogram. Written only by the owning thread, without RMW.
+	// The counters wrap around. Readers take the difference to their last snapshot.
+	boost::atomic<uint32_t> histCounts[kHistBuckets];
+	// Bumped by a resetting reader. The owning thread then starts with a new max.
+	// Everything from here on is on other cache lines than the ones the owning thread writes to.
+	alignas(64) boost::atomic<uint32_t> resetGen;
+
+	// Protected by the detector mutex.
+	bool used;
+	ThreadId threadId;
 	std::string name;
 	float timeoutSecs;
-	AbsMsTime lastLifeSignal;
+	AbsMsTime watcherBaseline; // set by the watcher, e.g. after AppNap or after a report
+	uint32_t histSnapshot[kHistBuckets]; // counts at the last reset
+
+	// CPU accounting. Protected by the detector mutex, sampled by the watcher.
+	long osThreadId;
+#ifndef __APPLE__
+	bool haveCpuClock;
+	clockid_t cpuClock;
+#endif
+	long long cpuTimeNs; // at the last sample. -1 if not available
+	AbsUsTime cpuSampleTimeUs;
+	float cpuPercent;
+	long long voluntaryCtxSwitches, involuntaryCtxSwitches; // -1 if not available
+
+	ThreadSlot() : lastLifeSignal(0), maxIntervalUs(0), lastLifeSignalUs(0), seenResetGen(0), resetGen(0),
+	used(false), threadId(0), timeoutSecs(0), watcherBaseline(0),
+	osThreadId(0), cpuTimeNs(-1), cpuSampleTimeUs(0), cpuPercent(0),
+	voluntaryCtxSwitches(-1), involuntaryCtxSwitches(-1) {
+#ifndef __APPLE__
+		haveCpuClock = false;
+#endif
+		for(int i = 0; i < kHistBuckets; ++i) {
+			histCounts[i] = 0;
+			histSnapshot[i] = 0;
+		}
+	}
 };
 
+static __thread ThreadSlot* curThreadSlot;
+
 void* backgroundThread_proc(void*);
 
 static const int kWatcherThreadSleepTimeMs = 100;
 static const int kAppNapTriggerMs = 1000;
+static const int kMaxThreads = 64;
+static const int kMaxSnapshotThreads = 128; // all threads of the process, not just the registered ones
+static const int kSnapshotTimeoutMs = 500;
+static const int kCpuSampleIntervalMs = 1000;
+
+
+// User + system time of the thread in nanosecs, or -1.
+static long long threadCpuTimeNs(const ThreadSlot& slot) {
+#ifdef __APPLE__
+	thread_basic_info_data_t info;
+	mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+	if(thread_info((thread_act_t) slot.osThreadId, THREAD_BASIC_INFO, (thread_info_t) &info, &count) != KERN_SUCCESS)
+		return -1;
+	return (long long) (info.user_time.seconds + info.system_time.seconds) * 1000000000LL
+		+ (long long) (info.user_time.microseconds + info.system_time.microseconds) * 1000LL;
+#else
+	if(!slot.haveCpuClock) return -1;
+	struct timespec ts;
+	// Fails if the thread is gone.
+	if(clock_gettime(slot.cpuClock, &ts) != 0) return -1;
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+// Linux only. Leaves them at -1 otherwise.
+static void readThreadCtxSwitches(long osThreadId, long long& voluntary, long long& involuntary) {
+	voluntary = involuntary = -1;
+#ifdef __linux__
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/task/%li/status", osThreadId);
+	FILE* f = fopen(path, "r");
+	if(!f) return;
+	char line[256];
+	while(fgets(line, sizeof(line), f)) {
+		static const char vol[] = "voluntary_ctxt_switches:";
+		static const char nonvol[] = "nonvoluntary_ctxt_switches:";
+		if(strncmp(line, vol, sizeof(vol) - 1) == 0)
+			voluntary = atoll(line + sizeof(vol) - 1);
+		else if(strncmp(line, nonvol, sizeof(nonvol) - 1) == 0)
+			involuntary = atoll(line + sizeof(nonvol) - 1);
+	}
+	fclose(f);
+#endif
+}
 
 struct ThreadHangDetector {
 	Mutex mutex;
@@ -40,11 +144,14 @@ struct ThreadHangDetector {
 		State_JoinBackgroundThread,
 		State_Exit
 	} state;
-	std::map<ThreadId, ThreadInfo> timers;
+	ThreadSlot slots[kMaxThreads];
+	int numUsedSlots;
+	ThreadCallstackSlot snapshot[kMaxSnapshotThreads]; // for the hang report. only used by the watcher
 	
 	ThreadHangDetector() {
 		backgroundThread = 0;
 		state = State_Normal;
+		numUsedSlots = 0;
 		cond = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
 		int ret = pthread_cond_init(&cond, NULL);
 		assert(ret == 0);
@@ -53,7 +160,9 @@ struct ThreadHangDetector {
 	~ThreadHangDetector() {
 		{
 			Mutex::ScopedLock lock(mutex);
-			timers.clear();
+			for(ThreadSlot& slot : slots)
+				slot.used = false;
+			numUsedSlots = 0;
 			_joinBackgroundThread();
 			state = State_Exit;
 		}
@@ -66,26 +175,56 @@ struct ThreadHangDetector {
 			return;
 		}
 		
+		// The name is also useful in the debugger, thus do it in any case.
+		setCurThreadOsName(threadName.c_str());
+		
 		// Don't use the hang detector while we are debugging.
 		if(AmIBeingDebugged())
 			return;
 		
 		ThreadId threadId = (ThreadId)pthread_self();
 		
-		ThreadInfo info;
-		info.name = threadName;
-		info.timeoutSecs = timeoutSecs;
-		info.lastLifeSignal = current_abs_time();
-
+		float effectiveTimeoutSecs = timeoutSecs;
 		if(AbsMsTime(timeoutSecs * 1000) <= 2 * kAppNapTriggerMs) {
-			info.timeoutSecs = (2 * kAppNapTriggerMs) / 1000.f;
+			effectiveTimeoutSecs = (2 * kAppNapTriggerMs) / 1000.f;
 			printf("ThreadHangDetector_registerCurThread: timeout (%f) is too low, setting to (%f)",
-				   timeoutSecs, info.timeoutSecs);
+				   timeoutSecs, effectiveTimeoutSecs);
 		}
 		
 		{
 			Mutex::ScopedLock lock(mutex);
-			timers[threadId] = info;
+			ThreadSlot* slot = curThreadSlot; // reuse if registered again
+			if(!slot) {
+				for(ThreadSlot& s : slots)
+					if(!s.used) { slot = &s; break; }
+				if(!slot) {
+					printf("ThreadHangDetector_registerCurThread: too many threads, ignoring %s\n", threadName.c_str());
+					return;
+				}
+				slot->used = true;
+				numUsedSlots++;
+			}
+			slot->threadId = threadId;
+			slot->name = threadName;
+			slot->timeoutSecs = effectiveTimeoutSecs;
+			slot->watcherBaseline = 0;
+			AbsUsTime now = current_abs_time_us();
+			slot->lastLifeSignalUs = now;
+			slot->lastLifeSignal.store(AbsMsTime(now / 1000), boost::memory_order_relaxed);
+			// Start with an empty histogram.
+			for(int i = 0; i < kHistBuckets; ++i)
+				slot->histSnapshot[i] = slot->histCounts[i].load(boost::memory_order_relaxed);
+			slot->maxIntervalUs.store(0, boost::memory_order_relaxed);
+			slot->seenResetGen = slot->resetGen.load(boost::memory_order_relaxed);
+			slot->osThreadId = currentOsThreadId();
+#ifndef __APPLE__
+			slot->haveCpuClock = pthread_getcpuclockid(pthread_self(), &slot->cpuClock) == 0;
+#endif
+			slot->cpuTimeNs = -1;
+			slot->cpuSampleTimeUs = 0;
+			slot->cpuPercent = 0;
+			_sampleCpu(*slot, now); // baseline
+			curThreadSlot = slot;
 
 			while(true) {
 				if(state == State_Exit) break;
@@ -96,10 +235,7 @@ struct ThreadHangDetector {
 					break;
 				}
 
-				struct timespec waitTime;
-				waitTime.tv_sec = 0;
-				waitTime.tv_nsec = 1UL * 1000UL * 1000UL; // 1ms in nanosecs
-				pthread_cond_timedwait_relative_np(&cond, &mutex.mutex, &waitTime);
+				condWaitRelativeMs(&cond, &mutex.mutex, 1);
 			}
 		}
 	}
@@ -110,37 +246,111 @@ struct ThreadHangDetector {
 			return;
 		}
 		
-		ThreadId threadId = (ThreadId)pthread_self();
-		
+		ThreadSlot* slot = curThreadSlot;
+		if(!slot) return; // not registered, e.g. because we are being debugged
+		AbsUsTime now = current_abs_time_us();
+		slot->lastLifeSignal.store(AbsMsTime(now / 1000), boost::memory_order_relaxed);
+
+		// The interval since the last signal is effectively the latency of one loop iteration.
+		AbsUsTime interval = (now > slot->lastLifeSignalUs) ? (now - slot->lastLifeSignalUs) : 0;
+		slot->lastLifeSignalUs = now;
+		boost::atomic<uint32_t>& bucket = slot->histCounts[histBucket(interval)];
+		bucket.store(bucket.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+		uint32_t interval32 = (interval < 0xffffffffULL) ? (uint32_t) interval : 0xffffffffU;
+		uint32_t resetGen = slot->resetGen.load(boost::memory_order_relaxed);
+		if(resetGen != slot->seenResetGen) {
+			slot->seenResetGen = resetGen;
+			slot->maxIntervalUs.store(interval32, boost::memory_order_relaxed);
+		}
+		else if(interval32 > slot->maxIntervalUs.load(boost::memory_order_relaxed))
+			slot->maxIntervalUs.store(interval32, boost::memory_order_relaxed);
+	}
+
+	int getLatencyStats(ThreadHangDetector_LatencyStats* out, int maxCount, bool reset) {
 		Mutex::ScopedLock lock(mutex);
-		timers[threadId].lastLifeSignal = current_abs_time();
+		int n = 0;
+		for(ThreadSlot& slot : slots) {
+			if(!slot.used) continue;
+			if(n >= maxCount) break;
+			ThreadHangDetector_LatencyStats& stats = out[n++];
+			memset(&stats, 0, sizeof(stats));
+			strncpy(stats.threadName, slot.name.c_str(), sizeof(stats.threadName) - 1);
+			stats.threadId = slot.threadId;
+
+			uint32_t counts[kHistBuckets];
+			unsigned long long total = 0;
+			for(int i = 0; i < kHistBuckets; ++i) {
+				uint32_t c = slot.histCounts[i].load(boost::memory_order_relaxed);
+				counts[i] = c - slot.histSnapshot[i]; // wraps around correctly
+				total += counts[i];
+				if(reset) slot.histSnapshot[i] = c;
+			}
+			stats.count = total;
+			if(total > 0) {
+				stats.maxUs = slot.maxIntervalUs.load(boost::memory_order_relaxed);
+				stats.p50Us = histPercentile(counts, total, 0.5, stats.maxUs);
+				stats.p99Us = histPercentile(counts, total, 0.99, stats.maxUs);
+			}
+			if(reset)
+				slot.resetGen.store(slot.resetGen.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+		}
+		return n;
 	}
-	
+
+	void _sampleCpu(ThreadSlot& slot, AbsUsTime now) {
+		long long cpuTimeNs = threadCpuTimeNs(slot);
+		if(cpuTimeNs >= 0) {
+			if(slot.cpuTimeNs >= 0 && now > slot.cpuSampleTimeUs && cpuTimeNs >= slot.cpuTimeNs)
+				slot.cpuPercent = (float) (100.0 * (cpuTimeNs - slot.cpuTimeNs) / ((now - slot.cpuSampleTimeUs) * 1000.0));
+			slot.cpuTimeNs = cpuTimeNs;
+			slot.cpuSampleTimeUs = now;
+		}
+		readThreadCtxSwitches(slot.osThreadId, slot.voluntaryCtxSwitches, slot.involuntaryCtxSwitches);
+	}
+
+	int getCpuStats(ThreadHangDetector_CpuStats* out, int maxCount) {
+		Mutex::ScopedLock lock(mutex);
+		int n = 0;
+		for(ThreadSlot& slot : slots) {
+			if(!slot.used) continue;
+			if(n >= maxCount) break;
+			ThreadHangDetector_CpuStats& stats = out[n++];
+			memset(&stats, 0, sizeof(stats));
+			strncpy(stats.threadName, slot.name.c_str(), sizeof(stats.threadName) - 1);
+			stats.threadId = slot.threadId;
+			stats.osThreadId = slot.osThreadId;
+			stats.cpuPercent = slot.cpuPercent;
+			stats.cpuTimeSecs = (slot.cpuTimeNs >= 0) ? (slot.cpuTimeNs / 1e9) : -1;
+			stats.voluntaryCtxSwitches = slot.voluntaryCtxSwitches;
+			stats.involuntaryCtxSwitches = slot.involuntaryCtxSwitches;
+		}
+		return n;
+	}
+
 	void unregisterCurThread() {
 		if(state == State_Exit) {
 			printf("ThreadHangDetector_unregisterCurThread after exit\n");
 			return;
 		}
 		
-		ThreadId threadId = (ThreadId)pthread_self();
-		
 		Mutex::ScopedLock lock(mutex);
-		auto n = timers.erase(threadId);
-		if(n == 0) return; // it was not registered
+		ThreadSlot* slot = curThreadSlot;
+		if(!slot) return; // it was not registered
+		curThreadSlot = NULL;
+		slot->used = false;
+		slot->name.clear();
+		numUsedSlots--;
 
 		while(true) {
 			if(state == State_Exit) break;
 			
 			if(state == State_Normal) {
-				if(timers.empty())
+				if(numUsedSlots == 0)
 					_joinBackgroundThread();
 				break;
 			}
 			
-			struct timespec waitTime;
-			waitTime.tv_sec = 0;
-			waitTime.tv_nsec = 1UL * 1000UL * 1000UL; // 1ms in nanosecs
-			pthread_cond_timedwait_relative_np(&cond, &mutex.mutex, &waitTime);
+			condWaitRelativeMs(&cond, &mutex.mutex, 1);
 		}
 	}
 	
@@ -157,7 +367,7 @@ struct ThreadHangDetector {
 	void _joinBackgroundThread() {
 		pthread_t t = (pthread_t) backgroundThread;
 		if(!t) return;
-		backgroundThread = NULL;
+		backgroundThread = 0;
 		assert(state == State_Normal);
 		state = State_JoinBackgroundThread;
 		pthread_cond_broadcast(&cond);
@@ -170,17 +380,80 @@ struct ThreadHangDetector {
 		state = State_Normal;
 	}
 	
-	// Only call this in a signal handler. All threads must be stopped.
+	// The thread which currently holds the GIL. This can change any moment,
+	// thus call it right after the snapshot and take it as a hint.
 	ThreadId _getPythonThreadId() {
 		volatile PyThreadState* tstate = _PyThreadState_Current;
 		if(!tstate) return 0;
 		return (ThreadId) tstate->thread_id;
 	}
 	
+	static const ThreadCallstackSlot* _findSnapshotSlot(const ThreadCallstackSlot* snapshot, int n, ThreadId threadId) {
+		for(int i = 0; i < n; ++i)
+			if(snapshot[i].threadId == threadId) return &snapshot[i];
+		return NULL;
+	}
+
+	static void _printSnapshotSlot(const ThreadCallstackSlot* slot) {
+		if(!slot) {
+			printf("! Thread did not respond\n");
+			return;
+		}
+		printf("backtrace() returned %d addresses\n", slot->callstackCount);
+		backtrace_symbols_fd(slot->callstack, slot->callstackCount, STDOUT_FILENO);
+	}
+
+	// All stacks come from one GetAllCallstacks() snapshot, i.e. from the same moment,
+	// and a thread which does not respond cannot block the watcher.
+	// The stacks go unsymbolized into a StackRecord. Only if that fails, we symbolize here.
+	void _reportHang(const ThreadSlot& info) {
+		int n = GetAllCallstacks(snapshot, kMaxSnapshotThreads, kSnapshotTimeoutMs);
+		ThreadId pythonThreadId = _getPythonThreadId();
+		
+		StackRecord record;
+		std::string reason = info.name + " thread is hanging";
+		bool haveRecord = record.begin(StackRecord_Hang, reason.c_str());
+		if(haveRecord) {
+			for(int i = 0; i < n; ++i)
+				if(snapshot[i].threadId)
+					record.addThread(snapshot[i].threadId, snapshot[i].name, snapshot[i].callstack, snapshot[i].callstackCount);
+			record.end();
+			printf("! Hang record with all threads: %s (see tools/symbolize.py)\n", record.filename);
+		}
+		else {
+			printf("! %s Thread backtrace\n", info.name.c_str());
+			_printSnapshotSlot(_findSnapshotSlot(snapshot, n, info.threadId));
+			if(info.threadId != mainThread) {
+				printf("! Main thread backtrace:\n");
+				_printSnapshotSlot(_findSnapshotSlot(snapshot, n, mainThread));
+			}
+		}
+		if(!pythonThreadId)
+			printf("! No active Python thread\n");
+		else if(pythonThreadId == info.threadId)
+			printf("! We are the active Python thread\n");
+		else if(pythonThreadId == mainThread)
+			printf("! The main thread is the active Python thread\n");
+		else {
+			printf("! Current Python thread: %li\n", (long) pythonThreadId);
+			if(!haveRecord)
+				_printSnapshotSlot(_findSnapshotSlot(snapshot, n, pythonThreadId));
+		}
+		
+		// Like the faulthandler watchdog, we read the Python frames while the threads run.
+		// We must not take the GIL, thus like in a signal handler.
+		print_python_backtrace(true, true);
+
+		// If enabled, this tells us who held the GIL and for how long.
+		if(GILStats_isEnabled())
+			GILStats_print(10);
+	}
+	
 	void _backgroundThread() {		
 		Mutex::ScopedLock lock(mutex);
 		
 		AbsMsTime watcherThreadTime = current_abs_time();
+		AbsMsTime lastCpuSampleTime = watcherThreadTime;
 		
 		while(true) {
 			if(state != State_Normal) break;
@@ -194,52 +467,39 @@ struct ThreadHangDetector {
 			assert(curTime >= watcherThreadTime);
 			if(curTime - watcherThreadTime >= kAppNapTriggerMs) {
 				//printf("ThreadHangDetector: AppNap trigger!\n"); // comment out, dont spam
-				// reset all timers
-				for(auto& it : timers)
-					it.second.lastLifeSignal = curTime;
+				// reset all timers. we don't touch the slot's life signal, it's owned by its thread.
+				for(ThreadSlot& slot : slots)
+					if(slot.used) slot.watcherBaseline = curTime;
 			}
 			watcherThreadTime = curTime;
 			
 			// Check each thread for hangs.
-			for(auto& it : timers) {
-				ThreadId threadId = it.first;
-				ThreadInfo& info = it.second;
-				assert(curTime >= info.lastLifeSignal);
-				if(curTime - info.lastLifeSignal > AbsMsTime(info.timeoutSecs * 1000)) {
+			for(ThreadSlot& slot : slots) {
+				if(!slot.used) continue;
+				ThreadSlot& info = slot;
+				AbsMsTime lastLifeSignal = slot.lastLifeSignal.load(boost::memory_order_relaxed);
+				if(lastLifeSignal < slot.watcherBaseline)
+					lastLifeSignal = slot.watcherBaseline;
+				// The thread might have signaled after we got curTime.
+				if(lastLifeSignal >= curTime) continue;
+				if(curTime - lastLifeSignal > AbsMsTime(info.timeoutSecs * 1000)) {
 					printf("! %s Thread is hanging for more than %f secs\n", info.name.c_str(), info.timeoutSecs);
-					ThreadId pythonThreadId = 0;
-					ExecInThread(threadId, [&](int,void*,void*) {
-						printf("! %s Thread backtrace\n", info.name.c_str());
-						print_backtrace(true, true);
-						pythonThreadId = _getPythonThreadId();
-					});
-					if(threadId != mainThread)
-						ExecInThread(mainThread, [&](int,void*,void*) {
-							printf("! Main thread backtrace:\n");
-							print_backtrace(true, false);
-						});
-					if(!pythonThreadId)
-						printf("! No active Python thread\n");
-					else if(pythonThreadId == threadId)
-						printf("! We are the active Python thread\n");
-					else if(pythonThreadId == mainThread)
-						printf("! The main thread is the active Python thread\n");
-					else
-						ExecInThread(pythonThreadId, [&](int,void*,void*) {
-							printf("Current Python thread backtrace:\n");
-							print_backtrace(true, false);
-						});
-					info.lastLifeSignal = current_abs_time(); // reset, don't immediately spam again
+					_reportHang(info);
+					info.watcherBaseline = current_abs_time(); // reset, don't immediately spam again
 					// I guess we dont want the following. Not sure...
 					//info.timeoutSecs = (float) pow(sqrt(info.timeoutSecs) + 1, 2); // increase quadratically
 				}
 			}
 			
+			if(curTime - lastCpuSampleTime >= kCpuSampleIntervalMs) {
+				lastCpuSampleTime = curTime;
+				AbsUsTime now = current_abs_time_us();
+				for(ThreadSlot& slot : slots)
+					if(slot.used) _sampleCpu(slot, now);
+			}
+			
 			// Sleep a bit.
-			struct timespec ts;
-			ts.tv_sec = 0;
-			ts.tv_nsec = kWatcherThreadSleepTimeMs * 1000UL * 1000UL; // ms in nanoseconds
-			pthread_cond_timedwait_relative_np(&cond, &mutex.mutex, &ts);
+			condWaitRelativeMs(&cond, &mutex.mutex, kWatcherThreadSleepTimeMs);
 		}
 	}
 };
@@ -248,6 +508,8 @@ static ThreadHangDetector detector;
 
 
 void* backgroundThread_proc(void*) {
+	// Otherwise it would inherit the name of the thread which started it.
+	setCurThreadOsName("HangDetector");
 	detector._backgroundThread();
 	return NULL;
 }
@@ -265,4 +527,12 @@ void ThreadHangDetector_unregisterCurThread() {
 	detector.unregisterCurThread();
 }
 
+int ThreadHangDetector_getLatencyStats(ThreadHangDetector_LatencyStats* out, int maxCount, int reset) {
+	if(!out || maxCount <= 0) return 0;
+	return detector.getLatencyStats(out, maxCount, reset != 0);
+}
 
+int ThreadHangDetector_getCpuStats(ThreadHangDetector_CpuStats* out, int maxCount) {
+	if(!out || maxCount <= 0) return 0;
+	return detector.getCpuStats(out, maxCount);
+}
@@ -19,6 +19,39 @@ extern "C" {
 	
 	__attribute__((visibility("default")))
 	void ThreadHangDetector_unregisterCurThread();
+
+	// The intervals between ThreadHangDetector_lifeSignalCurThread() calls of a registered thread.
+	// The percentiles are from a log-scaled histogram, i.e. they are upper bounds with ~25% error.
+	// The max is exact.
+	struct ThreadHangDetector_LatencyStats {
+		char threadName[64];
+		long threadId;
+		unsigned long long count; // number of intervals
+		unsigned long long p50Us;
+		unsigned long long p99Us;
+		unsigned long long maxUs;
+	};
+
+	// Fills out up to maxCount entries, one per registered thread, and returns the number of entries.
+	// The stats are since the last reset. If reset != 0, resets them after reading.
+	// The writers (the life signals) are not blocked by this.
+	__attribute__((visibility("default")))
+	int ThreadHangDetector_getLatencyStats(struct ThreadHangDetector_LatencyStats* out, int maxCount, int reset);
+
+	// CPU usage of a registered thread, sampled by the watcher thread about once per second.
+	struct ThreadHangDetector_CpuStats {
+		char threadName[64];
+		long threadId;
+		long osThreadId; // Linux: kernel tid, like in top -H. Mac: mach thread port
+		float cpuPercent; // over the last sample interval. 100 is one full core
+		double cpuTimeSecs; // user + system, since the thread start. -1 if not available
+		long long voluntaryCtxSwitches; // since the thread start. -1 if not available (e.g. Mac)
+		long long involuntaryCtxSwitches;
+	};
+
+	// Fills out up to maxCount entries, one per registered thread, and returns the number of entries.
+	__attribute__((visibility("default")))
+	int ThreadHangDetector_getCpuStats(struct ThreadHangDetector_CpuStats* out, int maxCount);
 }
 
 #endif /* defined(__MusicPlayer__ThreadHangDetector__) */
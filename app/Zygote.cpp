@@ -0,0 +1,439 @@
+//
+//  Zygote.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 24.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include <Python.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+
+#include "Zygote.hpp"
+#include "sysutils.hpp"
+#include "pthread_mutex.hpp"
+
+
+enum {
+	kMaxFds = 8,
+	kMagic = 0x5a59474f, // "ZYGO"
+	// The first request to a new zygote must wait for its Python init.
+	kReplyTimeoutMs = 30 * 1000
+};
+
+#ifdef MSG_NOSIGNAL
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0; // we set SO_NOSIGPIPE instead
+#endif
+
+// From the app to the zygote, and from the zygote to the worker, with the fds as SCM_RIGHTS.
+// To the zygote, there is one more fd after the numFds ones: the socket for the reply.
+// Thus the app does not need to hold its lock while it waits for the reply.
+struct ZygoteRequest {
+	int magic;
+	int numFds;
+	int origFds[kMaxFds]; // the fd numbers in the app, for the remapping in the worker
+};
+
+struct ZygoteReply {
+	int pid; // -1 on error
+};
+
+
+static bool _sendMsgWithFds(int sock, const void* buf, size_t len, const int* fds, int numFds) {
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	struct iovec iov;
+	iov.iov_base = (void*) buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	char control[CMSG_SPACE(sizeof(int) * (kMaxFds + 1))];
+	if(numFds > 0) {
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * numFds);
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * numFds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * numFds);
+	}
+	ssize_t ret;
+	do ret = sendmsg(sock, &msg, kSendFlags);
+	while(ret < 0 && errno == EINTR);
+	// Our messages are small, thus a Unix socket sends them at once.
+	return ret == (ssize_t) len;
+}
+
+// Returns false on EOF or error. Received fds beyond maxFds are closed.
+static bool _recvMsgWithFds(int sock, void* buf, size_t len, int* fds, int maxFds, int* numFds) {
+	*numFds = 0;
+	size_t pos = 0;
+	while(pos < len) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		struct iovec iov;
+		iov.iov_base = (char*) buf + pos;
+		iov.iov_len = len - pos;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		char control[CMSG_SPACE(sizeof(int) * (kMaxFds + 1))];
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		ssize_t ret = recvmsg(sock, &msg, 0);
+		if(ret < 0 && errno == EINTR) continue;
+		if(ret <= 0) goto error;
+		for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+			int n = (int) ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+			int* data = (int*) CMSG_DATA(cmsg);
+			for(int i = 0; i < n; ++i) {
+				if(*numFds < maxFds) fds[(*numFds)++] = data[i];
+				else close(data[i]);
+			}
+		}
+		pos += ret;
+	}
+	return true;
+
+error:
+	for(int i = 0; i < *numFds; ++i) close(fds[i]);
+	*numFds = 0;
+	return false;
+}
+
+
+// ---- app side
+
+static Mutex zygoteMutex;
+static std::string binaryPath;
+static int poolSize = 1;
+static int idleTimeoutSecs = 60;
+static int zygoteSock = -1;
+static pid_t zygotePid = 0;
+static int zygoteGeneration = 0; // increased with every start
+static ZygoteStats stats;
+
+void Zygote_init(const char* _binaryPath) {
+	Mutex::ScopedLock lock(zygoteMutex);
+	binaryPath = _binaryPath ? _binaryPath : "";
+}
+
+void Zygote_configure(int _poolSize, int _idleTimeoutSecs) {
+	Mutex::ScopedLock lock(zygoteMutex);
+	poolSize = (_poolSize >= 0) ? _poolSize : 0;
+	idleTimeoutSecs = (_idleTimeoutSecs >= 0) ? _idleTimeoutSecs : 0;
+}
+
+static bool _startZygote() {
+	if(binaryPath.empty()) return false;
+	int sv[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		printf("Zygote: socketpair failed: %s\n", strerror(errno));
+		return false;
+	}
+	// Other threads might fork+exec at the same time. They should not get these.
+	fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+	fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+
+	char fdStr[16], poolSizeStr[16], idleTimeoutStr[16];
+	snprintf(fdStr, sizeof(fdStr), "%i", sv[1]);
+	snprintf(poolSizeStr, sizeof(poolSizeStr), "%i", poolSize);
+	snprintf(idleTimeoutStr, sizeof(idleTimeoutStr), "%i", idleTimeoutSecs);
+	const char* argv[] = {binaryPath.c_str(), "--zygote", fdStr, poolSizeStr, idleTimeoutStr, NULL};
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		// We might have other threads, thus only async-signal-safe calls here.
+		fcntl(sv[1], F_SETFD, 0);
+		execv(argv[0], (char* const*) argv);
+		_exit(1);
+	}
+	close(sv[1]);
+	if(pid < 0) {
+		printf("Zygote: fork failed: %s\n", strerror(errno));
+		close(sv[0]);
+		return false;
+	}
+#ifdef SO_NOSIGPIPE
+	int one = 1;
+	setsockopt(sv[0], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+	zygoteSock = sv[0];
+	zygotePid = pid;
+	zygoteGeneration++;
+	stats.zygoteStarts++;
+	printf("Zygote: started, pid %i, pool size %i, idle timeout %is\n", (int) pid, poolSize, idleTimeoutSecs);
+	return true;
+}
+
+static void _stopZygote() {
+	if(zygoteSock >= 0) {
+		close(zygoteSock);
+		zygoteSock = -1;
+	}
+	if(zygotePid > 0) {
+		// It might already have quit because of the idle timeout.
+		// Its idle workers quit by themselves when it is gone.
+		kill(zygotePid, SIGKILL);
+		waitpid(zygotePid, NULL, 0);
+		zygotePid = 0;
+	}
+}
+
+// Holds zygoteMutex. Sends the request and returns the socket where we get the reply, or -1.
+static int _sendRequest(const int* fds, int numFds) {
+	int sv[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		printf("Zygote: socketpair failed: %s\n", strerror(errno));
+		return -1;
+	}
+	fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+	fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+
+	ZygoteRequest req;
+	memset(&req, 0, sizeof(req));
+	req.magic = kMagic;
+	req.numFds = numFds;
+	memcpy(req.origFds, fds, sizeof(int) * numFds);
+	int sendFds[kMaxFds + 1];
+	memcpy(sendFds, fds, sizeof(int) * numFds);
+	sendFds[numFds] = sv[1];
+	bool ok = _sendMsgWithFds(zygoteSock, &req, sizeof(req), sendFds, numFds + 1);
+	// Only the zygote has it now. If it quits, we get EOF.
+	close(sv[1]);
+	if(!ok) {
+		close(sv[0]);
+		return -1;
+	}
+	return sv[0];
+}
+
+// Without zygoteMutex. Closes replySock.
+static int _waitReply(int replySock) {
+	struct pollfd pfd;
+	pfd.fd = replySock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int ret;
+	do ret = poll(&pfd, 1, kReplyTimeoutMs);
+	while(ret < 0 && errno == EINTR);
+	if(ret <= 0) {
+		printf("Zygote: no reply\n");
+		close(replySock);
+		return -1;
+	}
+
+	ZygoteReply reply;
+	int numRecvFds = 0;
+	bool ok = _recvMsgWithFds(replySock, &reply, sizeof(reply), NULL, 0, &numRecvFds);
+	close(replySock);
+	return ok ? reply.pid : -1;
+}
+
+int Zygote_spawn(const int* fds, int numFds) {
+	if(numFds < 2 || numFds > kMaxFds) return -1;
+	AbsUsTime startTime = current_abs_time_us();
+
+	int pid = -1;
+	for(int attempt = 0; attempt < 2 && pid <= 0; ++attempt) {
+		bool newZygote = false;
+		int generation = 0;
+		int replySock = -1;
+		{
+			Mutex::ScopedLock lock(zygoteMutex);
+			if(zygoteSock < 0) {
+				if(!_startZygote()) break;
+				newZygote = true;
+			}
+			generation = zygoteGeneration;
+			replySock = _sendRequest(fds, numFds);
+		}
+		// A slow reply (e.g. a new zygote in its Python init) must not block the other spawns.
+		if(replySock >= 0)
+			pid = _waitReply(replySock);
+		if(pid <= 0) {
+			// Maybe it just quit because of the idle timeout. Then we retry with a new one.
+			// Another thread might have restarted it meanwhile. Then we keep that one.
+			Mutex::ScopedLock lock(zygoteMutex);
+			if(generation == zygoteGeneration)
+				_stopZygote();
+			if(newZygote) break;
+		}
+	}
+
+	Mutex::ScopedLock lock(zygoteMutex);
+	if(pid <= 0) {
+		stats.failures++;
+		return -1;
+	}
+	long long latency = (long long) (current_abs_time_us() - startTime);
+	stats.spawns++;
+	stats.lastSpawnLatencyUs = latency;
+	stats.totalSpawnLatencyUs += latency;
+	if(latency > stats.maxSpawnLatencyUs) stats.maxSpawnLatencyUs = latency;
+	return pid;
+}
+
+void Zygote_getStats(ZygoteStats* _stats) {
+	Mutex::ScopedLock lock(zygoteMutex);
+	*_stats = stats;
+}
+
+void Zygote_stop() {
+	Mutex::ScopedLock lock(zygoteMutex);
+	_stopZygote();
+}
+
+
+// ---- zygote side
+
+struct ZygoteWorker {
+	pid_t pid;
+	int sock;
+};
+
+__attribute__((noreturn))
+static void _workerMain(int sock) {
+	// The zygote ignores SIGCHLD. The job might want to wait for its own children.
+	signal(SIGCHLD, SIG_DFL);
+	PyOS_AfterFork();
+
+	ZygoteRequest req;
+	int fds[kMaxFds];
+	int numFds = 0;
+	if(!_recvMsgWithFds(sock, &req, sizeof(req), fds, kMaxFds, &numFds))
+		_exit(0); // the zygote quit
+	close(sock);
+	if(req.magic != kMagic || req.numFds != numFds || numFds < 2) {
+		printf("Zygote worker: invalid request\n");
+		_exit(1);
+	}
+
+	std::string code = "import TaskSystem\nTaskSystem.ExecingProcess.runChildFromZygote(";
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%i, %i, {", fds[0], fds[1]);
+	code += buf;
+	for(int i = 0; i < numFds; ++i) {
+		snprintf(buf, sizeof(buf), "%i: %i, ", req.origFds[i], fds[i]);
+		code += buf;
+	}
+	code += "})\n";
+	// On SystemExit, this already calls Py_Exit.
+	int ret = PyRun_SimpleString(code.c_str());
+	Py_Exit(ret ? 1 : 0);
+	_exit(1); // not reached
+}
+
+static bool _forkWorker(int appSock, const std::vector<ZygoteWorker>& pool, ZygoteWorker& worker) {
+	int sv[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		printf("Zygote: socketpair failed: %s\n", strerror(errno));
+		return false;
+	}
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0) {
+		close(sv[0]);
+		close(appSock);
+		for(size_t i = 0; i < pool.size(); ++i)
+			close(pool[i].sock);
+		_workerMain(sv[1]);
+	}
+	close(sv[1]);
+	if(pid < 0) {
+		printf("Zygote: fork failed: %s\n", strerror(errno));
+		close(sv[0]);
+		return false;
+	}
+	worker.pid = pid;
+	worker.sock = sv[0];
+	return true;
+}
+
+int Zygote_main(int sockFd, int poolSize, int idleTimeoutSecs) {
+	// The workers are reaped automatically. The app knows their pids and watches their pipes.
+	signal(SIGCHLD, SIG_IGN);
+
+	if(PyRun_SimpleString("import TaskSystem\nTaskSystem.ExecingProcess.zygotePreload()\n") != 0)
+		printf("Zygote: preload failed, continuing anyway\n");
+
+	std::vector<ZygoteWorker> pool;
+	while(true) {
+		while((int) pool.size() < poolSize) {
+			ZygoteWorker worker;
+			if(!_forkWorker(sockFd, pool, worker)) break;
+			pool.push_back(worker);
+		}
+
+		struct pollfd pfd;
+		pfd.fd = sockFd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int ret = poll(&pfd, 1, (idleTimeoutSecs > 0) ? (idleTimeoutSecs * 1000) : -1);
+		if(ret < 0 && errno == EINTR) continue;
+		if(ret <= 0) break; // idle timeout or error
+
+		ZygoteRequest req;
+		int fds[kMaxFds + 1];
+		int numFds = 0;
+		if(!_recvMsgWithFds(sockFd, &req, sizeof(req), fds, kMaxFds + 1, &numFds))
+			break; // the app has closed the socket
+		// The last fd is where the reply goes.
+		int replySock = -1;
+		if(numFds > 0)
+			replySock = fds[--numFds];
+
+		ZygoteReply reply;
+		reply.pid = -1;
+		if(req.magic == kMagic && req.numFds == numFds && numFds >= 2) {
+			// An idle worker might have died. Then we just take the next one.
+			for(int tries = 0; reply.pid < 0 && tries < 3; ++tries) {
+				ZygoteWorker worker;
+				if(!pool.empty()) {
+					worker = pool.front();
+					pool.erase(pool.begin());
+				}
+				else if(!_forkWorker(sockFd, pool, worker))
+					break;
+				if(_sendMsgWithFds(worker.sock, &req, sizeof(req), fds, numFds))
+					reply.pid = worker.pid;
+				else
+					kill(worker.pid, SIGKILL);
+				close(worker.sock);
+			}
+		}
+		else
+			printf("Zygote: invalid request\n");
+		for(int i = 0; i < numFds; ++i)
+			close(fds[i]);
+
+		// If the app gave up on this request already, that's fine.
+		if(replySock >= 0) {
+#ifdef SO_NOSIGPIPE
+			int one = 1;
+			setsockopt(replySock, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+			_sendMsgWithFds(replySock, &reply, sizeof(reply), NULL, 0);
+			close(replySock);
+		}
+	}
+
+	// The idle workers quit when they see EOF.
+	for(size_t i = 0; i < pool.size(); ++i)
+		close(pool[i].sock);
+	return 0;
+}
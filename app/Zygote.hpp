@@ -0,0 +1,61 @@
+//
+//  Zygote.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 24.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer__Zygote__
+#define __MusicPlayer__Zygote__
+
+// A pre-initialized helper process for the --forkExecProc tasks (TaskSystem.ExecingProcess).
+// Without it, every such task does fork()+execv() of the MusicPlayer binary and
+// the child must do Py_Initialize and all the imports again.
+//
+// The zygote is the MusicPlayer binary started with "--zygote <fd> <poolSize> <idleTimeoutSecs>".
+// It initializes Python, preloads the common modules and then waits for requests
+// on a Unix socket. It keeps <poolSize> forked warm workers around. For each request,
+// it passes the fds to an idle worker (or forks a new one) and replies with its pid.
+// The worker then runs TaskSystem.ExecingProcess.runChildFromZygote().
+// The zygote quits when it had no request for <idleTimeoutSecs>. It is restarted on the next request.
+//
+// If anything fails, Zygote_spawn() returns -1 and the caller falls back to fork()+execv().
+
+// no C++ mangling for these symbols
+extern "C" {
+	struct ZygoteStats {
+		long long spawns; // successful Zygote_spawn calls
+		long long failures; // Zygote_spawn calls which returned -1
+		long long zygoteStarts;
+		long long lastSpawnLatencyUs;
+		long long maxSpawnLatencyUs;
+		long long totalSpawnLatencyUs;
+	};
+
+	// Called from main(). Without this, Zygote_spawn() always fails.
+	__attribute__((visibility("default")))
+	void Zygote_init(const char* binaryPath);
+
+	// Takes effect at the next zygote start. idleTimeoutSecs = 0 means no timeout.
+	__attribute__((visibility("default")))
+	void Zygote_configure(int poolSize, int idleTimeoutSecs);
+
+	// fds[0] is the write end (child to parent), fds[1] the read end (parent to child),
+	// the others are passed along (see ExecingProcess_ConnectionWrapper).
+	// Returns the pid of the child, or -1 on error.
+	__attribute__((visibility("default")))
+	int Zygote_spawn(const int* fds, int numFds);
+
+	__attribute__((visibility("default")))
+	void Zygote_getStats(ZygoteStats* stats);
+
+	// Stops the zygote (and its idle workers) if it is running.
+	__attribute__((visibility("default")))
+	void Zygote_stop();
+}
+
+// The main loop of the zygote process. Python must be initialized. Returns the exit code.
+int Zygote_main(int sockFd, int poolSize, int idleTimeoutSecs);
+
+#endif /* defined(__MusicPlayer__Zygote__) */
@@ -14,6 +14,11 @@ CONFIG -= qt
 CONFIG += c++11
 QMAKE_CXXFLAGS += -std=c++11
 
+# Export our symbols (e.g. ThreadHangDetector_*), so that the modules can dlsym them.
+unix:!mac {
+	QMAKE_LFLAGS += -rdynamic
+}
+
 mac {
 	# Add mach_override.
 	INCLUDEPATH += ../mach_override
@@ -27,6 +27,7 @@
 
 
 #include "sysutils.hpp"
+#include "LogWriter.hpp"
 
 
 // Based on Apple's recommended method as described in
@@ -66,7 +67,7 @@ std::string getResourcePath() {
 }
 
 static NSString* getRelevantLogOutput(const std::string& filename) {
-	fflush(stdout);
+	LogWriter_flushSync(true);
 	FILE* f = fopen(filename.c_str(), "r");
 	if(!f) return nil;
 	
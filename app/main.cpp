@@ -10,8 +10,15 @@
 #include <stdio.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <execinfo.h>
 
 #include "sysutils.hpp"
+#include "SamplingProfiler.hpp"
+#include "StackRecord.hpp"
+#include "LogWriter.hpp"
+#include "StartupTrace.hpp"
+#include "Zygote.hpp"
 
 
 #ifndef __APPLE__
@@ -32,6 +39,13 @@ std::string logFilename = "~/Library/Logs/com.albertzeyer.MusicPlayer.log";
 std::string logFilename = "~/.com.albertzeyer.MusicPlayer/musicplayer.log";
 #endif
 
+// Crash and hang records go here. See StackRecord.hpp and tools/symbolize.py.
+#ifdef __APPLE__
+std::string stackRecordDir = "~/Library/Logs/com.albertzeyer.MusicPlayer";
+#else
+std::string stackRecordDir = "~/.com.albertzeyer.MusicPlayer";
+#endif
+
 
 std::string getTildeExpandedPath(const std::string& path) {
 	if(path.substr(0, 2) == "~/")
@@ -49,6 +63,7 @@ pid_t origPid = 0;
 
 // called with --forkExecProc. it's a subprocess for doing some specific work.
 // it's fork()+exec().
+// also set for the zygote (--zygote), which forks such subprocesses without exec(). see Zygote.hpp.
 bool forkExecProc = false;
 
 static void addPyPath() {
@@ -69,6 +84,16 @@ static bool haveArg(const char* arg) {
 	return false;
 }
 
+// Returns the n-th value after the arg, or NULL.
+static const char* getArgValue(const char* arg, int n = 0) {
+	for(int i = 1; i < sys_argc; ++i)
+		if(strcmp(sys_argv[i], arg) == 0) {
+			if(i + 1 + n < sys_argc) return sys_argv[i + 1 + n];
+			return NULL;
+		}
+	return NULL;
+}
+
 static bool checkStartupSuccess() {
 	PyObject* mods = PyImport_GetModuleDict();
 	if(!mods) return false;
@@ -89,15 +114,42 @@ static bool checkStartupSuccess() {
 
 
 
+static const char* signalName(int sig) {
+	switch(sig) {
+		case SIGABRT: return "SIGABRT";
+		case SIGBUS: return "SIGBUS";
+		case SIGSEGV: return "SIGSEGV";
+		case SIGFPE: return "SIGFPE";
+		case SIGILL: return "SIGILL";
+		default: return "signal";
+	}
+}
+
 void signal_handler(int sig) {
 	printf("Signal handler: %i\n", sig);
-	print_backtrace(true, true);
+	// Get the last lines to disk, before anything else can go wrong.
+	LogWriter_flushSync(true);
+	{
+		// Only the raw PCs. Symbolizing here is slow and not async-signal-safe.
+		void* callstack[128];
+		int framesC = backtrace(callstack, 128);
+		StackRecord record;
+		if(record.begin(StackRecord_Crash, signalName(sig))) {
+			record.addThread((ThreadId) pthread_self(), "crashed", callstack, framesC);
+			record.end();
+			printf("Crash record: %s (see tools/symbolize.py)\n", record.filename);
+			print_python_backtrace(true, true);
+		}
+		else
+			print_backtrace(true, true);
+	}
 	if(forkExecProc)
 		printf("This is a forkExec subprocess. I just quit.\n");
 	else if(origPid != getpid())
 		printf("This is a forked process. I just quit.\n");
 	else
 		handleFatalError("There was a fatal error.");
+	LogWriter_flushSync(true);
 	_exit(100 + sig);
 }
 
@@ -130,12 +182,15 @@ int main(int argc, char *argv[])
 	install_breakpoint_handlers();
 #endif
 	
-	forkExecProc = haveArg("--forkExecProc");
+	bool zygote = haveArg("--zygote");
+	forkExecProc = haveArg("--forkExecProc") || zygote;
 	bool shell = haveArg("--shell");
 	bool pyShell = haveArg("--pyshell");
 	bool pyExec = haveArg("--pyexec");
 	bool noLog = haveArg("--nolog");
 	bool help = haveArg("--help") || haveArg("-h");
+	if(!forkExecProc && haveArg("--startup-trace"))
+		StartupTrace_enable((getTildeExpandedPath(stackRecordDir) + "/startup-trace.json").c_str());
 	bool beingDebugged = AmIBeingDebugged();
 	
 	const char* logDisabledReason = NULL;
@@ -148,20 +203,17 @@ int main(int argc, char *argv[])
 	}
 	else {
 		// current workaround to log stdout/stderr. see http://stackoverflow.com/questions/13104588/how-to-get-stdout-into-console-app
-		logEnabled = true;
+		// stdout/stderr are buffered per thread and written by a background thread. See LogWriter.hpp.
 		printf("MusicPlayer: stdout/stderr goes to %s now\n", logFilename.c_str());
 		fflush(stdout);
-		int newFd = open(getTildeExpandedPath(logFilename).c_str(), O_WRONLY|O_APPEND|O_CREAT);
-		dup2(newFd, fileno(stdout));
-		dup2(newFd, fileno(stderr));
-		close(newFd);
-		//freopen(logFilename.c_str(), "a", stdout);
-		//freopen(logFilename.c_str(), "a", stderr);
-		stderr = stdout; // well, hack, ... I don't like two seperate buffers. just messes up the output
+		logEnabled = LogWriter_init(getTildeExpandedPath(logFilename));
+		if(!logEnabled)
+			logDisabledReason = "could not open log file, not redirecting stdout/stderr";
 	}
 
 	if(!forkExecProc) {
 		printf("%s", StartupStr);
+		StackRecord_init(stackRecordDir);
 		install_signal_handler();
 	}
 	
@@ -169,6 +221,7 @@ int main(int argc, char *argv[])
 		printf(
 			   "Help: Available options:\n"
 			   "  --nolog		: don't redirect stdout/stderr to log. also implied when run in debugger\n"
+			   "  --startup-trace	: write a timeline of the startup phases (Chrome trace JSON)\n"
 			   );
 	}
 
@@ -180,28 +233,53 @@ int main(int argc, char *argv[])
 	if(!forkExecProc)
 		printf("Python version: %s, prefix: %s, main: %s\n", Py_GetVersion(), Py_GetPrefix(), mainPyFilename.c_str());
 	
+	StartupTrace_begin("Python init");
 	Py_Initialize();
 	PyEval_InitThreads();
 	addPyPath();
+	StartupTrace_end("Python init");
+
+	// The main thread runs the GUI event loop. The profiler only samples when started, via the debugger module.
+	if(!forkExecProc)
+		SamplingProfiler_registerCurThread("Main");
 
 	if(logEnabled) {
-		PySys_SetObject((char*)"stdout", PyFile_FromFile(stdout, (char*)"<stdout>", (char*)"w", fclose));
+		// The FILE belongs to the LogWriter, thus Python must not close it.
+		PySys_SetObject((char*)"stdout", PyFile_FromFile(stdout, (char*)"<stdout>", (char*)"w", NULL));
 		PySys_SetObject((char*)"stderr", PySys_GetObject((char*)"stdout"));
 	}
 	PySys_SetObject((char*)"MusicPlayerBin", PyString_FromString(argv[0]));
 
 	// Preload imp and thread. I hope to fix this bug: https://github.com/albertz/music-player/issues/8 , there was a crash in initthread which itself has called initimp
+	StartupTrace_begin("preload imp/thread");
 	PyObject* m = NULL;
 	m = PyImport_ImportModule("imp");
 	Py_XDECREF(m);
 	m = PyImport_ImportModule("thread");
 	Py_XDECREF(m);
+	StartupTrace_end("preload imp/thread");
 	
 	PySys_SetArgvEx(argc, argv, 0);
+
+	if(zygote) {
+		const char* sockStr = getArgValue("--zygote", 0);
+		const char* poolSizeStr = getArgValue("--zygote", 1);
+		const char* idleTimeoutStr = getArgValue("--zygote", 2);
+		if(!sockStr || !poolSizeStr || !idleTimeoutStr) {
+			printf("--zygote: expected <fd> <poolSize> <idleTimeoutSecs>\n");
+			return 1;
+		}
+		return Zygote_main(atoi(sockStr), atoi(poolSizeStr), atoi(idleTimeoutStr));
+	}
+	if(!forkExecProc)
+		Zygote_init(argv[0]);
 			
 	FILE* fp = fopen((char*)mainPyFilename.c_str(), "r");
-	if(fp)
+	if(fp) {
+		StartupTrace_begin("main.py");
 		PyRun_SimpleFile(fp, "main.py");
+		StartupTrace_end("main.py");
+	}
 	else
 		printf("Could not open main.py!\n");
 	
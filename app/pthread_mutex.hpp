@@ -5,6 +5,7 @@
 
 #include <pthread.h>
 #include <assert.h>
+#include <time.h>
 
 struct Mutex {
 	pthread_mutex_t mutex;
@@ -38,5 +39,24 @@ struct Mutex {
 };
 
 
+// pthread_cond_timedwait with a relative timeout. Like pthread_cond_timedwait_relative_np on Mac.
+inline void condWaitRelativeMs(pthread_cond_t* cond, pthread_mutex_t* mutex, long ms) {
+	struct timespec ts;
+#ifdef __APPLE__
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000L * 1000L;
+	pthread_cond_timedwait_relative_np(cond, mutex, &ts);
+#else
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000L * 1000L;
+	if(ts.tv_nsec >= 1000L * 1000L * 1000L) {
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000L * 1000L * 1000L;
+	}
+	pthread_cond_timedwait(cond, mutex, &ts);
+#endif
+}
+
 
 #endif
@@ -3,10 +3,16 @@
 #include <execinfo.h>
 #include <dlfcn.h>
 #include "sysutils.hpp"
+#include "LogWriter.hpp"
 
 
 #include <time.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 
 
@@ -17,13 +23,10 @@
 #include <mach/mach_time.h>
 
 
-#define ORWL_NANO (+1.0E-9)
-#define ORWL_GIGA UINT64_C(1000000000)
-
 static double orwl_timebase = 0.0;
 static uint64_t orwl_timestart = 0;
 
-AbsMsTime current_abs_time() {
+AbsUsTime current_abs_time_us() {
 	// be more careful in a multithreaded environement
 	if (!orwl_timestart) {
 		mach_timebase_info_data_t tb = { 0, 0 };
@@ -32,68 +35,92 @@ AbsMsTime current_abs_time() {
 		orwl_timebase /= tb.denom;
 		orwl_timestart = mach_absolute_time();
 	}
-	struct timespec ts;
-	double diff = (mach_absolute_time() - orwl_timestart) * orwl_timebase;
-	ts.tv_sec = diff * ORWL_NANO;
-	ts.tv_nsec = diff - (ts.tv_sec * ORWL_GIGA);
-	return (unsigned long) ((ts.tv_sec * 1000UL)
-							+ (ts.tv_nsec / 1000000UL));
+	double diff = (mach_absolute_time() - orwl_timestart) * orwl_timebase; // nanosecs
+	return (AbsUsTime) (diff / 1000.);
 }
 #else
 
-AbsMsTime current_abs_time() {
+AbsUsTime current_abs_time_us() {
 	struct timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &systemtime);
-	return (unsigned long) ((ts.tv_sec * 1000UL)
-							+ (ts.tv_nsec / 1000000UL));
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((AbsUsTime) ts.tv_sec * 1000000ULL)
+			+ ((AbsUsTime) ts.tv_nsec / 1000ULL);
 }
 #endif
 
+AbsMsTime current_abs_time() {
+	return (AbsMsTime) (current_abs_time_us() / 1000ULL);
+}
+
 
 
 void print_backtrace(int bInSignalHandler, int bAllThreads) {
 	void *callstack[128];
 	int framesC = backtrace(callstack, sizeof(callstack));
 	printf("backtrace() returned %d addresses\n", framesC);
+	LogWriter_flushSync(true); // we write directly to the fd below
 	backtrace_symbols_fd(callstack, framesC, STDOUT_FILENO);
 
-	// Python threads
-	{
-		PyThreadState* tstate;
-		PyGILState_STATE gstate;
-		if(bInSignalHandler) {
-			/* PyThreadState_Get() doesn't give the state of the current thread if
-			 the thread doesn't hold the GIL. Read the thread local storage (TLS)
-			 instead: call PyGILState_GetThisThreadState(). */
-			tstate = PyGILState_GetThisThreadState();
-		}
-		else {
-			gstate = PyGILState_Ensure();
-			tstate = PyThreadState_Get();
-		}
-
-		if(bAllThreads && bInSignalHandler) { /* all threads only works in signal handler */
-			printf("All Python threads:\n");
-			typedef void (*PyDumpTracebackAllFunc)(void);
-			PyDumpTracebackAllFunc _Py_DumpTracebackAllThreads = (PyDumpTracebackAllFunc) dlsym(RTLD_DEFAULT, "_Py_DumpTracebackAllThreads");
-			if(_Py_DumpTracebackAllThreads)
-				_Py_DumpTracebackAllThreads();
-			else
-				printf("print_backtrace: _Py_DumpTracebackAllThreads not found\n");
-		}
-		else if(tstate) {
-			printf("Own Python thread:\n");
-			typedef void (*PyDumpTracebackFunc)(int fd, PyThreadState *tstate);
-			PyDumpTracebackFunc _Py_DumpTraceback = (PyDumpTracebackFunc) dlsym(RTLD_DEFAULT, "_Py_DumpTraceback");
-			if(_Py_DumpTraceback)
-				_Py_DumpTraceback(STDOUT_FILENO, tstate);
-			else
-				printf("print_backtrace: _Py_DumpTraceback not found\n");
-		}
-		else
-			printf("print_backtrace: This thread does not seem to have a Python thread.\n");
+	print_python_backtrace(bInSignalHandler, bAllThreads);
+}
+
+void print_python_backtrace(int bInSignalHandler, int bAllThreads) {
+	LogWriter_flushSync(true); // the dumps below write directly to the fd
+	PyThreadState* tstate;
+	PyGILState_STATE gstate;
+	if(bInSignalHandler) {
+		/* PyThreadState_Get() doesn't give the state of the current thread if
+		 the thread doesn't hold the GIL. Read the thread local storage (TLS)
+		 instead: call PyGILState_GetThisThreadState(). */
+		tstate = PyGILState_GetThisThreadState();
+	}
+	else {
+		gstate = PyGILState_Ensure();
+		tstate = PyThreadState_Get();
+	}
 
-		if(!bInSignalHandler)
-			PyGILState_Release(gstate);
+	if(bAllThreads && bInSignalHandler) { /* all threads only works in signal handler */
+		printf("All Python threads:\n");
+		typedef void (*PyDumpTracebackAllFunc)(void);
+		PyDumpTracebackAllFunc _Py_DumpTracebackAllThreads = (PyDumpTracebackAllFunc) dlsym(RTLD_DEFAULT, "_Py_DumpTracebackAllThreads");
+		if(_Py_DumpTracebackAllThreads)
+			_Py_DumpTracebackAllThreads();
+		else
+			printf("print_backtrace: _Py_DumpTracebackAllThreads not found\n");
+	}
+	else if(tstate) {
+		printf("Own Python thread:\n");
+		typedef void (*PyDumpTracebackFunc)(int fd, PyThreadState *tstate);
+		PyDumpTracebackFunc _Py_DumpTraceback = (PyDumpTracebackFunc) dlsym(RTLD_DEFAULT, "_Py_DumpTraceback");
+		if(_Py_DumpTraceback)
+			_Py_DumpTraceback(STDOUT_FILENO, tstate);
+		else
+			printf("print_backtrace: _Py_DumpTraceback not found\n");
 	}
+	else
+		printf("print_backtrace: This thread does not seem to have a Python thread.\n");
+
+	if(!bInSignalHandler)
+		PyGILState_Release(gstate);
+}
+
+long currentOsThreadId() {
+#if defined(__linux__)
+	return (long) syscall(SYS_gettid);
+#elif defined(__APPLE__)
+	return (long) pthread_mach_thread_np(pthread_self());
+#else
+	return (long) pthread_self();
+#endif
+}
+
+void setCurThreadOsName(const char* name) {
+#if defined(__APPLE__)
+	pthread_setname_np(name); // Mac only allows it for the current thread
+#elif defined(__linux__)
+	char buf[16]; // the kernel limit, including the terminating 0
+	strncpy(buf, name, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = 0;
+	pthread_setname_np(pthread_self(), buf);
+#endif
 }
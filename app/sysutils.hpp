@@ -26,6 +26,10 @@ extern "C" {
 	__attribute__((visibility("default")))
 	void print_backtrace(int bInSignalHandler, int bAllThreads);
 	
+	// Like print_backtrace() but only the Python part.
+	__attribute__((visibility("default")))
+	void print_python_backtrace(int bInSignalHandler, int bAllThreads);
+	
 	__attribute__((visibility("default")))
 	void handleFatalError(const char* msg);
 	
@@ -35,16 +39,56 @@ extern "C" {
 
 typedef unsigned long AbsMsTime;
 AbsMsTime current_abs_time();
+typedef unsigned long long AbsUsTime; // same clock as current_abs_time(), in microsecs
+AbsUsTime current_abs_time_us();
 
 void* GetPCFromUContext(void* ucontext);
 
 typedef long ThreadId;
 
+// Linux: kernel tid. Mac: mach thread port. Async-signal-safe.
+long currentOsThreadId();
+
+// The name shown by e.g. top -H, ps -L or the debugger. On Linux, it is truncated to 15 chars.
+void setCurThreadOsName(const char* name);
+
 // On Linux/Unix/Mac, the function will be called from a signal handler, running in the target thread.
 void ExecInThread(ThreadId threadId, boost::function<void(int signum, void* siginfo, void* sigsecret)> func);
 
 // Uses ExecInThread if the threadId != 0 and != current thread.
 int GetCallstack(ThreadId threadId, void **buffer, int size);
 
+// What GetCallstack runs in the target thread. Can be used with ExecInThread
+// when more needs to be done in the target thread (e.g. see SamplingProfiler.cpp).
+// Pass it via boost::ref, otherwise the result ends up in a copy.
+struct GetCallstackFunctor {
+	void** threadCallstackBuffer;
+	int threadCallstackBufferSize;
+	int threadCallstackCount;
+	
+	GetCallstackFunctor() : threadCallstackBuffer(NULL), threadCallstackBufferSize(0), threadCallstackCount(0) {}
+	
+	void operator()(int signr, void *info, void *secret);
+};
+
+// One thread in a GetAllCallstacks() snapshot.
+struct ThreadCallstackSlot {
+	enum { MaxDepth = 128 };
+	long osThreadId; // Linux: kernel tid. Mac: mach thread port
+	ThreadId threadId; // set by the thread itself. 0 if it did not respond in time
+	char name[32];
+	int callstackCount;
+	void* callstack[MaxDepth];
+};
+
+// Captures the callstacks of all threads of the process in one pass.
+// All threads are signaled at once and each one writes into its own slot.
+// They are kept in their signal handler until all have responded (or until the timeout),
+// thus the stacks are all from the same moment.
+// Returns the number of used slots. Slots of threads which did not respond have threadId == 0.
+// The signal interrupts sleeps and waits (nanosleep, select, poll) in the other threads,
+// i.e. they can return early with EINTR. Thus, don't call this frequently.
+int GetAllCallstacks(ThreadCallstackSlot* slots, int maxSlots, int timeoutMs);
+
 
 #endif
@@ -9,6 +9,10 @@ from compile_utils import *
 import compile_utils as c
 from glob import glob
 
+# With --benchmarks, the benchmark entry points (e.g. _gui.benchmarkSafeValues) are included.
+benchmarks = "--benchmarks" in sys.argv[1:]
+benchmarkOpts = ["-DMUSICPLAYER_BENCHMARKS"] if benchmarks else []
+
 # Compile core module.
 sys_exec(["./core/compile.py"])
 sys_exec(["cp", "core/musicplayer.so", "musicplayer.so"])
@@ -22,7 +26,7 @@ print("* Building _gui.so")
 guiFiles = glob("../_gui/*.cpp")
 cc(
 	guiFiles,
-	["-I../core"] + get_python_ccopts()
+	["-I../core"] + benchmarkOpts + get_python_ccopts()
 )
 link(
 	"../_gui.so",
@@ -7,12 +7,317 @@
 //
 
 #include <Python.h>
+#include <dlfcn.h>
 #include "debugger.h"
+#include "ThreadHangDetector.hpp"
+#include "SamplingProfiler.hpp"
+#include "GILStats.hpp"
+#include "EventTrace.hpp"
+#include <string>
+#include <vector>
 
 PyDoc_STRVAR(module_doc,
 	"debugger module.");
 
+// The ThreadHangDetector, the SamplingProfiler, GILStats and EventTrace live in the app binary, thus we look them up at runtime.
+// Sets a Python exception if not found.
+static void* appFunc(const char* name) {
+	void* f = dlsym(RTLD_DEFAULT, name);
+	if(!f)
+		PyErr_Format(PyExc_RuntimeError, "%s not found", name);
+	return f;
+}
+
+#define GetAppFunc(var, name) \
+	static decltype(&name) var = NULL; \
+	if(!var) var = (decltype(&name)) appFunc(#name); \
+	if(!var) return NULL;
+
+static PyObject* threadLatencyStats(PyObject* self, PyObject* args, PyObject* kws) {
+	PyObject* resetObj = Py_False;
+	static const char* kwlist[] = {"reset", NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kws, "|O:threadLatencyStats", (char**) kwlist, &resetObj))
+		return NULL;
+	int reset = PyObject_IsTrue(resetObj);
+	if(reset < 0) return NULL;
+
+	GetAppFunc(func, ThreadHangDetector_getLatencyStats);
+
+	static const int MaxThreads = 64;
+	ThreadHangDetector_LatencyStats stats[MaxThreads];
+	int n;
+	Py_BEGIN_ALLOW_THREADS
+	n = func(stats, MaxThreads, reset);
+	Py_END_ALLOW_THREADS
+
+	PyObject* res = PyList_New(0);
+	if(!res) return NULL;
+	for(int i = 0; i < n; ++i) {
+		PyObject* d = Py_BuildValue("{s:s,s:l,s:K,s:K,s:K,s:K}",
+			"name", stats[i].threadName,
+			"threadId", stats[i].threadId,
+			"count", stats[i].count,
+			"p50Us", stats[i].p50Us,
+			"p99Us", stats[i].p99Us,
+			"maxUs", stats[i].maxUs);
+		if(!d || PyList_Append(res, d) != 0) {
+			Py_XDECREF(d);
+			Py_DECREF(res);
+			return NULL;
+		}
+		Py_DECREF(d);
+	}
+	return res;
+}
+
+static PyObject* threadCpuStats(PyObject* self) {
+	GetAppFunc(func, ThreadHangDetector_getCpuStats);
+
+	static const int MaxThreads = 64;
+	ThreadHangDetector_CpuStats stats[MaxThreads];
+	int n;
+	Py_BEGIN_ALLOW_THREADS
+	n = func(stats, MaxThreads);
+	Py_END_ALLOW_THREADS
+
+	PyObject* res = PyList_New(0);
+	if(!res) return NULL;
+	for(int i = 0; i < n; ++i) {
+		PyObject* d = Py_BuildValue("{s:s,s:l,s:l,s:f,s:d,s:L,s:L}",
+			"name", stats[i].threadName,
+			"threadId", stats[i].threadId,
+			"osThreadId", stats[i].osThreadId,
+			"cpuPercent", (double) stats[i].cpuPercent,
+			"cpuTimeSecs", stats[i].cpuTimeSecs,
+			"voluntaryCtxSwitches", stats[i].voluntaryCtxSwitches,
+			"involuntaryCtxSwitches", stats[i].involuntaryCtxSwitches);
+		if(!d || PyList_Append(res, d) != 0) {
+			Py_XDECREF(d);
+			Py_DECREF(res);
+			return NULL;
+		}
+		Py_DECREF(d);
+	}
+	return res;
+}
+
+static PyObject* profilerRegisterCurThread(PyObject* self, PyObject* args) {
+	const char* name = NULL;
+	if(!PyArg_ParseTuple(args, "s:profilerRegisterCurThread", &name))
+		return NULL;
+	GetAppFunc(func, SamplingProfiler_registerCurThread);
+	func(name);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* profilerUnregisterCurThread(PyObject* self) {
+	GetAppFunc(func, SamplingProfiler_unregisterCurThread);
+	func();
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* profilerStart(PyObject* self, PyObject* args, PyObject* kws) {
+	int samplesPerSec = 97;
+	PyObject* pythonStacks = NULL;
+	static const char* kwlist[] = {"samplesPerSec", "pythonStacks", NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kws, "|iO:profilerStart", (char**) kwlist, &samplesPerSec, &pythonStacks))
+		return NULL;
+	int pythonStacksFlag = pythonStacks ? PyObject_IsTrue(pythonStacks) : 0;
+	if(pythonStacksFlag < 0) return NULL;
+	GetAppFunc(setPythonStacksFunc, SamplingProfiler_setPythonStacks);
+	GetAppFunc(func, SamplingProfiler_start);
+	setPythonStacksFunc(pythonStacksFlag);
+	func(samplesPerSec);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* profilerStop(PyObject* self) {
+	GetAppFunc(func, SamplingProfiler_stop);
+	// This joins the sampler thread. Let other Python threads run meanwhile.
+	Py_BEGIN_ALLOW_THREADS
+	func();
+	Py_END_ALLOW_THREADS
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* profilerIsRunning(PyObject* self) {
+	GetAppFunc(func, SamplingProfiler_isRunning);
+	return PyBool_FromLong(func());
+}
+
+static PyObject* profilerReset(PyObject* self) {
+	GetAppFunc(func, SamplingProfiler_reset);
+	Py_BEGIN_ALLOW_THREADS
+	func();
+	Py_END_ALLOW_THREADS
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* profilerDumpFolded(PyObject* self) {
+	GetAppFunc(func, SamplingProfiler_dumpFolded);
+	std::string buf;
+	Py_BEGIN_ALLOW_THREADS
+	// It can grow between the calls, thus loop.
+	size_t n = 0;
+	while(true) {
+		buf.resize(n + 1);
+		size_t needed = func(&buf[0], buf.size());
+		if(needed <= n) { buf.resize(needed); break; }
+		n = needed + needed / 4;
+	}
+	Py_END_ALLOW_THREADS
+	return PyString_FromStringAndSize(buf.data(), buf.size());
+}
+
+static PyObject* gilStatsSetEnabled(PyObject* self, PyObject* args) {
+	PyObject* flagObj = NULL;
+	if(!PyArg_ParseTuple(args, "O:gilStatsSetEnabled", &flagObj))
+		return NULL;
+	int flag = PyObject_IsTrue(flagObj);
+	if(flag < 0) return NULL;
+	GetAppFunc(func, GILStats_setEnabled);
+	func(flag);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* gilStatsReset(PyObject* self) {
+	GetAppFunc(func, GILStats_reset);
+	// Keep the GIL. GILStats expects it.
+	func();
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* gilStats(PyObject* self, PyObject* args, PyObject* kws) {
+	int maxSites = 20;
+	static const char* kwlist[] = {"maxSites", NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kws, "|i:gilStats", (char**) kwlist, &maxSites))
+		return NULL;
+	if(maxSites < 0) maxSites = 0;
+	if(maxSites > 512) maxSites = 512;
+
+	GetAppFunc(getThreadsFunc, GILStats_getThreads);
+	GetAppFunc(getTopSitesFunc, GILStats_getTopSites);
+
+	// Keep the GIL while we read, then all the counters are consistent.
+	static const int MaxThreads = 128;
+	GILStats_Thread threads[MaxThreads];
+	int numThreads = getThreadsFunc(threads, MaxThreads);
+	std::vector<GILStats_Site> sites(maxSites);
+	int numSites = maxSites ? getTopSitesFunc(&sites[0], maxSites) : 0;
+
+	PyObject* threadList = PyList_New(0);
+	PyObject* siteList = PyList_New(0);
+	PyObject* res = NULL;
+	if(!threadList || !siteList) goto final;
+	for(int i = 0; i < numThreads; ++i) {
+		const GILStats_Thread& t = threads[i];
+		PyObject* d = Py_BuildValue("{s:s,s:l,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+			"name", t.threadName,
+			"threadId", t.threadId,
+			"holdCount", t.holdCount,
+			"holdTotalUs", t.holdTotalUs,
+			"holdP50Us", t.holdP50Us,
+			"holdP99Us", t.holdP99Us,
+			"holdMaxUs", t.holdMaxUs,
+			"waitCount", t.waitCount,
+			"waitTotalUs", t.waitTotalUs,
+			"waitP50Us", t.waitP50Us,
+			"waitP99Us", t.waitP99Us,
+			"waitMaxUs", t.waitMaxUs);
+		if(!d || PyList_Append(threadList, d) != 0) {
+			Py_XDECREF(d);
+			goto final;
+		}
+		Py_DECREF(d);
+	}
+	for(int i = 0; i < numSites; ++i) {
+		const GILStats_Site& s = sites[i];
+		PyObject* d = Py_BuildValue("{s:s,s:K,s:K,s:K,s:K}",
+			"site", s.site,
+			"holdCount", s.holdCount,
+			"holdTotalUs", s.holdTotalUs,
+			"holdMaxUs", s.holdMaxUs,
+			"waitTotalUs", s.waitTotalUs);
+		if(!d || PyList_Append(siteList, d) != 0) {
+			Py_XDECREF(d);
+			goto final;
+		}
+		Py_DECREF(d);
+	}
+	res = Py_BuildValue("{s:O,s:O}", "threads", threadList, "sites", siteList);
+
+final:
+	Py_XDECREF(threadList);
+	Py_XDECREF(siteList);
+	return res;
+}
+
+static PyObject* eventTraceSetEnabled(PyObject* self, PyObject* args) {
+	PyObject* flagObj = NULL;
+	if(!PyArg_ParseTuple(args, "O:eventTraceSetEnabled", &flagObj))
+		return NULL;
+	int flag = PyObject_IsTrue(flagObj);
+	if(flag < 0) return NULL;
+	GetAppFunc(func, EventTrace_setEnabled);
+	func(flag);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* eventTraceDump(PyObject* self, PyObject* args) {
+	const char* filename = NULL;
+	if(!PyArg_ParseTuple(args, "s:eventTraceDump", &filename))
+		return NULL;
+	GetAppFunc(func, EventTrace_writeJson);
+	int n;
+	Py_BEGIN_ALLOW_THREADS
+	n = func(filename);
+	Py_END_ALLOW_THREADS
+	if(n < 0) {
+		PyErr_Format(PyExc_IOError, "cannot write %s", filename);
+		return NULL;
+	}
+	return PyInt_FromLong(n);
+}
+
 static PyMethodDef module_methods[] = {
+	{"threadLatencyStats", (PyCFunction) threadLatencyStats, METH_VARARGS|METH_KEYWORDS,
+		"threadLatencyStats(reset=False) -> list of dicts with name, threadId, count, p50Us, p99Us, maxUs.\n"
+		"The intervals between the hang detector life signals of each registered thread."},
+	{"threadCpuStats", (PyCFunction) threadCpuStats, METH_NOARGS,
+		"threadCpuStats() -> list of dicts with name, threadId, osThreadId, cpuPercent, cpuTimeSecs, "
+		"voluntaryCtxSwitches, involuntaryCtxSwitches (-1 if not available).\n"
+		"The CPU usage of each thread registered at the hang detector, sampled about once per second."},
+	{"profilerRegisterCurThread", (PyCFunction) profilerRegisterCurThread, METH_VARARGS,
+		"profilerRegisterCurThread(name). The thread must call profilerUnregisterCurThread() before it exits."},
+	{"profilerUnregisterCurThread", (PyCFunction) profilerUnregisterCurThread, METH_NOARGS, "profilerUnregisterCurThread()"},
+	{"profilerStart", (PyCFunction) profilerStart, METH_VARARGS|METH_KEYWORDS,
+		"profilerStart(samplesPerSec=97, pythonStacks=False). Starts sampling the registered threads. "
+		"With pythonStacks, the PyEval_EvalFrameEx frames are replaced by file:function:line."},
+	{"profilerStop", (PyCFunction) profilerStop, METH_NOARGS, "profilerStop()"},
+	{"profilerIsRunning", (PyCFunction) profilerIsRunning, METH_NOARGS, "profilerIsRunning() -> bool"},
+	{"profilerReset", (PyCFunction) profilerReset, METH_NOARGS, "profilerReset(). Clears the collected samples."},
+	{"profilerDumpFolded", (PyCFunction) profilerDumpFolded, METH_NOARGS,
+		"profilerDumpFolded() -> str. The collected samples in the folded stack format (for flamegraph.pl)."},
+	{"gilStatsSetEnabled", (PyCFunction) gilStatsSetEnabled, METH_VARARGS,
+		"gilStatsSetEnabled(flag). Enables the GIL hold/wait time instrumentation of the GUI modules."},
+	{"gilStatsReset", (PyCFunction) gilStatsReset, METH_NOARGS, "gilStatsReset()"},
+	{"gilStats", (PyCFunction) gilStats, METH_VARARGS|METH_KEYWORDS,
+		"gilStats(maxSites=20) -> dict with 'threads' (list of dicts with name, threadId, "
+		"holdCount, holdTotalUs, holdP50Us, holdP99Us, holdMaxUs, and the same for wait) "
+		"and 'sites' (list of dicts with site, holdCount, holdTotalUs, holdMaxUs, waitTotalUs, "
+		"sorted by holdTotalUs)."},
+	{"eventTraceSetEnabled", (PyCFunction) eventTraceSetEnabled, METH_VARARGS,
+		"eventTraceSetEnabled(flag). Traces the work of each GUI input event until the main thread is idle again."},
+	{"eventTraceDump", (PyCFunction) eventTraceDump, METH_VARARGS,
+		"eventTraceDump(filename) -> number of spans. Writes the event trace ring buffer in the Chrome trace format."},
     {NULL, NULL}  /* sentinel */
 };
 
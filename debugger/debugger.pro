@@ -14,6 +14,8 @@ CONFIG += thread
 CONFIG -= qt
 QMAKE_CXXFLAGS += -std=c++11
 
+INCLUDEPATH += $$top_srcdir/app
+
 mac {
         QMAKE_LFLAGS += -undefined dynamic_lookup
 }
@@ -0,0 +1,120 @@
+//
+//  AppFuncs.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 01.03.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer_guiQt_AppFuncs_hpp__
+#define __MusicPlayer_guiQt_AppFuncs_hpp__
+
+#include <stddef.h>
+#include <dlfcn.h>
+
+// StartupTrace (app/StartupTrace.hpp) and EventTrace (app/EventTrace.hpp) live
+// in the main binary, thus we look them up via dlsym.
+// If it is not there (e.g. guiQt imported in the Python interpreter),
+// these are no-ops.
+
+struct AppFuncs {
+	void (*startupTraceBegin)(const char* name);
+	void (*startupTraceEnd)(const char* name);
+	void (*startupTraceMark)(const char* name);
+
+	int (*eventTraceIsEnabled)();
+	unsigned long (*eventTraceBeginEvent)(const char* name);
+	void (*eventTraceEndNotify)(unsigned long id);
+	unsigned long (*eventTraceCurrent)();
+	void (*eventTraceOnIdle)();
+	unsigned long (*eventTraceSetCurrent)(unsigned long id);
+	unsigned long (*eventTraceSpawn)();
+	unsigned long long (*eventTraceTimeUs)();
+	void (*eventTraceTaskEnd)(unsigned long id, const char* name, unsigned long long startUs);
+
+	AppFuncs() {
+		startupTraceBegin = (void(*)(const char*)) dlsym(RTLD_DEFAULT, "StartupTrace_begin");
+		startupTraceEnd = (void(*)(const char*)) dlsym(RTLD_DEFAULT, "StartupTrace_end");
+		startupTraceMark = (void(*)(const char*)) dlsym(RTLD_DEFAULT, "StartupTrace_mark");
+		if(!startupTraceBegin || !startupTraceEnd)
+			startupTraceBegin = startupTraceEnd = NULL;
+
+		eventTraceIsEnabled = (int(*)()) dlsym(RTLD_DEFAULT, "EventTrace_isEnabled");
+		eventTraceBeginEvent = (unsigned long(*)(const char*)) dlsym(RTLD_DEFAULT, "EventTrace_beginEvent");
+		eventTraceEndNotify = (void(*)(unsigned long)) dlsym(RTLD_DEFAULT, "EventTrace_endNotify");
+		eventTraceCurrent = (unsigned long(*)()) dlsym(RTLD_DEFAULT, "EventTrace_current");
+		eventTraceOnIdle = (void(*)()) dlsym(RTLD_DEFAULT, "EventTrace_onIdle");
+		eventTraceSetCurrent = (unsigned long(*)(unsigned long)) dlsym(RTLD_DEFAULT, "EventTrace_setCurrent");
+		eventTraceSpawn = (unsigned long(*)()) dlsym(RTLD_DEFAULT, "EventTrace_spawn");
+		eventTraceTimeUs = (unsigned long long(*)()) dlsym(RTLD_DEFAULT, "EventTrace_timeUs");
+		eventTraceTaskEnd = (void(*)(unsigned long, const char*, unsigned long long)) dlsym(RTLD_DEFAULT, "EventTrace_taskEnd");
+		// Only use it all or nothing. The ids must match.
+		if(!eventTraceIsEnabled || !eventTraceBeginEvent || !eventTraceEndNotify || !eventTraceCurrent || !eventTraceOnIdle
+		   || !eventTraceSetCurrent || !eventTraceSpawn || !eventTraceTimeUs || !eventTraceTaskEnd) {
+			eventTraceIsEnabled = NULL;
+			eventTraceBeginEvent = NULL;
+			eventTraceEndNotify = NULL;
+			eventTraceCurrent = NULL;
+			eventTraceOnIdle = NULL;
+			eventTraceSetCurrent = NULL;
+			eventTraceSpawn = NULL;
+			eventTraceTimeUs = NULL;
+			eventTraceTaskEnd = NULL;
+		}
+	}
+};
+
+static inline const AppFuncs& appFuncs() {
+	static const AppFuncs funcs;
+	return funcs;
+}
+
+static inline void appStartupTrace_begin(const char* name) {
+	if(appFuncs().startupTraceBegin) appFuncs().startupTraceBegin(name);
+}
+
+static inline void appStartupTrace_end(const char* name) {
+	if(appFuncs().startupTraceEnd) appFuncs().startupTraceEnd(name);
+}
+
+static inline void appStartupTrace_mark(const char* name) {
+	if(appFuncs().startupTraceMark) appFuncs().startupTraceMark(name);
+}
+
+static inline int appEventTrace_isEnabled() {
+	return appFuncs().eventTraceIsEnabled ? appFuncs().eventTraceIsEnabled() : 0;
+}
+
+static inline unsigned long appEventTrace_beginEvent(const char* name) {
+	return appFuncs().eventTraceBeginEvent ? appFuncs().eventTraceBeginEvent(name) : 0;
+}
+
+static inline void appEventTrace_endNotify(unsigned long id) {
+	if(appFuncs().eventTraceEndNotify) appFuncs().eventTraceEndNotify(id);
+}
+
+static inline unsigned long appEventTrace_current() {
+	return appFuncs().eventTraceCurrent ? appFuncs().eventTraceCurrent() : 0;
+}
+
+static inline void appEventTrace_onIdle() {
+	if(appFuncs().eventTraceOnIdle) appFuncs().eventTraceOnIdle();
+}
+
+static inline unsigned long appEventTrace_setCurrent(unsigned long id) {
+	return appFuncs().eventTraceSetCurrent ? appFuncs().eventTraceSetCurrent(id) : 0;
+}
+
+static inline unsigned long appEventTrace_spawn() {
+	return appFuncs().eventTraceSpawn ? appFuncs().eventTraceSpawn() : 0;
+}
+
+static inline unsigned long long appEventTrace_timeUs() {
+	return appFuncs().eventTraceTimeUs ? appFuncs().eventTraceTimeUs() : 0;
+}
+
+static inline void appEventTrace_taskEnd(unsigned long id, const char* name, unsigned long long startUs) {
+	if(appFuncs().eventTraceTaskEnd) appFuncs().eventTraceTaskEnd(id, name, startUs);
+}
+
+#endif
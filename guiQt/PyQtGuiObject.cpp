@@ -11,45 +11,68 @@
 #include "PyThreading.hpp"
 #include "QtBaseWidget.hpp"
 #include "QtApp.hpp"
+#include "GILInstrument.hpp"
 
 
+// Main thread only. A control has either a widget or a painted item.
+static bool getGeometry(PyQtGuiObject* obj, QPoint& pos, QSize& size) {
+	QtPaintedItem::Ref item = obj->item.lock();
+	if(item) {
+		pos = item->geometry.topLeft();
+		size = item->geometry.size();
+		return true;
+	}
+	QtBaseWidget::ScopedRef widget(obj->widget);
+	if(!widget) return false;
+	pos = widget->pos();
+	size = widget->size();
+	return true;
+}
+
+// Main thread only.
+static void setGeometry(PyQtGuiObject* obj, const Vec* pos, const Vec* size) {
+	QtPaintedItem::Ref item = obj->item.lock();
+	if(item) {
+		QRect r = item->geometry;
+		if(pos) r.moveTo(pos->x, pos->y);
+		if(size) r.setSize(QSize(size->x, size->y));
+		item->setGeometry(r);
+		return;
+	}
+	QtBaseWidget::ScopedRef widget(obj->widget);
+	if(!widget) return;
+	if(pos)
+		widget->move(pos->x, pos->y);
+	if(size)
+		widget->resize(size->x, size->y);
+}
+
 static Vec imp_get_pos(GuiObject* obj) {
 	Vec ret;
 	execInMainThread_sync([&]() {
-		QtBaseWidget::ScopedRef widget(((PyQtGuiObject*) obj)->widget);
-		if(widget) {
-			QPoint pos = widget->pos();
+		QPoint pos; QSize size;
+		if(getGeometry((PyQtGuiObject*) obj, pos, size)) {
 			ret.x = pos.x();
 			ret.y = pos.y();
 		}
-	});
+	}, QtMainLane_Layout);
 	return ret;
 }
 
 static Vec imp_get_size(GuiObject* obj) {
 	Vec ret;
 	execInMainThread_sync([&]() {
-		QtBaseWidget::ScopedRef widget(((PyQtGuiObject*) obj)->widget);
-		if(widget) {
-			QSize size = widget->size();
+		QPoint pos; QSize size;
+		if(getGeometry((PyQtGuiObject*) obj, pos, size)) {
 			ret.x = size.width();
 			ret.y = size.height();
 		}
-	});
+	}, QtMainLane_Layout);
 	return ret;
 }
 
 static Vec imp_get_innnerSize(GuiObject* obj) {
-	Vec ret;
-	execInMainThread_sync([&]() {
-		QtBaseWidget::ScopedRef widget(((PyQtGuiObject*) obj)->widget);
-		if(widget) {
-			QSize size = widget->size();
-			ret.x = size.width();
-			ret.y = size.height();
-		}
-	});
-	return ret;
+	return imp_get_size(obj);
 }
 
 static Autoresize imp_get_autoresize(GuiObject* obj) {
@@ -58,25 +81,42 @@ static Autoresize imp_get_autoresize(GuiObject* obj) {
 
 static void imp_set_pos(GuiObject* obj, const Vec& v) {
 	execInMainThread_sync([&]() {
-		QtBaseWidget::ScopedRef widget(((PyQtGuiObject*) obj)->widget);
-		if(widget)
-			widget->move(v.x, v.y);
-	});
+		setGeometry((PyQtGuiObject*) obj, &v, NULL);
+	}, QtMainLane_Layout);
 }
 
 static void imp_set_size(GuiObject* obj, const Vec& v) {
 	execInMainThread_sync([&]() {
-		QtBaseWidget::ScopedRef widget(((PyQtGuiObject*) obj)->widget);
-		if(widget) {
-			widget->resize(v.x, v.y);
-		}
-	});
+		setGeometry((PyQtGuiObject*) obj, NULL, &v);
+	}, QtMainLane_Layout);
 }
 
 static void imp_set_autoresize(GuiObject* obj, const Autoresize& r) {
 	((PyQtGuiObject*) obj)->autoresize = r;
 }
 
+// Used by geometry transactions. See GuiObjectGeometry.cpp.
+static void imp_get_geometryBatch(GuiObject* const* objs, GuiGeometry* out, size_t n) {
+	execInMainThread_sync([&]() {
+		for(size_t i = 0; i < n; ++i) {
+			QPoint pos; QSize size;
+			if(!getGeometry((PyQtGuiObject*) objs[i], pos, size)) continue;
+			out[i].pos = Vec(pos.x(), pos.y());
+			out[i].size = Vec(size.width(), size.height());
+			out[i].innerSize = out[i].size;
+		}
+	}, QtMainLane_Layout);
+}
+
+static void imp_set_geometryBatch(const GuiGeometryUpdate* updates, size_t n) {
+	execInMainThread_sync([&]() {
+		for(size_t i = 0; i < n; ++i) {
+			const GuiGeometryUpdate& u = updates[i];
+			setGeometry((PyQtGuiObject*) u.obj, u.setPos ? &u.pos : NULL, u.setSize ? &u.size : NULL);
+		}
+	}, QtMainLane_Layout);
+}
+
 static void imp_addChild(GuiObject* obj, GuiObject* child) {
 	if(QtApp::isFork()) {
 		printf("PyQtGuiObject::imp_addChild called in fork\n");
@@ -84,7 +124,7 @@ static void imp_addChild(GuiObject* obj, GuiObject* child) {
 	}
 
 	{
-		PyScopedGIL gil;
+		PyScopedGILInstr gil(GIL_SITE);
 		if(!PyType_IsSubtype(Py_TYPE(child), &QtGuiObject_Type)) {
 			PyErr_Format(PyExc_ValueError, "QtGuiObject.addChild: we expect a QtGuiObject");
 			return;
@@ -92,9 +132,15 @@ static void imp_addChild(GuiObject* obj, GuiObject* child) {
 	}
 	
 	execInMainThread_sync([&]() {
+		QtPaintedItem::Ref childItem = ((PyQtGuiObject*) child)->item.lock();
+		if(childItem) {
+			QtBaseWidget::ScopedRef widgetRef(((PyQtGuiObject*) obj)->widget);
+			if(widgetRef) widgetRef->addPaintedItem(childItem);
+			return;
+		}
 		auto childWidget = ((PyQtGuiObject*) child)->widget;
 		((PyQtGuiObject*) obj)->addChild(childWidget);
-	});
+	}, QtMainLane_Layout);
 }
 
 static void imp_meth_updateContent(GuiObject* obj) {
@@ -119,7 +165,7 @@ QtBaseWidget::WeakRef PyQtGuiObject::getParentWidget() {
 		return QtBaseWidget::WeakRef();
 	}
 
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 	if(parent == NULL)
 		return QtBaseWidget::WeakRef();
 	if(PyType_IsSubtype(Py_TYPE(parent), &QtGuiObject_Type))
@@ -141,12 +187,17 @@ void PyQtGuiObject::addChild(QtBaseWidget::WeakRef child) {
 		QtBaseWidget::ScopedRef childRef(child);
 		if(!childRef) return;
 		childRef->setParent(widgetRef.ptr);
-	});
+	}, QtMainLane_Layout);
 }
 
 void PyQtGuiObject::updateContent() {
 	// Must not have the Python GIL.
 	execInMainThread_sync([&]() {	
+		QtPaintedItem::Ref itemRef = item.lock();
+		if(itemRef) {
+			itemRef->updateContent();
+			return;
+		}
 		QtBaseWidget::ScopedRef widgetRef(widget);
 		if(!widgetRef) return;
 		widgetRef->updateContent();
@@ -204,20 +255,22 @@ int PyQtGuiObject::init(PyObject* args, PyObject* kwds) {
 	set_pos = imp_set_pos;
 	set_size = imp_set_size;
 	set_autoresize = imp_set_autoresize;
+	get_geometryBatch = imp_get_geometryBatch;
+	set_geometryBatch = imp_set_geometryBatch;
 	meth_addChild = imp_addChild;
 	meth_updateContent = imp_meth_updateContent;
 	meth_childIter = imp_meth_childIter;
 	return 0;
 }
 
-PyObject* PyQtGuiObject::getattr(const char* key) {
+PyObject* PyQtGuiObject::getattro(PyObject* key) {
 	// fallthrough for now
-	return Py_TYPE(this)->tp_base->tp_getattr((PyObject*) this, (char*) key);
+	return Py_TYPE(this)->tp_base->tp_getattro((PyObject*) this, key);
 }
 
-int PyQtGuiObject::setattr(const char* key, PyObject* value) {
+int PyQtGuiObject::setattro(PyObject* key, PyObject* value) {
 	// fallthrough for now
-	return Py_TYPE(this)->tp_base->tp_setattr((PyObject*) this, (char*) key, value);
+	return Py_TYPE(this)->tp_base->tp_setattro((PyObject*) this, key, value);
 }
 
 
@@ -14,6 +14,7 @@
 #include <QPointer>
 #include "GuiObject.hpp"
 #include "QtBaseWidget.hpp"
+#include "QtPaintedItem.hpp"
 
 extern PyTypeObject QtGuiObject_Type;
 
@@ -29,11 +30,13 @@ struct QtBaseWidget;
 
 struct PyQtGuiObject : GuiObject {
 	int init(PyObject* args, PyObject* kwds);
-	PyObject* getattr(const char* key);
-	int setattr(const char* key, PyObject* value);
+	PyObject* getattro(PyObject* key);
+	int setattro(PyObject* key, PyObject* value);
 
 	QtBaseWidget::WeakRef widget;
 	QtBaseWidget::WeakRef getParentWidget();
+	// Instead of the widget for the lightweight controls. See QtPaintedItem.hpp.
+	QtPaintedItem::WeakRef item;
 
 	Autoresize autoresize;
 	
@@ -11,6 +11,19 @@
 #include "Builders.hpp"
 #include "FunctionWrapper.hpp"
 #include "QtMenu.hpp"
+#include "QtListWidget.hpp"
+#include "QtPaintedItem.hpp"
+#include "GILInstrument.hpp"
+#include "AppFuncs.hpp"
+
+#ifdef MUSICPLAYER_BENCHMARKS
+// QtBenchmark.cpp
+PyObject* guiQt_benchmarkOpenWindow(PyObject* self, PyObject* args);
+PyObject* guiQt_benchmarkWaitIdle(PyObject* self, PyObject* args);
+PyObject* guiQt_benchmarkListRowCount(PyObject* self, PyObject* args);
+PyObject* guiQt_benchmarkListScroll(PyObject* self, PyObject* args, PyObject* kws);
+PyObject* guiQt_benchmarkWidgetCount(PyObject* self);
+#endif
 
 
 static PyObject* QtGuiObject_alloc(PyTypeObject *type, Py_ssize_t nitems) {
@@ -53,12 +66,12 @@ static int QtGuiObject_init(PyObject* self, PyObject* args, PyObject* kwds) {
 	return ((PyQtGuiObject*) self)->init(args, kwds);
 }
 
-static PyObject* QtGuiObject_getattr(PyObject* self, char* key) {
-	return ((PyQtGuiObject*) self)->getattr(key);
+static PyObject* QtGuiObject_getattro(PyObject* self, PyObject* key) {
+	return ((PyQtGuiObject*) self)->getattro(key);
 }
 
-static int QtGuiObject_setattr(PyObject* self, char* key, PyObject* value) {
-	return ((PyQtGuiObject*) self)->setattr(key, value);
+static int QtGuiObject_setattro(PyObject* self, PyObject* key, PyObject* value) {
+	return ((PyQtGuiObject*) self)->setattro(key, value);
 }
 
 // http://docs.python.org/2/c-api/typeobj.html
@@ -70,8 +83,8 @@ PyTypeObject QtGuiObject_Type = {
 	0,	// itemsize
 	QtGuiObject_dealloc,		/*tp_dealloc*/
 	0,                  /*tp_print*/
-	QtGuiObject_getattr,		/*tp_getattr*/
-	QtGuiObject_setattr,		/*tp_setattr*/
+	0,		/*tp_getattr*/
+	0,		/*tp_setattr*/
 	0,                  /*tp_compare*/
 	0,					/*tp_repr*/
 	0,                  /*tp_as_number*/
@@ -80,8 +93,8 @@ PyTypeObject QtGuiObject_Type = {
 	0,					/*tp_hash */
 	0, // tp_call
 	0, // tp_str
-	0, // tp_getattro
-	0, // tp_setattro
+	QtGuiObject_getattro, // tp_getattro
+	QtGuiObject_setattro, // tp_setattro
 	0, // tp_as_buffer
 	Py_TPFLAGS_HAVE_CLASS|Py_TPFLAGS_HAVE_WEAKREFS|Py_TPFLAGS_HAVE_GC, // flags
 	"QtGuiObject type", // doc
@@ -119,8 +132,9 @@ py_guiQt_main(PyObject* self) {
 		
 	int ret = 0;
 	{
-		PyScopedGIUnlock giunlock;
+		PyScopedGIUnlockInstr giunlock(GIL_SITE);
 
+		appStartupTrace_begin("Qt init");
 		QtApp::prepareInit();
 
 		// Keep it static. Noone should access it when we return
@@ -128,15 +142,19 @@ py_guiQt_main(PyObject* self) {
 		static QtApp app;
 		
 		setupMenu();
+		appStartupTrace_end("Qt init");
 
-		if(!app.openMainWindow()) {
-			PyScopedGIL gil;
+		appStartupTrace_begin("open main window");
+		bool mainWindowOk = app.openMainWindow();
+		appStartupTrace_end("open main window");
+		if(!mainWindowOk) {
+			PyScopedGILInstr gil(GIL_SITE);
 			PyErr_SetString(PyExc_SystemError, "guiQt.main: failed to create main window");
 			return NULL;			
 		}
 		
 		{
-			PyScopedGIL gil;
+			PyScopedGILInstr gil(GIL_SITE);
 			PyObject* initRet = handleModuleCommand("main", "handleApplicationInit", NULL);
 			if(!initRet) {
 				PyErr_SetString(PyExc_SystemError, "guiQt.main: main.handleApplicationInit() error");
@@ -158,9 +176,9 @@ py_guiQt_main(PyObject* self) {
 PyObject *
 py_guiQt_quit(PyObject* self) {
 	(void)self;
-	Py_BEGIN_ALLOW_THREADS
+	GIL_BEGIN_ALLOW_THREADS
 	qApp->quit();
-	Py_END_ALLOW_THREADS
+	GIL_END_ALLOW_THREADS
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -169,9 +187,9 @@ py_guiQt_quit(PyObject* self) {
 PyObject*
 py_guiQt_updateControlMenu(PyObject* self) {
 	(void)self;
-	Py_BEGIN_ALLOW_THREADS
+	GIL_BEGIN_ALLOW_THREADS
 	//[[NSApp delegate] updateControlMenu];
-	Py_END_ALLOW_THREADS
+	GIL_END_ALLOW_THREADS
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -261,8 +279,10 @@ py_guiQt_buildControl(PyObject* self, PyObject* args, PyObject* kws) {
 		return NULL;
 	}
 	
+	// The builder sets up the childs and resizes the new widget.
+	int transaction = parent->suspendGeometryTransaction();
 	{
-		PyScopedGIUnlock gunlock;
+		PyScopedGIUnlockInstr gunlock(GIL_SITE);
 		execInMainThread_sync([&]() {
 			bool res = builderFunc(control);
 			if(!res)
@@ -270,18 +290,103 @@ py_guiQt_buildControl(PyObject* self, PyObject* args, PyObject* kws) {
 				printf("guiQt.buildControl: warning, returned error\n");		
 		});
 	}
+	parent->resumeGeometryTransaction(transaction);
 	
 	// forward control
 	return (PyObject*) control;
 }
 
 
+PyObject*
+py_guiQt_listPaintStats(PyObject* self) {
+	(void)self;
+	return Py_BuildValue(
+		"{s:k,s:k,s:k,s:k,s:k}",
+		"paints", qtListPaintStats.paints.load(),
+		"placeholderPaints", qtListPaintStats.placeholderPaints.load(),
+		"widgetPaints", qtListPaintStats.widgetPaints.load(),
+		"rowSetups", qtListPaintStats.rowSetups.load(),
+		"gilInPaint", qtListPaintStats.gilInPaint.load());
+}
+
+
+PyObject*
+py_guiQt_mainExecutorStats(PyObject* self, PyObject* args, PyObject* kws) {
+	(void)self;
+	PyObject* resetObj = Py_False;
+	static const char* kwlist[] = {"reset", NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kws, "|O:mainExecutorStats", (char**) kwlist, &resetObj))
+		return NULL;
+	int reset = PyObject_IsTrue(resetObj);
+	if(reset < 0) return NULL;
+
+	QtMainExecutorStats stats;
+	QtMainExecutor::getStats(stats, reset != 0);
+
+	static const char* laneNames[QtMainLane_Count] = {"input", "layout", "content"};
+	PyObject* lanes = PyDict_New();
+	if(!lanes) return NULL;
+	for(int i = 0; i < QtMainLane_Count; ++i) {
+		const QtMainLaneStats& l = stats.lanes[i];
+		PyObject* d = Py_BuildValue(
+			"{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+			"enqueued", l.enqueued,
+			"depth", l.depth,
+			"maxDepth", l.maxDepth,
+			"count", l.count,
+			"waitTotalUs", l.waitTotalUs,
+			"waitMaxUs", l.waitMaxUs,
+			"execTotalUs", l.execTotalUs,
+			"execMaxUs", l.execMaxUs);
+		if(!d || PyDict_SetItemString(lanes, laneNames[i], d) != 0) {
+			Py_XDECREF(d);
+			Py_DECREF(lanes);
+			return NULL;
+		}
+		Py_DECREF(d);
+	}
+	PyObject* res = Py_BuildValue(
+		"{s:N,s:K,s:K,s:l}",
+		"lanes", lanes,
+		"drains", stats.drains,
+		"slicesOverBudget", stats.slicesOverBudget,
+		"sliceBudgetUs", QtMainExecutor::kSliceBudgetUs);
+	return res;
+}
+
+PyObject*
+py_guiQt_setPaintedItems(PyObject* self, PyObject* args) {
+	(void)self;
+	PyObject* enabledObj = NULL;
+	if(!PyArg_ParseTuple(args, "O:setPaintedItems", &enabledObj))
+		return NULL;
+	int enabled = PyObject_IsTrue(enabledObj);
+	if(enabled < 0) return NULL;
+	GIL_BEGIN_ALLOW_THREADS
+	execInMainThread_sync([=]() { QtPaintedItem::setEnabled(enabled != 0); });
+	GIL_END_ALLOW_THREADS
+	Py_INCREF(Py_None);
+	return Py_None;
+}
 
 static PyMethodDef module_methods[] = {
 	{"main",	(PyCFunction)py_guiQt_main,	METH_NOARGS,	"overtakes main()"},
 	{"quit",	(PyCFunction)py_guiQt_quit,	METH_NOARGS,	"quit application"},
 	{"updateControlMenu",	(PyCFunction)py_guiQt_updateControlMenu,	METH_NOARGS,	""},
 	{"buildControl",  (PyCFunction)py_guiQt_buildControl, METH_VARARGS|METH_KEYWORDS, ""},
+	{"listPaintStats",	(PyCFunction)py_guiQt_listPaintStats,	METH_NOARGS,	"list row paint counters"},
+	{"mainExecutorStats",	(PyCFunction)py_guiQt_mainExecutorStats,	METH_VARARGS|METH_KEYWORDS,
+		"mainExecutorStats(reset=False) -> dict. per lane queue depth, wait and exec times of the main thread queue"},
+	{"setPaintedItems",	(PyCFunction)py_guiQt_setPaintedItems,	METH_VARARGS,
+		"setPaintedItems(enabled). whether new OneLineText/ClickableLabel controls are painted by their container (default) or are own widgets"},
+#ifdef MUSICPLAYER_BENCHMARKS
+	{"benchmarkOpenWindow",	(PyCFunction)guiQt_benchmarkOpenWindow,	METH_VARARGS,	"benchmarkOpenWindow(name) -> bool. see tools/benchmark-guiqt.py"},
+	{"benchmarkWaitIdle",	(PyCFunction)guiQt_benchmarkWaitIdle,	METH_VARARGS,	"benchmarkWaitIdle([maxRounds]) -> rounds. waits until the main thread queue is empty"},
+	{"benchmarkListRowCount",	(PyCFunction)guiQt_benchmarkListRowCount,	METH_VARARGS,	"benchmarkListRowCount(control) -> int"},
+	{"benchmarkListScroll",	(PyCFunction)guiQt_benchmarkListScroll,	METH_VARARGS|METH_KEYWORDS,
+		"benchmarkListScroll(control, frames=100) -> list of frame times in microsecs"},
+	{"benchmarkWidgetCount",	(PyCFunction)guiQt_benchmarkWidgetCount,	METH_NOARGS,	"benchmarkWidgetCount() -> number of QWidgets"},
+#endif
 	{NULL,				NULL}	/* sentinel */
 };
 
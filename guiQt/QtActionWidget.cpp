@@ -2,6 +2,7 @@
 #include "QtActionWidget.hpp"
 #include "Builders.hpp"
 #include "PyUtils.h"
+#include "GILInstrument.hpp"
 
 RegisterControl(Action)
 
@@ -27,7 +28,7 @@ void QtActionWidget::updateContent() {
 }
 
 void QtActionWidget::updateTitle() {
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 	PyQtGuiObject* control = getControl();
 	if(!control) return;
 	
@@ -58,7 +59,7 @@ void QtActionWidget::resizeEvent(QResizeEvent* ev) {
 }
 
 void QtActionWidget::onClick() {
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 	PyQtGuiObject* control = getControl();
 	if(!control) return;
 
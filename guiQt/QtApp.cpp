@@ -6,10 +6,13 @@
 #include "PyThreading.hpp"
 #include "PyQtGuiObject.hpp"
 #include "QtBaseWidget.hpp"
+#include "GILInstrument.hpp"
+#include "AppFuncs.hpp"
 #include <QAction>
 #include <QTextCodec>
 #include <QThread>
 #include <QApplication>
+#include <QAbstractEventDispatcher>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -68,6 +71,37 @@ QtApp::QtApp() : QApplication(dummy_argc, dummy_argv) {
 	this->setQuitOnLastWindowClosed(false);
 	
 	connect(this, SIGNAL(aboutToQuit()), this, SLOT(handleApplicationQuit()));
+	connect(QAbstractEventDispatcher::instance(), SIGNAL(aboutToBlock()), this, SLOT(handleAboutToBlock()));
+}
+
+// The user input events which we trace. NULL otherwise.
+static const char* inputEventName(QEvent::Type type) {
+	switch(type) {
+		case QEvent::MouseButtonPress: return "MouseButtonPress";
+		case QEvent::MouseButtonRelease: return "MouseButtonRelease";
+		case QEvent::MouseButtonDblClick: return "MouseButtonDblClick";
+		case QEvent::KeyPress: return "KeyPress";
+		case QEvent::KeyRelease: return "KeyRelease";
+		case QEvent::Wheel: return "Wheel";
+		case QEvent::Shortcut: return "Shortcut";
+		case QEvent::Close: return "Close";
+		default: return NULL;
+	}
+}
+
+bool QtApp::notify(QObject* receiver, QEvent* event) {
+	const char* name = appEventTrace_isEnabled() ? inputEventName(event->type()) : NULL;
+	// Qt forwards unhandled input events to the parents via notify(). That is still the same event.
+	if(!name || appEventTrace_current())
+		return QApplication::notify(receiver, event);
+	unsigned long id = appEventTrace_beginEvent(name);
+	bool res = QApplication::notify(receiver, event);
+	appEventTrace_endNotify(id);
+	return res;
+}
+
+void QtApp::handleAboutToBlock() {
+	appEventTrace_onIdle();
 }
 
 bool QtApp::isFork() {
@@ -75,7 +109,7 @@ bool QtApp::isFork() {
 }
 
 void QtApp::handleApplicationQuit() {
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 	
 	printf("about to quit ...\n");
 	
@@ -116,7 +150,7 @@ bool QtApp::openMainWindow() {
 bool QtApp::openWindow(const std::string& name) {
 	assert(QThread::currentThread() == qApp->thread());
 	
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 
 	PyObject* rootObj = handleModuleCommand("gui", "RootObjs.__getitem__", "(s)", name.c_str());
 	if(!rootObj) return false; // Python errs already handled in handleModuleCommand
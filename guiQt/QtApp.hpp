@@ -6,6 +6,7 @@
 #include <QMetaMethod>
 #include <boost/function.hpp>
 #include <assert.h>
+#include "QtMainExecutor.hpp"
 
 typedef boost::function<void(void)> QtFunc;
 
@@ -19,6 +20,9 @@ public:
 	
 	inline static QtApp* instance() { return (QtApp*) qApp; }
 	static bool isFork(); // checked via pid
+
+	// Traces the input events if enabled. See app/EventTrace.hpp.
+	virtual bool notify(QObject* receiver, QEvent* event);
 	
 signals:
 	
@@ -35,6 +39,7 @@ public:
 	
 private slots:
 	void handleApplicationQuit();
+	void handleAboutToBlock();
 	
 public slots:
 	void openWindowViaMenu(); // gets window from sender()
@@ -58,19 +63,19 @@ public slots:
 // WARNING: Python GIL must not be held when calling this.
 // When we queue the call to the main thread and the main thread
 // executes some other Python code earlier, it will deadlock.
+// See QtMainExecutor.hpp about the lanes.
 static inline
-void execInMainThread_sync(QtFunc func) {
+void execInMainThread_sync(QtFunc func, QtMainLane lane = QtMainLane_Content) {
 	assert(!QtApp::isFork());
 	if(qApp->thread() == QThread::currentThread())
 		func();
-	else {
-		((QtApp*) qApp)->invokeGenericExec(func, Qt::BlockingQueuedConnection);
-	}
+	else
+		QtMainExecutor::sync(func, lane);
 }
 
 static inline
-void execInMainThread_async(QtFunc func) {
-	((QtApp*) qApp)->invokeGenericExec(func, Qt::QueuedConnection);
+void execInMainThread_async(QtFunc func, QtMainLane lane = QtMainLane_Content) {
+	QtMainExecutor::async(func, lane);
 }
 
 #endif
@@ -7,11 +7,21 @@
 //
 
 #include "QtBaseWidget.hpp"
+#include "QtPaintedItem.hpp"
 #include "PyQtGuiObject.hpp"
 #include "PythonHelpers.h"
 #include "PyThreading.hpp"
+#include "GILInstrument.hpp"
+#include "AppFuncs.hpp"
 #include <QThread>
 #include <QApplication>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QMouseEvent>
+#include <QContextMenuEvent>
+#include <QMenu>
+#include <QClipboard>
+#include <algorithm>
 
 QtBaseWidget::ScopedRef::ScopedRef(const WeakRef& ref) : ptr(NULL), lock(true) {
    _ref = ref.ref.lock();
@@ -39,8 +49,12 @@ QtBaseWidget::~QtBaseWidget() {
 	selfRef.reset();
 	
 	{
-		PyScopedGIL gil;
+		PyScopedGILInstr gil(GIL_SITE);
 		Py_CLEAR(controlRef);
+		// The controls only have weak refs, thus this deletes the items.
+		for(auto& item : paintedItems)
+			item->container = NULL;
+		paintedItems.clear();
 	}
 }
 
@@ -53,7 +67,7 @@ QtBaseWidget::QtBaseWidget(PyQtGuiObject* control) :
 	control->widget = QtBaseWidget::WeakRef(*this);	
 		
 	{
-		PyScopedGIL gil;
+		PyScopedGILInstr gil(GIL_SITE);
 		controlRef = (PyWeakReference*) PyWeakref_NewRef((PyObject*) control, NULL);
 		canHaveFocus = attrChain_bool_default(control->attr, "canHaveFocus", false);
 	}
@@ -100,22 +114,88 @@ PyQtGuiObject* QtBaseWidget::getControl() {
 }
 */
 
+void QtBaseWidget::addPaintedItem(const boost::shared_ptr<QtPaintedItem>& item) {
+	if(item->container == this) return;
+	if(item->container) {
+		// E.g. the control got another parent.
+		// Take a copy of the ref first. We might have gotten a ref to the entry which we erase.
+		boost::shared_ptr<QtPaintedItem> itemRef(item);
+		QtBaseWidget* old = itemRef->container;
+		old->paintedItems.erase(std::remove(old->paintedItems.begin(), old->paintedItems.end(), itemRef), old->paintedItems.end());
+		old->update(itemRef->geometry);
+		itemRef->container = NULL;
+		addPaintedItem(itemRef);
+		return;
+	}
+	paintedItems.push_back(item);
+	item->container = this;
+	if(item->clickable)
+		setMouseTracking(true); // for the hover
+	update(item->geometry);
+}
+
+QtPaintedItem* QtBaseWidget::paintedItemAt(const QPoint& pos) {
+	for(auto it = paintedItems.rbegin(); it != paintedItems.rend(); ++it) {
+		if((*it)->geometry.contains(pos))
+			return it->get();
+	}
+	return NULL;
+}
+
 void QtBaseWidget::mousePressEvent(QMouseEvent* ev) {
+	QtPaintedItem* item = paintedItemAt(ev->pos());
+	if(item && item->clickable) {
+		item->click();
+		ev->accept();
+		return;
+	}
+
 	QWidget::mousePressEvent(ev);
 	
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 	PyQtGuiObject* control = getControl();
 	if(control) control->handleCurSelectedSong();
 	Py_XDECREF(control);
 }
 
+void QtBaseWidget::mouseMoveEvent(QMouseEvent* ev) {
+	if(!paintedItems.empty()) {
+		QtPaintedItem* hoverItem = paintedItemAt(ev->pos());
+		for(auto& item : paintedItems)
+			item->setHover(item->clickable && item.get() == hoverItem);
+	}
+	QWidget::mouseMoveEvent(ev);
+}
+
+// The painted items have no QLineEdit, thus there is no text selection.
+// At least allow to copy their text, like via the QLineEdit context menu.
+void QtBaseWidget::contextMenuEvent(QContextMenuEvent* ev) {
+	QtPaintedItem* item = paintedItemAt(ev->pos());
+	if(!item || item->text.isEmpty()) {
+		QWidget::contextMenuEvent(ev);
+		return;
+	}
+	QString text = item->text; // the item might be gone after exec()
+	QMenu menu(this);
+	QAction* copyAction = menu.addAction("Copy");
+	if(menu.exec(ev->globalPos()) == copyAction)
+		QApplication::clipboard()->setText(text);
+	ev->accept();
+}
+
+void QtBaseWidget::leaveEvent(QEvent* ev) {
+	for(auto& item : paintedItems)
+		item->setHover(false);
+	QWidget::leaveEvent(ev);
+}
+
 void QtBaseWidget::resizeEvent(QResizeEvent* ev) {
 	if(handleResize) return; // avoid infinite recursion
 	handleResize = true;
 	
 	QWidget::resizeEvent(ev);
 	
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 	PyQtGuiObject* control = getControl();
 	if(control) control->layout();
 	Py_XDECREF(control);
@@ -128,7 +208,7 @@ void QtBaseWidget::resizeEvent(QResizeEvent* ev) {
 {
 	bool res = false;
 	
-	PyGILState_STATE gstate = PyGILState_Ensure();
+	PyGILState_STATE gstate = GILInstrument_ensure(GIL_SITE);
 	CocoaGuiObject* control = [self getControl];
 	PyObject* subjectObj = control ? control->subjectObject : NULL;
 	Py_XINCREF(subjectObj);
@@ -169,15 +249,25 @@ void QtBaseWidget::resizeEvent(QResizeEvent* ev) {
 	}
 	Py_XDECREF(subjectObj);
 	Py_XDECREF(control);
-	PyGILState_Release(gstate);
+	GILInstrument_release(gstate);
 
 	if(!res)
 		[super mouseDragged:ev];
 }
 */
 
+void QtBaseWidget::notifyContentChanged() {
+	QtBaseWidget* parent = dynamic_cast<QtBaseWidget*>(parentWidget());
+	if(parent) parent->childContentChanged(this);
+}
+
+void QtBaseWidget::childContentChanged(QtBaseWidget* child) {
+	(void)child;
+	notifyContentChanged();
+}
+
 void QtBaseWidget::updateContent() {	
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 	
 	PyObject* control = (PyObject*) getControl();
 	if(!control) return;
@@ -192,3 +282,20 @@ void QtBaseWidget::updateContent() {
 	Py_DECREF(control);
 }
 
+void QtBaseWidget::paintEvent(QPaintEvent* ev) {
+	// Main thread only, thus no need for an atomic.
+	static bool firstPaint = true;
+	if(firstPaint) {
+		firstPaint = false;
+		appStartupTrace_mark("first window paint");
+	}
+	QWidget::paintEvent(ev);
+
+	if(!paintedItems.empty()) {
+		QPainter p(this);
+		for(auto& item : paintedItems) {
+			if(ev->rect().intersects(item->geometry))
+				item->paint(p);
+		}
+	}
+}
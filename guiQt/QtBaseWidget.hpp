@@ -15,10 +15,12 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
 #include <assert.h>
+#include <vector>
 #include "PyThreading.hpp"
 
 struct GuiObject;
 struct PyQtGuiObject;
+struct QtPaintedItem;
 
 // This is the native Qt object.
 // It is handled on the Python side via the
@@ -77,11 +79,27 @@ struct QtBaseWidget : QWidget {
 	virtual void updateContent();
 	typedef boost::function<void(GuiObject*, bool& stop)> ChildIterCallback;
 	virtual void childIter(ChildIterCallback) {}
+
+	// Main thread only. Widgets call notifyContentChanged() when their
+	// displayed content changed. By default, the parents just forward it.
+	// QtListWidget uses it to refresh its row snapshots.
+	void notifyContentChanged();
+	virtual void childContentChanged(QtBaseWidget* child);
 	
+	// The painted child items, see QtPaintedItem.hpp. Main thread only.
+	// We own them. They are painted in this order, on top of our own painting.
+	std::vector<boost::shared_ptr<QtPaintedItem> > paintedItems;
+	void addPaintedItem(const boost::shared_ptr<QtPaintedItem>& item);
+	QtPaintedItem* paintedItemAt(const QPoint& pos); // topmost
+
 	virtual void mousePressEvent(QMouseEvent*);
+	virtual void mouseMoveEvent(QMouseEvent*);
+	virtual void leaveEvent(QEvent*);
+	virtual void contextMenuEvent(QContextMenuEvent*);
 	
 	bool handleResize;
 	virtual void resizeEvent(QResizeEvent*);
+	virtual void paintEvent(QPaintEvent*);
 	// TODO: dragging
 };
 
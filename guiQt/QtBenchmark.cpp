@@ -0,0 +1,140 @@
+//
+//  QtBenchmark.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 26.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+// Import Python first, see PythonInterface.cpp.
+#include <Python.h>
+#include <vector>
+#include <string>
+#include "QtApp.hpp"
+#include "QtListWidget.hpp"
+#include "PyQtGuiObject.hpp"
+#include "GILInstrument.hpp"
+#include <QApplication>
+
+// Helpers for tools/benchmark-guiqt.py, which drives the real widgets headless
+// (QT_QPA_PLATFORM=offscreen). Exposed as guiQt.benchmark*().
+// All of them release the GIL and do their work in the main thread.
+// Only in builds with benchmarks, see guiQt.pro.
+
+#ifdef MUSICPLAYER_BENCHMARKS
+
+static bool checkControl(PyObject* control, const char* funcName) {
+	if(!PyType_IsSubtype(Py_TYPE(control), &QtGuiObject_Type)) {
+		PyErr_Format(PyExc_TypeError, "guiQt.%s: expected a QtGuiObject", funcName);
+		return false;
+	}
+	return true;
+}
+
+PyObject* guiQt_benchmarkOpenWindow(PyObject* self, PyObject* args) {
+	const char* name = NULL;
+	if(!PyArg_ParseTuple(args, "s:benchmarkOpenWindow", &name))
+		return NULL;
+	std::string nameStr(name);
+	bool res = false;
+	GIL_BEGIN_ALLOW_THREADS
+	execInMainThread_sync([&]() {
+		res = QtApp::instance()->openWindow(nameStr);
+	}, QtMainLane_Input);
+	GIL_END_ALLOW_THREADS
+	return PyBool_FromLong(res);
+}
+
+// Waits until the main thread queue is empty, i.e. all posted list updates,
+// row setups etc. are done. Returns the number of rounds it needed.
+PyObject* guiQt_benchmarkWaitIdle(PyObject* self, PyObject* args) {
+	int maxRounds = 1000;
+	if(!PyArg_ParseTuple(args, "|i:benchmarkWaitIdle", &maxRounds))
+		return NULL;
+	int rounds = 0;
+	GIL_BEGIN_ALLOW_THREADS
+	while(rounds < maxRounds) {
+		++rounds;
+		// The content lane is FIFO, thus this runs after everything which was posted before.
+		execInMainThread_sync([]() {});
+		QtMainExecutorStats stats;
+		QtMainExecutor::getStats(stats, false);
+		unsigned long long depth = 0;
+		for(int i = 0; i < QtMainLane_Count; ++i)
+			depth += stats.lanes[i].depth;
+		if(depth == 0) break;
+	}
+	GIL_END_ALLOW_THREADS
+	return PyInt_FromLong(rounds);
+}
+
+// Calls func with the QtListWidget of control in the main thread.
+// Returns false if the control has no list widget.
+template<typename Func>
+static bool withListWidget(PyObject* control, Func func) {
+	QtBaseWidget::WeakRef widgetRef = ((PyQtGuiObject*) control)->widget;
+	bool found = false;
+	GIL_BEGIN_ALLOW_THREADS
+	execInMainThread_sync([&]() {
+		QtBaseWidget::ScopedRef widget(widgetRef);
+		QtListWidget* list = widget ? dynamic_cast<QtListWidget*>(widget.get()) : NULL;
+		if(!list) return;
+		found = true;
+		func(list);
+	}, QtMainLane_Input);
+	GIL_END_ALLOW_THREADS
+	return found;
+}
+
+PyObject* guiQt_benchmarkListRowCount(PyObject* self, PyObject* args) {
+	PyObject* control = NULL;
+	if(!PyArg_ParseTuple(args, "O:benchmarkListRowCount", &control))
+		return NULL;
+	if(!checkControl(control, "benchmarkListRowCount")) return NULL;
+	int count = 0;
+	if(!withListWidget(control, [&](QtListWidget* list) { count = list->rowCount(); })) {
+		PyErr_SetString(PyExc_ValueError, "guiQt.benchmarkListRowCount: not a list control");
+		return NULL;
+	}
+	return PyInt_FromLong(count);
+}
+
+// Returns the list of frame times in microsecs.
+PyObject* guiQt_benchmarkListScroll(PyObject* self, PyObject* args, PyObject* kws) {
+	PyObject* control = NULL;
+	int frames = 100;
+	static const char* kwlist[] = {"control", "frames", NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kws, "O|i:benchmarkListScroll", (char**) kwlist, &control, &frames))
+		return NULL;
+	if(!checkControl(control, "benchmarkListScroll")) return NULL;
+	if(frames <= 0) {
+		PyErr_SetString(PyExc_ValueError, "guiQt.benchmarkListScroll: frames must be positive");
+		return NULL;
+	}
+	std::vector<long> frameTimesUs;
+	frameTimesUs.reserve(frames);
+	if(!withListWidget(control, [&](QtListWidget* list) { list->benchmarkScrollFrames(frames, frameTimesUs); })) {
+		PyErr_SetString(PyExc_ValueError, "guiQt.benchmarkListScroll: not a list control");
+		return NULL;
+	}
+	PyObject* res = PyList_New(frameTimesUs.size());
+	if(!res) return NULL;
+	for(size_t i = 0; i < frameTimesUs.size(); ++i) {
+		PyObject* v = PyInt_FromLong(frameTimesUs[i]);
+		if(!v) { Py_DECREF(res); return NULL; }
+		PyList_SET_ITEM(res, i, v);
+	}
+	return res;
+}
+
+PyObject* guiQt_benchmarkWidgetCount(PyObject* self) {
+	int count = 0;
+	GIL_BEGIN_ALLOW_THREADS
+	execInMainThread_sync([&]() {
+		count = QApplication::allWidgets().size();
+	});
+	GIL_END_ALLOW_THREADS
+	return PyInt_FromLong(count);
+}
+
+#endif // MUSICPLAYER_BENCHMARKS
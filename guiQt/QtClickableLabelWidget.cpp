@@ -9,13 +9,13 @@
 #include "QtClickableLabelWidget.hpp"
 #include "Builders.hpp"
 #include "QtUtils.hpp"
+#include "GILInstrument.hpp"
 
-RegisterControl(ClickableLabel)
+// Registered in QtPaintedItem.cpp. This widget is the fallback if there cannot be a painted item.
 
 QtClickableLabelWidget::QtClickableLabelWidget(PyQtGuiObject* control) : QtOneLineTextWidget(control) {}
 
-PyObject* QtClickableLabelWidget::getTextObj() {
-	PyQtGuiObject* control = getControl();
+PyObject* clickableLabel_getTextObj(PyQtGuiObject* control) {
 	PyObject* subjObj = control ? control->subjectObject : NULL;
 	Py_XINCREF(subjObj);
 	PyObject* textObj = NULL;
@@ -27,6 +27,34 @@ PyObject* QtClickableLabelWidget::getTextObj() {
 	if(PyErr_Occurred()) PyErr_Print();
 	Py_XDECREF(subjObj);
 	Py_XDECREF(kws);
+	return textObj;
+}
+
+void clickableLabel_handleClick(PyQtGuiObject* control) {
+	PyObject* subjObj = control ? control->subjectObject : NULL;
+	Py_XINCREF(subjObj);
+	PyObject* res = NULL;
+	PyObject* kws = PyDict_New();
+	if(subjObj && kws) {
+		PyDict_SetItemString(kws, "handleClick", Py_True);
+		res = PyEval_CallObjectWithKeywords(subjObj, NULL, kws);
+	}
+	if(PyErr_Occurred()) PyErr_Print();
+
+	GuiObject* parent = control ? control->parent : NULL;
+	Py_XINCREF(parent);
+	if(parent && parent->meth_updateContent)
+		parent->meth_updateContent(parent);
+
+	Py_XDECREF(subjObj);
+	Py_XDECREF(res);
+	Py_XDECREF(kws);
+	Py_XDECREF(parent);
+}
+
+PyObject* QtClickableLabelWidget::getTextObj() {
+	PyQtGuiObject* control = getControl();
+	PyObject* textObj = clickableLabel_getTextObj(control);
 	Py_XDECREF(control);
 	return textObj;
 }
@@ -35,7 +63,7 @@ void QtClickableLabelWidget::mousePressEvent(QMouseEvent *) {
 	WeakRef selfWeakRef(*this);
 
 	dispatch_async_background_queue([selfWeakRef](){
-		PyScopedGIL gil;
+		PyScopedGILInstr gil(GIL_SITE);
 
 		ScopedRef selfWeakRefScope(selfWeakRef);
 		QtClickableLabelWidget* self = (QtClickableLabelWidget*) selfWeakRefScope.get();
@@ -43,27 +71,9 @@ void QtClickableLabelWidget::mousePressEvent(QMouseEvent *) {
 		if(!self) return;
 
 		PyQtGuiObject* control = self->getControl();
-		PyObject* subjObj = control ? control->subjectObject : NULL;
-		Py_XINCREF(subjObj);
-		PyObject* res = NULL;
-		PyObject* kws = PyDict_New();
-		if(subjObj && kws) {
-			PyDict_SetItemString(kws, "handleClick", Py_True);
-			res = PyEval_CallObjectWithKeywords(subjObj, NULL, kws);
-		}
-		if(PyErr_Occurred()) PyErr_Print();
-
-		GuiObject* parent = control ? control->parent : NULL;
-		Py_XINCREF(parent);
-		if(parent && parent->meth_updateContent)
-			parent->meth_updateContent(parent);
-
+		clickableLabel_handleClick(control);
 		Py_XDECREF(control);
-		Py_XDECREF(subjObj);
-		Py_XDECREF(res);
-		Py_XDECREF(kws);
-		Py_XDECREF(parent);
-	});
+	}, QtMainLane_Input); // a click response
 }
 
 void QtClickableLabelWidget::enterEvent(QEvent *) {
@@ -21,4 +21,8 @@ struct QtClickableLabelWidget : QtOneLineTextWidget {
 
 };
 
+// Also used by the painted clickable labels, see QtPaintedItem.cpp. With the GIL.
+PyObject* clickableLabel_getTextObj(PyQtGuiObject* control); // new ref
+void clickableLabel_handleClick(PyQtGuiObject* control);
+
 #endif
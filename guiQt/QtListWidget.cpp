@@ -11,10 +11,21 @@
 #include "Builders.hpp"
 #include "FunctionWrapper.hpp"
 #include "QtUtils.hpp"
+#include "QtApp.hpp"
+#include "QtPaintedItem.hpp"
+#include "QtObjectWidget.hpp"
+#include "QtOneLineTextWidget.hpp"
+#include "GILInstrument.hpp"
 #include <vector>
+#include <set>
 #include <string>
+#include <algorithm>
 #include <QApplication>
 #include <QPainter>
+#include <QLineEdit>
+#include <QStaticText>
+#include <QScrollBar>
+#include <chrono>
 
 // Possible implementations:
 // - QScrollArea (all by myself)
@@ -25,59 +36,374 @@
 
 RegisterControl(List);
 
+// Building a row control is expensive: it is a full PyQtGuiObject + QtObjectWidget
+// tree which is set up by the Python layouting code. Thus we don't keep one per list item.
+// We keep a bounded pool of row controls instead. Only the rows in the visible window
+// (plus some overscan) are bound to a row control. When a row scrolls out, its row control
+// gets rebound to the subject object of another row.
+// If the visible window needs more rows than the cap, the pool grows beyond it.
+static const int DefaultMaxRowControls = 100;
+static const int RowOverscan = 5;
+
+QtListPaintStats qtListPaintStats;
+
+// Set while we are inside ItemDelegate::paint. Main thread only.
+static bool inListPaint = false;
+
+// Every GIL acquisition of the list code goes through here.
+// The paint path is not supposed to ever get here. See guiQt.listPaintStats().
+static inline void noteListGIL() {
+	if(inListPaint) qtListPaintStats.gilInPaint++;
+}
+
+// This is what we paint for a row. It is plain Qt data, so that painting
+// never needs the GIL. The colors are taken when the row gets set up
+// (with the GIL held). The texts are taken from the row widgets and their
+// painted items, which is also possible without the GIL, thus we can refresh
+// them lazily when the row widgets tell us that their content changed.
+// That only covers rows which contain nothing but texts. Other rows
+// (checkboxes, buttons, custom drawn widgets) are rendered from their widgets.
+struct RowSnapshot {
+	struct Text {
+		QRect rect; // relative to the row
+		QStaticText text; // elided to the rect and prepared
+	};
+	std::vector<Text> texts;
+	QColor background;
+	QColor foreground;
+	int height;
+	bool valid;
+	bool dirty; // texts must be refreshed
+	bool textOnly; // otherwise, we must render the row widget
+
+	RowSnapshot() : height(0), valid(false), dirty(false), textOnly(true) {}
+
+	// Whether the texts and colors are all there is to paint of the widget.
+	// Containers and the text widgets are, together with their QLineEdit.
+	static bool isTextOnlyWidget(QWidget* w) {
+		if(dynamic_cast<QtObjectWidget*>(w)) return true;
+		if(dynamic_cast<QtOneLineTextWidget*>(w)) return true;
+		if(dynamic_cast<QLineEdit*>(w) && dynamic_cast<QtOneLineTextWidget*>(w->parentWidget())) return true;
+		return false;
+	}
+
+	// Main thread only. Does not touch Python.
+	void updateTexts(QtBaseWidget* rowWidget) {
+		texts.clear();
+		height = rowWidget->height();
+		textOnly = isTextOnlyWidget(rowWidget);
+		for(QWidget* w : rowWidget->findChildren<QWidget*>()) {
+			if(!textOnly) break;
+			if(!w->isVisibleTo(rowWidget)) continue;
+			textOnly = isTextOnlyWidget(w);
+		}
+		QFontMetrics metrics(rowWidget->fontMetrics());
+		auto addText = [&](const QRect& rect, const QString& s) {
+			Text t;
+			t.rect = rect;
+			t.text.setTextFormat(Qt::PlainText);
+			t.text.setText(metrics.elidedText(s, Qt::ElideRight, rect.width() - 4));
+			t.text.prepare(QTransform(), rowWidget->font());
+			texts.push_back(t);
+		};
+		// The labels usually are painted items (see QtPaintedItem.hpp).
+		auto addPaintedItems = [&](QtBaseWidget* w) {
+			QPoint offset = w->mapTo(rowWidget, QPoint(0, 0));
+			for(auto& item : w->paintedItems)
+				addText(item->geometry.translated(offset), item->text);
+		};
+		addPaintedItems(rowWidget);
+		for(QtBaseWidget* w : rowWidget->findChildren<QtBaseWidget*>()) {
+			if(!w->isVisibleTo(rowWidget)) continue;
+			addPaintedItems(w);
+		}
+		for(QLineEdit* edit : rowWidget->findChildren<QLineEdit*>()) {
+			if(!edit->isVisibleTo(rowWidget)) continue;
+			addText(QRect(edit->mapTo(rowWidget, QPoint(0, 0)), edit->size()), edit->text());
+		}
+		dirty = false;
+	}
+};
+
+struct ListItem;
+
+struct RowControl {
+	PyQtGuiObject* control;
+	ListItem* item; // the currently bound item. NULL if free
+	int width; // the width we layouted for
+	unsigned long lastUsed; // for LRU eviction
+	RowSnapshot snapshot;
+
+	RowControl() : control(NULL), item(NULL), width(-1), lastUsed(0) {}
+};
+
 struct ListItem {
 	PyObject* subjectObject; // XXX: must be weak
-	PyQtGuiObject* control;
+	RowControl* row; // if bound
+	unsigned long windowGen; // see RowControlPool::setVisibleWindow
 
 	ListItem(PyObject* obj)
 		: subjectObject(obj), // we expect to already have increfd
-		  control(NULL)
+		  row(NULL),
+		  windowGen(0)
 	{}
 	~ListItem() {
-		Py_CLEAR(control);
+		if(row) row->item = NULL;
 	}
+};
 
-	void setupControl(int width, PyQtGuiObject* parent) {
-		assert(subjectObject);
+// All of this is expected to be called in the main thread.
+class RowControlPool {
+	std::vector<RowControl*> rows;
+	size_t maxRows;
+	unsigned long tick;
+	unsigned long windowGen;
 
-		PyScopedGIL gil;
+public:
+	RowControlPool() : maxRows(DefaultMaxRowControls), tick(0), windowGen(0) {}
+
+	~RowControlPool() {
+		noteListGIL();
+		PyScopedGILInstr gil(GIL_SITE);
+		for(RowControl* row : rows) {
+			if(row->item) row->item->row = NULL;
+			Py_CLEAR(row->control);
+			delete row;
+		}
+		rows.clear();
+	}
+
+	void setMaxRows(size_t n) {
+		if(n < 1) n = 1;
+		maxRows = n;
+	}
+
+	void childIter(QtBaseWidget::ChildIterCallback cb) {
+		for(RowControl* row : rows) {
+			bool stop = false;
+			if(row->control)
+				cb(row->control, stop);
+			if(stop) break;
+		}
+	}
+
+	QtBaseWidget::WeakRef getFirstWidget() const {
+		for(RowControl* row : rows) {
+			if(row->control) return row->control->widget;
+		}
+		return QtBaseWidget::WeakRef();
+	}
+
+	// items[first..last] is the visible window, including the overscan.
+	// Every row control which is bound to an item outside of it gets released.
+	void setVisibleWindow(const std::vector<ListItem*>& items, int first, int last) {
+		++windowGen;
+		for(int i = first; i <= last; ++i)
+			items[i]->windowGen = windowGen;
+		for(RowControl* row : rows) {
+			if(row->item && row->item->windowGen != windowGen)
+				unbind(row);
+		}
+	}
 
-		if(!control) {
-			control = guiQt_createControlObject(subjectObject, parent);
-			if(!control) return; // XXX err
+	bool inWindow(ListItem* item) const {
+		return item->windowGen == windowGen;
+	}
+
+	// Marks the snapshot of the row with the given widget as dirty.
+	// Returns true if we found such a bound row.
+	bool markDirty(QtBaseWidget* rowWidget) {
+		for(RowControl* row : rows) {
+			if(!row->control || !row->item) continue;
+			if(row->control->widget.getUnsafe() != rowWidget) continue;
+			row->snapshot.dirty = true;
+			return true;
+		}
+		return false;
+	}
+
+	// Returns a (borrowed) row control which is bound to the item.
+	PyQtGuiObject* acquire(ListItem* item, int width, PyQtGuiObject* parent) {
+		RowControl* row = item->row;
+		if(!row) {
+			row = getFreeRow();
+			row->item = item;
+			item->row = row;
+		}
+		if(!setupRow(row, width, parent)) {
+			unbind(row);
+			return NULL;
+		}
+		row->lastUsed = ++tick;
+		return row->control;
+	}
+
+private:
+	void unbind(RowControl* row) {
+		if(row->item) row->item->row = NULL;
+		row->item = NULL;
+	}
+
+	RowControl* getFreeRow() {
+		for(RowControl* row : rows) {
+			if(!row->item) return row;
+		}
+		if(rows.size() < maxRows) {
+			rows.push_back(new RowControl());
+			return rows.back();
+		}
+		// All row controls are bound. Evict the least recently used one,
+		// but never one in the visible window: the list would then rebind
+		// rows back and forth forever. The cap only limits the rows outside of it.
+		RowControl* lru = NULL;
+		for(RowControl* row : rows) {
+			if(inWindow(row->item)) continue;
+			if(!lru || row->lastUsed < lru->lastUsed)
+				lru = row;
+		}
+		if(!lru) {
+			// The window needs more rows than the cap. Grow past it.
+			rows.push_back(new RowControl());
+			return rows.back();
+		}
+		unbind(lru);
+		return lru;
+	}
+
+	bool setupRow(RowControl* row, int width, PyQtGuiObject* parent) {
+		ListItem* item = row->item;
+		assert(item);
+		assert(item->subjectObject);
+
+		noteListGIL();
+		qtListPaintStats.rowSetups++;
+		PyScopedGILInstr gil(GIL_SITE);
+
+		bool rebound = false;
+		if(!row->control) {
+			row->control = guiQt_createControlObject(item->subjectObject, parent);
+			if(!row->control) {
+				printf("Qt ListControl: cannot create row control\n");
+				if(PyErr_Occurred()) PyErr_Print();
+				return false;
+			}
 
 			// XXX
 			//control->PresetSize.x = [scrollview contentSize].width;
 			//if(!guiObjectList.empty())
 			//	subCtr->PresetSize.y = guiObjectList[0]->get_size(guiObjectList[0]).y;
 
-			if(!_buildControlObject_pre(control)) return; // XXX err
+			if(!_buildControlObject_pre(row->control)) return false; // XXX err
 			// XXX: handle size?
-			if(!_buildControlObject_post(control)) return; // XXX err
+			if(!_buildControlObject_post(row->control)) return false; // XXX err
+			row->width = -1;
+			rebound = true;
+		}
+		else if(row->control->subjectObject != item->subjectObject) {
+			// Recycle it. This keeps all the child controls and just updates their content.
+			PyObject* res = PyObject_CallMethod((PyObject*) row->control, (char*)"rebindSubjectObject", (char*)"(O)", item->subjectObject);
+			if(!res) {
+				printf("Qt ListControl: rebindSubjectObject failed\n");
+				if(PyErr_Occurred()) PyErr_Print();
+				return false;
+			}
+			Py_DECREF(res);
+			row->width = -1;
+			rebound = true;
+		}
+
+		PyQtGuiObject* control = row->control;
+		if(row->width != width) {
+			int h = control->get_size(control).y;
+			control->set_size(control, Vec(width, h));
+			control->layout();
+			row->width = width;
+		}
 
+		if(rebound || !row->snapshot.valid) {
+			row->snapshot.background = backgroundColor(control);
+			row->snapshot.foreground = foregroundColor(control);
+		}
+		{
+			QtBaseWidget::ScopedRef widget(control->widget);
+			if(!widget) return false;
+			row->snapshot.updateTexts(widget.get());
 		}
+		row->snapshot.valid = true;
+		return true;
+	}
+};
+
+// A single list event, as we get it from the subject list (onInsert, onRemove, onClear).
+struct ListOp {
+	enum Type { Insert, Remove, Clear } type;
+	int index;
+	PyObject* value; // for Insert. we own the ref
+
+	static ListOp insert(int index, PyObject* value) { ListOp op = {Insert, index, value}; return op; }
+	static ListOp remove(int index) { ListOp op = {Remove, index, NULL}; return op; }
+	static ListOp clear() { ListOp op = {Clear, 0, NULL}; return op; }
+};
 
-		int h = control->get_size(control).y;
-		control->set_size(control, Vec(width, h));
+// List events can come from any thread, and some of them come in bursts
+// (e.g. ListWrapper.shuffle is one onClear followed by one onInsert per item).
+// We collect them here and the main thread applies all of them at once.
+// Thus, there is at most one model update per main loop iteration.
+class ListUpdateBuffer {
+	PyMutex mutex;
+	std::vector<ListOp> ops;
+	bool flushScheduled;
 
-		control->layout();
+public:
+	ListUpdateBuffer() : flushScheduled(false) {}
+
+	// Returns true if the caller must schedule a flush.
+	bool push(const ListOp& op) {
+		PyScopedLock lock(mutex);
+		ops.push_back(op);
+		if(flushScheduled) return false;
+		flushScheduled = true;
+		return true;
+	}
+
+	void take(std::vector<ListOp>& out) {
+		PyScopedLock lock(mutex);
+		out.swap(ops);
+		flushScheduled = false;
 	}
 };
 
+// If a flush would result in more than this number of model updates,
+// we rather just reset the whole model.
+static const size_t MaxIncrementalListUpdates = 32;
+
 class QtListWidget::ListModel : public QAbstractItemModel {
 private:
 	QtBaseWidget::WeakRef listWidget;
 	std::vector<ListItem*> items;
+	RowControlPool rowPool;
+	ListUpdateBuffer updateBuffer;
+	std::vector<PyObject*> garbage; // see releaseGarbage()
+	std::set<ListItem*> pendingSetup; // see requestSetup()
+	bool setupScheduled;
 
 public:
 	ListModel(QtListWidget& owner)
-		: listWidget(owner)
+		: listWidget(owner),
+		  setupScheduled(false)
 	{}
 
 	~ListModel() {
 		for(ListItem* item : items)
-			delete item;
+			deleteItem(item);
 		items.clear();
+		// Events which were posted but not flushed yet still own their values.
+		std::vector<ListOp> ops;
+		updateBuffer.take(ops);
+		for(const ListOp& op : ops) {
+			if(op.value) garbage.push_back(op.value);
+		}
+		releaseGarbage();
 	}
 
 	virtual QModelIndex index(int row, int column, const QModelIndex &parent) const {
@@ -110,67 +436,265 @@ public:
 	}
 
 	void controlChildIter(QtBaseWidget::ChildIterCallback cb) {
-		for(ListItem* item : items) {
-			bool stop = false;
-			if(item->control)
-				cb(item->control, stop);
-			if(stop) break;
+		rowPool.childIter(cb);
+	}
+
+	void setMaxRowControls(int n) {
+		rowPool.setMaxRows(n);
+	}
+
+	void setVisibleWindow(int first, int last) {
+		if(items.empty()) return;
+		first = std::max(first, 0);
+		last = std::min(last, (int) items.size() - 1);
+		rowPool.setVisibleWindow(items, first, last);
+	}
+
+	// Called from paint. Never touches Python.
+	// Returns NULL if there is nothing to paint yet. In any case, if the row
+	// is not set up for the current width, we schedule that and repaint after it.
+	const RowSnapshot* rowSnapshot(ListItem* item, int width) {
+		RowControl* row = item->row;
+		if(!row || row->width != width)
+			requestSetup(item);
+		if(!row || !row->snapshot.valid) return NULL;
+		if(row->snapshot.dirty) {
+			QtBaseWidget::ScopedRef widget(row->control->widget);
+			if(widget) row->snapshot.updateTexts(widget.get());
 		}
+		return &row->snapshot;
 	}
 
-	void push_back(PyObject* value) {
-		dispatch_sync_main_queue([=]() {
-			int idx = items.size();
-			beginInsertRows(QModelIndex(), idx, idx);
-			items.push_back(new ListItem(value));
-			endInsertRows();
-		});
+	// Called from paint for rows which are not textOnly. Never touches Python
+	// by itself, but the row widgets paint themselves.
+	// Returns false if there is no row widget (yet).
+	bool renderRow(ListItem* item, QPainter* painter, const QPoint& offset) {
+		RowControl* row = item->row;
+		if(!row || !row->control) return false;
+		QtBaseWidget::ScopedRef widget(row->control->widget);
+		if(!widget) return false;
+		widget->render(painter, offset, QRegion(), QWidget::DrawChildren);
+		return true;
 	}
 
-	void insert(int _idx, PyObject* value) {
-		dispatch_sync_main_queue([=]() {
-			int idx = _idx;
-			if(idx < 0) idx = 0;
-			if((size_t)idx > items.size()) idx = items.size();
-			beginInsertRows(QModelIndex(), idx, idx);
-			items.insert(items.begin() + idx, new ListItem(value));
-			endInsertRows();
-		});
+	// Main thread only. Called when a row widget content changed.
+	bool rowContentChanged(QtBaseWidget* rowWidget) {
+		return rowPool.markDirty(rowWidget);
 	}
 
-	void remove(int idx) {
-		dispatch_sync_main_queue([=]() {
-			if(idx < 0) return;
-			if((size_t)idx >= items.size()) return;
-			beginRemoveRows(QModelIndex(), idx, idx);
-			ListItem* item = items[idx];
-			items.erase(items.begin() + idx);
-			delete item;
-			endRemoveRows();
+	// Building or rebinding a row control calls into Python and might need to wait
+	// for the GIL, so we never do it from paint but in a later main loop iteration.
+	void requestSetup(ListItem* item) {
+		pendingSetup.insert(item);
+		if(setupScheduled) return;
+		setupScheduled = true;
+		QtBaseWidget::WeakRef ownerRef = listWidget;
+		execInMainThread_async([ownerRef]() {
+			QtBaseWidget::ScopedRef owner(ownerRef);
+			if(!owner) return;
+			QtListWidget* self = dynamic_cast<QtListWidget*>(owner.get());
+			assert(self);
+			self->listModel->setupPendingRows(self);
 		});
 	}
 
-	void clear() {
-		dispatch_sync_main_queue([=]() {
-			beginResetModel();
-			for(ListItem* item : items)
-				delete item;
-			items.clear();
-			endResetModel();
+	void setupPendingRows(QtListWidget* owner) {
+		setupScheduled = false;
+		std::set<ListItem*> pending;
+		pending.swap(pendingSetup);
+		if(pending.empty()) return;
+		int width = owner->size().width();
+		{
+			noteListGIL();
+			PyScopedGILInstr gil(GIL_SITE);
+			PyQtGuiObject* parent = owner->getControl();
+			if(!parent) return;
+			for(ListItem* item : pending) {
+				// It might have been scrolled out already.
+				if(!rowPool.inWindow(item)) continue;
+				rowPool.acquire(item, width, parent);
+			}
+			Py_DECREF(parent);
+		}
+		owner->listWidget->viewport()->update();
+	}
+
+	// Can be called from any thread. Overtakes the ref of op.value.
+	void post(const ListOp& op) {
+		if(!updateBuffer.push(op)) return;
+		QtBaseWidget::WeakRef ownerRef = listWidget;
+		execInMainThread_async([ownerRef]() {
+			QtBaseWidget::ScopedRef owner(ownerRef);
+			if(!owner) return;
+			QtListWidget* self = dynamic_cast<QtListWidget*>(owner.get());
+			assert(self);
+			self->listModel->flushUpdates();
+			if(self->autoScrolldown)
+				self->listWidget->scrollToBottom();
 		});
 	}
 
+	// The following range operations must be called in the main thread.
+	// They overtake the refs of the given values.
+
+	void insertRange(int idx, const std::vector<PyObject*>& values) {
+		if(values.empty()) return;
+		if(idx < 0) idx = 0;
+		if((size_t)idx > items.size()) idx = items.size();
+		beginInsertRows(QModelIndex(), idx, idx + (int)values.size() - 1);
+		std::vector<ListItem*> newItems;
+		newItems.reserve(values.size());
+		for(PyObject* value : values)
+			newItems.push_back(new ListItem(value));
+		items.insert(items.begin() + idx, newItems.begin(), newItems.end());
+		endInsertRows();
+	}
+
+	void removeRange(int idx, int count) {
+		if(idx < 0) { count += idx; idx = 0; }
+		if((size_t)idx >= items.size()) return;
+		count = std::min(count, (int)items.size() - idx);
+		if(count <= 0) return;
+		beginRemoveRows(QModelIndex(), idx, idx + count - 1);
+		for(int i = idx; i < idx + count; ++i)
+			deleteItem(items[i]);
+		items.erase(items.begin() + idx, items.begin() + idx + count);
+		endRemoveRows();
+		releaseGarbage();
+	}
+
+	void replaceAll(const std::vector<PyObject*>& values) {
+		beginResetModel();
+		for(ListItem* item : items)
+			deleteItem(item);
+		items.clear();
+		items.reserve(values.size());
+		for(PyObject* value : values)
+			items.push_back(new ListItem(value));
+		endResetModel();
+		releaseGarbage();
+	}
+
+	// Applies all pending list events. Must be called in the main thread.
+	void flushUpdates() {
+		std::vector<ListOp> ops;
+		updateBuffer.take(ops);
+		if(ops.empty()) return;
+
+		// Everything before the last clear is irrelevant.
+		size_t start = 0;
+		bool reset = false;
+		for(size_t i = 0; i < ops.size(); ++i) {
+			if(ops[i].type == ListOp::Clear) {
+				start = i + 1;
+				reset = true;
+			}
+		}
+		for(size_t i = 0; i < start; ++i) {
+			if(ops[i].value) garbage.push_back(ops[i].value);
+		}
+
+		// Merge adjacent events into ranges.
+		struct Range {
+			ListOp::Type type;
+			int index;
+			int count; // for Remove
+			std::vector<PyObject*> values; // for Insert
+		};
+		std::vector<Range> ranges;
+		for(size_t i = start; i < ops.size(); ++i) {
+			const ListOp& op = ops[i];
+			Range* last = ranges.empty() ? NULL : &ranges.back();
+			if(op.type == ListOp::Insert) {
+				if(last && last->type == ListOp::Insert && op.index == last->index + (int)last->values.size()) {
+					last->values.push_back(op.value);
+					continue;
+				}
+				Range r = {ListOp::Insert, op.index, 0, std::vector<PyObject*>(1, op.value)};
+				ranges.push_back(r);
+			}
+			else if(op.type == ListOp::Remove) {
+				if(last && last->type == ListOp::Remove) {
+					if(op.index == last->index) { // e.g. popleft
+						last->count++;
+						continue;
+					}
+					if(op.index == last->index - 1) { // backwards
+						last->index--;
+						last->count++;
+						continue;
+					}
+				}
+				Range r = {ListOp::Remove, op.index, 1, std::vector<PyObject*>()};
+				ranges.push_back(r);
+			}
+		}
+
+		if(!reset && ranges.size() <= MaxIncrementalListUpdates) {
+			for(Range& r : ranges) {
+				if(r.type == ListOp::Insert)
+					insertRange(r.index, r.values);
+				else
+					removeRange(r.index, r.count);
+			}
+			releaseGarbage();
+			return;
+		}
+
+		// Calculate the new list and reset the model with it.
+		std::vector<PyObject*> values;
+		if(!reset) {
+			values.reserve(items.size());
+			for(ListItem* item : items) {
+				// Overtake the ref. replaceAll() will delete the item.
+				values.push_back(item->subjectObject);
+				item->subjectObject = NULL;
+			}
+		}
+		for(Range& r : ranges) {
+			int idx = std::max(r.index, 0);
+			if(r.type == ListOp::Insert) {
+				idx = std::min(idx, (int)values.size());
+				values.insert(values.begin() + idx, r.values.begin(), r.values.end());
+			}
+			else {
+				int end = std::min(idx + r.count, (int)values.size());
+				for(int i = idx; i < end; ++i)
+					garbage.push_back(values[i]);
+				if(idx < end)
+					values.erase(values.begin() + idx, values.begin() + end);
+			}
+		}
+		replaceAll(values);
+	}
+
+private:
+	void deleteItem(ListItem* item) {
+		pendingSetup.erase(item);
+		if(item->subjectObject)
+			garbage.push_back(item->subjectObject);
+		delete item;
+	}
+
+	// We collect the refs which we need to release, so that we only need to grab the GIL once.
+	void releaseGarbage() {
+		if(garbage.empty()) return;
+		noteListGIL();
+		PyScopedGILInstr gil(GIL_SITE);
+		for(PyObject* obj : garbage)
+			Py_DECREF(obj);
+		garbage.clear();
+	}
+
+public:
+
 	void updateLayout() {
 		if(items.empty()) return;
 		emit dataChanged(createIndex(0,0), createIndex(items.size()-1, 0));
 	}
 
 	QtBaseWidget::WeakRef getFirstWidget() const {
-		for(ListItem* item : items) {
-			PyQtGuiObject* control = item->control;
-			if(control) return control->widget;
-		}
-		return QtBaseWidget::WeakRef();
+		return rowPool.getFirstWidget();
 	}
 
 	const QtBaseWidget::WeakRef& getListWidget() const {
@@ -207,7 +731,16 @@ class QtListWidget::ItemDelegate : public QAbstractItemDelegate {
 public:
 	ItemDelegate(ListModel* m) : listModel(m) {}
 
+	// This must never touch Python. We paint from the row snapshot, or render
+	// the row widget if the row has more than texts.
 	virtual void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const {
+		struct PaintScope {
+			PaintScope() { inListPaint = true; }
+			~PaintScope() { inListPaint = false; }
+		} paintScope;
+		qtListPaintStats.paints++;
+
+		const RowSnapshot* snapshot = NULL;
 		ListItem* item = (ListItem*) index.data().value<void*>();
 		if(!item) goto error;
 
@@ -217,28 +750,34 @@ public:
 		else if(option.features & QStyleOptionViewItem::Alternate)
 			painter->fillRect(option.rect, option.palette.alternateBase());
 
-		{
-			QtBaseWidget::ScopedRef listWidget(listModel->getListWidget());
-			if(!listWidget) goto error;
-			PyQtGuiObject* parent = listWidget->getControl();
-			if(!parent) goto error;
-			item->setupControl(listWidget->size().width(), parent);
+		snapshot = listModel->rowSnapshot(item, listModel->getOwnerWidth());
+		if(!snapshot) {
+			// Placeholder. We get repainted when the row is set up.
+			qtListPaintStats.placeholderPaints++;
+			return;
 		}
 
-		{
-			if(!item->control) goto error;
-			QtBaseWidget::ScopedRef widget(item->control->widget);
-			if(!widget) goto error;
-
-			painter->setOpacity(0.8); // XXX?
-			widget->setAutoFillBackground(false);
-			widget->render(
-				painter,
-				QPoint(option.rect.x(), option.rect.y()),
-				QRegion(0, 0, option.rect.width(), option.rect.height()),
-				QWidget::DrawChildren);
+		painter->save();
+		painter->setClipRect(option.rect);
+		painter->setOpacity(0.8); // XXX?
+		if(snapshot->background.alpha() > 0)
+			painter->fillRect(option.rect, snapshot->background);
+		if(!snapshot->textOnly) {
+			qtListPaintStats.widgetPaints++;
+			listModel->renderRow(item, painter, option.rect.topLeft());
+			painter->restore();
+			return;
 		}
-
+		painter->setPen(
+			(option.state & QStyle::State_Selected)
+			? option.palette.color(QPalette::HighlightedText)
+			: snapshot->foreground);
+		for(const RowSnapshot::Text& t : snapshot->texts) {
+			QRect rect = t.rect.translated(option.rect.topLeft()).adjusted(2, 0, -2, 0);
+			int y = rect.top() + (rect.height() - (int) t.text.size().height()) / 2;
+			painter->drawStaticText(rect.left(), y, t.text);
+		}
+		painter->restore();
 		return;
 
 	error:
@@ -251,14 +790,35 @@ public:
 };
 
 class QtListWidget::ListView : public QListView {
+	ListModel* listModel;
+
 public:
-	ListView(QtListWidget& parent) : QListView(&parent) {
+	ListView(QtListWidget& parent, ListModel* m) : QListView(&parent), listModel(m) {
 		setUniformItemSizes(true);
 		setAlternatingRowColors(true);
 		//setBatchSize(1);
 		//setLayoutMode(QListView::Batched);
 		setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
 	}
+
+protected:
+	virtual void paintEvent(QPaintEvent* ev) {
+		// We get a paint event for every scroll, so this is the place
+		// where we know about the visible window.
+		updateVisibleWindow();
+		QListView::paintEvent(ev);
+	}
+
+	void updateVisibleWindow() {
+		int count = listModel->rowCount(QModelIndex());
+		if(count == 0) return;
+		QRect rect = viewport()->rect();
+		QModelIndex firstIdx = indexAt(rect.topLeft());
+		QModelIndex lastIdx = indexAt(rect.bottomLeft());
+		int first = firstIdx.isValid() ? firstIdx.row() : 0;
+		int last = lastIdx.isValid() ? lastIdx.row() : (count - 1);
+		listModel->setVisibleWindow(first - RowOverscan, last + RowOverscan);
+	}
 };
 
 QtListWidget::QtListWidget(PyQtGuiObject* control)
@@ -271,7 +831,7 @@ QtListWidget::QtListWidget(PyQtGuiObject* control)
 
 	listModel = new ListModel(*this);
 
-	listWidget = new ListView(*this);
+	listWidget = new ListView(*this, listModel);
 	listWidget->setItemDelegate(new ItemDelegate(listModel));
 	listWidget->setModel(listModel);
 	listWidget->resize(size());
@@ -279,12 +839,16 @@ QtListWidget::QtListWidget(PyQtGuiObject* control)
 
 
 	{
-		PyScopedGIL gil;
+		PyScopedGILInstr gil(GIL_SITE);
 
 		control->OuterSpace = Vec(0,0);
 
 		autoScrolldown = attrChain_bool_default(control->attr, "autoScrolldown", false);
 
+		long maxRowControls = attrChain_int_default(control->attr, "maxRowControls", -1);
+		if(maxRowControls > 0)
+			listModel->setMaxRowControls((int) maxRowControls);
+
 		{
 			PyObject* handler = attrChain(control->attr, "dragHandler");
 			if(!handler) {
@@ -337,7 +901,7 @@ QtListWidget::QtListWidget(PyQtGuiObject* control)
 
 	// do initial fill in background
 	dispatch_async_background_queue([selfWeakRef]() {
-		PyScopedGIL gil;
+		PyScopedGILInstr gil(GIL_SITE);
 
 		PyObject* lock = NULL;
 		PyObject* lockEnterRes = NULL;
@@ -380,10 +944,12 @@ QtListWidget::QtListWidget(PyQtGuiObject* control)
 				goto finalInitialFill;
 			}
 
-			while(true) {
+			// This is applied as a single model reset in the main thread.
+			self->listModel->post(ListOp::clear());
+			for(int idx = 0; ; ++idx) {
 				PyObject* listIterItem = PyIter_Next(listIter);
 				if(listIterItem == NULL) break;
-				self->listModel->push_back(listIterItem /* overtake ownership */);
+				self->listModel->post(ListOp::insert(idx, listIterItem /* overtake ownership */));
 			}
 
 			if(PyErr_Occurred()) {
@@ -393,22 +959,18 @@ QtListWidget::QtListWidget(PyQtGuiObject* control)
 			Py_DECREF(listIter);
 		}
 
-		if(self->autoScrolldown)
-			self->listWidget->scrollToBottom();
-
 		// We expect the list ( = control->subjectObject ) to support a certain interface,
 		// esp. to have onInsert, onRemove and onClear as utils.Event().
 		{
-			auto registerEv = [=](const char* evName, PyCallback func) {
+			// Takes over the reference of callbackWrapper.
+			auto registerEv = [=](const char* evName, PyObject* callbackWrapper) {
 				PyQtGuiObject* control = NULL;
 				PyObject* event = NULL;
 				PyObject* res = NULL;
-				PyObject* callbackWrapper = NULL;
 
 				control = self->getControl();
 				if(!control) goto finalRegisterEv;
 
-				callbackWrapper = (PyObject*) newFunctionWrapper(func);
 				if(!callbackWrapper) {
 					printf("Qt ListControl: cannot create callback wrapper for %s\n", evName);
 					goto finalRegisterEv;
@@ -445,53 +1007,44 @@ QtListWidget::QtListWidget(PyQtGuiObject* control)
 				Py_XDECREF(callbackWrapper);
 			};
 
-			registerEv("onInsert", [selfWeakRef](PyObject* args, PyObject* kws) {
+			// These are called for every list change, thus we use the positional fast path.
+			// utils.Event calls them positionally.
+			static const char* const insertArgs[] = {"index", "value", NULL};
+			registerEv("onInsert", (PyObject*) newPositionalFunctionWrapper("onInsert", insertArgs, [selfWeakRef](PyObject* const* args) {
+				long idx = PyInt_AsLong(args[0]);
+				if(idx == -1 && PyErr_Occurred())
+					return (PyObject*) NULL;
 				ScopedRef selfWeakRefScope(selfWeakRef);
 				QtListWidget* self = (QtListWidget*) selfWeakRefScope.get();
 				if(self) {
-					int idx; PyObject* v;
-					static const char *kwlist[] = {"index", "value", NULL};
-					if(!PyArg_ParseTupleAndKeywords(args, kws, "iO:onInsert", (char**)kwlist, &idx, &v))
-						return (PyObject*) NULL;
+					PyObject* v = args[1];
 					Py_INCREF(v);
-					self->listModel->insert(idx, v /* overtake */);
-					if(self->autoScrolldown) {
-						dispatch_sync_main_queue([selfWeakRef]() {
-							ScopedRef selfWeakRefScope(selfWeakRef);
-							QtListWidget* self = (QtListWidget*) selfWeakRefScope.get();
-							if(self && self->autoScrolldown)
-								self->listWidget->scrollToBottom();
-						});
-					}
+					self->listModel->post(ListOp::insert((int) idx, v /* overtake */));
 				}
 				Py_INCREF(Py_None);
 				return Py_None;
-			});
-			registerEv("onRemove", [selfWeakRef](PyObject* args, PyObject* kws) {
+			}));
+			static const char* const removeArgs[] = {"index", NULL};
+			registerEv("onRemove", (PyObject*) newPositionalFunctionWrapper("onRemove", removeArgs, [selfWeakRef](PyObject* const* args) {
+				long idx = PyInt_AsLong(args[0]);
+				if(idx == -1 && PyErr_Occurred())
+					return (PyObject*) NULL;
 				ScopedRef selfWeakRefScope(selfWeakRef);
 				QtListWidget* self = (QtListWidget*) selfWeakRefScope.get();
-				if(self) {
-					int idx;
-					static const char *kwlist[] = {"index", NULL};
-					if(!PyArg_ParseTupleAndKeywords(args, kws, "i:onRemove", (char**)kwlist, &idx))
-						return (PyObject*) NULL;
-					self->listModel->remove(idx);
-				}
+				if(self)
+					self->listModel->post(ListOp::remove((int) idx));
 				Py_INCREF(Py_None);
 				return Py_None;
-			});
-			registerEv("onClear", [selfWeakRef](PyObject* args, PyObject* kws) {
+			}));
+			static const char* const clearArgs[] = {NULL};
+			registerEv("onClear", (PyObject*) newPositionalFunctionWrapper("onClear", clearArgs, [selfWeakRef](PyObject* const* args) {
 				ScopedRef selfWeakRefScope(selfWeakRef);
 				QtListWidget* self = (QtListWidget*) selfWeakRefScope.get();
-				if(self) {
-					static const char *kwlist[] = {NULL};
-					if(!PyArg_ParseTupleAndKeywords(args, kws, ":onClear", (char**)kwlist))
-						return (PyObject*) NULL;
-					self->listModel->clear();
-				}
+				if(self)
+					self->listModel->post(ListOp::clear());
 				Py_INCREF(Py_None);
 				return Py_None;
-			});
+			}));
 		}
 
 finalInitialFill:
@@ -525,12 +1078,37 @@ void QtListWidget::updateContent() {
 	// TODO...
 }
 
+void QtListWidget::childContentChanged(QtBaseWidget* child) {
+	if(listModel->rowContentChanged(child))
+		listWidget->viewport()->update();
+}
+
 void QtListWidget::resizeEvent(QResizeEvent* ev) {
 	QtBaseWidget::resizeEvent(ev);
 	listModel->updateLayout();
 	listWidget->resize(size());
 }
 
+#ifdef MUSICPLAYER_BENCHMARKS
+int QtListWidget::rowCount() {
+	return listModel->rowCount(QModelIndex());
+}
+
+void QtListWidget::benchmarkScrollFrames(int frames, std::vector<long>& frameTimesUs) {
+	QScrollBar* bar = listWidget->verticalScrollBar();
+	int step = std::max(bar->pageStep(), 1);
+	for(int i = 0; i < frames; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		int v = bar->value() + step;
+		if(v > bar->maximum()) v = bar->minimum();
+		bar->setValue(v);
+		listWidget->viewport()->repaint();
+		QCoreApplication::processEvents();
+		frameTimesUs.push_back((long) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+	}
+}
+#endif
+
 // TODO...
 #if 0
 
@@ -12,6 +12,18 @@
 #include "QtBaseWidget.hpp"
 #include <QListWidget>
 #include <Python.h>
+#include <boost/atomic.hpp>
+#include <vector>
+
+// Counters of the list row paint path. Exposed via guiQt.listPaintStats().
+struct QtListPaintStats {
+	boost::atomic<unsigned long> paints;
+	boost::atomic<unsigned long> placeholderPaints; // rows without a snapshot yet
+	boost::atomic<unsigned long> widgetPaints; // rows rendered from their widgets, see RowSnapshot::textOnly
+	boost::atomic<unsigned long> rowSetups; // row control builds/rebinds
+	boost::atomic<unsigned long> gilInPaint; // GIL acquisitions while painting. should stay 0
+};
+extern QtListPaintStats qtListPaintStats;
 
 class QtListWidget : public QtBaseWidget {
 	Q_OBJECT
@@ -32,6 +44,15 @@ public:
 	virtual void childIter(ChildIterCallback);
 
 	virtual void updateContent();
+	virtual void childContentChanged(QtBaseWidget* child);
+
+#ifdef MUSICPLAYER_BENCHMARKS
+	// For the benchmark (QtBenchmark.cpp). Main thread only.
+	int rowCount();
+	// Per frame: scrolls down by a page (wraps around at the end), paints synchronously
+	// and processes the events, e.g. the row setups. Appends the frame times.
+	void benchmarkScrollFrames(int frames, std::vector<long>& frameTimesUs);
+#endif
 
 protected:
 	virtual void resizeEvent(QResizeEvent *);
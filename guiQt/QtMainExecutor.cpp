@@ -0,0 +1,220 @@
+//
+//  QtMainExecutor.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 26.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include "QtMainExecutor.hpp"
+#include "QtApp.hpp"
+#include "AppFuncs.hpp"
+#include <string.h>
+
+typedef QtMainExecutor::Node Node;
+typedef QtMainExecutor::Clock Clock;
+
+// Intrusive MPSC queue, by Dmitry Vyukov.
+// http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+// push() is wait-free. pop() is only called from the main thread.
+// pop() can return NULL while a push is halfway through. The pending counter
+// tells the drain that there is more, thus it retries in the next drain.
+struct MpscQueue {
+	boost::atomic<Node*> head;
+	Node* tail;
+	Node stub;
+
+	MpscQueue() : head(&stub), tail(&stub) {}
+
+	void push(Node* n) {
+		n->next.store(NULL, boost::memory_order_relaxed);
+		Node* prev = head.exchange(n, boost::memory_order_acq_rel);
+		prev->next.store(n, boost::memory_order_release);
+	}
+
+	Node* pop() {
+		Node* t = tail;
+		Node* next = t->next.load(boost::memory_order_acquire);
+		if(t == &stub) {
+			if(!next) return NULL;
+			tail = next;
+			t = next;
+			next = next->next.load(boost::memory_order_acquire);
+		}
+		if(next) {
+			tail = next;
+			return t;
+		}
+		if(t != head.load(boost::memory_order_acquire))
+			return NULL; // push in progress
+		push(&stub);
+		next = t->next.load(boost::memory_order_acquire);
+		if(next) {
+			tail = next;
+			return t;
+		}
+		return NULL;
+	}
+};
+
+// The counters which are written by the main thread only are atomic anyway because getStats() reads them.
+struct LaneCounters {
+	boost::atomic<unsigned long long> enqueued, executed, maxDepth;
+	boost::atomic<unsigned long long> count, waitTotalUs, waitMaxUs, execTotalUs, execMaxUs;
+};
+
+static MpscQueue lanes[QtMainLane_Count];
+static LaneCounters laneCounters[QtMainLane_Count];
+static boost::atomic<bool> drainScheduled(false);
+static boost::atomic<unsigned long long> drains(0), slicesOverBudget(0);
+
+static inline unsigned long long usBetween(Clock::time_point a, Clock::time_point b) {
+	if(b <= a) return 0;
+	return (unsigned long long) std::chrono::duration_cast<std::chrono::microseconds>(b - a).count();
+}
+
+static inline void storeMax(boost::atomic<unsigned long long>& c, unsigned long long v) {
+	if(v > c.load(boost::memory_order_relaxed))
+		c.store(v, boost::memory_order_relaxed);
+}
+
+// Main thread only.
+static inline void addRelaxed(boost::atomic<unsigned long long>& c, unsigned long long v) {
+	c.store(c.load(boost::memory_order_relaxed) + v, boost::memory_order_relaxed);
+}
+
+static unsigned long long pendingCount() {
+	unsigned long long n = 0;
+	for(int i = 0; i < QtMainLane_Count; ++i)
+		n += laneCounters[i].enqueued.load() - laneCounters[i].executed.load();
+	return n;
+}
+
+static void scheduleDrain(void (*drainFunc)()) {
+	if(drainScheduled.exchange(true)) return; // there is one already
+	QtApp::instance()->invokeGenericExec(drainFunc, Qt::QueuedConnection);
+}
+
+void QtMainExecutor::push(Node* node, QtMainLane lane) {
+	LaneCounters& c = laneCounters[lane];
+	node->enqueueTime = Clock::now();
+	node->eventId = appEventTrace_spawn();
+	// Count first, thus the drain never sees less pending than there is.
+	unsigned long long enqueued = c.enqueued.fetch_add(1) + 1;
+	unsigned long long executed = c.executed.load(boost::memory_order_relaxed);
+	if(enqueued > executed)
+		storeMax(c.maxDepth, enqueued - executed);
+	lanes[lane].push(node);
+	scheduleDrain(&QtMainExecutor::drain);
+}
+
+void QtMainExecutor::async(const Func& func, QtMainLane lane) {
+	Node* node = new Node();
+	node->func = func;
+	push(node, lane);
+}
+
+void QtMainExecutor::sync(const Func& func, QtMainLane lane) {
+	QSemaphore done;
+	Node node;
+	node.func = func;
+	node.done = &done;
+	push(&node, lane);
+	done.acquire();
+}
+
+static const char* laneTaskNames[QtMainLane_Count] = {"main task (input)", "main task (layout)", "main task (content)"};
+
+static void runNode(Node* node, QtMainLane lane) {
+	LaneCounters& c = laneCounters[lane];
+	Clock::time_point start = Clock::now();
+	unsigned long long waitUs = usBetween(node->enqueueTime, start);
+	if(node->eventId) {
+		unsigned long prevEventId = appEventTrace_setCurrent(node->eventId);
+		unsigned long long traceStartUs = appEventTrace_timeUs();
+		node->func();
+		appEventTrace_taskEnd(node->eventId, laneTaskNames[lane], traceStartUs);
+		appEventTrace_setCurrent(prevEventId);
+	}
+	else
+		node->func();
+	unsigned long long execUs = usBetween(start, Clock::now());
+
+	addRelaxed(c.count, 1);
+	addRelaxed(c.waitTotalUs, waitUs);
+	storeMax(c.waitMaxUs, waitUs);
+	addRelaxed(c.execTotalUs, execUs);
+	storeMax(c.execMaxUs, execUs);
+	c.executed++;
+
+	// A sync node lives on the stack of the waiting thread. Don't touch it after the release.
+	if(node->done)
+		node->done->release();
+	else
+		delete node;
+}
+
+void QtMainExecutor::drain() {
+	// Reset first. A push from now on schedules another drain.
+	drainScheduled = false;
+	addRelaxed(drains, 1);
+
+	Clock::time_point start = Clock::now();
+	bool overBudget = false;
+
+	// One item from every lane, thus no lane starves.
+	for(int lane = 0; lane < QtMainLane_Count; ++lane) {
+		Node* node = lanes[lane].pop();
+		if(node) runNode(node, (QtMainLane) lane);
+	}
+
+	// Then by priority, as long as we have time.
+	for(int lane = 0; lane < QtMainLane_Count && !overBudget; ++lane) {
+		while(true) {
+			if(usBetween(start, Clock::now()) >= (unsigned long long) kSliceBudgetUs) {
+				overBudget = true;
+				break;
+			}
+			Node* node = lanes[lane].pop();
+			if(!node) break;
+			runNode(node, (QtMainLane) lane);
+		}
+	}
+
+	if(pendingCount() > 0) {
+		if(overBudget) addRelaxed(slicesOverBudget, 1);
+		scheduleDrain(&QtMainExecutor::drain);
+	}
+}
+
+void QtMainExecutor::getStats(QtMainExecutorStats& stats, bool reset) {
+	memset(&stats, 0, sizeof(stats));
+	for(int i = 0; i < QtMainLane_Count; ++i) {
+		LaneCounters& c = laneCounters[i];
+		QtMainLaneStats& s = stats.lanes[i];
+		s.enqueued = c.enqueued;
+		unsigned long long executed = c.executed;
+		s.depth = (s.enqueued > executed) ? (s.enqueued - executed) : 0;
+		s.maxDepth = c.maxDepth;
+		s.count = c.count;
+		s.waitTotalUs = c.waitTotalUs;
+		s.waitMaxUs = c.waitMaxUs;
+		s.execTotalUs = c.execTotalUs;
+		s.execMaxUs = c.execMaxUs;
+		if(reset) {
+			// Races with the main thread. We might lose an update, that's ok for stats.
+			c.maxDepth = 0;
+			c.count = 0;
+			c.waitTotalUs = 0;
+			c.waitMaxUs = 0;
+			c.execTotalUs = 0;
+			c.execMaxUs = 0;
+		}
+	}
+	stats.drains = drains;
+	stats.slicesOverBudget = slicesOverBudget;
+	if(reset) {
+		drains = 0;
+		slicesOverBudget = 0;
+	}
+}
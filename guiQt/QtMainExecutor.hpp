@@ -0,0 +1,80 @@
+//
+//  QtMainExecutor.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 26.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer_guiQt_QtMainExecutor__
+#define __MusicPlayer_guiQt_QtMainExecutor__
+
+#include <QSemaphore>
+#include <boost/function.hpp>
+#include <boost/atomic.hpp>
+#include <chrono>
+
+// Runs closures from any thread in the main thread. See execInMainThread_sync/_async in QtApp.hpp.
+//
+// Every lane is a lock-free MPSC queue. A push only schedules a drain via QtApp::genericExec
+// if there is none pending yet, thus a burst of pushes costs one Qt meta-call.
+// A drain runs in the main thread and stops after kSliceBudgetUs. The rest is left
+// for the next drain, which is queued behind the window system events,
+// thus a burst of content updates cannot freeze the input handling.
+// Within a drain, higher priority lanes go first, but every non-empty lane gets
+// at least one item so that no lane starves.
+// A task queued while a GUI event is traced belongs to that event (see app/EventTrace.hpp).
+
+enum QtMainLane {
+	QtMainLane_Input = 0, // input handling and paint related
+	QtMainLane_Layout, // geometry get/set, adding childs
+	QtMainLane_Content, // content updates. the default
+	QtMainLane_Count
+};
+
+struct QtMainLaneStats {
+	unsigned long long enqueued; // since start
+	unsigned long long depth; // currently queued
+	unsigned long long maxDepth;
+	unsigned long long count; // executed, since the last reset
+	unsigned long long waitTotalUs; // from push until execution
+	unsigned long long waitMaxUs;
+	unsigned long long execTotalUs;
+	unsigned long long execMaxUs;
+};
+
+struct QtMainExecutorStats {
+	QtMainLaneStats lanes[QtMainLane_Count];
+	unsigned long long drains;
+	unsigned long long slicesOverBudget; // drains which stopped with items left
+};
+
+class QtMainExecutor {
+public:
+	static const long kSliceBudgetUs = 8000; // half a frame at 60 fps
+
+	typedef boost::function<void(void)> Func;
+	typedef std::chrono::steady_clock Clock;
+
+	struct Node {
+		boost::atomic<Node*> next;
+		Func func;
+		Clock::time_point enqueueTime;
+		QSemaphore* done; // set for sync calls. then the node is owned by the caller
+		unsigned long eventId; // see app/EventTrace.hpp
+		Node() : next(NULL), done(NULL), eventId(0) {}
+	};
+
+	// Can be called from any thread.
+	static void async(const Func& func, QtMainLane lane);
+	// Must not be called from the main thread. Blocks until func was executed.
+	static void sync(const Func& func, QtMainLane lane);
+
+	static void getStats(QtMainExecutorStats& stats, bool reset);
+
+private:
+	static void push(Node* node, QtMainLane lane);
+	static void drain();
+};
+
+#endif
@@ -5,13 +5,14 @@
 #include "PyThreading.hpp"
 #include "PythonHelpers.h"
 #include "PyUtils.h"
+#include "GILInstrument.hpp"
 #include <QMenuBar>
 #include <QPointer>
 
 QMenuBar* mainMenuBar = NULL;
 
 static void iterRootObjs(QMenu* parent) {
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 	
 	PyObject* guiMod = getModule("gui"); // borrowed
 	if(!guiMod) {
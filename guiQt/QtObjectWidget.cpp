@@ -8,11 +8,12 @@
 
 #include "QtObjectWidget.hpp"
 #include "Builders.hpp"
+#include "GILInstrument.hpp"
 
 RegisterControl(Object)
 
 QtObjectWidget::QtObjectWidget(PyQtGuiObject* control) : QtBaseWidget(control) {
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 	
 	control->OuterSpace = Vec(0,0);
 	resize(control->PresetSize.x, control->PresetSize.y);
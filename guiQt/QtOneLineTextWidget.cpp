@@ -11,15 +11,16 @@
 #include "Builders.hpp"
 #include "PythonHelpers.h"
 #include "PyUtils.h"
+#include "GILInstrument.hpp"
 #include <string>
 #include <assert.h>
 
 
-RegisterControl(OneLineText)
+// Registered in QtPaintedItem.cpp. This widget is the fallback if there cannot be a painted item.
 
 QtOneLineTextWidget::QtOneLineTextWidget(PyQtGuiObject* control) : QtBaseWidget(control) {
 	
-	PyScopedGIL gil;
+	PyScopedGILInstr gil(GIL_SITE);
 	long w = attrChain_int_default(control->attr, "width", -1);
 	long h = attrChain_int_default(control->attr, "height", -1);
 	if(w < 0) w = 30;
@@ -63,6 +64,7 @@ void QtOneLineTextWidget::resizeEvent(QResizeEvent* ev) {
 	QString elidedText = metrics.elidedText(
 				text, Qt::ElideRight, lineEditWidget->width() - MarginWidth);
 	lineEditWidget->setText(elidedText);
+	notifyContentChanged();
 }
 
 PyObject* QtOneLineTextWidget::getTextObj() {
@@ -78,7 +80,7 @@ void QtOneLineTextWidget::updateContent() {
 	std::string s = "?";
 
 	{
-		PyScopedGIL gil;
+		PyScopedGILInstr gil(GIL_SITE);
 	
 		control = getControl();
 		if(!control) return;
@@ -103,7 +105,7 @@ void QtOneLineTextWidget::updateContent() {
 	// Note: We had this async before. But I think other code wants to know the actual size
 	// and we only get it after we set the text.
 	execInMainThread_sync([=]() {
-		PyScopedGIL gil;
+		PyScopedGILInstr gil(GIL_SITE);
 
 		ScopedRef selfRef(selfRefCopy);
 		if(selfRef) {
@@ -113,7 +115,7 @@ void QtOneLineTextWidget::updateContent() {
 
 			QFontMetrics metrics(self->lineEditWidget->fontMetrics());
 
-			PyScopedGIL gil;
+			PyScopedGILInstr gil(GIL_SITE);
 			
 			/*
 			NSColor* color = backgroundColor(control);
@@ -142,6 +144,8 @@ void QtOneLineTextWidget::updateContent() {
 							self->text, Qt::ElideRight, self->lineEditWidget->width() - MarginWidth);
 				self->lineEditWidget->setText(elidedText);
 			}
+
+			self->notifyContentChanged();
 		}
 		
 		Py_DECREF(control);
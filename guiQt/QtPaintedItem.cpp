@@ -0,0 +1,225 @@
+//
+//  QtPaintedItem.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 28.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include "QtPaintedItem.hpp"
+#include "QtBaseWidget.hpp"
+#include "PyQtGuiObject.hpp"
+#include "QtOneLineTextWidget.hpp"
+#include "QtClickableLabelWidget.hpp"
+#include "Builders.hpp"
+#include "QtUtils.hpp"
+#include "PythonHelpers.h"
+#include "PyUtils.h"
+#include "GILInstrument.hpp"
+#include <QPainter>
+#include <QFontMetrics>
+#include <assert.h>
+
+// These were QtOneLineTextWidget and QtClickableLabelWidget before.
+// They still are if there cannot be a painted item.
+static struct _RegisterPaintedControls {
+	_RegisterPaintedControls() {
+		registerControlBuilder("OneLineText", [](PyQtGuiObject* control) {
+			if(!QtPaintedItem::build(control, false))
+				new QtOneLineTextWidget(control);
+			return true;
+		});
+		registerControlBuilder("ClickableLabel", [](PyQtGuiObject* control) {
+			if(!QtPaintedItem::build(control, true))
+				new QtClickableLabelWidget(control);
+			return true;
+		});
+	}
+} _registerPaintedControls_instance;
+
+// Like QtOneLineTextWidget.
+static const int MarginWidth = 5;
+static const int TextLeftMargin = 2;
+
+static bool paintedItemsEnabled = true; // main thread only
+
+bool QtPaintedItem::isEnabled() { return paintedItemsEnabled; }
+void QtPaintedItem::setEnabled(bool enabled) { paintedItemsEnabled = enabled; }
+
+QtPaintedItem::QtPaintedItem()
+	: controlRef(NULL),
+	  container(NULL),
+	  clickable(false),
+	  withBorder(false),
+	  autosizeWidth(false),
+	  hover(false),
+	  staticTextValid(false)
+{
+	staticText.setTextFormat(Qt::PlainText);
+}
+
+QtPaintedItem::~QtPaintedItem() {
+	if(controlRef) {
+		PyScopedGILInstr gil(GIL_SITE);
+		Py_CLEAR(controlRef);
+	}
+}
+
+bool QtPaintedItem::build(PyQtGuiObject* control, bool clickable) {
+	if(!paintedItemsEnabled) return false;
+
+	QtBaseWidget::ScopedRef container(control->getParentWidget());
+	if(!container) return false; // we are the root, thus there is nothing which could paint us
+
+	Ref item(new QtPaintedItem());
+	item->clickable = clickable;
+	long w = -1, h = -1;
+	{
+		PyScopedGILInstr gil(GIL_SITE);
+		item->controlRef = (PyWeakReference*) PyWeakref_NewRef((PyObject*) control, NULL);
+		if(!item->controlRef) {
+			printf("QtPaintedItem: cannot create controlRef\n");
+			if(PyErr_Occurred()) PyErr_Print();
+			return false;
+		}
+		w = attrChain_int_default(control->attr, "width", -1);
+		h = attrChain_int_default(control->attr, "height", -1);
+		if(w < 0) w = 30;
+		if(h < 0) h = 22;
+		control->PresetSize = Vec((int)w, (int)h);
+		item->withBorder = attrChain_bool_default(control->attr, "withBorder", false);
+		item->autosizeWidth = attrChain_bool_default(control->attr, "autosizeWidth", false);
+		item->foreground = foregroundColor(control);
+	}
+	item->geometry = QRect(0, 0, (int)w, (int)h);
+
+	control->item = item;
+	container->addPaintedItem(item);
+	return true;
+}
+
+PyQtGuiObject* QtPaintedItem::getControl() {
+	PyQtGuiObject* control = (PyQtGuiObject*) PyWeakref_GET_OBJECT(controlRef);
+	if(!control || (PyObject*) control == Py_None) return NULL;
+	Py_INCREF(control);
+	return control;
+}
+
+void QtPaintedItem::changed(const QRect& oldGeometry) {
+	if(!container) return;
+	container->update(oldGeometry | geometry);
+	// E.g. the list rows snapshot the painted texts.
+	container->notifyContentChanged();
+}
+
+void QtPaintedItem::setGeometry(const QRect& r) {
+	if(r == geometry) return;
+	QRect old = geometry;
+	if(r.size() != geometry.size())
+		staticTextValid = false;
+	geometry = r;
+	changed(old);
+}
+
+void QtPaintedItem::setHover(bool h) {
+	if(h == hover) return;
+	hover = h;
+	if(container) container->update(geometry);
+}
+
+void QtPaintedItem::updateContent() {
+	std::string s = "?";
+
+	{
+		PyScopedGILInstr gil(GIL_SITE);
+
+		PyQtGuiObject* control = getControl();
+		if(!control) return;
+
+		control->updateSubjectObject();
+
+		PyObject* textObj = NULL;
+		if(clickable)
+			textObj = clickableLabel_getTextObj(control);
+		else {
+			textObj = control->subjectObject;
+			Py_XINCREF(textObj);
+		}
+		if(!textObj && PyErr_Occurred()) PyErr_Print();
+		if(textObj && !pyStr(textObj, s)) {
+			if(PyErr_Occurred()) PyErr_Print();
+		}
+		Py_XDECREF(textObj);
+
+		foreground = foregroundColor(control);
+		// Like QtOneLineTextWidget, which reads it on every update.
+		autosizeWidth = attrChain_bool_default(control->attr, "autosizeWidth", false);
+		Py_DECREF(control);
+	}
+
+	text = QString::fromStdString(s);
+	staticTextValid = false;
+
+	QRect old = geometry;
+	if(autosizeWidth && container) {
+		QFontMetrics metrics(container->fontMetrics());
+		int w = metrics.boundingRect(text).width() + MarginWidth;
+		if(w != geometry.width()) {
+			geometry.setWidth(w);
+
+			PyScopedGILInstr gil(GIL_SITE);
+			PyQtGuiObject* control = getControl();
+			if(control) {
+				PyObject* res = PyObject_CallMethod((PyObject*) control, (char*)"layoutLine", NULL);
+				if(!res && PyErr_Occurred()) PyErr_Print();
+				Py_XDECREF(res);
+				Py_DECREF(control);
+			}
+		}
+	}
+
+	changed(old);
+}
+
+// Called from the container paintEvent. Never touches Python.
+void QtPaintedItem::paint(QPainter& p) {
+	assert(container);
+	if(!staticTextValid) {
+		QFontMetrics metrics(container->fontMetrics());
+		staticText.setText(metrics.elidedText(text, Qt::ElideRight, geometry.width() - MarginWidth));
+		staticText.prepare(QTransform(), container->font());
+		staticTextValid = true;
+	}
+
+	p.save();
+	p.setClipRect(geometry);
+	if(withBorder) {
+		p.setPen(container->palette().color(QPalette::Mid));
+		p.drawRect(geometry.adjusted(0, 0, -1, -1));
+	}
+	// Like QtClickableLabelWidget, which used the highlighted text color on hover.
+	p.setPen(hover ? container->palette().color(QPalette::Highlight) : foreground);
+	int y = geometry.top() + (geometry.height() - (int) staticText.size().height()) / 2;
+	p.drawStaticText(geometry.left() + TextLeftMargin, y, staticText);
+	p.restore();
+}
+
+void QtPaintedItem::click() {
+	if(!clickable) return;
+	PyWeakReference* ref = controlRef;
+	{
+		PyScopedGILInstr gil(GIL_SITE);
+		Py_INCREF(ref); // the item might be gone when the click is handled
+	}
+
+	dispatch_async_background_queue([ref]() {
+		PyScopedGILInstr gil(GIL_SITE);
+		PyQtGuiObject* control = (PyQtGuiObject*) PyWeakref_GET_OBJECT(ref);
+		if(control && (PyObject*) control != Py_None) {
+			Py_INCREF(control);
+			clickableLabel_handleClick(control);
+			Py_DECREF(control);
+		}
+		Py_DECREF(ref);
+	}, QtMainLane_Input); // a click response
+}
@@ -0,0 +1,71 @@
+//
+//  QtPaintedItem.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 28.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer_guiQt_QtPaintedItem_hpp__
+#define __MusicPlayer_guiQt_QtPaintedItem_hpp__
+
+#include <Python.h>
+#include <QRect>
+#include <QString>
+#include <QStaticText>
+#include <QColor>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+struct QtBaseWidget;
+struct PyQtGuiObject;
+class QPainter;
+
+// A read-only text (Traits.OneLineText) or a clickable label (Traits.ClickableLabel)
+// without an own QWidget. QtOneLineTextWidget is a QWidget with an embedded QLineEdit,
+// which is a lot for a label, esp. when every list row has some of them.
+// The container (the QtBaseWidget of the parent control) owns the item,
+// paints it with a cached QStaticText and does the hit-testing for clicks.
+// Unlike the read-only QLineEdit, the text cannot be selected. It can only be
+// copied as a whole via the context menu, see QtBaseWidget::contextMenuEvent().
+// The control only has a weak ref to it, see PyQtGuiObject::item.
+// Everything here is main thread only.
+struct QtPaintedItem : boost::noncopyable {
+	typedef boost::shared_ptr<QtPaintedItem> Ref;
+	typedef boost::weak_ptr<QtPaintedItem> WeakRef;
+
+	PyWeakReference* controlRef;
+	QtBaseWidget* container; // NULL when the container is gone
+	QRect geometry; // in container coordinates
+	QString text;
+	QColor foreground;
+	bool clickable;
+	bool withBorder;
+	bool autosizeWidth;
+	bool hover;
+
+	// Returns false if there cannot be a painted item for the control,
+	// e.g. if it is disabled or there is no container. Then build a widget instead.
+	static bool build(PyQtGuiObject* control, bool clickable);
+	// See guiQt.setPaintedItems(). Only affects newly built controls.
+	static bool isEnabled();
+	static void setEnabled(bool enabled);
+
+	~QtPaintedItem();
+	PyQtGuiObject* getControl(); // new ref. needs the GIL
+
+	void setGeometry(const QRect& r);
+	void setHover(bool h);
+	void updateContent();
+	void paint(QPainter& p);
+	void click();
+
+private:
+	QtPaintedItem();
+	QStaticText staticText; // elided to the current width
+	bool staticTextValid;
+	void changed(const QRect& oldGeometry);
+};
+
+#endif
@@ -0,0 +1,555 @@
+//
+//  QtTableWidget.cpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 27.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#include "QtTableWidget.hpp"
+#include "PythonHelpers.h"
+#include "PyUtils.h"
+#include "Builders.hpp"
+#include "QtUtils.hpp"
+#include "QtApp.hpp"
+#include "GILInstrument.hpp"
+#include <QHeaderView>
+#include <QAbstractTableModel>
+#include <QItemSelectionModel>
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <assert.h>
+
+RegisterControl(Table)
+
+// The Python side gives us a format_<key> function in Traits.Table.
+// For these keys, we know what it does (see modules/Search.py) and do it natively.
+static QtTableWidget::NativeFormat nativeFormatForKey(const std::string& key) {
+	if(key == "duration") return QtTableWidget::NativeFormat_Time;
+	if(key == "rating") return QtTableWidget::NativeFormat_Stars;
+	return QtTableWidget::NativeFormat_None;
+}
+
+// Like utils.formatTime.
+static QString formatTime(double t) {
+	long secs = (long) floor(t + 0.5);
+	long mins = secs / 60;
+	secs -= mins * 60;
+	long hours = mins / 60;
+	mins -= hours * 60;
+	QChar zero('0');
+	if(hours)
+		return QString("%1:%2:%3").arg(hours, 2, 10, zero).arg(mins, 2, 10, zero).arg(secs, 2, 10, zero);
+	return QString("%1:%2").arg(mins, 2, 10, zero).arg(secs, 2, 10, zero);
+}
+
+static QString formatNumber(double v) {
+	if(v == floor(v) && fabs(v) < 1e15)
+		return QString::number((qlonglong) v);
+	return QString::number(v);
+}
+
+enum CellKind {
+	Cell_None = 0, // missing or None
+	Cell_Number,
+	Cell_Text,
+};
+
+struct QtTableWidget::Snapshot {
+	struct Column {
+		NativeFormat format;
+		bool preformatted; // texts are from the Python formatter
+		std::vector<unsigned char> kinds; // CellKind
+		std::vector<double> numbers; // for Cell_Number
+		std::vector<QString> texts; // for Cell_Text, or all if preformatted
+	};
+	std::vector<Column> columns;
+	size_t rowCount;
+	PyObject* rows; // the source list. only for the selection handler
+
+	Snapshot() : rowCount(0), rows(NULL) {}
+	~Snapshot() {
+		if(rows) {
+			PyScopedGILInstr gil(GIL_SITE);
+			Py_CLEAR(rows);
+		}
+	}
+
+	QString displayText(size_t col, size_t row) const {
+		const Column& c = columns[col];
+		if(c.preformatted) return c.texts[row];
+		switch(c.kinds[row]) {
+			case Cell_Number: {
+				double v = c.numbers[row];
+				switch(c.format) {
+					case NativeFormat_Time: return (v > 0) ? formatTime(v) : QString();
+					case NativeFormat_Stars: return QString((int) floor(v * 5 + 0.5), QChar(0x2605));
+					default: return formatNumber(v);
+				}
+			}
+			case Cell_Text: return c.texts[row];
+			default: return QString();
+		}
+	}
+
+	// Like Python 2 sorting: None < numbers < strings. Strings are compared case-insensitive.
+	int compare(size_t col, size_t a, size_t b) const {
+		const Column& c = columns[col];
+		if(c.kinds[a] != c.kinds[b])
+			return (c.kinds[a] < c.kinds[b]) ? -1 : 1;
+		switch(c.kinds[a]) {
+			case Cell_Number:
+				if(c.numbers[a] == c.numbers[b]) return 0;
+				return (c.numbers[a] < c.numbers[b]) ? -1 : 1;
+			case Cell_Text:
+				return c.texts[a].compare(c.texts[b], Qt::CaseInsensitive);
+			default:
+				return 0;
+		}
+	}
+};
+
+class QtTableWidget::TableModel : public QAbstractTableModel {
+	std::vector<QString> headers;
+	SnapshotPtr snapshot;
+	std::vector<size_t> order; // view row -> snapshot row
+	int sortColumn; // -1: source order
+	Qt::SortOrder sortOrder;
+
+	void updateOrder() {
+		size_t n = snapshot ? snapshot->rowCount : 0;
+		order.resize(n);
+		for(size_t i = 0; i < n; ++i) order[i] = i;
+		if(!snapshot || sortColumn < 0 || (size_t) sortColumn >= snapshot->columns.size()) return;
+		const Snapshot& s = *snapshot;
+		size_t col = sortColumn;
+		bool desc = sortOrder == Qt::DescendingOrder;
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			int c = s.compare(col, a, b);
+			return desc ? (c > 0) : (c < 0);
+		});
+	}
+
+public:
+	TableModel(QObject* parent, const std::vector<std::string>& keys)
+		: QAbstractTableModel(parent), sortColumn(-1), sortOrder(Qt::AscendingOrder)
+	{
+		for(const std::string& key : keys) {
+			// Like key.capitalize().
+			QString title = QString::fromStdString(key).toLower();
+			if(!title.isEmpty()) title[0] = title[0].toUpper();
+			headers.push_back(title);
+		}
+	}
+
+	virtual int rowCount(const QModelIndex& parent) const {
+		if(parent.isValid()) return 0;
+		return (int) order.size();
+	}
+
+	virtual int columnCount(const QModelIndex& parent) const {
+		if(parent.isValid()) return 0;
+		return (int) headers.size();
+	}
+
+	virtual QVariant data(const QModelIndex& index, int role) const {
+		if(!snapshot || !index.isValid()) return QVariant();
+		size_t row = index.row(), col = index.column();
+		if(row >= order.size() || col >= snapshot->columns.size()) return QVariant();
+		if(role == Qt::DisplayRole)
+			return snapshot->displayText(col, order[row]);
+		if(role == Qt::TextAlignmentRole && snapshot->columns[col].format == NativeFormat_Time)
+			return int(Qt::AlignRight | Qt::AlignVCenter);
+		return QVariant();
+	}
+
+	virtual QVariant headerData(int section, Qt::Orientation orientation, int role) const {
+		if(orientation != Qt::Horizontal || role != Qt::DisplayRole) return QVariant();
+		if(section < 0 || (size_t) section >= headers.size()) return QVariant();
+		return headers[section];
+	}
+
+	virtual Qt::ItemFlags flags(const QModelIndex& index) const {
+		if(!index.isValid()) return Qt::NoItemFlags;
+		return Qt::ItemIsEnabled | Qt::ItemIsSelectable; // not editable
+	}
+
+	// Note that this resets the selection, like a new snapshot does.
+	virtual void sort(int column, Qt::SortOrder order) {
+		beginResetModel();
+		sortColumn = column;
+		sortOrder = order;
+		updateOrder();
+		endResetModel();
+	}
+
+	// Main thread only. A single model reset, independent of the row count.
+	void setSnapshot(const SnapshotPtr& s) {
+		beginResetModel();
+		snapshot = s;
+		updateOrder(); // keep the current sorting
+		endResetModel();
+	}
+
+	const SnapshotPtr& getSnapshot() const { return snapshot; }
+
+	size_t sourceRow(int row) const {
+		assert(row >= 0 && (size_t) row < order.size());
+		return order[row];
+	}
+};
+
+
+QtTableWidget::QtTableWidget(PyQtGuiObject* control)
+	: QtBaseWidget(control),
+	  tableModel(NULL),
+	  tableView(NULL),
+	  formaters(NULL),
+	  hasSelectionHandler(false),
+	  snapshotGeneration(0)
+{
+	resize(width(), /* default height */ 80);
+
+	{
+		PyScopedGILInstr gil(GIL_SITE);
+
+		control->OuterSpace = Vec(0,0);
+
+		PyObject* type = attrChain(control->attr, "type");
+		PyObject* keysObj = type ? PyObject_GetAttrString(type, "keys") : NULL;
+		PyObject* keysSeq = keysObj ? PySequence_Fast(keysObj, "Traits.Table.keys must be a sequence") : NULL;
+		if(keysSeq) {
+			for(Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(keysSeq); ++i) {
+				std::string key;
+				if(!pyStr(PySequence_Fast_GET_ITEM(keysSeq, i), key)) {
+					printf("Qt TableControl: invalid key\n");
+					if(PyErr_Occurred()) PyErr_Print();
+					continue;
+				}
+				keys.push_back(key);
+				nativeFormats.push_back(nativeFormatForKey(key));
+			}
+		}
+		else {
+			printf("Qt TableControl: cannot get attr.type.keys\n");
+			if(PyErr_Occurred()) PyErr_Print();
+		}
+
+		formaters = type ? PyObject_GetAttrString(type, "formaters") : NULL;
+		if(formaters && !PyDict_Check(formaters)) Py_CLEAR(formaters);
+		if(PyErr_Occurred()) PyErr_Print();
+
+		PyObject* handler = attrChain(control->attr, "selectionChangeHandler");
+		if(!handler && PyErr_Occurred()) PyErr_Print();
+		hasSelectionHandler = handler && handler != Py_None;
+
+		Py_XDECREF(handler);
+		Py_XDECREF(keysSeq);
+		Py_XDECREF(keysObj);
+		Py_XDECREF(type);
+	}
+
+	tableModel = new TableModel(this, keys);
+
+	tableView = new QTableView(this);
+	tableView->setModel(tableModel);
+	tableView->setSelectionBehavior(QAbstractItemView::SelectRows);
+	tableView->setSelectionMode(QAbstractItemView::ExtendedSelection);
+	tableView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+	tableView->setAlternatingRowColors(true);
+	tableView->setWordWrap(false);
+	tableView->verticalHeader()->hide();
+	// Uniform row heights. Otherwise the view would measure every row.
+	tableView->verticalHeader()->setDefaultSectionSize(tableView->fontMetrics().height() + 4);
+	tableView->horizontalHeader()->setStretchLastSection(true);
+	// Keep the source order (e.g. search relevance) until the user clicks on a column header.
+	tableView->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+	tableView->setSortingEnabled(true);
+	tableView->resize(size());
+	tableView->show();
+
+	connect(tableView->selectionModel(), SIGNAL(selectionChanged(const QItemSelection&, const QItemSelection&)),
+			this, SLOT(onSelectionChanged()));
+}
+
+QtTableWidget::~QtTableWidget() {
+	delete tableView;
+	tableView = 0;
+	if(formaters) {
+		PyScopedGILInstr gil(GIL_SITE);
+		Py_CLEAR(formaters);
+	}
+}
+
+static void cellFromPyObject(QtTableWidget::Snapshot::Column& c, PyObject* value, QString& text) {
+	if(!value || value == Py_None) {
+		c.kinds.push_back(Cell_None);
+		c.numbers.push_back(0);
+		return;
+	}
+	if(PyInt_Check(value) || PyLong_Check(value) || PyFloat_Check(value)) {
+		double v = PyFloat_AsDouble(value);
+		if(v == -1 && PyErr_Occurred()) {
+			PyErr_Clear(); // e.g. long overflow
+			v = 0;
+		}
+		c.kinds.push_back(Cell_Number);
+		c.numbers.push_back(v);
+		return;
+	}
+	std::string s;
+	if(!pyStr(value, s)) {
+		if(PyErr_Occurred()) PyErr_Print();
+		s = "?";
+	}
+	c.kinds.push_back(Cell_Text);
+	c.numbers.push_back(0);
+	text = QString::fromUtf8(s.c_str(), (int) s.size());
+}
+
+// Copies the rows into a snapshot. This calls the Python formatters for every
+// non-native cell, thus it can take long for many rows. We build it in steps of
+// at most kTableBuildStepUs, each a separate main thread task, so that the main
+// executor can run other things (e.g. input handling) in between.
+// It only works on the data which it copied from the widget at the start
+// (under a short ScopedRef), thus it never holds the widget lock while it runs Python.
+static const long kTableBuildStepUs = 4000;
+
+struct TableSnapshotBuild {
+	typedef QtTableWidget::Snapshot Snapshot;
+
+	QtBaseWidget::WeakRef widgetRef;
+	unsigned long generation;
+	std::vector<std::string> keys;
+	std::vector<QtTableWidget::NativeFormat> nativeFormats;
+	PyObject* formaters; // own ref or NULL
+	PyQtGuiObject* control; // own ref
+
+	QtTableWidget::SnapshotPtr snapshot;
+	PyObject* rowsList; // own ref. a copy, thus it cannot change in between the steps
+	std::vector<PyObject*> keyObjs; // own refs
+	std::vector<PyObject*> pyFormaters; // borrowed from formaters
+	size_t rowCount;
+	size_t nextRow;
+
+	TableSnapshotBuild()
+		: generation(0), formaters(NULL), control(NULL), rowsList(NULL), rowCount(0), nextRow(0) {}
+
+	// With GIL.
+	void releaseRefs() {
+		for(PyObject* k : keyObjs) Py_XDECREF(k);
+		keyObjs.clear();
+		pyFormaters.clear();
+		Py_CLEAR(rowsList);
+		Py_CLEAR(formaters);
+		Py_CLEAR(control);
+	}
+
+	~TableSnapshotBuild() {
+		if(!rowsList && !formaters && !control && keyObjs.empty()) return;
+		PyScopedGILInstr gil(GIL_SITE);
+		releaseRefs();
+	}
+
+	// With GIL. Returns false if there is nothing to build, then the snapshot is empty.
+	bool start() {
+		snapshot.reset(new Snapshot());
+		control->updateSubjectObject();
+		PyObject* rows = control->subjectObject;
+		if(!rows || rows == Py_None) return false;
+		rowsList = PySequence_List(rows);
+		if(!rowsList) {
+			printf("Qt TableControl: subject must be a sequence\n");
+			if(PyErr_Occurred()) PyErr_Print();
+			return false;
+		}
+
+		rowCount = PyList_GET_SIZE(rowsList);
+		snapshot->columns.resize(keys.size());
+		for(size_t col = 0; col < keys.size(); ++col) {
+			Snapshot::Column& c = snapshot->columns[col];
+			PyObject* formater = formaters ? PyDict_GetItemString(formaters, keys[col].c_str()) : NULL;
+			// Only if the Python side wants it formatted at all.
+			c.format = formater ? nativeFormats[col] : QtTableWidget::NativeFormat_None;
+			if(c.format != QtTableWidget::NativeFormat_None) formater = NULL;
+			c.preformatted = formater != NULL;
+			pyFormaters.push_back(formater);
+			c.kinds.reserve(rowCount);
+			c.numbers.reserve(rowCount);
+			c.texts.reserve(rowCount);
+			keyObjs.push_back(PyString_FromString(keys[col].c_str()));
+			if(!keyObjs.back()) return false;
+		}
+		return true;
+	}
+
+	// With GIL. Returns true when all rows are done.
+	bool step() {
+		auto stepStart = std::chrono::steady_clock::now();
+		while(nextRow < rowCount) {
+			addRow(PyList_GET_ITEM(rowsList, nextRow));
+			++nextRow;
+			// Check the time only every few rows. That is cheap enough.
+			if(nextRow % 16 == 0 &&
+			   std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - stepStart).count() > kTableBuildStepUs)
+				return nextRow >= rowCount;
+		}
+		return true;
+	}
+
+	void addRow(PyObject* item) {
+		for(size_t col = 0; col < keys.size(); ++col) {
+			Snapshot::Column& c = snapshot->columns[col];
+			// Like item.get(key). The rows are dicts (e.g. songdb.search results).
+			PyObject* value = PyDict_Check(item) ? PyDict_GetItem(item, keyObjs[col]) : NULL;
+			QString text;
+			cellFromPyObject(c, value, text);
+			if(pyFormaters[col]) {
+				PyObject* formatted = PyObject_CallFunctionObjArgs(pyFormaters[col], value ? value : Py_None, NULL);
+				std::string s;
+				if(!formatted || !pyStr(formatted, s)) {
+					if(PyErr_Occurred()) PyErr_Print();
+					s = "?";
+				}
+				Py_XDECREF(formatted);
+				if(c.kinds.back() != Cell_Number) c.kinds.back() = Cell_Text; // sort by the formatted text
+				text = QString::fromUtf8(s.c_str(), (int) s.size());
+			}
+			c.texts.push_back(text);
+		}
+	}
+
+	// With GIL. Only now, thus the model never sees incomplete columns.
+	void finish() {
+		snapshot->rowCount = rowCount;
+		snapshot->rows = rowsList;
+		Py_INCREF(snapshot->rows);
+		releaseRefs();
+	}
+
+	// Main thread only. Whether the widget is gone or there was another update in the meantime.
+	bool superseded() const {
+		QtBaseWidget::ScopedRef selfRef(widgetRef);
+		if(!selfRef) return true;
+		QtTableWidget* self = dynamic_cast<QtTableWidget*>(selfRef.get());
+		assert(self);
+		return self->snapshotGeneration != generation;
+	}
+
+	// Main thread only.
+	void apply() {
+		QtBaseWidget::ScopedRef selfRef(widgetRef);
+		if(!selfRef) return;
+		QtTableWidget* self = dynamic_cast<QtTableWidget*>(selfRef.get());
+		assert(self);
+		// There was another update in the meantime.
+		if(self->snapshotGeneration != generation) return;
+		self->tableModel->setSnapshot(snapshot);
+	}
+};
+
+typedef boost::shared_ptr<TableSnapshotBuild> TableSnapshotBuildPtr;
+
+static void tableSnapshotBuildDone(TableSnapshotBuildPtr build) {
+	execInMainThread_async([=]() { build->apply(); });
+}
+
+static void tableSnapshotBuildStep(TableSnapshotBuildPtr build) {
+	if(build->superseded()) return;
+	bool done;
+	{
+		PyScopedGILInstr gil(GIL_SITE);
+		done = build->step();
+		if(done) build->finish();
+	}
+	if(done)
+		tableSnapshotBuildDone(build);
+	else
+		dispatch_async_background_queue([=]() { tableSnapshotBuildStep(build); });
+}
+
+void QtTableWidget::updateContent() {
+	TableSnapshotBuildPtr build(new TableSnapshotBuild());
+	build->widgetRef = WeakRef(*this);
+	build->generation = ++snapshotGeneration;
+
+	dispatch_async_background_queue([=]() {
+		PyScopedGILInstr gil(GIL_SITE);
+		{
+			// Only copy what we need. We must not hold the widget lock
+			// while we call into Python.
+			ScopedRef selfRef(build->widgetRef);
+			if(!selfRef) return;
+			QtTableWidget* self = dynamic_cast<QtTableWidget*>(selfRef.get());
+			assert(self);
+			build->keys = self->keys;
+			build->nativeFormats = self->nativeFormats;
+			build->formaters = self->formaters;
+			Py_XINCREF(build->formaters);
+			build->control = self->getControl();
+		}
+		if(!build->control) return;
+		if(!build->start()) {
+			// Show the empty snapshot.
+			build->releaseRefs();
+			tableSnapshotBuildDone(build);
+			return;
+		}
+		dispatch_async_background_queue([=]() { tableSnapshotBuildStep(build); });
+	});
+}
+
+void QtTableWidget::resizeEvent(QResizeEvent* ev) {
+	QtBaseWidget::resizeEvent(ev);
+	tableView->resize(size());
+}
+
+void QtTableWidget::onSelectionChanged() {
+	if(!hasSelectionHandler) return;
+
+	SnapshotPtr snapshot = tableModel->getSnapshot();
+	if(!snapshot) return;
+	std::vector<size_t> rows;
+	for(const QModelIndex& index : tableView->selectionModel()->selectedRows())
+		rows.push_back(tableModel->sourceRow(index.row()));
+	std::sort(rows.begin(), rows.end());
+
+	WeakRef selfRefCopy(*this);
+	dispatch_async_background_queue([=]() {
+		PyScopedGILInstr gil(GIL_SITE);
+
+		PyQtGuiObject* control = NULL;
+		PyObject* selection = NULL;
+		PyObject* handler = NULL;
+		PyObject* res = NULL;
+
+		{
+			ScopedRef selfRef(selfRefCopy);
+			if(!selfRef) return;
+			control = selfRef->getControl();
+		}
+		if(!control) return;
+		if(!control->parent || !control->parent->subjectObject || !snapshot->rows) goto final;
+
+		// Like the Cocoa TableViewDelegate: the list of the selected row objects.
+		selection = PyList_New(rows.size());
+		if(!selection) goto final;
+		for(size_t i = 0; i < rows.size(); ++i) {
+			PyObject* item = PySequence_Fast_GET_ITEM(snapshot->rows, rows[i]);
+			Py_INCREF(item);
+			PyList_SET_ITEM(selection, i, item);
+		}
+
+		handler = attrChain(control->attr, "selectionChangeHandler");
+		if(!handler || handler == Py_None) goto final;
+		res = PyObject_CallFunctionObjArgs(handler, control->parent->subjectObject, selection, NULL);
+
+	final:
+		if(PyErr_Occurred()) PyErr_Print();
+		Py_XDECREF(res);
+		Py_XDECREF(handler);
+		Py_XDECREF(selection);
+		Py_DECREF(control);
+	});
+}
@@ -0,0 +1,63 @@
+//
+//  QtTableWidget.hpp
+//  MusicPlayer
+//
+//  Created by Albert Zeyer on 27.02.14.
+//  Copyright (c) 2014 Albert Zeyer. All rights reserved.
+//
+
+#ifndef __MusicPlayer_guiQt_QtTableWidget_hpp__
+#define __MusicPlayer_guiQt_QtTableWidget_hpp__
+
+#include "QtBaseWidget.hpp"
+#include <QTableView>
+#include <Python.h>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <string>
+
+// Traits.Table. The rows (e.g. search results, a list of dicts) are copied
+// into a columnar C++ snapshot, once per updateContent(). The model only
+// works on that, thus painting, sorting and formatting never touch Python.
+class QtTableWidget : public QtBaseWidget {
+	Q_OBJECT
+
+public:
+	struct Snapshot;
+	typedef boost::shared_ptr<Snapshot> SnapshotPtr;
+
+	// Formatters which we do natively. Taken instead of the Python Traits.Table
+	// format_<key> function for the known keys, see nativeFormatForKey().
+	enum NativeFormat {
+		NativeFormat_None = 0,
+		NativeFormat_Time, // like utils.formatTime, empty if <= 0
+		NativeFormat_Stars, // rating in [0,1] -> 0-5 stars
+	};
+
+protected:
+	class TableModel;
+
+	TableModel* tableModel;
+	QTableView* tableView;
+	std::vector<std::string> keys;
+	std::vector<NativeFormat> nativeFormats;
+	PyObject* formaters; // attr.type.formaters, only used for the non-native ones
+	bool hasSelectionHandler;
+	unsigned long snapshotGeneration; // main thread only
+
+	friend struct TableSnapshotBuild; // see QtTableWidget.cpp
+
+public:
+	QtTableWidget(PyQtGuiObject* control);
+	~QtTableWidget();
+
+	virtual void updateContent();
+
+protected:
+	virtual void resizeEvent(QResizeEvent *);
+
+public slots:
+	void onSelectionChanged();
+};
+
+#endif
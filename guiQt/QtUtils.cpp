@@ -2,9 +2,9 @@
 #include "QtUtils.hpp"
 #include "QtApp.hpp"
 
-void dispatch_async_background_queue(boost::function<void()> f) {
+void dispatch_async_background_queue(boost::function<void()> f, QtMainLane lane) {
 	// XXX: other thread, not the main thread
-	execInMainThread_async(f);
+	execInMainThread_async(f, lane);
 }
 
 void dispatch_sync_main_queue(boost::function<void()> f) {
@@ -2,8 +2,9 @@
 #define __MP_QTUTILS_HPP
 
 #include <boost/function.hpp>
+#include "QtMainExecutor.hpp"
 
-void dispatch_async_background_queue(boost::function<void()>);
+void dispatch_async_background_queue(boost::function<void()>, QtMainLane lane = QtMainLane_Content);
 void dispatch_sync_main_queue(boost::function<void()>);
 
 #endif // QTUTILS_HPP
@@ -22,6 +22,10 @@ QMAKE_CXXFLAGS += -std=c++11
 INCLUDEPATH += $$top_srcdir/_gui
 INCLUDEPATH += $$top_srcdir/core
 
+# The benchmark entry points (guiQt.benchmark*) are only
+# in builds configured with: qmake CONFIG+=benchmarks
+CONFIG(benchmarks): DEFINES += MUSICPLAYER_BENCHMARKS
+
 mac {
         QMAKE_LFLAGS += -undefined dynamic_lookup
 }
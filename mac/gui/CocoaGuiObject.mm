@@ -127,15 +127,12 @@ static void imp_meth_updateContent(GuiObject* obj) {
 
 NSView* CocoaGuiObject::getNativeObj() {
 	// This function can be called without the Python GIL.
-	id nativeObj = nil;
-	nativeGuiObject.operate<void>([&](PyObject*& ptr) { nativeObj = PyObjCObj_GetNativeObj(ptr); });
-	return nativeObj;
+	return nativeGuiObject.read<id>([](PyObject* ptr) { return PyObjCObj_GetNativeObj(ptr); });
 }
 
 void CocoaGuiObject::setNativeObj(NSView* v) {
 	PyObject* nativeObj = PyObjCObj_NewNative(v);
-	nativeGuiObject.operate<void>([&](PyObject*& ptr) { std::swap(ptr, nativeObj); });
-	Py_XDECREF(nativeObj);
+	Py_DecRef(nativeGuiObject.exchange(nativeObj));
 }
 
 void CocoaGuiObject::addChild(NSView* child) {
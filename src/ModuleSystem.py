@@ -2,6 +2,7 @@
 from utils import *
 import appinfo
 import os
+import StartupTrace
 from threading import currentThread, Thread
 
 
@@ -39,8 +40,11 @@ class Module:
 					sys.excepthook(*sys.exc_info())
 					# continue anyway, maybe it still works and maybe the mainFunc does sth good/important
 			else:
-				self.module = __import__(self.moduleName)
+				with StartupTrace.phase("import %s" % self.moduleName):
+					self.module = __import__(self.moduleName)
 			mainFunc = getattr(self.module, self.mainFuncName)
+			# The mainFunc usually runs until we quit, thus we only mark its start.
+			StartupTrace.mark("module %s started" % self.name)
 			try:
 				mainFunc()
 			except KeyboardInterrupt:
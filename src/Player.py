@@ -64,6 +64,11 @@ def initEventCallbacks():
 initEventCallbacks()
 
 def loadPlayer(state):
+	import StartupTrace
+	with StartupTrace.phase("load player"):
+		return _loadPlayer(state)
+
+def _loadPlayer(state):
 	import musicplayer
 
 	from appinfo import args, config
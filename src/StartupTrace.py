@@ -0,0 +1,66 @@
+# MusicPlayer, https://github.com/albertz/music-player
+# Copyright (c) 2014, Albert Zeyer, www.az2000.de
+# All rights reserved.
+# This code is under the 2-clause BSD license, see License.txt in the root directory of this project.
+
+# Startup phase timeline. See app/StartupTrace.hpp.
+# Enabled with --startup-trace. All functions here do nothing otherwise,
+# or if we don't run inside of the MusicPlayer binary.
+
+_lib = None
+
+def _getLib():
+	global _lib
+	if _lib is not None: return _lib
+	_lib = False
+	try:
+		import ctypes
+		lib = ctypes.CDLL(None)
+		lib.StartupTrace_isEnabled.restype = ctypes.c_int
+		for f in ("StartupTrace_begin", "StartupTrace_end", "StartupTrace_mark"):
+			getattr(lib, f).argtypes = [ctypes.c_char_p]
+			getattr(lib, f).restype = None
+		if lib.StartupTrace_isEnabled():
+			_lib = lib
+	except Exception:
+		pass # e.g. not in the MusicPlayer binary
+	return _lib
+
+def _cstr(name):
+	if not isinstance(name, bytes): name = name.encode("utf8")
+	return name
+
+def isEnabled():
+	return bool(_getLib())
+
+def begin(name):
+	lib = _getLib()
+	if lib: lib.StartupTrace_begin(_cstr(name))
+
+def end(name):
+	lib = _getLib()
+	if lib: lib.StartupTrace_end(_cstr(name))
+
+def mark(name):
+	lib = _getLib()
+	if lib: lib.StartupTrace_mark(_cstr(name))
+
+_marksOnce = set()
+
+def markOnce(name):
+	"""For milestones like "first sound"."""
+	if name in _marksOnce: return
+	_marksOnce.add(name)
+	mark(name)
+
+class phase:
+	"""
+	with StartupTrace.phase("import gui"):
+		import gui
+	"""
+	def __init__(self, name):
+		self.name = name
+	def __enter__(self):
+		begin(self.name)
+	def __exit__(self, *exc):
+		end(self.name)
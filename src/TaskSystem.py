@@ -6,7 +6,7 @@ most of them quite low level.
 
 from __future__ import print_function
 from utils import *
-from threading import Condition, Thread, RLock, Lock, currentThread
+from threading import Condition, Thread, RLock, Lock, currentThread, local
 import Logging
 import sys
 import os
@@ -354,7 +354,8 @@ class Pickler(_BasePickler):
 	def __init__(self, *args, **kwargs):
 		if "protocol" not in kwargs:
 			kwargs["protocol"] = pickle.HIGHEST_PROTOCOL
-		super(Pickler, self).__init__(*args, **kwargs)
+		# pickle.Pickler is an old-style class in Python 2, thus no super().
+		_BasePickler.__init__(self, *args, **kwargs)
 	dispatch = _BasePickler.dispatch.copy()
 
 	def save_func(self, obj):
@@ -442,6 +443,46 @@ class Pickler(_BasePickler):
 	def __setstate__(self, state): pass
 
 
+_zygoteLib = None
+
+def getZygoteLib():
+	"""
+	The zygote functions of the MusicPlayer binary (app/Zygote.hpp), or None if not available.
+	"""
+	global _zygoteLib
+	if _zygoteLib is not None: return _zygoteLib or None
+	_zygoteLib = False
+	try:
+		from appinfo import config
+		if not config.zygote: return None
+		import ctypes
+		lib = ctypes.CDLL(None)
+		lib.Zygote_spawn.restype = ctypes.c_int
+		lib.Zygote_spawn.argtypes = [ctypes.POINTER(ctypes.c_int), ctypes.c_int]
+		lib.Zygote_configure(int(config.zygotePoolSize), int(config.zygoteIdleTimeout))
+		_zygoteLib = lib
+	except Exception:
+		pass # e.g. not in the MusicPlayer binary
+	return _zygoteLib or None
+
+def zygoteStats():
+	lib = getZygoteLib()
+	if not lib: return None
+	import ctypes
+	fields = ["spawns", "failures", "zygoteStarts", "lastSpawnLatencyUs", "maxSpawnLatencyUs", "totalSpawnLatencyUs"]
+	class ZygoteStats(ctypes.Structure):
+		_fields_ = [(f, ctypes.c_longlong) for f in fields]
+	stats = ZygoteStats()
+	lib.Zygote_getStats(ctypes.byref(stats))
+	return dict([(f, getattr(stats, f)) for f in fields])
+
+# While we pickle the ExecingProcess args for the zygote, this collects the fds
+# which must be passed along (collectedFds). Per thread, because several threads
+# can start an ExecingProcess at the same time, and the pickling runs in the calling thread.
+# In the zygote child, _ExecingProcess_fdRemap maps them to the new fds.
+_ExecingProcess_pickleState = local()
+_ExecingProcess_fdRemap = {}
+
 class ExecingProcess:
 	def __init__(self, target, args, name):
 		self.target = target
@@ -458,6 +499,7 @@ class ExecingProcess:
 			return readend,writeend
 		self.pipe_c2p = pipeOpen()
 		self.pipe_p2c = pipeOpen()
+		if self._startViaZygote(): return
 		pid = os.fork()
 		if pid == 0: # child
 			self.pipe_c2p[0].close()
@@ -479,28 +521,77 @@ class ExecingProcess:
 			self.pickler.dump(self.target)
 			self.pickler.dump(self.args)
 			self.pipe_p2c[1].flush()
+	def _startViaZygote(self):
+		lib = getZygoteLib()
+		if not lib: return False
+		# The zygote child doesn't inherit our fds, thus we collect all the fds
+		# which we pickle (ExecingProcess_ConnectionWrapper) and pass them along.
+		buf = StringIO()
+		collectedFds = _ExecingProcess_pickleState.collectedFds = []
+		try:
+			pickler = Pickler(buf)
+			pickler.dump(self.name)
+			pickler.dump(self.target)
+			pickler.dump(self.args)
+			fds = [self.pipe_c2p[1].fileno(), self.pipe_p2c[0].fileno()]
+			fds += [fd for fd in collectedFds if fd not in fds]
+		finally:
+			_ExecingProcess_pickleState.collectedFds = None
+		import ctypes
+		pid = lib.Zygote_spawn((ctypes.c_int * len(fds))(*fds), len(fds))
+		if pid <= 0: return False # fallback to fork+exec
+		self.pipe_c2p[1].close()
+		self.pipe_p2c[0].close()
+		self.pid = pid
+		self.pipe_p2c[1].write(buf.getvalue())
+		self.pipe_p2c[1].flush()
+		return True
 	Verbose = False
+	viaZygote = False # set in the zygote child
+	ZygotePreloadModules = ["utils", "Song", "ModuleSystem", "songdb"]
+	@staticmethod
+	def zygotePreload():
+		# Called in the zygote process. This is what main.py would do before checkExec(),
+		# plus the imports which the tasks usually need.
+		import better_exchook
+		better_exchook.install()
+		import appinfo
+		for modName in ExecingProcess.ZygotePreloadModules:
+			try:
+				__import__(modName)
+			except Exception:
+				print("Zygote: error while preloading", modName)
+				sys.excepthook(*sys.exc_info())
+	@staticmethod
+	def runChildFromZygote(writeFileNo, readFileNo, fdRemap):
+		global _ExecingProcess_fdRemap
+		_ExecingProcess_fdRemap = fdRemap
+		ExecingProcess.viaZygote = True
+		ExecingProcess._runChild(writeFileNo, readFileNo)
 	@staticmethod
 	def checkExec():
 		if "--forkExecProc" in sys.argv:
 			argidx = sys.argv.index("--forkExecProc")
 			writeFileNo = int(sys.argv[argidx + 1])
 			readFileNo = int(sys.argv[argidx + 2])
-			readend = os.fdopen(readFileNo, "r")
-			writeend = os.fdopen(writeFileNo, "w")
-			unpickler = Unpickler(readend)
-			name = unpickler.load()
-			if ExecingProcess.Verbose: print("ExecingProcess child %s (pid %i)" % (name, os.getpid()))
-			try:
-				target = unpickler.load()
-				args = unpickler.load()
-			except EOFError:
-				print("Error: unpickle incomplete")
-				raise SystemExit
-			ret = target(*args)
-			Pickler(writeend).dump(ret)
-			if ExecingProcess.Verbose: print("ExecingProcess child %s (pid %i) finished" % (name, os.getpid()))
+			ExecingProcess._runChild(writeFileNo, readFileNo)
+	@staticmethod
+	def _runChild(writeFileNo, readFileNo):
+		readend = os.fdopen(readFileNo, "r")
+		writeend = os.fdopen(writeFileNo, "w")
+		unpickler = Unpickler(readend)
+		name = unpickler.load()
+		if ExecingProcess.Verbose: print("ExecingProcess child %s (pid %i)" % (name, os.getpid()))
+		try:
+			target = unpickler.load()
+			args = unpickler.load()
+		except EOFError:
+			print("Error: unpickle incomplete")
 			raise SystemExit
+		ret = target(*args)
+		Pickler(writeend).dump(ret)
+		if ExecingProcess.Verbose: print("ExecingProcess child %s (pid %i) finished" % (name, os.getpid()))
+		raise SystemExit
 
 class ExecingProcess_ConnectionWrapper(object):
 	def __init__(self, fd=None):
@@ -508,8 +599,12 @@ class ExecingProcess_ConnectionWrapper(object):
 		if self.fd:
 			from _multiprocessing import Connection
 			self.conn = Connection(fd)
-	def __getstate__(self): return self.fd
-	def __setstate__(self, state): self.__init__(state)
+	def __getstate__(self):
+		collectedFds = getattr(_ExecingProcess_pickleState, "collectedFds", None)
+		if collectedFds is not None:
+			collectedFds.append(self.fd)
+		return self.fd
+	def __setstate__(self, state): self.__init__(_ExecingProcess_fdRemap.get(state, state))
 	def __getattr__(self, attr): return getattr(self.conn, attr)
 	def _check_closed(self): assert not self.conn.closed
 	def _check_writable(self): assert self.conn.writable
@@ -608,7 +703,9 @@ class AsyncTask:
 	@property
 	def isChild(self):
 		if self.isParent: return False
-		assert self.parent_pid == os.getppid()
+		# Via the zygote, our parent process is the zygote.
+		if not ExecingProcess.viaZygote:
+			assert self.parent_pid == os.getppid()
 		return True
 
 	# This might be called from the module code.
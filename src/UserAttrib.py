@@ -35,6 +35,7 @@ class UserAttrib(object):
 		withBorder = False
 		searchLook = False
 		autoScrolldown = False
+		maxRowControls = None
 		dragHandler = None
 		selectionChangeHandler = None
 
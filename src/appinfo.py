@@ -55,6 +55,10 @@ class Config:
 	mpdBindHost = '127.0.0.1'
 	mpdBindPort = 6600
 	sampleRate = 48000
+	# Pre-forked helper process for the subprocess tasks. See app/Zygote.hpp.
+	zygote = True
+	zygotePoolSize = 1
+	zygoteIdleTimeout = 60 # secs
 	def __init__(self, **kwargs):
 		for k in dir(self):
 			if k.startswith("_"): continue
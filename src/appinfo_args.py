@@ -54,6 +54,10 @@ argParser.add_argument(
 argParser.add_argument(
 	"--forkExecProc", nargs=2, help=argparse.SUPPRESS
 )
+argParser.add_argument(
+	# See app/Zygote.hpp.
+	"--zygote", nargs=3, help=argparse.SUPPRESS
+)
 argParser.add_argument(
 	# Used by MacOSX in some debug cases.
 	"-NSDocumentRevisionsDebugMode", nargs=1, help=argparse.SUPPRESS
@@ -68,6 +72,10 @@ argParser.add_argument(
 argParser.add_argument(
 	"--profile", action="store_true", help="enable profiling"
 )
+argParser.add_argument(
+	# Handled in the native main(), see app/StartupTrace.hpp.
+	"--startup-trace", action="store_true", help="write a timeline of the startup phases (Chrome trace JSON)"
+)
 argParser.add_argument(
 	"--nomodstartup", action="store_true", help="(debugging) don't load mods at startup"
 )
@@ -7,6 +7,7 @@ from __future__ import print_function
 import appinfo
 from TaskSystem import do_in_mainthread
 import sys
+from contextlib import contextmanager
 from utils import safe_property
 
 
@@ -97,6 +98,39 @@ class _GuiObject:
 		for control in self.childIter():
 			self.updateChild(control)
 
+	def rebindSubjectObject(self, subjectObject):
+		"""
+		This is used by list controls which recycle their row controls.
+		We keep all the child controls and just update them for the new subject object.
+		"""
+		self.subjectObject = subjectObject
+		# Our own update handler, like in updateSubjectObject().
+		# Events only keep weakrefs, thus replacing it also unregisters the old one.
+		self._updateHandler = lambda: do_in_mainthread(self.updateContent, wait=False)
+		if self.attr and self.attr.hasUpdateEvent():
+			self.attr.updateEvent(subjectObject).register(self._updateHandler)
+		if getattr(subjectObject, "_updateEvent", None):
+			getattr(subjectObject, "_updateEvent").register(self._updateHandler)
+		for control in self.childIter():
+			if control.attr.hasUpdateEvent():
+				def controlUpdateHandler(control=control):
+					do_in_mainthread(lambda: self.updateChild(control), wait=False)
+				# Events only keep weakrefs, thus this also unregisters the old handler.
+				control._updateHandler = controlUpdateHandler
+				control.attr.updateEvent(subjectObject).register(control._updateHandler)
+			self.updateChild(control)
+
+	@contextmanager
+	def geometryTransaction(self):
+		"""
+		Within this, pos/size/innerSize accesses go against a cached shadow geometry
+		and all changes are applied at once at the end of the outermost transaction.
+		See GuiObject.beginGeometryTransaction() in _gui.
+		"""
+		self.beginGeometryTransaction()
+		try: yield
+		finally: self.commitGeometryTransaction()
+
 	def guiObjectsInLine(self):
 		obj = self
 		while True:
@@ -112,59 +146,60 @@ class _GuiObject:
 		with us (via `guiObjectsInLine`). It then layouts their x-pos and sets
 		the autoresize mask on those controls.
 		"""
-		line = list(self.guiObjectsInLine())
-		minY = min([control.pos[1] for control in line])
-		maxH = max([control.size[1] for control in line])
+		with self.geometryTransaction():
+			line = list(self.guiObjectsInLine())
+			minY = min([control.pos[1] for control in line])
+			maxH = max([control.size[1] for control in line])
+
+			# Set x-pos from left to right.
+			# XXX: Haven't we done this already in setupChilds()?
+			x = self.parent.OuterSpace[0]
+			for control in line:
+				spaceX = self.parent.DefaultSpace[0]
+				if control.attr.spaceX is not None: spaceX = control.attr.spaceX
 
-		# Set x-pos from left to right.
-		# XXX: Haven't we done this already in setupChilds()?
-		x = self.parent.OuterSpace[0]
-		for control in line:
-			spaceX = self.parent.DefaultSpace[0]
-			if control.attr.spaceX is not None: spaceX = control.attr.spaceX
+				w,h = control.size
+				y = minY + (maxH - h) / 2.
 
-			w,h = control.size
-			y = minY + (maxH - h) / 2.
+				control.pos = (x,y)
 
-			control.pos = (x,y)
+				x += w + spaceX
 
-			x += w + spaceX
+			# Search the variable-width-control.
+			varWidthControl = None
+			for control in line:
+				if control.attr.variableWidth:
+					varWidthControl = control
+					break
+			if not varWidthControl:
+				varWidthControl = line[-1]
+				if varWidthControl.attr.variableWidth is False:
+					# It explicitly doesn't want to be of variable size.
+					# We can return because there is nothing to do anymore.
+					return
+
+			x = self.parent.innerSize[0] - self.parent.OuterSpace[0]
+			for control in reversed(line):
+				w,h = control.size
+				y = control.pos[1]
 
-		# Search the variable-width-control.
-		varWidthControl = None
-		for control in line:
-			if control.attr.variableWidth:
-				varWidthControl = control
-				break
-		if not varWidthControl:
-			varWidthControl = line[-1]
-			if varWidthControl.attr.variableWidth is False:
-				# It explicitly doesn't want to be of variable size.
-				# We can return because there is nothing to do anymore.
-				return
-
-		x = self.parent.innerSize[0] - self.parent.OuterSpace[0]
-		for control in reversed(line):
-			w,h = control.size
-			y = control.pos[1]
-
-			if control is varWidthControl:
-				w = x - control.pos[0]
-				x = control.pos[0]
-				control.pos = (x,y)
-				control.size = (w,h)
-				control.autoresize = control.autoresize[:2] + (True,) + control.autoresize[3:]
-				control.layout()
-				break
-			else:
-				x -= w
-				control.pos = (x,y)
-				control.size = (w,h)
-				control.autoresize = (True,) + control.autoresize[1:]
+				if control is varWidthControl:
+					w = x - control.pos[0]
+					x = control.pos[0]
+					control.pos = (x,y)
+					control.size = (w,h)
+					control.autoresize = control.autoresize[:2] + (True,) + control.autoresize[3:]
+					control.layout()
+					break
+				else:
+					x -= w
+					control.pos = (x,y)
+					control.size = (w,h)
+					control.autoresize = (True,) + control.autoresize[1:]
 
-				spaceX = self.parent.DefaultSpace[0]
-				if control.attr.spaceX is not None: spaceX = control.attr.spaceX
-				x -= spaceX
+					spaceX = self.parent.DefaultSpace[0]
+					if control.attr.spaceX is not None: spaceX = control.attr.spaceX
+					x -= spaceX
 
 	def childGuiObjectsInColumn(self):
 		obj = self.firstChildGuiObject
@@ -181,69 +216,69 @@ class _GuiObject:
 		In this function itself, we handle the variable-height-control,
 		and we call `layoutLine()` to handle the variable-width-controls.
 		"""
+		with self.geometryTransaction():
+			lastVertControls = list(self.childGuiObjectsInColumn())
+			if not lastVertControls: return
 
-		lastVertControls = list(self.childGuiObjectsInColumn())
-		if not lastVertControls: return
-
-		# Search variable-height-control.
-		varHeightControl = None
-		for control in lastVertControls:
-			if control.attr.variableHeight:
-				varHeightControl = control
-				break
-		if not varHeightControl:
-			varHeightControl = lastVertControls[-1]
-			if varHeightControl.attr.variableHeight is False:
-				# It explicitly doesn't want to be of variable size.
-				varHeightControl = None
-
-		# Set y-pos from top to bottom, until we get to the varHeightControl.
-		# XXX: Exactly this is already done in setupChilds, isn't it?
-		if False:
-			y = self.OuterSpace[1]
+			# Search variable-height-control.
+			varHeightControl = None
 			for control in lastVertControls:
-				if control is varHeightControl: break
-
-				x = control.pos[0]
-				control.pos = (x,y)
+				if control.attr.variableHeight:
+					varHeightControl = control
+					break
+			if not varHeightControl:
+				varHeightControl = lastVertControls[-1]
+				if varHeightControl.attr.variableHeight is False:
+					# It explicitly doesn't want to be of variable size.
+					varHeightControl = None
+
+			# Set y-pos from top to bottom, until we get to the varHeightControl.
+			# XXX: Exactly this is already done in setupChilds, isn't it?
+			if False:
+				y = self.OuterSpace[1]
+				for control in lastVertControls:
+					if control is varHeightControl: break
+
+					x = control.pos[0]
+					control.pos = (x,y)
 
-				if control.attr.spaceY is not None: y += control.attr.spaceY
-				else: y += self.DefaultSpace[1]
-				y += control.size[1]
+					if control.attr.spaceY is not None: y += control.attr.spaceY
+					else: y += self.DefaultSpace[1]
+					y += control.size[1]
+
+			if varHeightControl:
+				# Set y-pos from bottom to top, until we get to the varHeightControl.
+				y = self.innerSize[1] - self.OuterSpace[1]
+				for control in reversed(lastVertControls):
+					w,h = control.size
+					x = control.pos[0]
+
+					if control is varHeightControl:
+						h = y - control.pos[1]
+						y = control.pos[1]
+						control.pos = (x,y)
+						control.size = (w,h)
+						control.autoresize = control.autoresize[0:3] + (True,)
+						# The size has changed, thus update its layout.
+						control.layout()
+						break
+					else:
+						y -= h
+						for lineControl in control.guiObjectsInLine():
+							lineControl.pos = (lineControl.pos[0],y)
+							lineControl.autoresize = lineControl.autoresize[0:1] + (True,) + lineControl.autoresize[2:4]
+						y -= self.DefaultSpace[1]
 
-		if varHeightControl:
-			# Set y-pos from bottom to top, until we get to the varHeightControl.
-			y = self.innerSize[1] - self.OuterSpace[1]
-			for control in reversed(lastVertControls):
-				w,h = control.size
-				x = control.pos[0]
+			for control in lastVertControls:
+				control.layoutLine()
 
-				if control is varHeightControl:
-					h = y - control.pos[1]
-					y = control.pos[1]
-					control.pos = (x,y)
-					control.size = (w,h)
-					control.autoresize = control.autoresize[0:3] + (True,)
-					# The size has changed, thus update its layout.
-					control.layout()
-					break
-				else:
-					y -= h
-					for lineControl in control.guiObjectsInLine():
-						lineControl.pos = (lineControl.pos[0],y)
-						lineControl.autoresize = lineControl.autoresize[0:1] + (True,) + lineControl.autoresize[2:4]
-					y -= self.DefaultSpace[1]
-
-		for control in lastVertControls:
-			control.layoutLine()
-
-		# If we are not auto-resizable in height,
-		# set our own height according to the last control.
-		if not self.autoresize[3]:
-			w,h = self.size
-			lastCtr = lastVertControls[-1]
-			h = lastCtr.pos[1] + lastCtr.size[1]
-			self.size = (w,h)
+			# If we are not auto-resizable in height,
+			# set our own height according to the last control.
+			if not self.autoresize[3]:
+				w,h = self.size
+				lastCtr = lastVertControls[-1]
+				h = lastCtr.pos[1] + lastCtr.size[1]
+				self.size = (w,h)
 
 	firstChildGuiObject = None
 	childs = {} # (attrName -> guiObject) map. this might change...
@@ -254,14 +289,15 @@ class _GuiObject:
 		However, you can set another size after it and you are supposed to call `layout()`
 		in the end.
 		"""
-
 		#self.updateSubjectObject() # XXX: make it explicit? break simple list interface
 		self.firstChildGuiObject = None
 		self.childs = {}
-		x, y = self.OuterSpace
-		maxX, maxY = 0, 0
-		lastControl = None
 
+		# Build all the child controls first.
+		# buildControl() and updateContent() run native code which might change
+		# the geometry on its own, thus they apply and leave any open geometry transaction.
+		# If we did this in the layouting loop below, every child would flush it.
+		controls = []
 		from UserAttrib import iterUserAttribs
 		for attr in iterUserAttribs(self.subjectObject):
 			try:
@@ -279,44 +315,51 @@ class _GuiObject:
 				attr.updateEvent(self.subjectObject).register(control._updateHandler)
 			self.addChild(control)
 			self.childs[attr.name] = control
+			control.updateContent()
+			controls.append((attr, control))
+
+		# The initial layouting. This is all in one transaction.
+		with self.geometryTransaction():
+			x, y = self.OuterSpace
+			maxX, maxY = 0, 0
+			lastControl = None
+
+			for attr, control in controls:
+				spaceX, spaceY = self.DefaultSpace
+				if attr.spaceX is not None: spaceX = attr.spaceX
+				if attr.spaceY is not None: spaceY = attr.spaceY
+
+				if attr.alignRight and lastControl: # align next right
+					x = lastControl.pos[0] + lastControl.size[0] + spaceX
+					# y from before
+					control.leftGuiObject = lastControl
+					if lastControl:
+						lastControl.rightGuiObject = control
+
+				elif lastControl: # align next below
+					x = self.OuterSpace[0]
+					y = maxY + spaceY
+					control.topGuiObject = lastControl
+					if lastControl:
+						lastControl.bottomGuiObject = control
+
+				else: # very first
+					pass
 
-			spaceX, spaceY = self.DefaultSpace
-			if attr.spaceX is not None: spaceX = attr.spaceX
-			if attr.spaceY is not None: spaceY = attr.spaceY
-
-			if attr.alignRight and lastControl: # align next right
-				x = lastControl.pos[0] + lastControl.size[0] + spaceX
-				# y from before
-				control.leftGuiObject = lastControl
-				if lastControl:
-					lastControl.rightGuiObject = control
-
-			elif lastControl: # align next below
-				x = self.OuterSpace[0]
-				y = maxY + spaceY
-				control.topGuiObject = lastControl
-				if lastControl:
-					lastControl.bottomGuiObject = control
-
-			else: # very first
-				pass
-
-			control.pos = (x,y)
-			control.autoresize = (False,False,False,False) # initial, might get changed in `layout()`
-
-			lastControl = control
-			maxX = max(maxX, control.pos[0] + control.size[0])
-			maxY = max(maxY, control.pos[1] + control.size[1])
+				control.pos = (x,y)
+				control.autoresize = (False,False,False,False) # initial, might get changed in `layout()`
 
-			control.updateContent()
+				lastControl = control
+				maxX = max(maxX, control.pos[0] + control.size[0])
+				maxY = max(maxY, control.pos[1] + control.size[1])
 
-		# Recalculate layout based on current size and variable width/height controls.
-		# Note that there are some cases where this recalculation is not needed,
-		# but its much easier to just call it always now.
-		self.layout()
+			# Recalculate layout based on current size and variable width/height controls.
+			# Note that there are some cases where this recalculation is not needed,
+			# but its much easier to just call it always now.
+			self.layout()
 
-		# Handy for now. This return might change.
-		return (maxX + self.OuterSpace[0], maxY + self.OuterSpace[1])
+			# Handy for now. This return might change.
+			return (maxX + self.OuterSpace[0], maxY + self.OuterSpace[1])
 
 
 
@@ -47,9 +47,11 @@ if __name__ == '__main__' and appinfo.args.addsyspythonpaths:
 
 def handleApplicationInit():
 	import ModuleSystem
+	import StartupTrace
 
 	if not appinfo.args.nomodstartup:
-		for m in ModuleSystem.modules: m.start()
+		with StartupTrace.phase("start modules"):
+			for m in ModuleSystem.modules: m.start()
 	else:
 		# In some cases, we at least need some modules. Start only those.
 		if appinfo.args.shell:
@@ -83,7 +85,11 @@ def main():
 		exec(compile(sourcecode, "<pyexec>", "exec"))
 		raise SystemExit
 
-	import utils
+	import StartupTrace
+	StartupTrace.mark("main.py main()")
+
+	with StartupTrace.phase("import utils"):
+		import utils
 	import time
 
 	print("MusicPlayer", appinfo.version, "from", appinfo.buildTime, "git-ref", appinfo.gitRef[:10], "on", appinfo.platform, "(%s)" % sys.platform)
@@ -132,7 +138,8 @@ def main():
 	if os.path.basename(my_dir) == "src":
 		sys.path.insert(0, os.path.dirname(my_dir) + "/core")
 	try:
-		import musicplayer
+		with StartupTrace.phase("import musicplayer"):
+			import musicplayer
 	except Exception:
 		print("Error while importing core module! This is fatal.")
 		sys.excepthook(*sys.exc_info())
@@ -145,7 +152,8 @@ def main():
 	# Import gui module here. Again, mostly as an early error check.
 	# If there is no gui, the module should still load and provide
 	# dummy functions where appropriate.
-	import gui
+	with StartupTrace.phase("import gui"):
+		import gui
 
 	# Default quit handling.
 	# Note that this is executed after `threading._shutdown`, i.e. after
@@ -156,10 +164,11 @@ def main():
 	# Import some core modules. They propagate themselves to other
 	# subsystems, like GUI.
 	# XXX: Maybe move all this to `State` module?
-	import State
-	import Preferences
-	import Search
-	import SongEdit
+	with StartupTrace.phase("import State"):
+		import State
+		import Preferences
+		import Search
+		import SongEdit
 
 	# This will overtake the main loop and raise SystemExit at its end,
 	# or never return.
@@ -7,8 +7,11 @@
 def playerMain():
 	from Player import PlayerEventCallbacks
 	from State import state
+	import StartupTrace
 	for ev,args,kwargs in state.updates.read():
 		if ev is PlayerEventCallbacks.onPlayingStateChange:
+			# The core sends this when the audio output was started.
+			if kwargs["newState"] == True: StartupTrace.markOnce("first sound")
 			state.__class__.playPause.updateEvent(state).push()
 		elif ev is PlayerEventCallbacks.onSongChange:
 			state.curSong.save()
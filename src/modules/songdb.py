@@ -439,7 +439,9 @@ def _init():
 def initDb(db):
 	with globals()["_%s_initlock" % db]:
 		if not globals()[db]:
-			globals()[db] = DB(**DBs[db])
+			import StartupTrace
+			with StartupTrace.phase("open DB %s" % db):
+				globals()[db] = DB(**DBs[db])
 		return globals()[db]
 
 def lazyInitDb(*dbs):
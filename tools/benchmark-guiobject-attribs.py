@@ -0,0 +1,69 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# MusicPlayer, https://github.com/albertz/music-player
+# Copyright (c) 2014, Albert Zeyer, www.az2000.de
+# All rights reserved.
+# This code is under the 2-clause BSD license, see License.txt in the root directory of this project.
+
+# Micro-benchmark for the _gui.GuiObject attribute access.
+# Usage: benchmark-guiobject-attribs.py [<dir of _gui.so>]
+# Run it against two builds to compare them.
+
+import _common_init
+import sys, os
+from timeit import default_timer as timer
+
+if len(sys.argv) > 1:
+	sys.path.insert(0, os.path.abspath(sys.argv[1]))
+# We only want the gui module for gui._GuiObject, not any real GUI.
+sys.argv = sys.argv[:1] + ["--gui", "none"]
+
+import gui
+import _gui
+
+N = 1000000
+
+def bench(name, func):
+	start = timer()
+	func(N)
+	t = timer() - start
+	print("%-28s %8.2f M/sec" % (name, N / t / 1e6))
+
+def main():
+	obj = _gui.GuiObject()
+	parent = _gui.GuiObject()
+	obj.parent = parent
+	obj.someCustomAttrib = 42
+
+	def getNative(n):
+		for i in xrange(n): obj.OuterSpace
+	def getNativeObj(n):
+		for i in xrange(n): obj.parent
+	def getInstanceAttrib(n):
+		for i in xrange(n): obj.someCustomAttrib
+	def getClassAttrib(n):
+		for i in xrange(n): obj.childs
+	def getMethod(n):
+		for i in xrange(n): obj.addChild
+	def setNative(n):
+		v = (8,8)
+		for i in xrange(n): obj.DefaultSpace = v
+	def setInstanceAttrib(n):
+		for i in xrange(n): obj.someCustomAttrib = i
+	def getDynamicKey(n):
+		# Not interned.
+		key = "".join(["Outer", "Space"])
+		for i in xrange(n): getattr(obj, key)
+
+	print("GuiObject attribute lookups, %i iterations each" % N)
+	bench("get native Vec", getNative)
+	bench("get native object", getNativeObj)
+	bench("get method", getMethod)
+	bench("get instance attrib", getInstanceAttrib)
+	bench("get class attrib", getClassAttrib)
+	bench("get non-interned key", getDynamicKey)
+	bench("set native Vec", setNative)
+	bench("set instance attrib", setInstanceAttrib)
+
+if __name__ == "__main__":
+	main()
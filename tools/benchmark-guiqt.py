@@ -0,0 +1,199 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# MusicPlayer, https://github.com/albertz/music-player
+# Copyright (c) 2014, Albert Zeyer, www.az2000.de
+# All rights reserved.
+# This code is under the 2-clause BSD license, see License.txt in the root directory of this project.
+
+# Headless benchmark of the guiQt widgets.
+# Usage: benchmark-guiqt.py <MusicPlayer binary> [--out <file.json>] [--rows 1000,10000,100000] [--frames 100] [--widgets]
+# This restarts itself inside the MusicPlayer binary (guiQt needs the symbols from there)
+# with QT_QPA_PLATFORM=offscreen, builds a window with a stub subject tree
+# and measures:
+#  - the main window build time and the buildControl() calls,
+#  - the list fill time for every row count,
+#  - the scroll + paint frame times,
+#  - the time until a ListWrapper.shuffle() is applied,
+#  - the peak RSS and the QWidget count after each stage.
+# The results are printed as JSON. Run it against two builds to compare them.
+# guiQt.so must be built with benchmarks (qmake CONFIG+=benchmarks).
+
+from __future__ import print_function
+import sys, os, json
+
+EnvKey = "MUSICPLAYER_BENCHMARK_GUIQT"
+
+
+def parseArgs(argv):
+	import argparse
+	parser = argparse.ArgumentParser(description="guiQt headless benchmark")
+	parser.add_argument("binary", help="MusicPlayer binary")
+	parser.add_argument("--out", help="JSON output file. stdout by default")
+	parser.add_argument("--rows", default="1000,10000,100000", help="comma-separated list row counts")
+	parser.add_argument("--frames", type=int, default=100, help="scroll frames per list")
+	parser.add_argument("--widgets", action="store_true", help="labels as own widgets instead of painted items")
+	return parser.parse_args(argv)
+
+
+def startBinary():
+	import _common_init
+	import subprocess
+	args = parseArgs(sys.argv[1:])
+	env = dict(os.environ)
+	env["QT_QPA_PLATFORM"] = "offscreen"
+	env[EnvKey] = json.dumps({
+		"out": os.path.abspath(args.out) if args.out else None,
+		"rows": [int(n) for n in args.rows.split(",")],
+		"frames": args.frames,
+		"paintedItems": not args.widgets})
+	me = os.path.abspath(__file__)
+	if me.endswith(".pyc"): me = me[:-1]
+	code = "execfile(%r, {'__name__': '__main__', '__file__': %r})" % (me, me)
+	cmd = [args.binary, "--nolog", "--nomodstartup", "--gui", "qt", "--pyexec", code]
+	sys.exit(subprocess.call(cmd, env=env))
+
+
+def maxRssKb():
+	import resource
+	rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+	if sys.platform == "darwin": rss //= 1024 # bytes there
+	return rss
+
+
+def percentile(values, p):
+	values = sorted(values)
+	if not values: return 0
+	return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+
+def runInBinary():
+	from timeit import default_timer as timer
+	t0 = timer()
+	config = json.loads(os.environ[EnvKey])
+	results = {"rows": {}}
+
+	import threading
+	import gui
+	import guiQt
+	if not hasattr(guiQt, "benchmarkOpenWindow"):
+		sys.exit("%s was built without benchmarks. See the usage." % guiQt.__file__)
+	import Traits
+	from UserAttrib import UserAttrib
+	from utils import initBy
+	import Queue
+	# No State updates thread here. Not part of what we measure.
+	Queue.putOnModify = lambda *args, **kwargs: None
+
+	buildStats = {"count": 0, "time": 0.0}
+	origBuildControl = gui.buildControl
+	def buildControl(*args, **kwargs):
+		start = timer()
+		try:
+			return origBuildControl(*args, **kwargs)
+		finally:
+			buildStats["count"] += 1
+			buildStats["time"] += timer() - start
+	gui.buildControl = buildControl
+
+	class Row(object):
+		def __init__(self, idx): self.idx = idx
+		@UserAttrib(type=Traits.OneLineText, variableWidth=True)
+		@property
+		def title(self): return "Row %i, some longer text to render" % self.idx
+
+	class RowList(list):
+		def save(self): pass
+
+	class Subject(object):
+		def __init__(self, n):
+			self.lock = threading.RLock()
+			self.n = n
+		@UserAttrib(type=Traits.OneLineText, variableWidth=True)
+		@property
+		def label(self): return "Benchmark with %i rows" % self.n
+		@UserAttrib(type=Traits.List, variableHeight=True, canHaveFocus=True)
+		@initBy
+		def list(self):
+			return Queue.ListWrapper(self, RowList([Row(i) for i in range(self.n)]))
+
+	guiQt.setPaintedItems(config["paintedItems"])
+	results["paintedItems"] = config["paintedItems"]
+
+	gui.RootObjs.clear()
+	gui.registerRootObj(obj=Subject(10), name="Main", title="Benchmark", priority=0)
+	for n in config["rows"]:
+		gui.registerRootObj(obj=Subject(n), name="Bench %i" % n)
+
+	def listControl(name):
+		return gui.RootObjs[name].guiObj.childs["list"]
+
+	def waitListRows(control, n, timeout=600):
+		start = timer()
+		while True:
+			guiQt.benchmarkWaitIdle()
+			if guiQt.benchmarkListRowCount(control) == n: return
+			if timer() - start > timeout: raise Exception("timeout, rows %i != %i" % (guiQt.benchmarkListRowCount(control), n))
+
+	def benchThread():
+		try:
+			guiQt.benchmarkWaitIdle()
+			results["mainWindow"] = {
+				"time": initTime[0] - t0,
+				"buildControlCalls": buildStats["count"],
+				"buildControlTime": buildStats["time"],
+				"maxRssKb": maxRssKb(),
+				"widgetCount": guiQt.benchmarkWidgetCount()}
+			for n in config["rows"]:
+				name = "Bench %i" % n
+				r = results["rows"][str(n)] = {}
+				# The list fill is done in the background, thus wait for the widget.
+				start = timer()
+				assert guiQt.benchmarkOpenWindow(name)
+				control = listControl(name)
+				waitListRows(control, n)
+				r["fillTime"] = timer() - start
+				r["maxRssKbAfterFill"] = maxRssKb()
+				r["widgetCountAfterFill"] = guiQt.benchmarkWidgetCount()
+
+				frames = guiQt.benchmarkListScroll(control, frames=config["frames"])
+				r["scrollFrameUs"] = {
+					"p50": percentile(frames, 50),
+					"p99": percentile(frames, 99),
+					"max": max(frames)}
+
+				start = timer()
+				gui.RootObjs[name].obj.list.shuffle()
+				waitListRows(control, n)
+				r["shuffleTime"] = timer() - start
+				r["maxRssKb"] = maxRssKb()
+			results["maxRssKb"] = maxRssKb()
+			results["mainExecutor"] = guiQt.mainExecutorStats()
+
+			s = json.dumps(results, indent=2, sort_keys=True)
+			if config["out"]:
+				with open(config["out"], "w") as f: f.write(s + "\n")
+			else:
+				print(s)
+		except Exception:
+			sys.excepthook(*sys.exc_info())
+		guiQt.quit()
+
+	initTime = [None]
+	# guiQt.main() calls this after it has opened the main window.
+	class MainMod:
+		@staticmethod
+		def handleApplicationInit():
+			initTime[0] = timer()
+			t = threading.Thread(target=benchThread, name="benchmark")
+			t.daemon = True
+			t.start()
+	sys.modules["main"] = MainMod
+
+	gui.main() # raises SystemExit at the end
+
+
+if __name__ == "__main__":
+	if getattr(sys, "MusicPlayerBin", None) and EnvKey in os.environ:
+		runInBinary()
+	else:
+		startBinary()
@@ -0,0 +1,46 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# MusicPlayer, https://github.com/albertz/music-player
+# Copyright (c) 2014, Albert Zeyer, www.az2000.de
+# All rights reserved.
+# This code is under the 2-clause BSD license, see License.txt in the root directory of this project.
+
+# Reader scaling of SafeValue vs. ReadMostlyValue (_gui/ReadMostlyValue.hpp).
+# Usage: benchmark-safevalue.py [<dir of _gui.so>] [--writer <interval us>]
+# _gui.so must be built with benchmarks (qmake CONFIG+=benchmarks, or compile.py --benchmarks).
+
+import _common_init
+import sys, os
+import multiprocessing
+
+args = sys.argv[1:]
+writeIntervalUs = 0
+if "--writer" in args:
+	i = args.index("--writer")
+	writeIntervalUs = int(args[i + 1])
+	del args[i:i + 2]
+if args:
+	sys.path.insert(0, os.path.abspath(args[0]))
+
+import _gui
+if not hasattr(_gui, "benchmarkSafeValues"):
+	sys.exit("%s was built without benchmarks. See the usage." % _gui.__file__)
+
+N = 2000000
+
+def main():
+	numCpus = multiprocessing.cpu_count()
+	threadCounts = sorted(set([1, 2, 4, 8, 16, numCpus]))
+	threadCounts = [n for n in threadCounts if n <= numCpus] or [1]
+	print("%i CPUs, %i reads per thread, writer interval: %s" % (
+		numCpus, N, ("%i us" % writeIntervalUs) if writeIntervalUs else "no writer"))
+	variants = None
+	for n in threadCounts:
+		res = _gui.benchmarkSafeValues(numThreads=n, iterations=N, writeIntervalUs=writeIntervalUs)
+		if variants is None:
+			variants = sorted(res.keys())
+			print("%-8s" % "threads" + "".join(["%22s" % v for v in variants]))
+		print("%-8i" % n + "".join(["%17.1f M/s" % (res[v] / 1e6) for v in variants]))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,241 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# MusicPlayer, https://github.com/albertz/music-player
+# Copyright (c) 2014, Albert Zeyer, www.az2000.de
+# All rights reserved.
+# This code is under the 2-clause BSD license, see License.txt in the root directory of this project.
+
+# Symbolizes the crash/hang records (stackrecord-*.bin) which the app writes.
+# See app/StackRecord.hpp for the format.
+# Uses addr2line on Linux and atos on Mac. The results are cached in a file
+# (by default next to the record) so that later runs don't need to call them again.
+# Usage: symbolize.py [--cache <file>] <record>...
+
+import sys, os
+import struct
+import subprocess
+import pickle
+
+
+class Record:
+	def __init__(self, filename):
+		self.filename = filename
+		self.kind = None
+		self.pid = None
+		self.unixTime = None
+		self.reason = ""
+		self.threads = [] # list of (threadId, name, [pc])
+		self.maps = "" # Linux: /proc/self/maps
+		self.images = "" # Mac: "<hex load addr> <path>" lines
+		self._read()
+
+	def _read(self):
+		data = open(self.filename, "rb").read()
+		magic = data[0:8]
+		assert magic == b"MPSTKREC", "%s: not a stack record" % self.filename
+		# We don't know the byte order. The version must be small.
+		for endian in "<>":
+			version, pointerSize, kind, pid, unixTime = struct.unpack(endian + "IIIIQ", data[8:32])
+			if version < 0x10000: break
+		assert version == 1, "%s: unknown version %i" % (self.filename, version)
+		self.kind = {1: "crash", 2: "hang"}.get(kind, str(kind))
+		self.pid = pid
+		self.unixTime = unixTime
+		pcFmt = endian + {4: "I", 8: "Q"}[pointerSize]
+		pos = 32
+		while pos + 8 <= len(data):
+			tag = data[pos:pos + 4]
+			payloadLen, = struct.unpack(endian + "I", data[pos + 4:pos + 8])
+			payload = data[pos + 8:pos + 8 + payloadLen]
+			pos += 8 + payloadLen
+			if tag == b"RSN ":
+				self.reason = payload.decode("utf8", "replace")
+			elif tag == b"THRD":
+				threadId, = struct.unpack(endian + "Q", payload[0:8])
+				name = payload[8:40].split(b"\0")[0].decode("utf8", "replace")
+				numFrames, = struct.unpack(endian + "I", payload[40:44])
+				pcs = [struct.unpack(pcFmt, payload[44 + i * pointerSize:44 + (i + 1) * pointerSize])[0]
+					for i in range(numFrames)]
+				self.threads += [(threadId, name, pcs)]
+			elif tag == b"MAPS":
+				self.maps += payload.decode("utf8", "replace")
+			elif tag == b"IMGS":
+				self.images += payload.decode("utf8", "replace")
+			elif tag == b"END ":
+				break
+		# A crashed process might not have written everything. Just use what we have.
+
+
+class Module:
+	def __init__(self, path, start, end, loadBase):
+		self.path = path
+		self.start = start
+		self.end = end
+		self.loadBase = loadBase # what we subtract from the PC for the symbolizer
+
+	def cacheKey(self):
+		try:
+			st = os.stat(self.path)
+			return (self.path, int(st.st_mtime), st.st_size)
+		except OSError:
+			return (self.path, 0, 0)
+
+
+def isElfExecutable(path):
+	"""Non-PIE executables (ET_EXEC) use absolute addresses."""
+	try:
+		header = open(path, "rb").read(18)
+	except IOError:
+		return False
+	if header[0:4] != b"\x7fELF": return False
+	endian = "<" if header[5:6] == b"\x01" else ">"
+	eType, = struct.unpack(endian + "H", header[16:18])
+	return eType == 2
+
+
+def modulesFromMaps(maps):
+	mods = []
+	for line in maps.splitlines():
+		parts = line.split(None, 5)
+		if len(parts) < 6: continue
+		addrs, perms, offset, dev, inode, path = parts
+		path = path.strip()
+		if not path.startswith("/"): continue # e.g. [stack], [vdso]
+		start, end = [int(x, 16) for x in addrs.split("-")]
+		offset = int(offset, 16)
+		mods += [(start, end, offset, path)]
+	res = []
+	absCache = {}
+	for start, end, offset, path in mods:
+		if path not in absCache:
+			absCache[path] = isElfExecutable(path)
+		loadBase = 0 if absCache[path] else (start - offset)
+		res += [Module(path, start, end, loadBase)]
+	return res
+
+
+def modulesFromImages(images):
+	imgs = []
+	for line in images.splitlines():
+		addr, path = line.split(" ", 1)
+		imgs += [(int(addr, 16), path)]
+	imgs.sort()
+	res = []
+	for i, (addr, path) in enumerate(imgs):
+		end = imgs[i + 1][0] if i + 1 < len(imgs) else 2 ** 64
+		res += [Module(path, addr, end, addr)]
+	return res
+
+
+def findModule(modules, pc):
+	for m in modules:
+		if m.start <= pc < m.end: return m
+	return None
+
+
+def runSymbolizer(module, addrs):
+	"""Returns a list of strings, one per addr."""
+	if sys.platform == "darwin":
+		cmd = ["atos", "-o", module.path, "-l", "0x%x" % module.loadBase] + ["0x%x" % (module.loadBase + a) for a in addrs]
+		linesPerAddr = 1
+	else:
+		cmd = ["addr2line", "-C", "-f", "-e", module.path] + ["0x%x" % a for a in addrs]
+		linesPerAddr = 2
+	try:
+		out = subprocess.Popen(cmd, stdout=subprocess.PIPE).communicate()[0].decode("utf8", "replace")
+	except OSError as e:
+		print("symbolize: cannot run %s: %s" % (cmd[0], e))
+		return ["?"] * len(addrs)
+	lines = out.splitlines()
+	res = []
+	for i in range(len(addrs)):
+		entry = lines[i * linesPerAddr:(i + 1) * linesPerAddr]
+		if linesPerAddr == 2 and len(entry) == 2:
+			func, loc = entry
+			res += ["%s (%s)" % (func, loc) if not loc.startswith("??") else func]
+		else:
+			res += [" ".join(entry) or "?"]
+	return res
+
+
+class SymbolCache:
+	def __init__(self, filename):
+		self.filename = filename
+		self.cache = {}
+		self.changed = False
+		if filename and os.path.exists(filename):
+			try:
+				self.cache = pickle.load(open(filename, "rb"))
+			except Exception as e:
+				print("symbolize: cannot load cache %s: %s" % (filename, e))
+
+	def save(self):
+		if not self.filename or not self.changed: return
+		pickle.dump(self.cache, open(self.filename, "wb"), protocol=2)
+
+	def symbolize(self, module, addrs):
+		key = module.cacheKey()
+		entries = self.cache.setdefault(key, {})
+		missing = sorted(set([a for a in addrs if a not in entries]))
+		if missing:
+			for a, sym in zip(missing, runSymbolizer(module, missing)):
+				entries[a] = sym
+			self.changed = True
+		return [entries[a] for a in addrs]
+
+
+def symbolizeRecord(record, cache):
+	if record.maps:
+		modules = modulesFromMaps(record.maps)
+	else:
+		modules = modulesFromImages(record.images)
+
+	# Collect all addrs per module first, so that we call the symbolizer once per module.
+	frames = [] # per thread: list of (pc, module, addr)
+	addrsByModule = {}
+	for threadId, name, pcs in record.threads:
+		threadFrames = []
+		for i, pc in enumerate(pcs):
+			m = findModule(modules, pc)
+			# These are return addresses, except the first one. pc - 1 is within the call.
+			addr = (pc - (1 if i > 0 else 0) - m.loadBase) if m else None
+			threadFrames += [(pc, m, addr)]
+			if m: addrsByModule.setdefault(m.path, (m, set()))[1].add(addr)
+		frames += [threadFrames]
+
+	symbols = {}
+	for path, (m, addrs) in addrsByModule.items():
+		addrs = sorted(addrs)
+		for a, sym in zip(addrs, cache.symbolize(m, addrs)):
+			symbols[(path, a)] = sym
+
+	print("%s: %s, pid %i, time %i: %s" % (record.filename, record.kind, record.pid, record.unixTime, record.reason))
+	for (threadId, name, pcs), threadFrames in zip(record.threads, frames):
+		print("Thread %i (%s):" % (threadId, name))
+		for i, (pc, m, addr) in enumerate(threadFrames):
+			if m:
+				print("  #%-3i 0x%x %s [%s]" % (i, pc, symbols[(m.path, addr)], os.path.basename(m.path)))
+			else:
+				print("  #%-3i 0x%x ?" % (i, pc))
+	print("")
+
+
+def main():
+	args = sys.argv[1:]
+	cacheFile = None
+	if "--cache" in args:
+		i = args.index("--cache")
+		cacheFile = args[i + 1]
+		del args[i:i + 2]
+	if not args:
+		print("usage: %s [--cache <file>] <record>..." % sys.argv[0])
+		sys.exit(1)
+	if not cacheFile:
+		cacheFile = os.path.join(os.path.dirname(os.path.abspath(args[0])), "symbolcache.pickle")
+	cache = SymbolCache(cacheFile)
+	for filename in args:
+		symbolizeRecord(Record(filename), cache)
+	cache.save()
+
+if __name__ == "__main__":
+	main()